@@ -143,59 +143,8 @@ target_include_directories(
 apply_folly_compile_options_to_target(dwarfs_folly_lite)
 target_link_libraries(dwarfs_folly_lite PUBLIC folly_deps)
 
-if(WITH_BENCHMARKS)
-  add_library(dwarfs_follybenchmark_lite OBJECT 
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/Benchmark.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/Format.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/Unicode.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/detail/PerfScoped.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/detail/StaticSingletonManager.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/ext/test_ext.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/io/FsUtil.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/json/dynamic.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/json/json.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/json/json_pointer.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/AsyncFileWriter.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/AsyncLogWriter.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/CustomLogFormatter.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/FileWriterFactory.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/GlogStyleFormatter.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/ImmediateFileWriter.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/LogCategory.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/LogCategoryConfig.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/LogHandlerConfig.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/LogLevel.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/LogMessage.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/LogName.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/LogStream.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/LogStreamProcessor.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/LoggerDB.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/ObjectToString.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/RateLimiter.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/StandardLogHandler.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/StandardLogHandlerFactory.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/StreamHandlerFactory.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/logging/xlog.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/system/Pid.cpp
-    ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/testing/TestUtil.cpp
-  )
-  if(NOT WIN32)
-    target_sources(dwarfs_follybenchmark_lite PRIVATE
-      ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/Subprocess.cpp
-    )
-  endif()
-  set_property(TARGET dwarfs_follybenchmark_lite PROPERTY CXX_STANDARD 20)
-  apply_folly_compile_options_to_target(dwarfs_follybenchmark_lite)
-  target_link_libraries(dwarfs_follybenchmark_lite PUBLIC dwarfs_folly_lite)
-endif()
-
-if(ENABLE_STACKTRACE OR WITH_BENCHMARKS)
-  if(ENABLE_STACKTRACE)
-    set(_target dwarfs_folly_lite)
-  else()
-    set(_target dwarfs_follybenchmark_lite)
-  endif()
-  target_sources(${_target} PRIVATE
+if(ENABLE_STACKTRACE)
+  target_sources(dwarfs_folly_lite PRIVATE
     ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/SharedMutex.cpp
     ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/concurrency/CacheLocality.cpp
     ${CMAKE_CURRENT_SOURCE_DIR}/folly/folly/detail/Futex.cpp
@@ -25,6 +25,7 @@ add_library(
   src/block_compressor_parser.cpp
   src/checksum.cpp
   src/conv.cpp
+  src/cpu_budget.cpp
   src/error.cpp
   src/file_access_generic.cpp
   src/file_stat.cpp
@@ -66,6 +67,7 @@ add_library(
 add_library(
   dwarfs_reader
 
+  src/reader/block_allocator_mode.cpp
   src/reader/block_cache_options.cpp
   src/reader/block_range.cpp
   src/reader/filesystem_options.cpp
@@ -74,10 +76,14 @@ add_library(
   src/reader/metadata_types.cpp
   src/reader/mlock_mode.cpp
 
+  src/reader/internal/block_buffer_arena.cpp
   src/reader/internal/block_cache.cpp
+  src/reader/internal/block_pin.cpp
   src/reader/internal/cached_block.cpp
+  src/reader/internal/compressed_cache.cpp
   src/reader/internal/filesystem_parser.cpp
   src/reader/internal/inode_reader_v2.cpp
+  src/reader/internal/memory_pressure_controller.cpp
   src/reader/internal/metadata_types.cpp
   src/reader/internal/metadata_v2.cpp
 )
@@ -85,6 +91,7 @@ add_library(
 add_library(
   dwarfs_writer
 
+  src/writer/build_checkpoint.cpp
   src/writer/categorizer.cpp
   src/writer/category_parser.cpp
   src/writer/chmod_entry_transformer.cpp
@@ -98,6 +105,7 @@ add_library(
   src/writer/fragment_category.cpp
   src/writer/fragment_order_parser.cpp
   src/writer/inode_fragments.cpp
+  src/writer/memory_budget.cpp
   src/writer/rule_based_entry_filter.cpp
   src/writer/scanner.cpp
   src/writer/segmenter.cpp
@@ -105,11 +113,16 @@ add_library(
   src/writer/writer_progress.cpp
 
   src/writer/internal/block_manager.cpp
+  src/writer/internal/cdc_segmenter.cpp
   src/writer/internal/chmod_transformer.cpp
+  src/writer/internal/chunk_index.cpp
+  src/writer/internal/cyclic_hash.cpp
   src/writer/internal/entry.cpp
   src/writer/internal/file_scanner.cpp
+  src/writer/internal/file_stream.cpp
   src/writer/internal/fragment_chunkable.cpp
   src/writer/internal/global_entry_data.cpp
+  src/writer/internal/hash_cache.cpp
   src/writer/internal/inode_element_view.cpp
   src/writer/internal/inode_manager.cpp
   src/writer/internal/inode_ordering.cpp
@@ -117,8 +130,11 @@ add_library(
   src/writer/internal/nilsimsa.cpp
   src/writer/internal/progress.cpp
   src/writer/internal/scanner_progress.cpp
+  src/writer/internal/segmenter_progress.cpp
   src/writer/internal/similarity.cpp
   src/writer/internal/similarity_ordering.cpp
+  src/writer/internal/spill_index.cpp
+  src/writer/internal/staging_area.cpp
 
   # src/writer/categorizer/binary_categorizer.cpp
   src/writer/categorizer/fits_categorizer.cpp
@@ -35,6 +35,7 @@
 #include <utility>
 #include <vector>
 
+#include <dwarfs/byte_buffer.h>
 #include <dwarfs/compression.h>
 #include <dwarfs/compression_constraints.h>
 
@@ -123,6 +124,8 @@ class block_decompressor {
  public:
   block_decompressor(compression_type type, const uint8_t* data, size_t size,
                      std::vector<uint8_t>& target);
+  block_decompressor(compression_type type, const uint8_t* data, size_t size,
+                     mutable_byte_buffer& target);
 
   bool decompress_frame(size_t frame_size = BUFSIZ) {
     return impl_->decompress_frame(frame_size);
@@ -154,6 +157,7 @@ class block_decompressor {
   };
 
  private:
+  std::unique_ptr<vector_byte_buffer> vector_target_;
   std::unique_ptr<impl> impl_;
 };
 
@@ -173,7 +177,7 @@ class compression_factory : public compression_info {
   make_compressor(option_map& om) const = 0;
   virtual std::unique_ptr<block_decompressor::impl>
   make_decompressor(std::span<uint8_t const> data,
-                    std::vector<uint8_t>& target) const = 0;
+                    mutable_byte_buffer& target) const = 0;
 };
 
 namespace detail {
@@ -191,7 +195,7 @@ class compression_registry {
   make_compressor(std::string_view spec) const;
   std::unique_ptr<block_decompressor::impl>
   make_decompressor(compression_type type, std::span<uint8_t const> data,
-                    std::vector<uint8_t>& target) const;
+                    mutable_byte_buffer& target) const;
 
   void for_each_algorithm(
       std::function<void(compression_type, compression_info const&)> const& fn)
@@ -0,0 +1,117 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <dwarfs/error.h>
+
+namespace dwarfs {
+
+/**
+ * A resizable buffer of bytes that decompressors write into
+ *
+ * Unlike std::vector, implementations are not required to initialize
+ * the bytes added by resize(). Callers are expected to overwrite them.
+ */
+class mutable_byte_buffer {
+ public:
+  virtual ~mutable_byte_buffer() = default;
+
+  virtual uint8_t* data() = 0;
+  virtual uint8_t const* data() const = 0;
+  virtual size_t size() const = 0;
+  virtual size_t capacity() const = 0;
+  virtual void reserve(size_t size) = 0;
+  virtual void resize(size_t size) = 0;
+  virtual void clear() = 0;
+
+  bool empty() const { return size() == 0; }
+
+  uint8_t& operator[](size_t i) { return data()[i]; }
+  uint8_t const& operator[](size_t i) const { return data()[i]; }
+};
+
+/**
+ * A byte buffer backed by a std::vector
+ *
+ * The vector is either owned by the buffer or provided by the caller.
+ */
+class vector_byte_buffer final : public mutable_byte_buffer {
+ public:
+  vector_byte_buffer()
+      : vec_{own_} {}
+
+  explicit vector_byte_buffer(std::vector<uint8_t>& vec)
+      : vec_{vec} {}
+
+  vector_byte_buffer(vector_byte_buffer const&) = delete;
+  vector_byte_buffer& operator=(vector_byte_buffer const&) = delete;
+
+  uint8_t* data() override { return vec_.data(); }
+  uint8_t const* data() const override { return vec_.data(); }
+  size_t size() const override { return vec_.size(); }
+  size_t capacity() const override { return vec_.capacity(); }
+  void reserve(size_t size) override { vec_.reserve(size); }
+  void resize(size_t size) override { vec_.resize(size); }
+  void clear() override { vec_.clear(); }
+
+ private:
+  std::vector<uint8_t> own_;
+  std::vector<uint8_t>& vec_;
+};
+
+/**
+ * A byte buffer backed by a fixed span of memory provided by the caller
+ *
+ * As the capacity cannot change, reserve() is merely a hint and it is an
+ * error to resize the buffer beyond the size of the span.
+ */
+class span_byte_buffer final : public mutable_byte_buffer {
+ public:
+  explicit span_byte_buffer(std::span<uint8_t> span)
+      : span_{span} {}
+
+  uint8_t* data() override { return span_.data(); }
+  uint8_t const* data() const override { return span_.data(); }
+  size_t size() const override { return size_; }
+  size_t capacity() const override { return span_.size(); }
+  void reserve(size_t) override {}
+
+  void resize(size_t size) override {
+    if (size > span_.size()) {
+      DWARFS_THROW(runtime_error, "span_byte_buffer capacity exceeded");
+    }
+    size_ = size;
+  }
+
+  void clear() override { size_ = 0; }
+
+ private:
+  std::span<uint8_t> span_;
+  size_t size_{0};
+};
+
+} // namespace dwarfs
@@ -0,0 +1,121 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+namespace dwarfs {
+
+/**
+ * Limits the number of jobs running at the same time across several
+ * worker groups
+ *
+ * Each worker group sharing a budget keeps its own threads, and with
+ * them its own thread names and CPU time accounting. However, a worker
+ * has to hold one of the budget's slots while running a job. This lets
+ * each stage of a pipeline use all slots while the other stages are idle,
+ * without oversubscribing the CPUs when all stages are busy.
+ *
+ * A job that waits for other jobs must do so inside a `blocking_section`,
+ * which returns the slot for the duration of the wait. Otherwise, waiting
+ * jobs could use up the budget and the jobs they wait for never run.
+ */
+class cpu_budget {
+ public:
+  struct stats {
+    size_t acquired{0};
+    size_t contended{0};
+    size_t peak_active{0};
+  };
+
+  explicit cpu_budget(size_t slots);
+
+  size_t slots() const { return slots_; }
+
+  /**
+   * Acquire a slot for the current thread, waiting for one if necessary
+   */
+  void acquire();
+
+  /**
+   * Return the slot held by the current thread
+   */
+  void release();
+
+  stats get_stats() const;
+
+  /**
+   * The budget whose slot is held by the current thread, if any
+   */
+  static cpu_budget* current();
+
+  /**
+   * Wait on a condition variable until `pred` is true
+   *
+   * The slot held by the current thread is only returned if it actually
+   * has to wait. It is re-acquired with `lock` released, so no thread
+   * ever waits for a slot while holding the lock.
+   */
+  template <typename CondVar, typename Lock, typename Predicate>
+  static void wait(CondVar& cv, Lock& lock, Predicate pred) {
+    while (!pred()) {
+      if (!current()) {
+        cv.wait(lock, pred);
+        return;
+      }
+
+      {
+        blocking_section bs;
+        cv.wait(lock, pred);
+        lock.unlock();
+      }
+
+      lock.lock();
+    }
+  }
+
+  /**
+   * Returns the slot held by the current thread, if any, until destroyed
+   */
+  class blocking_section {
+   public:
+    blocking_section();
+    ~blocking_section();
+
+    blocking_section(blocking_section const&) = delete;
+    blocking_section& operator=(blocking_section const&) = delete;
+
+   private:
+    cpu_budget* budget_;
+  };
+
+ private:
+  size_t const slots_;
+  std::mutex mutable mx_;
+  std::condition_variable cv_;
+  size_t active_{0};
+  stats stats_;
+};
+
+} // namespace dwarfs
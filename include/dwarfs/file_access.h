@@ -73,6 +73,18 @@ class file_access {
   virtual std::unique_ptr<output_stream>
   open_output_binary(std::filesystem::path const& path,
                      std::error_code& ec) const = 0;
+
+  // Atomically replaces `to` with `from`
+  virtual void rename(std::filesystem::path const& from,
+                      std::filesystem::path const& to,
+                      std::error_code& ec) const = 0;
+
+  virtual void create_directories(std::filesystem::path const& path,
+                                  std::error_code& ec) const = 0;
+
+  // Removes `path` and, if it is a directory, everything below it
+  virtual void remove_all(std::filesystem::path const& path,
+                          std::error_code& ec) const = 0;
 };
 
 } // namespace dwarfs
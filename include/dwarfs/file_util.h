@@ -39,6 +39,8 @@ class temporary_directory {
  public:
   temporary_directory();
   explicit temporary_directory(std::string_view prefix);
+  temporary_directory(std::string_view prefix,
+                      std::filesystem::path const& parent);
   ~temporary_directory();
 
   temporary_directory(temporary_directory&&) = default;
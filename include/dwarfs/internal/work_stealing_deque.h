@@ -0,0 +1,166 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace dwarfs::internal {
+
+/**
+ * A growable work-stealing deque of pointers
+ *
+ * This is based on the Chase-Lev deque, using the memory orderings from
+ * "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al.,
+ * PPoPP 2013). Unlike the original, items are only ever taken from the
+ * top, so all consumers see the items in FIFO order.
+ *
+ * Only a single thread may push at any given time, but any number of
+ * threads can concurrently take items without locking. The deque does
+ * not own the items.
+ *
+ * The deque never shrinks. When it grows, the previous ring is retired,
+ * but not freed until the deque is destroyed, as consumers may still be
+ * reading from it and there is no cheap way to tell when they're done.
+ * This is intentional: each ring is twice as large as the previous one,
+ * so this at most doubles the memory used by a deque that grew once.
+ */
+template <typename T>
+class work_stealing_deque {
+ public:
+  explicit work_stealing_deque(size_t initial_capacity = 64) {
+    size_t capacity = 1;
+    while (capacity < initial_capacity) {
+      capacity <<= 1;
+    }
+    rings_.push_back(std::make_unique<ring>(capacity));
+    ring_.store(rings_.back().get(), std::memory_order_relaxed);
+  }
+
+  work_stealing_deque(work_stealing_deque const&) = delete;
+  work_stealing_deque& operator=(work_stealing_deque const&) = delete;
+
+  /**
+   * Add an item at the bottom of the deque
+   *
+   * Must not be called concurrently with another push().
+   */
+  void push(T* item) {
+    auto const b = bottom_.load(std::memory_order_relaxed);
+    auto const t = top_.load(std::memory_order_acquire);
+    auto* r = ring_.load(std::memory_order_relaxed);
+
+    if (b - t >= r->capacity()) {
+      r = grow(r, t, b);
+    }
+
+    r->put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Take the item at the top of the deque
+   *
+   * This can be called from any thread.
+   *
+   * \returns The item, or nullptr if the deque is empty.
+   */
+  T* take() {
+    auto t = top_.load(std::memory_order_acquire);
+
+    for (;;) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      auto const b = bottom_.load(std::memory_order_acquire);
+
+      if (t >= b) {
+        return nullptr;
+      }
+
+      auto* item = ring_.load(std::memory_order_acquire)->get(t);
+
+      // On failure, another thread has taken the item and `t` is updated
+      if (top_.compare_exchange_weak(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed)) {
+        return item;
+      }
+    }
+  }
+
+  /**
+   * Approximate number of items in the deque
+   */
+  size_t size_hint() const {
+    auto const b = bottom_.load(std::memory_order_relaxed);
+    auto const t = top_.load(std::memory_order_relaxed);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+  }
+
+ private:
+  class ring {
+   public:
+    explicit ring(size_t capacity)
+        : mask_{static_cast<int64_t>(capacity) - 1}
+        , items_{std::make_unique<std::atomic<T*>[]>(capacity)} {}
+
+    int64_t capacity() const { return mask_ + 1; }
+
+    T* get(int64_t i) const {
+      return items_[i & mask_].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t i, T* item) {
+      items_[i & mask_].store(item, std::memory_order_relaxed);
+    }
+
+   private:
+    int64_t const mask_;
+    std::unique_ptr<std::atomic<T*>[]> items_;
+  };
+
+  ring* grow(ring* r, int64_t t, int64_t b) {
+    auto next = std::make_unique<ring>(2 * r->capacity());
+
+    for (auto i = t; i < b; ++i) {
+      next->put(i, r->get(i));
+    }
+
+    auto* p = next.get();
+    rings_.push_back(std::move(next));
+    ring_.store(p, std::memory_order_release);
+
+    return p;
+  }
+
+  alignas(64) std::atomic<int64_t> top_{0};
+  alignas(64) std::atomic<int64_t> bottom_{0};
+  std::atomic<ring*> ring_;
+  // Consumers may still be reading from a previous ring, so all rings
+  // are kept until the deque is destroyed. As each ring is twice as large
+  // as the previous one, this at most doubles the memory used.
+  std::vector<std::unique_ptr<ring>> rings_;
+};
+
+} // namespace dwarfs::internal
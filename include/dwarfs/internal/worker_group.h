@@ -30,11 +30,13 @@
 #include <memory>
 #include <optional>
 #include <utility>
+#include <vector>
 
 #include <folly/Function.h>
 
 namespace dwarfs {
 
+class cpu_budget;
 class logger;
 class os_access;
 
@@ -46,22 +48,69 @@ namespace internal {
  * This is an easy to use, multithreaded work dispatcher.
  * You can add jobs at any time and they will be dispatched
  * to the next available worker thread.
+ *
+ * Jobs are either demand jobs, which someone is waiting for, or
+ * speculative jobs (e.g. prefetching), which are only dispatched when
+ * no demand jobs are queued. The number of workers that can run
+ * speculative jobs at the same time can be limited. Speculative jobs
+ * can be promoted to demand jobs or cancelled while they are queued.
  */
 class worker_group {
  public:
   using job_t = std::function<void()>;
   using moveonly_job_t = folly::Function<void()>;
 
+  enum class job_priority { demand, speculative };
+
+  /**
+   * How jobs are distributed to the workers
+   *
+   * `shared_queue` uses a single, locked queue for all workers, which is
+   * simple and keeps jobs strictly in order. `work_stealing` gives each
+   * worker its own queues that other workers can steal from. This is
+   * meant for jobs that add lots of small jobs themselves, but it has
+   * only been measured with the synthetic jobs of worker_group_benchmark
+   * so far, so no production worker group uses it yet.
+   */
+  enum class scheduling { shared_queue, work_stealing };
+
+  struct queue_stats {
+    size_t jobs{0};
+    size_t cancelled{0};
+    std::chrono::nanoseconds total_delay{0};
+    std::chrono::nanoseconds max_delay{0};
+  };
+
+  class job_state;
+  using job_ticket = std::shared_ptr<job_state>;
+
   /**
    * Create a worker group
    *
    * \param num_workers     Number of worker threads.
+   * \param sched           How jobs are distributed to the workers.
    */
   explicit worker_group(
       logger& lgr, os_access const& os, const char* group_name,
       size_t num_workers = 1,
       size_t max_queue_len = std::numeric_limits<size_t>::max(),
-      int niceness = 0);
+      int niceness = 0, scheduling sched = scheduling::shared_queue);
+
+  /**
+   * Create a worker group sharing a CPU budget with other worker groups
+   *
+   * No matter how many workers each group has, at most as many jobs as
+   * the budget has slots will run at the same time across all groups
+   * sharing the budget. Without a budget, this is the same as a regular
+   * worker group.
+   *
+   * \param budget          The shared budget, may be empty.
+   * \param num_workers     Number of worker threads.
+   */
+  worker_group(logger& lgr, os_access const& os, const char* group_name,
+               std::shared_ptr<cpu_budget> budget, size_t num_workers,
+               size_t max_queue_len = std::numeric_limits<size_t>::max(),
+               int niceness = 0);
 
   worker_group() = default;
   ~worker_group() = default;
@@ -85,6 +134,46 @@ class worker_group {
     return add_job(moveonly_job_t{std::forward<T>(job)});
   }
 
+  /**
+   * Add a speculative job
+   *
+   * \returns A ticket for promoting or cancelling the job, or an empty
+   *          ticket if the worker group is not running.
+   */
+  job_ticket add_speculative_job(moveonly_job_t&& job) {
+    return impl_->add_speculative_job(std::move(job));
+  }
+
+  template <std::invocable T>
+  job_ticket add_speculative_job(T&& job) {
+    return add_speculative_job(moveonly_job_t{std::forward<T>(job)});
+  }
+
+  /**
+   * Turn a queued speculative job into a demand job
+   *
+   * \returns Whether the job was still queued.
+   */
+  bool promote(job_ticket const& ticket) { return impl_->promote(ticket); }
+
+  /**
+   * Remove a queued speculative job without running it
+   *
+   * \returns Whether the job was still queued and has been removed.
+   */
+  bool cancel(job_ticket const& ticket) { return impl_->cancel(ticket); }
+
+  /**
+   * Limit the number of workers running speculative jobs at the same time
+   */
+  void set_max_speculative_workers(size_t num) {
+    impl_->set_max_speculative_workers(num);
+  }
+
+  queue_stats get_queue_stats(job_priority prio) const {
+    return impl_->get_queue_stats(prio);
+  }
+
   size_t size() const { return impl_->size(); }
   size_t queue_size() const { return impl_->queue_size(); }
 
@@ -114,6 +203,11 @@ class worker_group {
     virtual bool running() const = 0;
     virtual bool add_job(job_t&& job) = 0;
     virtual bool add_moveonly_job(moveonly_job_t&& job) = 0;
+    virtual job_ticket add_speculative_job(moveonly_job_t&& job) = 0;
+    virtual bool promote(job_ticket const& ticket) = 0;
+    virtual bool cancel(job_ticket const& ticket) = 0;
+    virtual void set_max_speculative_workers(size_t num) = 0;
+    virtual queue_stats get_queue_stats(job_priority prio) const = 0;
     virtual size_t size() const = 0;
     virtual size_t queue_size() const = 0;
     virtual std::chrono::nanoseconds
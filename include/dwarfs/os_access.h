@@ -22,6 +22,7 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <filesystem>
 #include <memory>
 #include <optional>
@@ -43,6 +44,15 @@ class dir_reader {
   virtual bool read(std::filesystem::path& name) = 0;
 };
 
+struct memory_pressure {
+  // Share of time in which at least some tasks were stalled waiting for
+  // memory, averaged over the last 10 seconds (Linux PSI "some avg10")
+  std::optional<double> stall_pct;
+  // Memory currently used by / available to the control group
+  std::optional<uint64_t> current_bytes;
+  std::optional<uint64_t> limit_bytes;
+};
+
 class os_access {
  public:
   virtual ~os_access() = default;
@@ -68,5 +78,6 @@ class os_access {
   thread_get_cpu_time(std::thread::id tid, std::error_code& ec) const = 0;
   virtual std::filesystem::path
   find_executable(std::filesystem::path const& name) const = 0;
+  virtual memory_pressure get_memory_pressure() const = 0;
 };
 } // namespace dwarfs
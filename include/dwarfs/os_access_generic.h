@@ -55,5 +55,6 @@ class os_access_generic : public os_access {
   thread_get_cpu_time(std::thread::id tid, std::error_code& ec) const override;
   std::filesystem::path
   find_executable(std::filesystem::path const& name) const override;
+  memory_pressure get_memory_pressure() const override;
 };
 } // namespace dwarfs
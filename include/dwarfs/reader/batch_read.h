@@ -0,0 +1,69 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <system_error>
+#include <vector>
+
+#include <dwarfs/reader/block_range.h>
+#include <dwarfs/types.h>
+
+namespace dwarfs::reader {
+
+/**
+ * A single request in a batched read
+ *
+ * This is equivalent to the arguments of a single `readv()` call.
+ */
+struct read_request {
+  uint32_t inode{0};
+  file_off_t offset{0};
+  size_t size{std::numeric_limits<size_t>::max()};
+};
+
+/**
+ * The result of a single request in a batched read
+ *
+ * `index` is the position of the request in the batch. `ranges`
+ * holds the data in file order; it is empty if `ec` is set.
+ */
+struct read_result {
+  size_t index{0};
+  std::vector<block_range> ranges;
+  std::error_code ec;
+
+  size_t size() const {
+    size_t total{0};
+    for (auto const& r : ranges) {
+      total += r.size();
+    }
+    return total;
+  }
+};
+
+using read_callback = std::function<void(read_result&&)>;
+
+} // namespace dwarfs::reader
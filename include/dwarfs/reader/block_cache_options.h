@@ -24,6 +24,8 @@
 #include <cstddef>
 #include <iosfwd>
 
+#include <dwarfs/reader/block_allocator_mode.h>
+
 namespace dwarfs::reader {
 
 struct block_cache_options {
@@ -34,6 +36,9 @@ struct block_cache_options {
   bool init_workers{true};
   bool disable_block_integrity_check{false};
   size_t sequential_access_detector_threshold{0};
+  block_allocator_mode allocator{block_allocator_mode::MALLOC};
+  bool bypass_whole_block_reads{false};
+  size_t max_compressed_bytes{0};
 };
 
 std::ostream& operator<<(std::ostream& os, block_cache_options const& opts);
@@ -24,11 +24,13 @@
 #include <cstdint>
 #include <memory>
 #include <span>
+#include <utility>
 
 namespace dwarfs::reader {
 
 namespace internal {
 
+class block_pin;
 class cached_block;
 
 } // namespace internal
@@ -39,6 +41,46 @@ class block_range {
   block_range(uint8_t const* data, size_t offset, size_t size);
   block_range(std::shared_ptr<internal::cached_block const> block,
               size_t offset, size_t size);
+  // Adds a reference to `pin`
+  block_range(internal::block_pin& pin, size_t offset, size_t size);
+
+  block_range(block_range const& other)
+      : span_{other.span_}
+      , block_{other.block_}
+      , pin_{other.pin_} {
+    if (pin_) {
+      ref(pin_);
+    }
+  }
+
+  block_range(block_range&& other) noexcept
+      : span_{other.span_}
+      , block_{std::move(other.block_)}
+      , pin_{std::exchange(other.pin_, nullptr)} {}
+
+  block_range& operator=(block_range const& other) {
+    block_range tmp{other};
+    swap(tmp);
+    return *this;
+  }
+
+  block_range& operator=(block_range&& other) noexcept {
+    block_range tmp{std::move(other)};
+    swap(tmp);
+    return *this;
+  }
+
+  ~block_range() {
+    if (pin_) {
+      unref(pin_);
+    }
+  }
+
+  void swap(block_range& other) noexcept {
+    std::swap(span_, other.span_);
+    block_.swap(other.block_);
+    std::swap(pin_, other.pin_);
+  }
 
   auto data() const { return span_.data(); }
   auto begin() const { return span_.begin(); }
@@ -46,8 +88,12 @@ class block_range {
   auto size() const { return span_.size(); }
 
  private:
+  static void ref(internal::block_pin* pin) noexcept;
+  static void unref(internal::block_pin* pin) noexcept;
+
   std::span<uint8_t const> span_;
   std::shared_ptr<internal::cached_block const> block_;
+  internal::block_pin* pin_{nullptr};
 };
 
 } // namespace dwarfs::reader
@@ -25,12 +25,21 @@
 
 namespace dwarfs::reader {
 
-enum class cache_tidy_strategy { NONE, EXPIRY_TIME, BLOCK_SWAPPED_OUT };
+enum class cache_tidy_strategy {
+  NONE,
+  EXPIRY_TIME,
+  BLOCK_SWAPPED_OUT,
+  MEMORY_PRESSURE,
+};
 
 struct cache_tidy_config {
   cache_tidy_strategy strategy{cache_tidy_strategy::NONE};
   std::chrono::milliseconds interval{std::chrono::seconds(1)};
   std::chrono::milliseconds expiry_time{std::chrono::seconds(60)};
+  // MEMORY_PRESSURE: shrink the cache if memory stalls exceed this
+  // percentage or memory usage exceeds this fraction of the limit
+  double max_stall_pct{10.0};
+  double max_memory_usage{0.9};
 };
 
 } // namespace dwarfs::reader
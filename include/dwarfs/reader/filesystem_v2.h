@@ -36,6 +36,7 @@
 #include <nlohmann/json.hpp>
 
 #include <dwarfs/file_stat.h>
+#include <dwarfs/reader/batch_read.h>
 #include <dwarfs/reader/block_range.h>
 #include <dwarfs/reader/fsinfo_features.h>
 #include <dwarfs/reader/metadata_types.h>
@@ -128,6 +129,36 @@ class filesystem_v2 {
     impl_->walk_data_order(func);
   }
 
+  /**
+   * Walk all entries in data order while prefetching blocks
+   *
+   * Before an entry is passed to `func`, the blocks of up to
+   * `prefetch_blocks` blocks beyond that entry's data will have been
+   * submitted to the block cache workers for decompression. This is
+   * useful when `func` reads the file contents. To bound memory usage,
+   * an entry is passed on early if too many entries are waiting for the
+   * next block to be prefetched, e.g. because they are small files that
+   * share a block.
+   */
+  void walk_data_order_prefetch(std::function<void(dir_entry_view)> const& func,
+                                size_t prefetch_blocks) const {
+    impl_->walk_data_order_prefetch(func, prefetch_blocks);
+  }
+
+  /**
+   * Walk all entries using a pool of `num_threads` worker threads
+   *
+   * Each directory is processed by a single job, and each subdirectory
+   * is handed off to a new job. `func` will be called concurrently from
+   * multiple threads and in no particular order, except that a directory
+   * is always visited before its entries. Passing 0 for `num_threads`
+   * uses one thread per CPU.
+   */
+  void walk_parallel(std::function<void(dir_entry_view)> const& func,
+                     size_t num_threads = 0) const {
+    impl_->walk_parallel(func, num_threads);
+  }
+
   std::optional<inode_view> find(const char* path) const {
     return impl_->find(path);
   }
@@ -282,6 +313,21 @@ class filesystem_v2 {
     return impl_->readv(inode, size, offset, ec);
   }
 
+  /**
+   * Read data from multiple inodes in one go
+   *
+   * Requests are grouped by block so that each block is only submitted
+   * to the block cache once, no matter how many requests touch it. The
+   * callback is invoked exactly once per request, from the calling
+   * thread, as soon as all data for that request is available. Results
+   * are thus delivered roughly in block order rather than request order;
+   * use `read_result::index` to map them back to the request.
+   */
+  void read_batch(std::span<read_request const> requests,
+                  read_callback const& callback) const {
+    impl_->read_batch(requests, callback);
+  }
+
   std::optional<std::span<uint8_t const>> header() const {
     return impl_->header();
   }
@@ -336,6 +382,11 @@ class filesystem_v2 {
     walk(std::function<void(dir_entry_view)> const& func) const = 0;
     virtual void
     walk_data_order(std::function<void(dir_entry_view)> const& func) const = 0;
+    virtual void
+    walk_data_order_prefetch(std::function<void(dir_entry_view)> const& func,
+                             size_t prefetch_blocks) const = 0;
+    virtual void walk_parallel(std::function<void(dir_entry_view)> const& func,
+                               size_t num_threads) const = 0;
     virtual std::optional<inode_view> find(const char* path) const = 0;
     virtual std::optional<inode_view> find(int inode) const = 0;
     virtual std::optional<inode_view>
@@ -389,6 +440,8 @@ class filesystem_v2 {
     virtual std::vector<std::future<block_range>>
     readv(uint32_t inode, size_t size, file_off_t offset,
           std::error_code& ec) const = 0;
+    virtual void read_batch(std::span<read_request const> requests,
+                            read_callback const& callback) const = 0;
     virtual std::optional<std::span<uint8_t const>> header() const = 0;
     virtual void set_num_workers(size_t num) = 0;
     virtual void set_cache_tidy_config(cache_tidy_config const& cfg) = 0;
@@ -0,0 +1,92 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <folly/container/F14Map.h>
+
+#include <dwarfs/byte_buffer.h>
+#include <dwarfs/reader/block_allocator_mode.h>
+
+namespace dwarfs::reader::internal {
+
+/**
+ * Allocates decompressed block buffers from fixed-size slabs
+ *
+ * Slabs are mapped directly from the OS instead of going through malloc,
+ * optionally backed by huge pages. Slab sizes are rounded up to the page
+ * size, so blocks of the same size always share a slab size. Released
+ * slabs are kept for reuse up to a total size of `max_free_bytes`, so
+ * replacing an evicted block doesn't have to fault in fresh pages; all
+ * other slabs are returned to the OS right away.
+ */
+class block_buffer_arena
+    : public std::enable_shared_from_this<block_buffer_arena> {
+ public:
+  static constexpr size_t huge_page_size{static_cast<size_t>(2) << 20};
+
+  struct stats {
+    size_t mapped_bytes{0};
+    size_t peak_mapped_bytes{0};
+    size_t free_bytes{0};
+    size_t slabs_mapped{0};
+    size_t slabs_reused{0};
+    size_t hugetlb_failures{0};
+  };
+
+  block_buffer_arena(block_allocator_mode mode, size_t max_free_bytes);
+  ~block_buffer_arena();
+
+  block_buffer_arena(block_buffer_arena const&) = delete;
+  block_buffer_arena& operator=(block_buffer_arena const&) = delete;
+
+  // Must be owned by a shared_ptr. The buffer acquires its storage upon
+  // the first call to reserve() or resize().
+  std::unique_ptr<mutable_byte_buffer> make_buffer();
+
+  // Returns a slab of at least `size` bytes and its actual size
+  std::pair<uint8_t*, size_t> acquire(size_t size);
+  void release(uint8_t* data, size_t slab_size);
+
+  size_t slab_size(size_t size) const;
+
+  stats get_stats() const;
+
+ private:
+  uint8_t* map_slab(size_t size, bool& hugetlb_failed) const;
+  static void unmap_slab(uint8_t* data, size_t size);
+
+  block_allocator_mode const mode_;
+  size_t const max_free_bytes_;
+  size_t const page_size_;
+  std::mutex mutable mx_;
+  folly::F14FastMap<size_t, std::vector<uint8_t*>> free_;
+  stats stats_;
+};
+
+} // namespace dwarfs::reader::internal
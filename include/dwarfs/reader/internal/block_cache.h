@@ -25,11 +25,15 @@
 #include <cstdint>
 
 #include <future>
+#include <limits>
 #include <memory>
+#include <span>
+#include <vector>
 
 #include <dwarfs/block_compressor.h>
 #include <dwarfs/fstypes.h>
 #include <dwarfs/reader/block_range.h>
+#include <dwarfs/reader/internal/range_completion.h>
 
 namespace dwarfs {
 
@@ -51,6 +55,11 @@ namespace reader::internal {
 
 class block_cache {
  public:
+  struct range_request {
+    size_t offset;
+    size_t size;
+  };
+
   block_cache(logger& lgr, os_access const& os, std::shared_ptr<mmif> mm,
               const block_cache_options& options,
               std::shared_ptr<performance_monitor const> perfmon);
@@ -74,6 +83,40 @@ class block_cache {
     return impl_->get(block_no, offset, size);
   }
 
+  // Same as above, but signals the result through `slot` instead of
+  // allocating a promise/future pair
+  void get(size_t block_no, size_t offset, size_t size,
+           range_completion::slot& slot) const {
+    impl_->get(block_no, offset, size, slot);
+  }
+
+  // Start decompressing the block in the background unless it's already
+  // cached or being decompressed. This is a speculative job that will not
+  // hold up any other requests.
+  void prefetch(size_t block_no) const {
+    impl_->prefetch(block_no, std::numeric_limits<size_t>::max());
+  }
+
+  // Same as above, but only decompress up to `range_end`
+  void prefetch(size_t block_no, size_t range_end) const {
+    impl_->prefetch(block_no, range_end);
+  }
+
+  // Decompress an entire block straight into `dest`, without inserting
+  // it into the cache. This only works if bypassing whole block reads is
+  // enabled, the block is neither cached nor being decompressed and the
+  // size of `dest` matches the uncompressed block size. Otherwise, this
+  // returns false and the block must be read through the cache.
+  bool read_uncached(size_t block_no, std::span<uint8_t> dest) const {
+    return impl_->read_uncached(block_no, dest);
+  }
+
+  // All ranges are handled by a single request set for the block
+  std::vector<std::future<block_range>>
+  get(size_t block_no, std::span<range_request const> ranges) const {
+    return impl_->get(block_no, ranges);
+  }
+
   class impl {
    public:
     virtual ~impl() = default;
@@ -85,6 +128,13 @@ class block_cache {
     virtual void set_tidy_config(cache_tidy_config const& cfg) = 0;
     virtual std::future<block_range>
     get(size_t block_no, size_t offset, size_t length) const = 0;
+    virtual void get(size_t block_no, size_t offset, size_t length,
+                     range_completion::slot& slot) const = 0;
+    virtual std::vector<std::future<block_range>>
+    get(size_t block_no, std::span<range_request const> ranges) const = 0;
+    virtual void prefetch(size_t block_no, size_t range_end) const = 0;
+    virtual bool
+    read_uncached(size_t block_no, std::span<uint8_t> dest) const = 0;
   };
 
  private:
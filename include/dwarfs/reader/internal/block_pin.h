@@ -0,0 +1,116 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+#include <folly/container/F14Map.h>
+
+namespace dwarfs::reader::internal {
+
+class cached_block;
+
+/**
+ * Keeps track of the memory held by pinned blocks
+ *
+ * Pinned blocks may outlive their eviction from the block cache as long
+ * as a block range still references them, so the memory they hold must
+ * be limited separately. A block is only counted once, no matter how many
+ * pins reference it. The block cache keeps the budget in sync with its
+ * own effective size, so it shrinks along with the cache.
+ */
+class block_pin_accounting {
+ public:
+  explicit block_pin_accounting(size_t budget)
+      : budget_{budget} {}
+
+  bool try_add(cached_block const& block);
+  void remove(cached_block const& block);
+
+  void set_budget(size_t budget) {
+    budget_.store(budget, std::memory_order_relaxed);
+  }
+
+  size_t pinned_bytes() const {
+    return pinned_bytes_.load(std::memory_order_relaxed);
+  }
+
+  size_t peak_pinned_bytes() const {
+    return peak_pinned_bytes_.load(std::memory_order_relaxed);
+  }
+
+  size_t rejected() const { return rejected_.load(std::memory_order_relaxed); }
+
+ private:
+  std::mutex mx_;
+  folly::F14FastMap<cached_block const*, size_t> pins_;
+  std::atomic<size_t> budget_;
+  std::atomic<size_t> pinned_bytes_{0};
+  std::atomic<size_t> peak_pinned_bytes_{0};
+  std::atomic<size_t> rejected_{0};
+};
+
+/**
+ * A reference-counted pin on a fully decompressed block
+ *
+ * Each pin is owned by a single thread's pin table and only referenced
+ * by block ranges created on that thread, so its reference count stays
+ * in a cache line that is local to the thread. This is in contrast to
+ * the shared_ptr control block of a hot block, which is updated by all
+ * threads reading from that block.
+ */
+class block_pin {
+ public:
+  static block_pin*
+  create(std::shared_ptr<cached_block const> block,
+         std::shared_ptr<block_pin_accounting> accounting);
+
+  block_pin(block_pin const&) = delete;
+  block_pin& operator=(block_pin const&) = delete;
+
+  void ref() noexcept { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+  void unref() noexcept {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+  cached_block const& block() const { return *block_; }
+
+ private:
+  block_pin(std::shared_ptr<cached_block const> block,
+            std::shared_ptr<block_pin_accounting> accounting)
+      : block_{std::move(block)}
+      , accounting_{std::move(accounting)} {}
+
+  ~block_pin();
+
+  std::shared_ptr<cached_block const> block_;
+  std::shared_ptr<block_pin_accounting> accounting_;
+  std::atomic<size_t> refs_{1};
+};
+
+} // namespace dwarfs::reader::internal
@@ -23,6 +23,7 @@
 
 #include <chrono>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -30,6 +31,7 @@ namespace dwarfs {
 
 class logger;
 class mmif;
+class mutable_byte_buffer;
 
 namespace internal {
 
@@ -41,12 +43,25 @@ namespace reader::internal {
 
 class cached_block {
  public:
+  using compressed_data_ptr = std::shared_ptr<std::vector<uint8_t> const>;
+  using compressed_data_loader = std::function<compressed_data_ptr()>;
+
+  // Creating a block is cheap; nothing is read from the image until the
+  // block is loaded. If `load_compressed` is set, the block is decompressed
+  // from the in-memory copy it returns instead of from the image, which is
+  // then left untouched.
   static std::unique_ptr<cached_block>
   create(logger& lgr, dwarfs::internal::fs_section const& b,
-         std::shared_ptr<mmif> mm, bool release, bool disable_integrity_check);
+         std::shared_ptr<mmif> mm, std::unique_ptr<mutable_byte_buffer> buffer,
+         compressed_data_loader load_compressed, bool release,
+         bool disable_integrity_check);
 
   virtual ~cached_block() = default;
 
+  // Fetches and checks the compressed data. Must be called before any of
+  // the other members apart from range_end(), which is zero until then.
+  // Can be retried if it throws.
+  virtual void load() = 0;
   virtual size_t range_end() const = 0;
   virtual const uint8_t* data() const = 0;
   virtual void decompress_until(size_t end) = 0;
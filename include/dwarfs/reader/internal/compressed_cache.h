@@ -0,0 +1,82 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include <folly/container/F14Map.h>
+
+namespace dwarfs::reader::internal {
+
+/**
+ * An LRU cache of compressed block data
+ *
+ * For images on slow or remote storage, the expensive part of a block
+ * cache miss is fetching the compressed data rather than decompressing
+ * it. As compressed data is usually a lot denser than decompressed data,
+ * keeping it in memory allows for a much larger working set to stay
+ * resident. The cache is limited by the total size of its data.
+ */
+class compressed_cache {
+ public:
+  using data_ptr = std::shared_ptr<std::vector<uint8_t> const>;
+
+  struct stats {
+    size_t hits{0};
+    size_t misses{0};
+    size_t evictions{0};
+    size_t bytes{0};
+    size_t peak_bytes{0};
+  };
+
+  explicit compressed_cache(size_t max_bytes)
+      : max_bytes_{max_bytes} {}
+
+  // Returns nullptr if the block isn't cached
+  data_ptr get(size_t block_no);
+
+  // Stores a copy of `data`, unless it's larger than the whole cache, in
+  // which case nullptr is returned
+  data_ptr put(size_t block_no, std::span<uint8_t const> data);
+
+  stats get_stats() const;
+
+ private:
+  struct entry {
+    data_ptr data;
+    std::list<size_t>::iterator lru_pos;
+  };
+
+  size_t const max_bytes_;
+  std::mutex mutable mx_;
+  std::list<size_t> lru_;
+  folly::F14FastMap<size_t, entry> entries_;
+  stats stats_;
+};
+
+} // namespace dwarfs::reader::internal
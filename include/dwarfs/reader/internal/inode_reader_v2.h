@@ -22,12 +22,15 @@
 #pragma once
 
 #include <cstddef>
+#include <functional>
 #include <iosfwd>
 #include <memory>
+#include <span>
 #include <string>
 #include <system_error>
 #include <vector>
 
+#include <dwarfs/reader/batch_read.h>
 #include <dwarfs/reader/block_range.h>
 #include <dwarfs/types.h>
 
@@ -46,6 +49,8 @@ namespace reader::internal {
 
 class inode_reader_v2 {
  public:
+  using chunk_getter = std::function<chunk_range(uint32_t, std::error_code&)>;
+
   inode_reader_v2() = default;
 
   inode_reader_v2(logger& lgr, block_cache&& bc,
@@ -76,11 +81,21 @@ class inode_reader_v2 {
     return impl_->readv(inode, size, offset, chunks, ec);
   }
 
+  void read_batch(std::span<read_request const> requests,
+                  chunk_getter const& get_chunks,
+                  read_callback const& callback) const {
+    impl_->read_batch(requests, get_chunks, callback);
+  }
+
   void
   dump(std::ostream& os, const std::string& indent, chunk_range chunks) const {
     impl_->dump(os, indent, chunks);
   }
 
+  void prefetch_block(size_t block_no) const {
+    impl_->prefetch_block(block_no);
+  }
+
   void set_num_workers(size_t num) { impl_->set_num_workers(num); }
 
   void set_cache_tidy_config(cache_tidy_config const& cfg) {
@@ -105,8 +120,13 @@ class inode_reader_v2 {
     virtual std::vector<std::future<block_range>>
     readv(uint32_t inode, size_t size, file_off_t offset, chunk_range chunks,
           std::error_code& ec) const = 0;
+    virtual void
+    read_batch(std::span<read_request const> requests,
+               chunk_getter const& get_chunks,
+               read_callback const& callback) const = 0;
     virtual void dump(std::ostream& os, const std::string& indent,
                       chunk_range chunks) const = 0;
+    virtual void prefetch_block(size_t block_no) const = 0;
     virtual void set_num_workers(size_t num) = 0;
     virtual void set_cache_tidy_config(cache_tidy_config const& cfg) = 0;
     virtual size_t num_blocks() const = 0;
@@ -0,0 +1,62 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include <dwarfs/os_access.h>
+
+namespace dwarfs::reader::internal {
+
+/**
+ * Computes the effective block cache size based on memory pressure
+ *
+ * The cache size is halved while memory is under pressure and slowly
+ * grown back to its configured maximum once the pressure has eased.
+ * Between the two thresholds, the size is kept as is so it doesn't
+ * oscillate.
+ */
+class memory_pressure_controller {
+ public:
+  memory_pressure_controller(size_t max_bytes, double max_stall_pct,
+                             double max_memory_usage)
+      : max_bytes_{max_bytes}
+      , effective_bytes_{max_bytes}
+      , max_stall_pct_{max_stall_pct}
+      , max_memory_usage_{max_memory_usage} {}
+
+  size_t update(memory_pressure const& mp);
+
+  size_t effective_bytes() const { return effective_bytes_; }
+  size_t max_bytes() const { return max_bytes_; }
+
+ private:
+  bool under_pressure(memory_pressure const& mp) const;
+  bool relaxed(memory_pressure const& mp) const;
+
+  size_t const max_bytes_;
+  size_t effective_bytes_;
+  double const max_stall_pct_;
+  double const max_memory_usage_;
+};
+
+} // namespace dwarfs::reader::internal
@@ -50,6 +50,12 @@ struct vfs_stat;
 
 class performance_monitor;
 
+namespace internal {
+
+class worker_group;
+
+} // namespace internal
+
 namespace thrift::metadata {
 class metadata;
 }
@@ -97,6 +103,12 @@ class metadata_v2 {
     impl_->walk_data_order(func);
   }
 
+  // func will be called concurrently from the worker group's threads
+  void walk_parallel(dwarfs::internal::worker_group& wg,
+                     std::function<void(dir_entry_view)> const& func) const {
+    impl_->walk_parallel(wg, func);
+  }
+
   std::optional<inode_view> find(const char* path) const {
     return impl_->find(path);
   }
@@ -197,6 +209,10 @@ class metadata_v2 {
     virtual void
     walk_data_order(std::function<void(dir_entry_view)> const& func) const = 0;
 
+    virtual void
+    walk_parallel(dwarfs::internal::worker_group& wg,
+                  std::function<void(dir_entry_view)> const& func) const = 0;
+
     virtual std::optional<inode_view> find(const char* path) const = 0;
     virtual std::optional<inode_view> find(int inode) const = 0;
     virtual std::optional<inode_view>
@@ -0,0 +1,141 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <utility>
+
+#include <dwarfs/reader/block_range.h>
+#include <dwarfs/small_vector.h>
+
+namespace dwarfs::reader::internal {
+
+/**
+ * Completion object for a fixed number of block ranges
+ *
+ * This is a lightweight replacement for a vector of promise/future
+ * pairs when the caller is going to wait for all ranges anyway. It
+ * lives on the caller's stack and doesn't perform any heap allocations
+ * as long as the number of ranges fits into the inline storage.
+ *
+ * The destructor waits for all outstanding slots, so the block cache
+ * can never write to a slot that no longer exists. A producer claims a
+ * slot when it takes over the obligation to complete it; slots that
+ * were never claimed can be failed by the caller using abandon(), so an
+ * early exit can't leave the destructor waiting forever.
+ */
+class range_completion {
+ public:
+  // Same as iovec_read_buf, this covers the vast majority of reads
+  static constexpr size_t inline_storage = 16;
+
+  class slot {
+   public:
+    void set_value(block_range&& br) {
+      range_ = std::move(br);
+      done_ = true;
+      owner_->complete_one();
+    }
+
+    void set_exception(std::exception_ptr ep) {
+      error_ = std::move(ep);
+      done_ = true;
+      owner_->complete_one();
+    }
+
+    // Called by a producer that is going to complete this slot
+    void claim() { claimed_ = true; }
+
+    // Only valid after range_completion::wait() has returned
+    block_range& get() {
+      if (error_) {
+        std::rethrow_exception(error_);
+      }
+      return range_;
+    }
+
+   private:
+    friend class range_completion;
+
+    range_completion* owner_{nullptr};
+    block_range range_;
+    std::exception_ptr error_;
+    bool claimed_{false};
+    bool done_{false};
+  };
+
+  explicit range_completion(size_t count)
+      : slots_(count)
+      , pending_{count} {
+    for (auto& s : slots_) {
+      s.owner_ = this;
+    }
+  }
+
+  ~range_completion() { wait(); }
+
+  range_completion(range_completion const&) = delete;
+  range_completion& operator=(range_completion const&) = delete;
+
+  size_t size() const { return slots_.size(); }
+
+  slot& operator[](size_t i) { return slots_[i]; }
+
+  auto begin() { return slots_.begin(); }
+  auto end() { return slots_.end(); }
+
+  // Fails all slots that have neither been claimed by a producer nor
+  // completed directly by the caller. Must be called from the thread
+  // that owns this object.
+  void abandon(std::exception_ptr const& ep) {
+    for (auto& s : slots_) {
+      if (!s.claimed_ && !s.done_) {
+        s.set_exception(ep);
+      }
+    }
+  }
+
+  void wait() {
+    std::unique_lock lock(mx_);
+    cond_.wait(lock, [this] { return pending_ == 0; });
+  }
+
+ private:
+  void complete_one() {
+    // The decrement must happen under the lock; otherwise, wait() could
+    // return and the object could be destroyed before we notify.
+    std::lock_guard lock(mx_);
+    if (--pending_ == 0) {
+      cond_.notify_all();
+    }
+  }
+
+  small_vector<slot, inline_storage> slots_;
+  std::mutex mx_;
+  std::condition_variable cond_;
+  size_t pending_;
+};
+
+} // namespace dwarfs::reader::internal
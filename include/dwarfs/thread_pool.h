@@ -30,6 +30,7 @@
 
 namespace dwarfs {
 
+class cpu_budget;
 class logger;
 class os_access;
 
@@ -54,6 +55,10 @@ class thread_pool {
               size_t num_workers = 1,
               size_t max_queue_len = std::numeric_limits<size_t>::max(),
               int niceness = 0);
+  thread_pool(logger& lgr, os_access const& os, const char* group_name,
+              std::shared_ptr<cpu_budget> budget, size_t num_workers,
+              size_t max_queue_len = std::numeric_limits<size_t>::max(),
+              int niceness = 0);
 
   ~thread_pool();
 
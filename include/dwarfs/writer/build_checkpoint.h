@@ -0,0 +1,163 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <dwarfs/compression.h>
+
+namespace dwarfs {
+
+class file_access;
+class logger;
+
+namespace writer {
+
+/**
+ * Persistent state that allows an interrupted build to be resumed
+ *
+ * A checkpoint is a directory next to the output image. It contains a
+ * journal of compressed blocks and inode orderings, as well as a hash
+ * cache with the scan and hashing results of all input files (see
+ * `scanner_options::hash_cache`). Records are appended to the journal
+ * as soon as they become available, and each record is protected by
+ * checksums, so a build that is killed at any point leaves a usable
+ * checkpoint behind. Each build writes a journal segment of its own and
+ * only reads the segments of previous builds, so a torn record at the
+ * end of a segment is simply ignored. When resuming, the segments of
+ * previous builds are compacted into a single segment first, dropping
+ * any torn records, so there are never more than two segments.
+ *
+ * Segmenting is not checkpointed: the segmenter state and the chunks of
+ * each inode are rebuilt when resuming, and only the compression of
+ * blocks that turn out to be identical is skipped. As every compressed
+ * block is kept in the journal until the build has completed, the
+ * checkpoint needs about as much space as the output image.
+ *
+ * Records are keyed by a hash of everything that went into them. A
+ * compressed block is only reused if the exact same data is compressed
+ * with the same compressor, and an ordering is only reused if the same
+ * set of inodes is ordered using the same options. Records of inputs
+ * that have changed are thus simply never found.
+ *
+ * All methods are thread-safe.
+ */
+class build_checkpoint {
+ public:
+  using key_type = std::array<uint64_t, 2>;
+
+  struct compressed_block {
+    compression_type compression;
+    std::vector<uint8_t> data;
+  };
+
+  struct stats {
+    size_t loaded_blocks{0};
+    size_t loaded_orderings{0};
+    size_t discarded_bytes{0};
+    size_t reused_blocks{0};
+    size_t reused_bytes{0};
+    size_t reused_orderings{0};
+    size_t added_blocks{0};
+    size_t added_orderings{0};
+  };
+
+  /**
+   * Open the checkpoint in `dir`, creating it if necessary
+   *
+   * Orderings are only reused if `config` is the same as when they
+   * were added.
+   */
+  build_checkpoint(logger& lgr, std::shared_ptr<file_access const> fa,
+                   std::filesystem::path const& dir, std::string_view config);
+
+  static key_type
+  block_key(std::string_view compressor, std::optional<std::string> const& meta,
+            std::span<uint8_t const> data);
+
+  std::filesystem::path const& path() const { return impl_->path(); }
+
+  std::filesystem::path hash_cache_path() const {
+    return impl_->hash_cache_path();
+  }
+
+  bool resumed() const { return impl_->resumed(); }
+
+  std::optional<compressed_block> find_block(key_type const& key) {
+    return impl_->find_block(key);
+  }
+
+  void add_block(key_type const& key, compression_type compression,
+                 std::span<uint8_t const> data) {
+    impl_->add_block(key, compression, data);
+  }
+
+  std::optional<std::vector<uint32_t>> find_ordering(key_type const& key) {
+    return impl_->find_ordering(key);
+  }
+
+  void add_ordering(key_type const& key, std::span<uint32_t const> index) {
+    impl_->add_ordering(key, index);
+  }
+
+  /**
+   * Remove the checkpoint once the build has completed
+   */
+  void remove() { impl_->remove(); }
+
+  stats get_stats() const { return impl_->get_stats(); }
+
+  class impl {
+   public:
+    virtual ~impl() = default;
+
+    virtual std::filesystem::path const& path() const = 0;
+    virtual std::filesystem::path hash_cache_path() const = 0;
+    virtual bool resumed() const = 0;
+    virtual std::optional<compressed_block>
+    find_block(key_type const& key) = 0;
+    virtual void add_block(key_type const& key, compression_type compression,
+                           std::span<uint8_t const> data) = 0;
+    virtual std::optional<std::vector<uint32_t>>
+    find_ordering(key_type const& key) = 0;
+    virtual void
+    add_ordering(key_type const& key, std::span<uint32_t const> index) = 0;
+    virtual void remove() = 0;
+    virtual stats get_stats() const = 0;
+  };
+
+ private:
+  std::unique_ptr<impl> impl_;
+};
+
+} // namespace writer
+
+} // namespace dwarfs
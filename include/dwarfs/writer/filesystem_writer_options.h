@@ -22,14 +22,20 @@
 #pragma once
 
 #include <cstddef>
+#include <memory>
 
 namespace dwarfs::writer {
 
+class build_checkpoint;
+class memory_budget;
+
 struct filesystem_writer_options {
   size_t max_queue_size{64 << 20};
   size_t worst_case_block_size{4 << 20};
   bool remove_header{false};
   bool no_section_index{false};
+  std::shared_ptr<memory_budget> memory;
+  std::shared_ptr<build_checkpoint> checkpoint;
 };
 
 } // namespace dwarfs::writer
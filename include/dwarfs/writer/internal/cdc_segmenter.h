@@ -0,0 +1,49 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include <dwarfs/writer/segmenter.h>
+
+namespace dwarfs {
+
+struct compression_constraints;
+
+class logger;
+
+namespace writer::internal {
+
+class block_manager;
+class progress;
+
+std::unique_ptr<segmenter::impl>
+create_cdc_segmenter(logger& lgr, progress& prog,
+                     std::shared_ptr<block_manager> blkmgr,
+                     segmenter::config const& cfg,
+                     compression_constraints const& cc, size_t total_size,
+                     segmenter::block_ready_cb block_ready);
+
+} // namespace writer::internal
+
+} // namespace dwarfs
@@ -0,0 +1,108 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include <parallel_hashmap/phmap.h>
+
+namespace dwarfs::writer::internal {
+
+class block_data;
+
+/**
+ * Index of content-defined chunks by fingerprint
+ *
+ * Each content-defined chunking segmenter has its own index by default.
+ * If a shared index is configured, the segmenters of all categories use
+ * the same index and can reference chunks stored in another category's
+ * blocks. All members are thread-safe.
+ *
+ * The index also keeps the data of the most recently completed blocks,
+ * so the segmenters can compare a chunk against the copy the index
+ * points to before referencing it.
+ */
+class chunk_index {
+ public:
+  struct fingerprint {
+    uint64_t low;
+    uint64_t high;
+
+    bool operator==(fingerprint const&) const = default;
+  };
+
+  struct location {
+    size_t block;
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  std::optional<location> find(fingerprint const& fp) const;
+
+  /**
+   * Add a chunk to the index
+   *
+   * Returns false if a chunk with the same fingerprint was added in the
+   * meantime, in which case the index is not modified.
+   */
+  bool insert(fingerprint const& fp, location const& loc);
+
+  /**
+   * Point an existing fingerprint to a new location
+   */
+  void replace(fingerprint const& fp, location const& loc);
+
+  size_t size() const;
+
+  /**
+   * Keep the data of a completed block for verifying chunks
+   *
+   * Only the `keep` most recently retained blocks are kept, no matter
+   * which segmenter retained them. The data must not be modified anymore.
+   */
+  void retain_block(size_t block, std::shared_ptr<block_data const> data,
+                    size_t keep);
+
+  /**
+   * Get the data of a retained block, or nullptr if it is not retained
+   */
+  std::shared_ptr<block_data const> find_block(size_t block) const;
+
+ private:
+  struct fingerprint_hash {
+    size_t operator()(fingerprint const& fp) const noexcept {
+      return static_cast<size_t>(fp.low);
+    }
+  };
+
+  std::mutex mutable mx_;
+  phmap::flat_hash_map<fingerprint, location, fingerprint_hash> index_;
+  std::deque<std::pair<size_t, std::shared_ptr<block_data const>>> blocks_;
+};
+
+} // namespace dwarfs::writer::internal
@@ -21,8 +21,10 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <stdexcept>
+#include <string_view>
 
 #include <dwarfs/compiler.h>
 
@@ -30,6 +32,12 @@ namespace dwarfs::writer::internal {
 
 class rsync_hash {
  public:
+  enum class cpu_variant {
+    fallback,
+    has_avx2,
+    has_avx512bw,
+  };
+
   rsync_hash() = default;
 
   DWARFS_FORCE_INLINE uint32_t operator()() const {
@@ -48,6 +56,21 @@ class rsync_hash {
     b_ += a_;
   }
 
+  // Equivalent to calling update(out[i], in[i]) followed by operator()()
+  // for `count` bytes, storing all hash values in `hashes`. The results
+  // are bit-identical for all CPU variants.
+  void update_batch(uint8_t const* out, uint8_t const* in, size_t count,
+                    uint32_t* hashes) {
+    update_batch(best_cpu_variant(), out, in, count, hashes);
+  }
+
+  void update_batch(cpu_variant cpu, uint8_t const* out, uint8_t const* in,
+                    size_t count, uint32_t* hashes);
+
+  static cpu_variant best_cpu_variant();
+  static bool is_supported(cpu_variant cpu);
+  static std::string_view cpu_variant_name(cpu_variant cpu);
+
   DWARFS_FORCE_INLINE void clear() {
     a_ = 0;
     b_ = 0;
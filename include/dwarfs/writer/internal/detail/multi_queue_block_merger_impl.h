@@ -35,6 +35,8 @@
 
 #include <folly/Function.h>
 
+#include <dwarfs/cpu_budget.h>
+
 #include <range/v3/range/conversion.hpp>
 #include <range/v3/view/all.hpp>
 #include <range/v3/view/join.hpp>
@@ -87,7 +89,9 @@ class multi_queue_block_merger_impl : public block_merger_base,
 
     std::unique_lock lock{mx_};
 
-    cv_.wait(lock, [this, &src, &block_size] {
+    // This usually runs in a segmenter job, so give up its CPU budget
+    // slot while waiting for blocks to be compressed
+    cpu_budget::wait(cv_, lock, [this, &src, &block_size] {
       auto queueable = this->queueable_size();
 
       // if this is the active slot, we can accept the block if there is
@@ -46,6 +46,7 @@ class metadata;
 
 } // namespace thrift::metadata
 
+class checksum;
 class mmif;
 class os_access;
 
@@ -133,6 +134,8 @@ class file : public entry {
 
   type_t type() const override;
   std::string_view hash() const;
+  void set_hash(checksum const& cs);
+  void set_hash(std::string_view hash);
   void set_inode(std::shared_ptr<inode> ino);
   std::shared_ptr<inode> get_inode() const;
   void accept(entry_visitor& v, bool preorder) override;
@@ -39,9 +39,17 @@ class worker_group;
 
 } // namespace internal
 
+namespace writer {
+
+class memory_budget;
+
+} // namespace writer
+
 namespace writer::internal {
 
 class file;
+class file_stream;
+class hash_cache;
 class inode_manager;
 class progress;
 
@@ -50,6 +58,12 @@ class file_scanner {
   struct options {
     std::optional<std::string> hash_algo{};
     bool debug_inode_create{false};
+    std::shared_ptr<memory_budget> memory{};
+    bool single_pass{false};
+    std::shared_ptr<hash_cache> cache{};
+    // Files are added to the stream as they are scanned and marked as
+    // ready once their inode is known
+    std::shared_ptr<file_stream> stream{};
   };
 
   file_scanner(logger& lgr, dwarfs::internal::worker_group& wg,
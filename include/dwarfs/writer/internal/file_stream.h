@@ -0,0 +1,88 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+#include <folly/container/F14Set.h>
+
+namespace dwarfs::writer::internal {
+
+class file;
+
+/**
+ * Hands out files in the order they were discovered, as soon as the
+ * inodes holding their contents are known
+ *
+ * This allows segmenting to start while the input is still being
+ * scanned and hashed. Files are added by the (single-threaded) file
+ * scanner in discovery order, but whether or not a file is a duplicate
+ * is often only known after hashing, which happens in the background.
+ * A file is only handed out once it has been marked as ready, and only
+ * after all files discovered before it, so the order doesn't depend on
+ * how fast the background jobs are.
+ *
+ * The inode of a file must be fully populated by the time the file is
+ * marked as ready.
+ */
+class file_stream {
+ public:
+  /**
+   * Append a file in discovery order
+   */
+  void add(file* p);
+
+  /**
+   * Mark a file as ready once its inode is known
+   */
+  void set_ready(file const* p);
+
+  /**
+   * Signal that no more files will be added or marked as ready
+   */
+  void close();
+
+  /**
+   * Get the next file in discovery order, waiting until it is ready
+   *
+   * Returns a null pointer once the stream is closed and all files
+   * that were ready have been handed out.
+   */
+  file* next();
+
+  /**
+   * Number of files that have not been handed out
+   */
+  size_t pending() const;
+
+ private:
+  std::mutex mutable mx_;
+  std::condition_variable cv_;
+  std::deque<file*> queue_;
+  folly::F14FastSet<file const*> ready_;
+  bool closed_{false};
+};
+
+} // namespace dwarfs::writer::internal
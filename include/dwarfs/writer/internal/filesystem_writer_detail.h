@@ -67,15 +67,17 @@ class filesystem_writer_detail {
                      std::nullopt) const = 0;
   virtual void
   configure(std::vector<fragment_category> const& expected_categories,
-            size_t max_active_slots) = 0;
+            size_t max_active_slots,
+            std::vector<size_t> const& shards_per_category = {}) = 0;
   virtual void
   configure_rewrite(size_t filesystem_size, size_t block_count) = 0;
   virtual void copy_header(std::span<uint8_t const> header) = 0;
   virtual void
   write_block(fragment_category cat, std::shared_ptr<block_data>&& data,
               physical_block_cb_type physical_block_cb,
-              std::optional<std::string> meta = std::nullopt) = 0;
-  virtual void finish_category(fragment_category cat) = 0;
+              std::optional<std::string> meta = std::nullopt,
+              size_t shard = 0) = 0;
+  virtual void finish_category(fragment_category cat, size_t shard = 0) = 0;
   virtual void write_metadata_v2_schema(std::shared_ptr<block_data>&& data) = 0;
   virtual void write_metadata_v2(std::shared_ptr<block_data>&& data) = 0;
   virtual void write_history(std::shared_ptr<block_data>&& data) = 0;
@@ -36,13 +36,17 @@ class single_inode_fragment;
 
 namespace internal {
 
+class file;
 class inode;
 
 class fragment_chunkable : public chunkable {
  public:
+  // If `fp` is given, it is used instead of the inode's files, which
+  // are only known once all files have been scanned.
   fragment_chunkable(inode const& ino, single_inode_fragment& frag,
                      file_off_t offset, mmif& mm,
-                     categorizer_manager const* catmgr);
+                     categorizer_manager const* catmgr,
+                     file const* fp = nullptr);
   ~fragment_chunkable();
 
   file const* get_file() const override;
@@ -58,6 +62,7 @@ class fragment_chunkable : public chunkable {
   file_off_t offset_;
   mmif& mm_;
   categorizer_manager const* catmgr_;
+  file const* fp_;
 };
 
 } // namespace internal
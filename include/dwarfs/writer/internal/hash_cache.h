@@ -0,0 +1,137 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <iosfwd>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <folly/container/F14Map.h>
+#include <folly/container/F14Set.h>
+
+#include <dwarfs/file_stat.h>
+
+#include <dwarfs/writer/internal/inode.h>
+
+namespace dwarfs::writer::internal {
+
+class file;
+
+/**
+ * Remembers file hashes and scan results across builds
+ *
+ * Entries are keyed by (device, inode, size, mtime, ctime) of a file,
+ * so a file that didn't change since the last build doesn't have to
+ * be read again until it is segmented.
+ *
+ * File hashes are only reused if they were computed with the same
+ * algorithm, scan results only if the cache was written using the
+ * same scanner configuration. Files that have been changed too
+ * recently for their timestamps to be reliable are not cached.
+ *
+ * All lookups and updates are thread-safe.
+ */
+class hash_cache {
+ public:
+  struct stats {
+    size_t loaded_entries{0};
+    size_t hash_hits{0};
+    size_t start_hash_hits{0};
+    size_t scan_hits{0};
+    size_t saved_entries{0};
+  };
+
+  hash_cache(std::string_view hash_algo, std::string_view config,
+             std::time_t build_time);
+  ~hash_cache();
+
+  /**
+   * Load the cache contents from `is`
+   *
+   * Throws if the input is not a valid cache file. Entries with a
+   * different hash algorithm or configuration are silently ignored.
+   */
+  void load(std::istream& is);
+
+  /**
+   * Write all entries used or added during this build to `os`
+   *
+   * If `current` is given, it must be the current contents of the cache
+   * file. Entries that were added to the file by another build since
+   * it was loaded are preserved.
+   */
+  void save(std::ostream& os, std::istream* current = nullptr);
+
+  std::optional<std::string> find_hash(file const& f);
+  std::optional<uint64_t> find_start_hash(file const& f);
+  std::optional<inode_scan_result> find_scan_result(file const& f);
+
+  void set_hash(file const& f, std::string_view hash);
+  void set_start_hash(file const& f, uint64_t start_hash);
+  void set_scan_result(file const& f, inode_scan_result const& res);
+
+  stats get_stats() const;
+
+ private:
+  struct key {
+    file_stat::dev_type dev;
+    file_stat::ino_type ino;
+    file_stat::off_type size;
+    file_stat::time_type mtime;
+    file_stat::time_type ctime;
+
+    bool operator==(key const&) const = default;
+  };
+
+  struct key_hasher {
+    size_t operator()(key const& k) const;
+  };
+
+  struct entry {
+    std::string hash;
+    std::optional<uint64_t> start_hash;
+    std::optional<inode_scan_result> scan;
+  };
+
+  using entry_map = folly::F14NodeMap<key, entry, key_hasher>;
+
+  std::optional<key> make_key(file const& f) const;
+  bool is_cacheable(key const& k) const;
+  entry* find_locked(key const& k);
+  entry& current_locked(key const& k);
+  bool read(std::istream& is, entry_map& entries) const;
+
+  std::string const hash_algo_;
+  std::string const config_;
+  std::time_t const build_time_;
+  std::mutex mutable mx_;
+  entry_map loaded_;
+  entry_map current_;
+  folly::F14FastSet<key, key_hasher> loaded_keys_;
+  stats stats_;
+};
+
+} // namespace dwarfs::writer::internal
@@ -21,11 +21,16 @@
 
 #pragma once
 
+#include <cstdint>
 #include <exception>
+#include <functional>
 #include <iosfwd>
 #include <memory>
 #include <optional>
+#include <span>
 #include <tuple>
+#include <utility>
+#include <variant>
 #include <vector>
 
 #include <dwarfs/small_vector.h>
@@ -53,13 +58,28 @@ namespace writer::internal {
 class file;
 class progress;
 
+// Everything scanning an inode yields, in a form that can be stored
+// and restored later
+struct inode_scan_result {
+  using similarity_type =
+      std::variant<std::monostate, uint32_t, nilsimsa::hash_type>;
+
+  std::vector<std::pair<fragment_category, file_off_t>> fragments;
+  std::vector<std::pair<fragment_category, similarity_type>> similarity;
+};
+
 class inode : public object {
  public:
   using files_vector = small_vector<file*, 1>;
 
+  // Receives all data of the scanned file exactly once and in order,
+  // reading parts of the file only if they were not scanned anyway
+  using scan_tap = std::function<void(std::span<uint8_t const>)>;
+
   virtual void set_files(files_vector&& fv) = 0;
   virtual void populate(size_t size) = 0;
-  virtual void scan(mmif* mm, inode_options const& options, progress& prog) = 0;
+  virtual void scan(mmif* mm, inode_options const& options, progress& prog,
+                    scan_tap const* tap) = 0;
   virtual void set_num(uint32_t num) = 0;
   virtual uint32_t num() const = 0;
   virtual bool has_category(fragment_category cat) const = 0;
@@ -73,6 +93,10 @@ class inode : public object {
   virtual bool
   append_chunks_to(std::vector<thrift::metadata::chunk>& vec) const = 0;
   virtual inode_fragments& fragments() = 0;
+  // Returns nothing if the result depends on categorizer state, e.g.
+  // if there are fragments with subcategories
+  virtual std::optional<inode_scan_result> scan_result() const = 0;
+  virtual void restore(inode_scan_result const& res) = 0;
   virtual void dump(std::ostream& os, inode_options const& options) const = 0;
   virtual void set_scan_error(file const* fp, std::exception_ptr ep) = 0;
   virtual std::optional<std::pair<file const*, std::exception_ptr>>
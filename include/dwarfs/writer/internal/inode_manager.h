@@ -25,6 +25,8 @@
 #include <functional>
 #include <iosfwd>
 #include <memory>
+#include <optional>
+#include <string>
 #include <string_view>
 #include <utility>
 #include <vector>
@@ -36,6 +38,7 @@
 namespace dwarfs {
 
 class logger;
+class mmif;
 class os_access;
 
 struct inode_options;
@@ -46,15 +49,33 @@ class worker_group;
 
 }
 
+namespace writer {
+
+class build_checkpoint;
+class memory_budget;
+
+} // namespace writer
+
 namespace writer::internal {
 
 class file;
+class hash_cache;
 class progress;
+class staging_area;
 
 class inode_manager {
  public:
   using inode_cb = std::function<void(std::shared_ptr<inode> const&)>;
 
+  struct scan_request {
+    // The file's mapping, if it has already been mapped
+    std::shared_ptr<mmif> mm{};
+    // Hash the file in the same pass if set
+    std::optional<std::string> hash_algo{};
+    // Called once the file has been scanned
+    std::function<void()> done{};
+  };
+
   struct fragment_info {
     fragment_info(fragment_category::value_type cat, size_t count, size_t size)
         : category{cat}
@@ -73,7 +94,11 @@ class inode_manager {
     size_t total_size{0};
   };
 
-  inode_manager(logger& lgr, progress& prog, inode_options const& opts);
+  inode_manager(logger& lgr, progress& prog, inode_options const& opts,
+                std::shared_ptr<memory_budget> memory = nullptr,
+                std::shared_ptr<staging_area> staging = nullptr,
+                std::shared_ptr<hash_cache> cache = nullptr,
+                std::shared_ptr<build_checkpoint> checkpoint = nullptr);
 
   std::shared_ptr<inode> create_inode() { return impl_->create_inode(); }
 
@@ -88,8 +113,9 @@ class inode_manager {
   }
 
   void scan_background(dwarfs::internal::worker_group& wg, os_access const& os,
-                       std::shared_ptr<inode> ino, file* p) const {
-    impl_->scan_background(wg, os, std::move(ino), p);
+                       std::shared_ptr<inode> ino, file* p,
+                       scan_request req = {}) const {
+    impl_->scan_background(wg, os, std::move(ino), p, std::move(req));
   }
 
   bool has_invalid_inodes() const { return impl_->has_invalid_inodes(); }
@@ -119,7 +145,8 @@ class inode_manager {
     virtual fragment_infos fragment_category_info() const = 0;
     virtual void
     scan_background(dwarfs::internal::worker_group& wg, os_access const& os,
-                    std::shared_ptr<inode> ino, file* p) const = 0;
+                    std::shared_ptr<inode> ino, file* p,
+                    scan_request req) const = 0;
     virtual bool has_invalid_inodes() const = 0;
     virtual void try_scan_invalid(dwarfs::internal::worker_group& wg,
                                   os_access const& os) = 0;
@@ -0,0 +1,156 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <dwarfs/file_util.h>
+
+namespace dwarfs {
+
+namespace writer::internal {
+
+/**
+ * On-disk match index for blocks that have left the segmenter lookback
+ *
+ * The raw data of each retired block is copied to a memory-mapped spill
+ * segment, and its hash/offset pairs are added to an open addressing hash
+ * table that lives in a memory-mapped file. Neither needs to be kept in
+ * anonymous memory, so the operating system is free to page them out and
+ * the segmenter can find matches against everything it has written so far
+ * with bounded memory usage.
+ *
+ * Segments are created at their full size and filled one block after the
+ * other, so existing mappings never have to change and block data stays
+ * valid for the lifetime of the index.
+ *
+ * All files are created in a temporary directory below `dir` and are
+ * removed when the index is destroyed.
+ */
+class spill_index {
+ public:
+  explicit spill_index(std::filesystem::path const& dir);
+  ~spill_index();
+
+  /**
+   * Append a retired block
+   *
+   * All subsequent calls to `add()` refer to this block.
+   */
+  void add_block(size_t block_num, std::span<uint8_t const> data);
+
+  /**
+   * Add a hash value at `offset` in the last block added
+   *
+   * The offset is stored as-is and passed back from `for_each_offset()`,
+   * so the caller can use whatever unit it prefers.
+   */
+  void add(uint32_t hash, uint32_t offset);
+
+  /**
+   * Call `func(block_num, block_data, offset)` for each entry of `hash`
+   */
+  template <typename F>
+  void for_each_offset(uint32_t hash, F&& func) const {
+    auto const* const slots = table();
+
+    for (auto i = slot_index(hash); slots[i].block != 0;
+         i = (i + 1) & (capacity_ - 1)) {
+      if (slots[i].hash == hash) {
+        auto const& blk = blocks_[slots[i].block - 1];
+        func(blk.num, block_span(blk), slots[i].offset);
+      }
+    }
+  }
+
+  /**
+   * Call `func(hash)` for each entry in the index
+   */
+  template <typename F>
+  void for_each_hash(F&& func) const {
+    auto const* const slots = table();
+
+    for (size_t i = 0; i < capacity_; ++i) {
+      if (slots[i].block != 0) {
+        func(slots[i].hash);
+      }
+    }
+  }
+
+  // number of slots in the hash table, always a power of two
+  size_t capacity() const { return capacity_; }
+  size_t size() const { return size_; }
+  size_t block_count() const { return blocks_.size(); }
+  size_t data_size() const { return data_size_; }
+
+ private:
+  struct slot {
+    uint32_t hash;
+    uint32_t block; // index into blocks_ plus one, zero for empty slots
+    uint32_t offset;
+  };
+
+  struct spilled_block {
+    size_t num;
+    size_t segment;
+    size_t offset;
+    size_t size;
+  };
+
+  struct segment {
+    boost::iostreams::mapped_file file;
+    size_t size{0};
+  };
+
+  slot* table() const { return reinterpret_cast<slot*>(table_.data()); }
+
+  size_t slot_index(uint32_t hash) const {
+    // Fibonacci hashing, as the low bits of rolling hash values are
+    // also used by the bloom filters
+    return (static_cast<uint64_t>(hash) * UINT64_C(0x9E3779B97F4A7C15)) >>
+           (64 - capacity_bits_);
+  }
+
+  std::span<uint8_t const> block_span(spilled_block const& blk) const;
+  void insert(slot const& s);
+  void grow();
+
+  temporary_directory dir_;
+  std::vector<segment> segments_;
+  size_t data_size_{0};
+  std::vector<spilled_block> blocks_;
+  boost::iostreams::mapped_file table_;
+  std::filesystem::path table_path_;
+  size_t capacity_bits_{0};
+  size_t capacity_{0};
+  size_t size_{0};
+};
+
+} // namespace writer::internal
+
+} // namespace dwarfs
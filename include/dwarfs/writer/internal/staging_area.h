@@ -0,0 +1,101 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+#include <folly/container/F14Map.h>
+
+namespace dwarfs {
+
+class mmif;
+
+namespace writer::internal {
+
+class inode;
+
+/**
+ * Keeps the contents of small files in memory between scanning and
+ * segmenting
+ *
+ * Files are copied into the staging area while they're mapped for
+ * scanning anyway, so the segmenter doesn't have to read them again.
+ * Both the size of individual files and the total size are limited;
+ * files that don't fit are simply read again later.
+ */
+class staging_area {
+ public:
+  struct stats {
+    size_t staged_files{0};
+    size_t rejected_files{0};
+    size_t taken_files{0};
+    size_t peak_bytes{0};
+  };
+
+  staging_area(size_t max_bytes, size_t max_file_size);
+  ~staging_area();
+
+  /**
+   * Whether a file of this size could be staged at all
+   */
+  bool accepts(size_t size) const { return size > 0 && size <= max_file_size_; }
+
+  /**
+   * Copy the contents of `mm` for inode `ino`, unless the staging area
+   * is full
+   *
+   * The contents will be handed out `num_uses` times, once for each
+   * category the inode is segmented in.
+   */
+  bool stage(inode const& ino, mmif const& mm, size_t num_uses);
+
+  /**
+   * Get the staged contents of inode `ino`
+   *
+   * The contents are removed from the staging area after the last use.
+   * Returns a null pointer if the inode's contents were not staged.
+   */
+  std::shared_ptr<mmif> take(inode const& ino);
+
+  stats get_stats() const;
+
+ private:
+  class staged_file;
+
+  size_t const max_bytes_;
+  size_t const max_file_size_;
+  std::mutex mutable mx_;
+  struct entry {
+    std::shared_ptr<staged_file> file;
+    size_t uses_left;
+  };
+
+  folly::F14FastMap<inode const*, entry> files_;
+  size_t bytes_{0};
+  stats stats_;
+};
+
+} // namespace writer::internal
+
+} // namespace dwarfs
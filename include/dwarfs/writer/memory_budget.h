@@ -0,0 +1,157 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string_view>
+
+namespace dwarfs::writer {
+
+/**
+ * Accounts for the memory used by the stages of the writer pipeline
+ *
+ * Components reserve memory from the budget before allocating or
+ * mapping it, and release the reservation once the memory is gone.
+ * A blocking reservation waits while the budget is exhausted, which
+ * applies backpressure to the stage that wants more memory.
+ *
+ * To guarantee progress, a reservation only ever waits for memory held
+ * by components that release it without depending on other stages,
+ * i.e. `scan` and `compression`. If nothing of this kind is currently
+ * reserved, the reservation is granted even if it exceeds the limit.
+ * Memory held by the other components is still accounted and counts
+ * against the limit, so it delays new reservations.
+ *
+ * A limit of zero disables backpressure, but keeps the accounting.
+ *
+ * Only the large buffers that scale with the block size or file size are
+ * accounted. Not accounted are per-inode data such as similarity hashes
+ * and nilsimsa digests, working buffers kept by categorizers in addition
+ * to the mapped file, the metadata, and memory used internally by the
+ * compression algorithms.
+ */
+class memory_budget {
+ public:
+  enum class component {
+    // files mapped for hashing, categorization and similarity analysis
+    scan,
+    // active blocks, bloom filters and hash indices of the segmenters
+    segmenter,
+    // uncompressed blocks waiting for or undergoing compression
+    compression,
+    // compressed blocks waiting to be written
+    write_queue,
+  };
+
+  static constexpr size_t num_components = 4;
+
+  static std::string_view component_name(component c);
+
+  struct component_stats {
+    size_t current{0};
+    size_t peak{0};
+  };
+
+  struct stats {
+    std::array<component_stats, num_components> components{};
+    size_t current{0};
+    size_t peak{0};
+    size_t waits{0};
+  };
+
+  class reservation {
+   public:
+    reservation() = default;
+    reservation(memory_budget& budget, component c)
+        : budget_{&budget}
+        , component_{c} {}
+
+    reservation(reservation&& other) noexcept;
+    reservation& operator=(reservation&& other) noexcept;
+
+    reservation(reservation const&) = delete;
+    reservation& operator=(reservation const&) = delete;
+
+    ~reservation() { release(); }
+
+    explicit operator bool() const { return budget_ != nullptr; }
+
+    size_t size() const { return size_; }
+
+    /**
+     * Add `bytes` to the reservation, waiting for memory if necessary
+     */
+    void grow(size_t bytes);
+
+    /**
+     * Change the size of the reservation without waiting
+     */
+    void resize(size_t bytes);
+
+    /**
+     * Move the reservation to another component without waiting
+     */
+    void transfer(component c, size_t bytes);
+
+    void release();
+
+   private:
+    memory_budget* budget_{nullptr};
+    component component_{component::scan};
+    size_t size_{0};
+  };
+
+  explicit memory_budget(size_t limit);
+
+  size_t limit() const { return limit_; }
+
+  /**
+   * Reserve `bytes` for component `c`, waiting for memory if necessary
+   */
+  reservation reserve(component c, size_t bytes);
+
+  /**
+   * Reserve `bytes` for component `c` without ever waiting
+   */
+  reservation account(component c, size_t bytes);
+
+  stats get_stats() const;
+
+ private:
+  void grow(component c, size_t bytes, size_t own, bool wait);
+  void shrink(component c, size_t bytes);
+  void transfer(component from, size_t from_bytes, component to,
+                size_t to_bytes);
+  void update_peaks(component c);
+  static bool is_drainable(component c);
+  size_t drainable() const;
+
+  size_t const limit_;
+  std::mutex mutable mx_;
+  std::condition_variable cv_;
+  stats stats_;
+};
+
+} // namespace dwarfs::writer
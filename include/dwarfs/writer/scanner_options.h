@@ -23,7 +23,9 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <filesystem>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string>
 #include <vector>
@@ -32,9 +34,15 @@
 #include <dwarfs/history_config.h>
 #include <dwarfs/writer/inode_options.h>
 
-namespace dwarfs::writer {
+namespace dwarfs {
 
+class cpu_budget;
+
+namespace writer {
+
+class build_checkpoint;
 class entry_interface;
+class memory_budget;
 
 struct scanner_options {
   std::optional<std::string> file_hash_algorithm{"xxh3-128"};
@@ -61,9 +69,24 @@ struct scanner_options {
   std::optional<std::function<void(bool, writer::entry_interface const&)>>
       debug_filter_function;
   size_t num_segmenter_workers{1};
+  size_t segmenter_shards{1};
+  size_t num_discovery_workers{1};
+  std::shared_ptr<cpu_budget> budget;
+  std::shared_ptr<memory_budget> memory;
+  bool single_pass{false};
+  // Segment and compress files while the input is still being scanned.
+  // Only possible without categorization and with `none` or `path` order.
+  bool pipelined{false};
+  size_t staging_size{64 << 20};
+  std::optional<std::filesystem::path> hash_cache;
+  // Cached scan results are only reused if this hasn't changed
+  std::string hash_cache_config;
+  std::shared_ptr<build_checkpoint> checkpoint;
   bool enable_history{true};
   std::optional<std::vector<std::string>> command_line_arguments;
   history_config history;
 };
 
-} // namespace dwarfs::writer
+} // namespace writer
+
+} // namespace dwarfs
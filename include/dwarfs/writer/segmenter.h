@@ -22,6 +22,7 @@
 #pragma once
 
 #include <cstddef>
+#include <filesystem>
 #include <functional>
 #include <memory>
 #include <vector>
@@ -34,12 +35,14 @@ class logger;
 
 namespace writer {
 
+class memory_budget;
 class writer_progress;
 
 namespace internal {
 
 class block_data;
 class block_manager;
+class chunk_index;
 class chunkable;
 
 } // namespace internal
@@ -53,6 +56,24 @@ class segmenter {
     size_t max_active_blocks{1};
     unsigned bloom_filter_size{4};
     unsigned block_size_bits{22};
+    unsigned cdc_chunk_size_bits{0};
+    bool cdc_hash_only{false};
+    std::shared_ptr<memory_budget> memory{};
+    std::filesystem::path spill_dir{};
+    std::shared_ptr<internal::chunk_index> shared_chunk_index{};
+  };
+
+  struct stats {
+    // rolling hash segmenter
+    size_t total_matches{0};
+    size_t good_matches{0};
+    size_t bad_matches{0};
+    size_t bloom_lookups{0};
+    size_t bloom_hits{0};
+    // content-defined chunking segmenter
+    size_t chunks{0};
+    size_t duplicate_chunks{0};
+    size_t duplicate_bytes{0};
   };
 
   using block_ready_cb = std::function<void(
@@ -69,12 +90,15 @@ class segmenter {
 
   void finish() { impl_->finish(); }
 
+  stats get_stats() const { return impl_->get_stats(); }
+
   class impl {
    public:
     virtual ~impl() = default;
 
     virtual void add_chunkable(internal::chunkable& chkable) = 0;
     virtual void finish() = 0;
+    virtual stats get_stats() const = 0;
   };
 
  private:
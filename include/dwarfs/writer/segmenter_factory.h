@@ -44,7 +44,12 @@ class segmenter_factory {
     categorized_option<unsigned> window_increment_shift;
     categorized_option<size_t> max_active_blocks;
     categorized_option<unsigned> bloom_filter_size;
+    categorized_option<unsigned> cdc_chunk_size_bits;
     unsigned block_size_bits{22};
+    std::shared_ptr<memory_budget> memory{};
+    std::filesystem::path spill_dir{};
+    bool shared_chunk_index{false};
+    bool cdc_hash_only{false};
   };
 
   segmenter_factory(logger& lgr, writer_progress& prog);
@@ -65,6 +70,14 @@ class segmenter_factory {
 
   size_t get_block_size() const { return impl_->get_block_size(); }
 
+  /**
+   * Whether the segmenters created by this factory share state and must
+   * run one after the other to produce a reproducible image
+   */
+  bool requires_serial_segmenting() const {
+    return impl_->requires_serial_segmenting();
+  }
+
   class impl {
    public:
     virtual ~impl() = default;
@@ -74,6 +87,7 @@ class segmenter_factory {
                              std::shared_ptr<internal::block_manager> blkmgr,
                              segmenter::block_ready_cb block_ready) const = 0;
     virtual size_t get_block_size() const = 0;
+    virtual bool requires_serial_segmenting() const = 0;
   };
 
  private:
@@ -42,7 +42,15 @@ block_compressor::block_compressor(const std::string& spec) {
 
 block_decompressor::block_decompressor(compression_type type,
                                        const uint8_t* data, size_t size,
-                                       std::vector<uint8_t>& target) {
+                                       std::vector<uint8_t>& target)
+    : vector_target_{std::make_unique<vector_byte_buffer>(target)} {
+  impl_ = compression_registry::instance().make_decompressor(
+      type, std::span<uint8_t const>(data, size), *vector_target_);
+}
+
+block_decompressor::block_decompressor(compression_type type,
+                                       const uint8_t* data, size_t size,
+                                       mutable_byte_buffer& target) {
   impl_ = compression_registry::instance().make_decompressor(
       type, std::span<uint8_t const>(data, size), target);
 }
@@ -93,7 +101,7 @@ compression_registry::make_compressor(std::string_view spec) const {
 std::unique_ptr<block_decompressor::impl>
 compression_registry::make_decompressor(compression_type type,
                                         std::span<uint8_t const> data,
-                                        std::vector<uint8_t>& target) const {
+                                        mutable_byte_buffer& target) const {
   auto fit = factories_.find(type);
 
   if (fit == factories_.end()) {
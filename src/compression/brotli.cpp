@@ -96,12 +96,12 @@ class brotli_block_compressor final : public block_compressor::impl {
 class brotli_block_decompressor final : public block_decompressor::impl {
  public:
   brotli_block_decompressor(const uint8_t* data, size_t size,
-                            std::vector<uint8_t>& target)
+                            mutable_byte_buffer& target)
       : brotli_block_decompressor(folly::Range<uint8_t const*>(data, size),
                                   target) {}
 
   brotli_block_decompressor(folly::Range<uint8_t const*> data,
-                            std::vector<uint8_t>& target)
+                            mutable_byte_buffer& target)
       : decompressed_{target}
       , uncompressed_size_{folly::decodeVarint(data)}
       , data_{data.data()}
@@ -164,7 +164,7 @@ class brotli_block_decompressor final : public block_decompressor::impl {
         ::BrotliDecoderGetErrorCode(decoder_.get()));
   }
 
-  std::vector<uint8_t>& decompressed_;
+  mutable_byte_buffer& decompressed_;
   const size_t uncompressed_size_;
   uint8_t const* data_;
   size_t size_;
@@ -211,7 +211,7 @@ class brotli_compression_factory : public compression_factory {
 
   std::unique_ptr<block_decompressor::impl>
   make_decompressor(std::span<uint8_t const> data,
-                    std::vector<uint8_t>& target) const override {
+                    mutable_byte_buffer& target) const override {
     return std::make_unique<brotli_block_decompressor>(data.data(), data.size(),
                                                        target);
   }
@@ -96,7 +96,7 @@ class dwarfs_flac_stream_encoder final : public FLAC::Encoder::Stream {
 class dwarfs_flac_stream_decoder final : public FLAC::Decoder::Stream {
  public:
   dwarfs_flac_stream_decoder(
-      std::vector<uint8_t>& target, std::span<uint8_t const> data,
+      mutable_byte_buffer& target, std::span<uint8_t const> data,
       thrift::compression::flac_block_header const& header)
       : target_{target}
       , data_{data}
@@ -184,7 +184,7 @@ class dwarfs_flac_stream_decoder final : public FLAC::Decoder::Stream {
   bool eof_callback() override { return pos_ >= data_.size(); }
 
  private:
-  std::vector<uint8_t>& target_;
+  mutable_byte_buffer& target_;
   std::vector<FLAC__int32> tmp_;
   std::span<uint8_t const> data_;
   thrift::compression::flac_block_header const& header_;
@@ -388,12 +388,12 @@ class flac_block_compressor final : public block_compressor::impl {
 class flac_block_decompressor final : public block_decompressor::impl {
  public:
   flac_block_decompressor(const uint8_t* data, size_t size,
-                          std::vector<uint8_t>& target)
+                          mutable_byte_buffer& target)
       : flac_block_decompressor(folly::Range<uint8_t const*>(data, size),
                                 target) {}
 
   flac_block_decompressor(folly::Range<uint8_t const*> data,
-                          std::vector<uint8_t>& target)
+                          mutable_byte_buffer& target)
       : decompressed_{target}
       , uncompressed_size_{folly::decodeVarint(data)}
       , header_{decode_header(data)}
@@ -477,7 +477,7 @@ class flac_block_decompressor final : public block_decompressor::impl {
     return hdr;
   }
 
-  std::vector<uint8_t>& decompressed_;
+  mutable_byte_buffer& decompressed_;
   size_t const uncompressed_size_;
   thrift::compression::flac_block_header const header_;
   std::unique_ptr<dwarfs_flac_stream_decoder> decoder_;
@@ -515,7 +515,7 @@ class flac_compression_factory : public compression_factory {
 
   std::unique_ptr<block_decompressor::impl>
   make_decompressor(std::span<uint8_t const> data,
-                    std::vector<uint8_t>& target) const override {
+                    mutable_byte_buffer& target) const override {
     return std::make_unique<flac_block_decompressor>(data.data(), data.size(),
                                                      target);
   }
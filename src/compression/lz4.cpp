@@ -111,7 +111,7 @@ class lz4_block_compressor final : public block_compressor::impl {
 class lz4_block_decompressor final : public block_decompressor::impl {
  public:
   lz4_block_decompressor(const uint8_t* data, size_t size,
-                         std::vector<uint8_t>& target)
+                         mutable_byte_buffer& target)
       : decompressed_(target)
       , data_(data + sizeof(uint32_t))
       , input_size_(size - sizeof(uint32_t))
@@ -159,7 +159,7 @@ class lz4_block_decompressor final : public block_decompressor::impl {
     return size;
   }
 
-  std::vector<uint8_t>& decompressed_;
+  mutable_byte_buffer& decompressed_;
   const uint8_t* const data_;
   const size_t input_size_;
   const size_t uncompressed_size_;
@@ -191,7 +191,7 @@ class lz4_compression_factory : public compression_factory {
 
   std::unique_ptr<block_decompressor::impl>
   make_decompressor(std::span<uint8_t const> data,
-                    std::vector<uint8_t>& target) const override {
+                    mutable_byte_buffer& target) const override {
     return std::make_unique<lz4_block_decompressor>(data.data(), data.size(),
                                                     target);
   }
@@ -229,7 +229,7 @@ class lz4hc_compression_factory : public compression_factory {
 
   std::unique_ptr<block_decompressor::impl>
   make_decompressor(std::span<uint8_t const> data,
-                    std::vector<uint8_t>& target) const override {
+                    mutable_byte_buffer& target) const override {
     return std::make_unique<lz4_block_decompressor>(data.data(), data.size(),
                                                     target);
   }
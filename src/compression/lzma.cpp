@@ -206,7 +206,7 @@ lzma_block_compressor::compress(const std::vector<uint8_t>& data,
 class lzma_block_decompressor final : public block_decompressor::impl {
  public:
   lzma_block_decompressor(const uint8_t* data, size_t size,
-                          std::vector<uint8_t>& target)
+                          mutable_byte_buffer& target)
       : stream_(LZMA_STREAM_INIT)
       , decompressed_(target)
       , uncompressed_size_(get_uncompressed_size(data, size)) {
@@ -276,7 +276,7 @@ class lzma_block_decompressor final : public block_decompressor::impl {
   static size_t get_uncompressed_size(const uint8_t* data, size_t size);
 
   lzma_stream stream_;
-  std::vector<uint8_t>& decompressed_;
+  mutable_byte_buffer& decompressed_;
   const size_t uncompressed_size_;
   std::string error_;
 };
@@ -372,7 +372,7 @@ class lzma_compression_factory : public compression_factory {
 
   std::unique_ptr<block_decompressor::impl>
   make_decompressor(std::span<uint8_t const> data,
-                    std::vector<uint8_t>& target) const override {
+                    mutable_byte_buffer& target) const override {
     return std::make_unique<lzma_block_decompressor>(data.data(), data.size(),
                                                      target);
   }
@@ -68,7 +68,7 @@ class null_block_compressor final : public block_compressor::impl {
 class null_block_decompressor final : public block_decompressor::impl {
  public:
   null_block_decompressor(const uint8_t* data, size_t size,
-                          std::vector<uint8_t>& target)
+                          mutable_byte_buffer& target)
       : decompressed_(target)
       , data_(data)
       , uncompressed_size_(size) {
@@ -106,7 +106,7 @@ class null_block_decompressor final : public block_decompressor::impl {
   size_t uncompressed_size() const override { return uncompressed_size_; }
 
  private:
-  std::vector<uint8_t>& decompressed_;
+  mutable_byte_buffer& decompressed_;
   const uint8_t* const data_;
   const size_t uncompressed_size_;
 };
@@ -132,7 +132,7 @@ class null_compression_factory : public compression_factory {
 
   std::unique_ptr<block_decompressor::impl>
   make_decompressor(std::span<uint8_t const> data,
-                    std::vector<uint8_t>& target) const override {
+                    mutable_byte_buffer& target) const override {
     return std::make_unique<null_block_decompressor>(data.data(), data.size(),
                                                      target);
   }
@@ -174,12 +174,12 @@ class ricepp_block_compressor final : public block_compressor::impl {
 class ricepp_block_decompressor final : public block_decompressor::impl {
  public:
   ricepp_block_decompressor(const uint8_t* data, size_t size,
-                            std::vector<uint8_t>& target)
+                            mutable_byte_buffer& target)
       : ricepp_block_decompressor(folly::Range<uint8_t const*>(data, size),
                                   target) {}
 
   ricepp_block_decompressor(folly::Range<uint8_t const*> data,
-                            std::vector<uint8_t>& target)
+                            mutable_byte_buffer& target)
       : decompressed_{target}
       , uncompressed_size_{folly::decodeVarint(data)}
       , header_{decode_header(data)}
@@ -253,7 +253,7 @@ class ricepp_block_decompressor final : public block_decompressor::impl {
     return hdr;
   }
 
-  std::vector<uint8_t>& decompressed_;
+  mutable_byte_buffer& decompressed_;
   size_t const uncompressed_size_;
   thrift::compression::ricepp_block_header const header_;
   std::span<uint8_t const> data_;
@@ -288,7 +288,7 @@ class ricepp_compression_factory : public compression_factory {
 
   std::unique_ptr<block_decompressor::impl>
   make_decompressor(std::span<uint8_t const> data,
-                    std::vector<uint8_t>& target) const override {
+                    mutable_byte_buffer& target) const override {
     return std::make_unique<ricepp_block_decompressor>(data.data(), data.size(),
                                                        target);
   }
@@ -115,7 +115,7 @@ zstd_block_compressor::compress(const std::vector<uint8_t>& data,
 class zstd_block_decompressor final : public block_decompressor::impl {
  public:
   zstd_block_decompressor(const uint8_t* data, size_t size,
-                          std::vector<uint8_t>& target)
+                          mutable_byte_buffer& target)
       : decompressed_(target)
       , data_(data)
       , size_(size)
@@ -168,7 +168,7 @@ class zstd_block_decompressor final : public block_decompressor::impl {
   size_t uncompressed_size() const override { return uncompressed_size_; }
 
  private:
-  std::vector<uint8_t>& decompressed_;
+  mutable_byte_buffer& decompressed_;
   const uint8_t* const data_;
   const size_t size_;
   const unsigned long long uncompressed_size_;
@@ -205,7 +205,7 @@ class zstd_compression_factory : public compression_factory {
 
   std::unique_ptr<block_decompressor::impl>
   make_decompressor(std::span<uint8_t const> data,
-                    std::vector<uint8_t>& target) const override {
+                    mutable_byte_buffer& target) const override {
     return std::make_unique<zstd_block_decompressor>(data.data(), data.size(),
                                                      target);
   }
@@ -0,0 +1,87 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <utility>
+
+#include <dwarfs/cpu_budget.h>
+
+namespace dwarfs {
+
+namespace {
+
+// The budget whose slot is held by the current thread
+thread_local cpu_budget* current_budget{nullptr};
+
+} // namespace
+
+cpu_budget::cpu_budget(size_t slots)
+    : slots_{std::max<size_t>(slots, 1)} {}
+
+void cpu_budget::acquire() {
+  {
+    std::unique_lock lock(mx_);
+
+    if (active_ >= slots_) {
+      ++stats_.contended;
+      cv_.wait(lock, [this] { return active_ < slots_; });
+    }
+
+    ++active_;
+    ++stats_.acquired;
+    stats_.peak_active = std::max(stats_.peak_active, active_);
+  }
+
+  current_budget = this;
+}
+
+void cpu_budget::release() {
+  current_budget = nullptr;
+
+  {
+    std::lock_guard lock(mx_);
+    --active_;
+  }
+
+  cv_.notify_one();
+}
+
+cpu_budget* cpu_budget::current() { return current_budget; }
+
+auto cpu_budget::get_stats() const -> stats {
+  std::lock_guard lock(mx_);
+  return stats_;
+}
+
+cpu_budget::blocking_section::blocking_section()
+    : budget_{current_budget} {
+  if (budget_) {
+    budget_->release();
+  }
+}
+
+cpu_budget::blocking_section::~blocking_section() {
+  if (budget_) {
+    budget_->acquire();
+  }
+}
+
+} // namespace dwarfs
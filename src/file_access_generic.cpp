@@ -188,6 +188,22 @@ class file_access_generic : public file_access {
     }
     return rv;
   }
+
+  void rename(std::filesystem::path const& from,
+              std::filesystem::path const& to,
+              std::error_code& ec) const override {
+    std::filesystem::rename(from, to, ec);
+  }
+
+  void create_directories(std::filesystem::path const& path,
+                          std::error_code& ec) const override {
+    std::filesystem::create_directories(path, ec);
+  }
+
+  void remove_all(std::filesystem::path const& path,
+                  std::error_code& ec) const override {
+    std::filesystem::remove_all(path, ec);
+  }
 };
 
 } // namespace
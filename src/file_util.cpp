@@ -35,13 +35,13 @@ namespace fs = std::filesystem;
 
 namespace {
 
-fs::path make_tempdir_path(std::string_view prefix) {
+fs::path make_tempdir_path(std::string_view prefix, fs::path const& parent) {
   static thread_local boost::uuids::random_generator gen;
   auto dirname = boost::uuids::to_string(gen());
   if (!prefix.empty()) {
     dirname = std::string(prefix) + '.' + dirname;
   }
-  return fs::temp_directory_path() / dirname;
+  return parent / dirname;
 }
 
 bool keep_temporary_directories() {
@@ -63,7 +63,11 @@ temporary_directory::temporary_directory()
     : temporary_directory(std::string_view{}) {}
 
 temporary_directory::temporary_directory(std::string_view prefix)
-    : path_{make_tempdir_path(prefix)} {
+    : temporary_directory(prefix, fs::temp_directory_path()) {}
+
+temporary_directory::temporary_directory(std::string_view prefix,
+                                         fs::path const& parent)
+    : path_{make_tempdir_path(prefix, parent)} {
   fs::create_directory(path_);
 }
 
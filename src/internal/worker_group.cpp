@@ -19,15 +19,21 @@
  * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <cstring>
 #include <ctime>
+#include <deque>
 #include <exception>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <optional>
 #include <string>
 #include <thread>
 #include <type_traits>
@@ -39,18 +45,105 @@
 #include <folly/portability/Windows.h>
 #include <folly/system/ThreadName.h>
 
+#include <dwarfs/cpu_budget.h>
 #include <dwarfs/error.h>
 #include <dwarfs/logger.h>
 #include <dwarfs/os_access.h>
 #include <dwarfs/string.h>
 #include <dwarfs/util.h>
 
+#include <dwarfs/internal/work_stealing_deque.h>
 #include <dwarfs/internal/worker_group.h>
 
 namespace dwarfs::internal {
 
+// Only used for identity, all state is protected by the worker group
+class worker_group::job_state {};
+
 namespace {
 
+using any_job_t =
+    std::variant<worker_group::job_t, worker_group::moveonly_job_t>;
+using clock_type = std::chrono::steady_clock;
+
+struct queued_job {
+  any_job_t job;
+  clock_type::time_point queued_at;
+  // only set for jobs in the speculative queue
+  worker_group::job_ticket state;
+};
+
+size_t stats_index(worker_group::job_priority prio) {
+  return prio == worker_group::job_priority::demand ? 0 : 1;
+}
+
+// TODO: move out of this file
+void set_thread_niceness(int niceness) {
+  if (niceness > 0) {
+#ifdef _WIN32
+    auto hthr = ::GetCurrentThread();
+    int priority =
+        niceness > 5 ? THREAD_PRIORITY_LOWEST : THREAD_PRIORITY_BELOW_NORMAL;
+    ::SetThreadPriority(hthr, priority);
+#else
+    // XXX:
+    // According to POSIX, the nice value is a per-process setting. However,
+    // under the current Linux/NPTL implementation of POSIX threads, the nice
+    // value is a per-thread attribute: different threads in the same process
+    // can have different nice values. Portable applications should avoid
+    // relying on the Linux behavior, which may be made standards conformant
+    // in the future.
+    auto rv [[maybe_unused]] = ::nice(niceness);
+#endif
+  }
+}
+
+void set_affinity_from_environment(os_access const& os,
+                                   const char* group_name,
+                                   worker_group::impl& wg) {
+  if (auto var = os.getenv("DWARFS_WORKER_GROUP_AFFINITY")) {
+    auto groups = split_to<std::vector<std::string_view>>(var.value(), ':');
+
+    for (auto& group : groups) {
+      auto parts = split_to<std::vector<std::string_view>>(group, '=');
+
+      if (parts.size() == 2 && parts[0] == group_name) {
+        auto cpus = split_to<std::vector<int>>(parts[1], ',');
+        wg.set_affinity(cpus);
+      }
+    }
+  }
+}
+
+std::chrono::nanoseconds
+threads_cpu_time(os_access const& os, std::vector<std::thread> const& threads,
+                 std::error_code& ec) {
+  std::chrono::nanoseconds t{};
+
+  for (auto const& thr : threads) {
+    t += os.thread_get_cpu_time(thr.get_id(), ec);
+    if (ec) {
+      return {};
+    }
+  }
+
+  return t;
+}
+
+bool set_threads_affinity(os_access const& os,
+                          std::vector<std::thread> const& threads,
+                          std::vector<int> const& cpus) {
+  for (auto const& thr : threads) {
+    std::error_code ec;
+    os.thread_set_affinity(thr.get_id(), cpus, ec);
+    if (ec) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 template <typename LoggerPolicy, typename Policy>
 class basic_worker_group final : public worker_group::impl, private Policy {
  public:
@@ -68,6 +161,8 @@ class basic_worker_group final : public worker_group::impl, private Policy {
       num_workers = std::max(hardware_concurrency(), 1u);
     }
 
+    max_speculative_workers_ = num_workers;
+
     if (!group_name) {
       group_name = "worker";
     }
@@ -80,7 +175,7 @@ class basic_worker_group final : public worker_group::impl, private Policy {
       });
     }
 
-    check_set_affinity_from_enviroment(group_name);
+    set_affinity_from_environment(os_, group_name, *this);
   }
 
   basic_worker_group(const basic_worker_group&) = delete;
@@ -151,6 +246,81 @@ class basic_worker_group final : public worker_group::impl, private Policy {
     return add_job_impl(std::move(job));
   }
 
+  /**
+   * Add a new speculative job to the worker group
+   *
+   * The job will only be dispatched if there are no demand jobs queued
+   * and the limit of speculative workers hasn't been reached.
+   *
+   * \param job             The job to add to the dispatcher.
+   */
+  worker_group::job_ticket
+  add_speculative_job(worker_group::moveonly_job_t&& job) override {
+    auto ticket = std::make_shared<worker_group::job_state>();
+
+    if (!add_job_impl(std::move(job), ticket)) {
+      ticket.reset();
+    }
+
+    return ticket;
+  }
+
+  bool promote(worker_group::job_ticket const& ticket) override {
+    {
+      std::lock_guard lock(mx_);
+
+      auto it = find_speculative(ticket);
+
+      if (it == speculative_.end()) {
+        return false;
+      }
+
+      it->state.reset();
+      demand_.push_back(std::move(*it));
+      speculative_.erase(it);
+    }
+
+    cond_.notify_one();
+
+    return true;
+  }
+
+  bool cancel(worker_group::job_ticket const& ticket) override {
+    {
+      std::lock_guard lock(mx_);
+
+      auto it = find_speculative(ticket);
+
+      if (it == speculative_.end()) {
+        return false;
+      }
+
+      speculative_.erase(it);
+      ++stats_[stats_index(worker_group::job_priority::speculative)].cancelled;
+      --pending_;
+    }
+
+    wait_.notify_all();
+    queue_.notify_one();
+
+    return true;
+  }
+
+  void set_max_speculative_workers(size_t num) override {
+    {
+      std::lock_guard lock(mx_);
+      max_speculative_workers_ = std::max<size_t>(num, 1);
+    }
+
+    cond_.notify_all();
+  }
+
+  worker_group::queue_stats
+  get_queue_stats(worker_group::job_priority prio) const override {
+    std::lock_guard lock(mx_);
+    return stats_[stats_index(prio)];
+  }
+
   /**
    * Return the number of worker threads
    *
@@ -165,23 +335,14 @@ class basic_worker_group final : public worker_group::impl, private Policy {
    */
   size_t queue_size() const override {
     std::lock_guard lock(mx_);
-    return jobs_.size();
+    return demand_.size() + speculative_.size();
   }
 
   std::chrono::nanoseconds get_cpu_time(std::error_code& ec) const override {
     ec.clear();
 
     std::lock_guard lock(mx_);
-    std::chrono::nanoseconds t{};
-
-    for (auto const& w : workers_) {
-      t += os_.thread_get_cpu_time(w.get_id(), ec);
-      if (ec) {
-        return {};
-      }
-    }
-
-    return t;
+    return threads_cpu_time(os_, workers_, ec);
   }
 
   std::optional<std::chrono::nanoseconds> try_get_cpu_time() const override {
@@ -196,29 +357,22 @@ class basic_worker_group final : public worker_group::impl, private Policy {
     }
 
     std::lock_guard lock(mx_);
-
-    for (size_t i = 0; i < workers_.size(); ++i) {
-      std::error_code ec;
-      os_.thread_set_affinity(workers_[i].get_id(), cpus, ec);
-      if (ec) {
-        return false;
-      }
-    }
-
-    return true;
+    return set_threads_affinity(os_, workers_, cpus);
   }
 
  private:
-  using any_job_t =
-      std::variant<worker_group::job_t, worker_group::moveonly_job_t>;
-  using jobs_t = std::queue<any_job_t>;
+  using jobs_t = std::deque<queued_job>;
 
-  bool add_job_impl(any_job_t&& job) {
+  bool add_job_impl(any_job_t&& job,
+                    worker_group::job_ticket ticket = nullptr) {
     if (running_) {
       {
         std::unique_lock lock(mx_);
-        queue_.wait(lock, [this] { return jobs_.size() < max_queue_len_; });
-        jobs_.emplace(std::move(job));
+        queue_.wait(lock, [this] {
+          return demand_.size() + speculative_.size() < max_queue_len_;
+        });
+        auto& queue = ticket ? speculative_ : demand_;
+        queue.push_back({std::move(job), clock_type::now(), std::move(ticket)});
         ++pending_;
       }
 
@@ -230,40 +384,43 @@ class basic_worker_group final : public worker_group::impl, private Policy {
     return false;
   }
 
-  void check_set_affinity_from_enviroment(const char* group_name) {
-    if (auto var = os_.getenv("DWARFS_WORKER_GROUP_AFFINITY")) {
-      auto groups = split_to<std::vector<std::string_view>>(var.value(), ':');
-
-      for (auto& group : groups) {
-        auto parts = split_to<std::vector<std::string_view>>(group, '=');
-
-        if (parts.size() == 2 && parts[0] == group_name) {
-          auto cpus = split_to<std::vector<int>>(parts[1], ',');
-          set_affinity(cpus);
-        }
-      }
+  // must be called with mx_ held
+  jobs_t::iterator find_speculative(worker_group::job_ticket const& ticket) {
+    if (!ticket) {
+      return speculative_.end();
     }
+
+    return std::find_if(
+        speculative_.begin(), speculative_.end(),
+        [&](queued_job const& qj) { return qj.state == ticket; });
   }
 
-  // TODO: move out of this class
-  static void set_thread_niceness(int niceness) {
-    if (niceness > 0) {
-#ifdef _WIN32
-      auto hthr = ::GetCurrentThread();
-      int priority =
-          niceness > 5 ? THREAD_PRIORITY_LOWEST : THREAD_PRIORITY_BELOW_NORMAL;
-      ::SetThreadPriority(hthr, priority);
-#else
-      // XXX:
-      // According to POSIX, the nice value is a per-process setting. However,
-      // under the current Linux/NPTL implementation of POSIX threads, the nice
-      // value is a per-thread attribute: different threads in the same process
-      // can have different nice values. Portable applications should avoid
-      // relying on the Linux behavior, which may be made standards conformant
-      // in the future.
-      auto rv [[maybe_unused]] = ::nice(niceness);
-#endif
+  // must be called with mx_ held
+  std::optional<queued_job> next_job(bool& speculative) {
+    jobs_t* queue = nullptr;
+
+    if (!demand_.empty()) {
+      queue = &demand_;
+      speculative = false;
+    } else if (!speculative_.empty() &&
+               running_speculative_ < max_speculative_workers_) {
+      queue = &speculative_;
+      speculative = true;
+    } else {
+      return std::nullopt;
     }
+
+    auto qj = std::move(queue->front());
+    queue->pop_front();
+
+    auto delay = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        clock_type::now() - qj.queued_at);
+    auto& st = stats_[speculative ? 1 : 0];
+    ++st.jobs;
+    st.total_delay += delay;
+    st.max_delay = std::max(st.max_delay, delay);
+
+    return qj;
   }
 
   void do_work(bool is_background [[maybe_unused]]) {
@@ -271,26 +428,34 @@ class basic_worker_group final : public worker_group::impl, private Policy {
     auto hthr = ::GetCurrentThread();
 #endif
     for (;;) {
-      any_job_t job;
+      std::optional<queued_job> job;
+      bool speculative{false};
 
       {
         std::unique_lock lock(mx_);
 
-        while (jobs_.empty() && running_) {
-          cond_.wait(lock);
-        }
+        for (;;) {
+          job = next_job(speculative);
 
-        if (jobs_.empty()) {
-          if (running_) {
-            continue;
-          } else {
+          if (job) {
             break;
           }
+
+          // Only exit once all jobs have been dispatched
+          if (!running_ && demand_.empty() && speculative_.empty()) {
+            break;
+          }
+
+          cond_.wait(lock);
         }
 
-        job = std::move(jobs_.front());
+        if (!job) {
+          break;
+        }
 
-        jobs_.pop();
+        if (speculative) {
+          ++running_speculative_;
+        }
       }
 
       {
@@ -301,7 +466,7 @@ class basic_worker_group final : public worker_group::impl, private Policy {
         }
 #endif
         try {
-          std::visit([](auto&& j) { j(); }, job);
+          std::visit([](auto&& j) { j(); }, job->job);
         } catch (...) {
           LOG_FATAL << "exception thrown in worker thread: "
                     << exception_str(std::current_exception());
@@ -313,20 +478,35 @@ class basic_worker_group final : public worker_group::impl, private Policy {
 #endif
       }
 
+      // Destroy the job outside of the lock
+      job.reset();
+
       {
         std::lock_guard lock(mx_);
         pending_--;
+        if (speculative) {
+          --running_speculative_;
+        }
       }
 
       wait_.notify_one();
       queue_.notify_one();
+
+      if (speculative) {
+        // Another speculative job may be able to run now
+        cond_.notify_one();
+      }
     }
   }
 
   LOG_PROXY_DECL(LoggerPolicy);
   os_access const& os_;
   std::vector<std::thread> workers_;
-  jobs_t jobs_;
+  jobs_t demand_;
+  jobs_t speculative_;
+  size_t running_speculative_{0};
+  size_t max_speculative_workers_{0};
+  std::array<worker_group::queue_stats, 2> stats_{};
   std::condition_variable cond_;
   std::condition_variable queue_;
   std::condition_variable wait_;
@@ -336,6 +516,513 @@ class basic_worker_group final : public worker_group::impl, private Policy {
   const size_t max_queue_len_;
 };
 
+// Identifies the worker group and queue of the current worker thread, so
+// jobs added from within a job can go to the worker's own queue
+struct stealing_worker_context {
+  void const* group{nullptr};
+  size_t index{0};
+};
+
+thread_local stealing_worker_context current_stealing_worker;
+
+/**
+ * A work-stealing worker group
+ *
+ * Each worker owns a local queue for the jobs it adds itself, which
+ * doesn't need any locking, plus an inbox for jobs added by other
+ * threads. Inboxes are picked round-robin, so concurrent producers
+ * rarely contend for the same lock. Jobs are taken from all queues
+ * without locking, so idle workers steal from busy ones. Idle workers
+ * spin for a short while before they park.
+ *
+ * Speculative jobs are kept in a single, locked queue, as they need to
+ * be found for promotion and cancellation.
+ */
+template <typename LoggerPolicy>
+class stealing_worker_group final : public worker_group::impl {
+ public:
+  stealing_worker_group(logger& lgr, os_access const& os,
+                        const char* group_name, size_t num_workers,
+                        size_t max_queue_len, int niceness [[maybe_unused]])
+      : LOG_PROXY_INIT(lgr)
+      , os_{os}
+      , max_queue_len_{max_queue_len} {
+    if (num_workers < 1) {
+      num_workers = std::max(hardware_concurrency(), 1u);
+    }
+
+    max_speculative_workers_ = num_workers;
+
+    if (!group_name) {
+      group_name = "worker";
+    }
+
+    for (size_t i = 0; i < num_workers; ++i) {
+      queues_.push_back(std::make_unique<worker_queue>());
+    }
+
+    for (size_t i = 0; i < num_workers; ++i) {
+      workers_.emplace_back([this, niceness, group_name, i] {
+        folly::setThreadName(fmt::format("{}{}", group_name, i + 1));
+        set_thread_niceness(niceness);
+        do_work(i, niceness > 10);
+      });
+    }
+
+    set_affinity_from_environment(os_, group_name, *this);
+  }
+
+  stealing_worker_group(const stealing_worker_group&) = delete;
+  stealing_worker_group& operator=(const stealing_worker_group&) = delete;
+
+  ~stealing_worker_group() noexcept override {
+    try {
+      stop();
+    } catch (...) {
+    }
+  }
+
+  void stop() override {
+    if (running_) {
+      {
+        std::lock_guard lock(park_mx_);
+        running_ = false;
+      }
+
+      park_cv_.notify_all();
+
+      for (auto& w : workers_) {
+        w.join();
+      }
+    }
+  }
+
+  void wait() override {
+    if (running_) {
+      std::unique_lock lock(wait_mx_);
+      wait_cv_.wait(lock, [&] { return pending_ == 0; });
+    }
+  }
+
+  bool running() const override { return running_; }
+
+  bool add_job(worker_group::job_t&& job) override {
+    return add_job_impl(std::move(job));
+  }
+
+  bool add_moveonly_job(worker_group::moveonly_job_t&& job) override {
+    return add_job_impl(std::move(job));
+  }
+
+  worker_group::job_ticket
+  add_speculative_job(worker_group::moveonly_job_t&& job) override {
+    if (!running_) {
+      return nullptr;
+    }
+
+    auto ticket = std::make_shared<worker_group::job_state>();
+
+    reserve_slot();
+    ++pending_;
+
+    {
+      std::lock_guard lock(spec_mx_);
+      speculative_.push_back({std::move(job), clock_type::now(), ticket});
+      ++queued_speculative_;
+    }
+
+    wake_one();
+
+    return ticket;
+  }
+
+  bool promote(worker_group::job_ticket const& ticket) override {
+    std::lock_guard lock(spec_mx_);
+
+    auto it = find_speculative(ticket);
+
+    if (it == speculative_.end()) {
+      return false;
+    }
+
+    auto qj = std::make_unique<queued_job>(std::move(*it));
+    speculative_.erase(it);
+    qj->state.reset();
+
+    // Push before updating the counter, so the job is never invisible to
+    // workers that are about to exit
+    push_demand(std::move(qj));
+    --queued_speculative_;
+
+    return true;
+  }
+
+  bool cancel(worker_group::job_ticket const& ticket) override {
+    {
+      std::lock_guard lock(spec_mx_);
+
+      auto it = find_speculative(ticket);
+
+      if (it == speculative_.end()) {
+        return false;
+      }
+
+      speculative_.erase(it);
+      --queued_speculative_;
+    }
+
+    stats_[stats_index(worker_group::job_priority::speculative)].cancelled++;
+    release_slot();
+    job_done();
+
+    return true;
+  }
+
+  void set_max_speculative_workers(size_t num) override {
+    {
+      std::lock_guard lock(spec_mx_);
+      max_speculative_workers_ = std::max<size_t>(num, 1);
+    }
+
+    wake_all();
+  }
+
+  worker_group::queue_stats
+  get_queue_stats(worker_group::job_priority prio) const override {
+    auto const& st = stats_[stats_index(prio)];
+    return {
+        .jobs = st.jobs.load(),
+        .cancelled = st.cancelled.load(),
+        .total_delay = std::chrono::nanoseconds(st.total_delay_ns.load()),
+        .max_delay = std::chrono::nanoseconds(st.max_delay_ns.load()),
+    };
+  }
+
+  size_t size() const override { return workers_.size(); }
+
+  size_t queue_size() const override {
+    return queued_demand_ + queued_speculative_;
+  }
+
+  std::chrono::nanoseconds get_cpu_time(std::error_code& ec) const override {
+    ec.clear();
+    return threads_cpu_time(os_, workers_, ec);
+  }
+
+  std::optional<std::chrono::nanoseconds> try_get_cpu_time() const override {
+    std::error_code ec;
+    auto t = get_cpu_time(ec);
+    return ec ? std::nullopt : std::make_optional(t);
+  }
+
+  bool set_affinity(std::vector<int> const& cpus) override {
+    if (cpus.empty()) {
+      return false;
+    }
+
+    return set_threads_affinity(os_, workers_, cpus);
+  }
+
+ private:
+  // Number of times an idle worker looks for jobs before parking
+  static constexpr size_t kSpinRounds{64};
+
+  struct alignas(64) worker_queue {
+    // only ever pushed to by the worker owning the queue
+    work_stealing_deque<queued_job> local;
+    // jobs from other threads, pushes are serialized by inbox_mx
+    work_stealing_deque<queued_job> inbox;
+    std::mutex inbox_mx;
+
+    ~worker_queue() {
+      for (auto* q : {&local, &inbox}) {
+        while (auto* qj = q->take()) {
+          delete qj;
+        }
+      }
+    }
+  };
+
+  struct atomic_queue_stats {
+    std::atomic<size_t> jobs{0};
+    std::atomic<size_t> cancelled{0};
+    std::atomic<int64_t> total_delay_ns{0};
+    std::atomic<int64_t> max_delay_ns{0};
+  };
+
+  bool add_job_impl(any_job_t&& job) {
+    if (!running_) {
+      return false;
+    }
+
+    reserve_slot();
+    ++pending_;
+    push_demand(std::make_unique<queued_job>(
+        queued_job{std::move(job), clock_type::now(), nullptr}));
+
+    return true;
+  }
+
+  void push_demand(std::unique_ptr<queued_job> qj) {
+    auto const& ctx = current_stealing_worker;
+
+    if (ctx.group == this) {
+      queues_[ctx.index]->local.push(qj.release());
+    } else {
+      auto& q = *queues_[next_inbox_++ % queues_.size()];
+      std::lock_guard lock(q.inbox_mx);
+      q.inbox.push(qj.release());
+    }
+
+    ++queued_demand_;
+    wake_one();
+  }
+
+  // Only blocks if the queue length is limited
+  void reserve_slot() {
+    if (max_queue_len_ == std::numeric_limits<size_t>::max()) {
+      ++queued_total_;
+    } else {
+      std::unique_lock lock(space_mx_);
+      space_cv_.wait(lock, [this] { return queued_total_ < max_queue_len_; });
+      ++queued_total_;
+    }
+  }
+
+  void release_slot() {
+    --queued_total_;
+
+    if (max_queue_len_ != std::numeric_limits<size_t>::max()) {
+      {
+        std::lock_guard lock(space_mx_);
+      }
+      space_cv_.notify_one();
+    }
+  }
+
+  void job_done() {
+    if (--pending_ == 0) {
+      {
+        std::lock_guard lock(wait_mx_);
+      }
+      wait_cv_.notify_all();
+    }
+
+    if (!running_) {
+      // Workers waiting to exit may need to re-check
+      wake_all();
+    }
+  }
+
+  void wake_one() {
+    if (sleepers_ > 0) {
+      {
+        std::lock_guard lock(park_mx_);
+      }
+      park_cv_.notify_one();
+    }
+  }
+
+  void wake_all() {
+    {
+      std::lock_guard lock(park_mx_);
+    }
+    park_cv_.notify_all();
+  }
+
+  bool work_available() const {
+    return queued_demand_ > 0 ||
+           (queued_speculative_ > 0 &&
+            running_speculative_ < max_speculative_workers_);
+  }
+
+  void record_dispatch(worker_group::job_priority prio,
+                       queued_job const& qj) {
+    auto delay = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     clock_type::now() - qj.queued_at)
+                     .count();
+    auto& st = stats_[stats_index(prio)];
+    ++st.jobs;
+    st.total_delay_ns += delay;
+    auto max = st.max_delay_ns.load();
+    while (delay > max && !st.max_delay_ns.compare_exchange_weak(max, delay)) {
+    }
+  }
+
+  std::unique_ptr<queued_job> next_demand_job(size_t index) {
+    if (queued_demand_.load(std::memory_order_relaxed) == 0) {
+      return nullptr;
+    }
+
+    for (size_t i = 0; i < queues_.size(); ++i) {
+      auto& q = *queues_[(index + i) % queues_.size()];
+      auto* qj = q.local.take();
+
+      if (!qj) {
+        qj = q.inbox.take();
+      }
+
+      if (qj) {
+        --queued_demand_;
+        release_slot();
+        record_dispatch(worker_group::job_priority::demand, *qj);
+        return std::unique_ptr<queued_job>(qj);
+      }
+    }
+
+    return nullptr;
+  }
+
+  std::unique_ptr<queued_job> next_speculative_job() {
+    if (queued_speculative_.load(std::memory_order_relaxed) == 0) {
+      return nullptr;
+    }
+
+    std::unique_ptr<queued_job> qj;
+
+    {
+      std::lock_guard lock(spec_mx_);
+
+      if (speculative_.empty() ||
+          running_speculative_ >= max_speculative_workers_) {
+        return nullptr;
+      }
+
+      qj = std::make_unique<queued_job>(std::move(speculative_.front()));
+      speculative_.pop_front();
+      --queued_speculative_;
+      ++running_speculative_;
+    }
+
+    release_slot();
+    record_dispatch(worker_group::job_priority::speculative, *qj);
+
+    return qj;
+  }
+
+  // must be called with spec_mx_ held
+  std::deque<queued_job>::iterator
+  find_speculative(worker_group::job_ticket const& ticket) {
+    if (!ticket) {
+      return speculative_.end();
+    }
+
+    return std::find_if(
+        speculative_.begin(), speculative_.end(),
+        [&](queued_job const& qj) { return qj.state == ticket; });
+  }
+
+  // Returns false once the worker should exit
+  bool park() {
+    std::unique_lock lock(park_mx_);
+
+    ++sleepers_;
+    park_cv_.wait(lock, [this] {
+      return work_available() ||
+             (!running_ && queued_demand_ == 0 && queued_speculative_ == 0);
+    });
+    --sleepers_;
+
+    return running_ || work_available();
+  }
+
+  void do_work(size_t index, bool is_background [[maybe_unused]]) {
+#ifdef _WIN32
+    auto hthr = ::GetCurrentThread();
+#endif
+    current_stealing_worker = {this, index};
+
+    size_t idle_rounds{0};
+
+    for (;;) {
+      bool speculative{false};
+      auto job = next_demand_job(index);
+
+      if (!job) {
+        job = next_speculative_job();
+        speculative = static_cast<bool>(job);
+      }
+
+      if (!job) {
+        if (idle_rounds < kSpinRounds) {
+          ++idle_rounds;
+          std::this_thread::yield();
+          continue;
+        }
+
+        idle_rounds = 0;
+
+        if (!park()) {
+          break;
+        }
+
+        continue;
+      }
+
+      idle_rounds = 0;
+
+#ifdef _WIN32
+      if (is_background) {
+        ::SetThreadPriority(hthr, THREAD_MODE_BACKGROUND_BEGIN);
+      }
+#endif
+      try {
+        std::visit([](auto&& j) { j(); }, job->job);
+      } catch (...) {
+        LOG_FATAL << "exception thrown in worker thread: "
+                  << exception_str(std::current_exception());
+      }
+#ifdef _WIN32
+      if (is_background) {
+        ::SetThreadPriority(hthr, THREAD_MODE_BACKGROUND_END);
+      }
+#endif
+
+      job.reset();
+
+      if (speculative) {
+        {
+          std::lock_guard lock(spec_mx_);
+          --running_speculative_;
+        }
+
+        if (queued_speculative_ > 0) {
+          // Another speculative job may be able to run now
+          wake_one();
+        }
+      }
+
+      job_done();
+    }
+
+    current_stealing_worker = {};
+  }
+
+  LOG_PROXY_DECL(LoggerPolicy);
+  os_access const& os_;
+  std::vector<std::unique_ptr<worker_queue>> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<size_t> next_inbox_{0};
+  std::atomic<size_t> queued_demand_{0};
+  std::atomic<size_t> queued_speculative_{0};
+  std::atomic<size_t> queued_total_{0};
+  std::atomic<size_t> running_speculative_{0};
+  std::atomic<size_t> max_speculative_workers_{0};
+  std::atomic<size_t> pending_{0};
+  std::atomic<size_t> sleepers_{0};
+  std::atomic<bool> running_{true};
+  std::array<atomic_queue_stats, 2> stats_;
+  std::deque<queued_job> speculative_;
+  std::mutex spec_mx_;
+  std::mutex park_mx_;
+  std::condition_variable park_cv_;
+  std::mutex wait_mx_;
+  std::condition_variable wait_cv_;
+  std::mutex space_mx_;
+  std::condition_variable space_cv_;
+  size_t const max_queue_len_;
+};
+
 class no_policy {
  public:
   class task {
@@ -347,13 +1034,70 @@ class no_policy {
 template <typename LoggerPolicy>
 using default_worker_group = basic_worker_group<LoggerPolicy, no_policy>;
 
+class budget_policy {
+ public:
+  explicit budget_policy(std::shared_ptr<cpu_budget> budget)
+      : budget_{std::move(budget)} {}
+
+  class task {
+   public:
+    explicit task(budget_policy* policy)
+        : budget_{*policy->budget_} {
+      budget_.acquire();
+    }
+
+    ~task() { budget_.release(); }
+
+    task(task const&) = delete;
+    task& operator=(task const&) = delete;
+
+   private:
+    cpu_budget& budget_;
+  };
+
+ private:
+  std::shared_ptr<cpu_budget> budget_;
+};
+
+template <typename LoggerPolicy>
+using budgeted_worker_group = basic_worker_group<LoggerPolicy, budget_policy>;
+
 } // namespace
 
+worker_group::worker_group(logger& lgr, os_access const& os,
+                           const char* group_name,
+                           std::shared_ptr<cpu_budget> budget,
+                           size_t num_workers, size_t max_queue_len,
+                           int niceness) {
+  if (budget) {
+    impl_ = make_unique_logging_object<impl, budgeted_worker_group,
+                                       logger_policies>(
+        lgr, os, group_name, num_workers, max_queue_len, niceness,
+        std::move(budget));
+  } else {
+    impl_ = make_unique_logging_object<impl, default_worker_group,
+                                       logger_policies>(
+        lgr, os, group_name, num_workers, max_queue_len, niceness);
+  }
+}
+
 worker_group::worker_group(logger& lgr, os_access const& os,
                            const char* group_name, size_t num_workers,
-                           size_t max_queue_len, int niceness)
-    : impl_{make_unique_logging_object<impl, default_worker_group,
+                           size_t max_queue_len, int niceness,
+                           scheduling sched) {
+  switch (sched) {
+  case scheduling::shared_queue:
+    impl_ = make_unique_logging_object<impl, default_worker_group,
                                        logger_policies>(
-          lgr, os, group_name, num_workers, max_queue_len, niceness)} {}
+        lgr, os, group_name, num_workers, max_queue_len, niceness);
+    break;
+
+  case scheduling::work_stealing:
+    impl_ = make_unique_logging_object<impl, stealing_worker_group,
+                                       logger_policies>(
+        lgr, os, group_name, num_workers, max_queue_len, niceness);
+    break;
+  }
+}
 
 } // namespace dwarfs::internal
@@ -21,6 +21,8 @@
 
 #include <cerrno>
 #include <cstdlib>
+#include <fstream>
+#include <string_view>
 
 #include <folly/portability/PThread.h>
 #include <folly/portability/Unistd.h>
@@ -65,6 +67,49 @@ pthread_t std_to_pthread_id(std::thread::id tid) {
 
 #endif
 
+#ifdef __linux__
+
+std::optional<std::string>
+read_line(fs::path const& path, std::string_view prefix = {}) {
+  std::ifstream ifs(path);
+  std::string line;
+
+  while (std::getline(ifs, line)) {
+    if (line.starts_with(prefix)) {
+      return line;
+    }
+  }
+
+  return std::nullopt;
+}
+
+std::optional<uint64_t> read_bytes(fs::path const& path) {
+  // memory.max contains "max" if there is no limit
+  if (auto line = read_line(path); line && !line->starts_with("max")) {
+    try {
+      return std::stoull(*line);
+    } catch (std::exception const&) {
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<double> read_psi_avg10(fs::path const& path) {
+  // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+  if (auto line = read_line(path, "some ")) {
+    static constexpr std::string_view key{"avg10="};
+    if (auto pos = line->find(key); pos != std::string::npos) {
+      try {
+        return std::stod(line->substr(pos + key.size()));
+      } catch (std::exception const&) {
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+#endif
+
 class generic_dir_reader final : public dir_reader {
  public:
   explicit generic_dir_reader(fs::path const& path)
@@ -223,4 +268,24 @@ os_access_generic::find_executable(std::filesystem::path const& name) const {
   return boost::process::search_path(name.wstring()).wstring();
 }
 
+memory_pressure os_access_generic::get_memory_pressure() const {
+  memory_pressure mp;
+
+#ifdef __linux__
+  // Only the unified (v2) cgroup hierarchy is supported
+  if (auto cg = read_line("/proc/self/cgroup", "0::")) {
+    fs::path const dir{"/sys/fs/cgroup" + cg->substr(3)};
+    mp.current_bytes = read_bytes(dir / "memory.current");
+    mp.limit_bytes = read_bytes(dir / "memory.max");
+    mp.stall_pct = read_psi_avg10(dir / "memory.pressure");
+  }
+
+  if (!mp.stall_pct) {
+    mp.stall_pct = read_psi_avg10("/proc/pressure/memory");
+  }
+#endif
+
+  return mp;
+}
+
 } // namespace dwarfs
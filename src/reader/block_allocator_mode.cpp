@@ -0,0 +1,46 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fmt/format.h>
+
+#include <dwarfs/error.h>
+#include <dwarfs/reader/block_allocator_mode.h>
+
+namespace dwarfs::reader {
+
+block_allocator_mode parse_block_allocator_mode(std::string_view mode) {
+  if (mode == "malloc") {
+    return block_allocator_mode::MALLOC;
+  }
+  if (mode == "arena") {
+    return block_allocator_mode::ARENA;
+  }
+  if (mode == "thp") {
+    return block_allocator_mode::ARENA_THP;
+  }
+  if (mode == "hugetlb") {
+    return block_allocator_mode::ARENA_HUGETLB;
+  }
+  DWARFS_THROW(runtime_error,
+               fmt::format("invalid block allocator mode: {}", mode));
+}
+
+} // namespace dwarfs::reader
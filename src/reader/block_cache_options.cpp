@@ -27,12 +27,33 @@
 
 namespace dwarfs::reader {
 
+namespace {
+
+char const* allocator_name(block_allocator_mode mode) {
+  switch (mode) {
+  case block_allocator_mode::MALLOC:
+    return "malloc";
+  case block_allocator_mode::ARENA:
+    return "arena";
+  case block_allocator_mode::ARENA_THP:
+    return "thp";
+  case block_allocator_mode::ARENA_HUGETLB:
+    return "hugetlb";
+  }
+  return "unknown";
+}
+
+} // namespace
+
 std::ostream& operator<<(std::ostream& os, block_cache_options const& opts) {
   os << fmt::format(
       "max_bytes={}, num_workers={}, decompress_ratio={}, mm_release={}, "
-      "init_workers={}, disable_block_integrity_check={}",
+      "init_workers={}, disable_block_integrity_check={}, allocator={}, "
+      "bypass_whole_block_reads={}, max_compressed_bytes={}",
       opts.max_bytes, opts.num_workers, opts.decompress_ratio, opts.mm_release,
-      opts.init_workers, opts.disable_block_integrity_check);
+      opts.init_workers, opts.disable_block_integrity_check,
+      allocator_name(opts.allocator), opts.bypass_whole_block_reads,
+      opts.max_compressed_bytes);
   return os;
 }
 
@@ -24,6 +24,7 @@
 #include <dwarfs/error.h>
 #include <dwarfs/reader/block_range.h>
 
+#include <dwarfs/reader/internal/block_pin.h>
 #include <dwarfs/reader/internal/cached_block.h>
 
 namespace dwarfs::reader {
@@ -49,4 +50,23 @@ block_range::block_range(std::shared_ptr<internal::cached_block const> block,
   }
 }
 
+block_range::block_range(internal::block_pin& pin, size_t offset, size_t size)
+    : span_{pin.block().data() + offset, size} {
+  auto const& block = pin.block();
+  if (!block.data()) {
+    DWARFS_THROW(runtime_error, "block_range: block data is null");
+  }
+  if (offset + size > block.range_end()) {
+    DWARFS_THROW(runtime_error,
+                 fmt::format("block_range: size out of range ({0} > {1})",
+                             offset + size, block.range_end()));
+  }
+  pin.ref();
+  pin_ = &pin;
+}
+
+void block_range::ref(internal::block_pin* pin) noexcept { pin->ref(); }
+
+void block_range::unref(internal::block_pin* pin) noexcept { pin->unref(); }
+
 } // namespace dwarfs::reader
@@ -22,6 +22,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstring>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <mutex>
@@ -62,6 +63,11 @@ using namespace dwarfs::internal;
 
 namespace {
 
+// Upper limit for the number of entries held back by
+// walk_data_order_prefetch(), so entries sharing blocks that have already
+// been prefetched don't pile up
+constexpr size_t const kMaxHeldBackEntries{1024};
+
 void check_section_logger(logger& lgr, fs_section const& section) {
   LOG_PROXY(debug_logger_policy, lgr);
 
@@ -219,6 +225,11 @@ class filesystem_ final : public filesystem_v2::impl {
   void walk(std::function<void(dir_entry_view)> const& func) const override;
   void walk_data_order(
       std::function<void(dir_entry_view)> const& func) const override;
+  void
+  walk_data_order_prefetch(std::function<void(dir_entry_view)> const& func,
+                           size_t prefetch_blocks) const override;
+  void walk_parallel(std::function<void(dir_entry_view)> const& func,
+                     size_t num_threads) const override;
   std::optional<inode_view> find(const char* path) const override;
   std::optional<inode_view> find(int inode) const override;
   std::optional<inode_view> find(int inode, const char* name) const override;
@@ -267,6 +278,8 @@ class filesystem_ final : public filesystem_v2::impl {
   std::vector<std::future<block_range>>
   readv(uint32_t inode, size_t size, file_off_t offset,
         std::error_code& ec) const override;
+  void read_batch(std::span<read_request const> requests,
+                  read_callback const& callback) const override;
   std::optional<std::span<uint8_t const>> header() const override;
   void set_num_workers(size_t num) override { ir_.set_num_workers(num); }
   void set_cache_tidy_config(cache_tidy_config const& cfg) override {
@@ -347,6 +360,7 @@ class filesystem_ final : public filesystem_v2::impl {
   PERFMON_CLS_TIMER_DECL(readv_iovec_ec)
   PERFMON_CLS_TIMER_DECL(readv_future)
   PERFMON_CLS_TIMER_DECL(readv_future_ec)
+  PERFMON_CLS_TIMER_DECL(read_batch)
 };
 
 template <typename LoggerPolicy>
@@ -442,7 +456,8 @@ filesystem_<LoggerPolicy>::filesystem_(
     PERFMON_CLS_TIMER_INIT(readv_iovec)
     PERFMON_CLS_TIMER_INIT(readv_iovec_ec)
     PERFMON_CLS_TIMER_INIT(readv_future)
-    PERFMON_CLS_TIMER_INIT(readv_future_ec) // clang-format on
+    PERFMON_CLS_TIMER_INIT(readv_future_ec)
+    PERFMON_CLS_TIMER_INIT(read_batch) // clang-format on
 {
   block_cache cache(lgr, os_, mm_, options.block_cache, perfmon);
   filesystem_parser parser(mm_, image_offset_);
@@ -716,6 +731,78 @@ void filesystem_<LoggerPolicy>::walk_data_order(
   meta_.walk_data_order(func);
 }
 
+template <typename LoggerPolicy>
+void filesystem_<LoggerPolicy>::walk_data_order_prefetch(
+    std::function<void(dir_entry_view)> const& func,
+    size_t prefetch_blocks) const {
+  if (prefetch_blocks == 0) {
+    meta_.walk_data_order(func);
+    return;
+  }
+
+  // Entries are held back in a queue until the blocks of the next
+  // `prefetch_blocks` entries have been requested. `seq` is the number
+  // of blocks prefetched when the entry was queued; it's the position
+  // of the last block the entry needs in the prefetch sequence.
+  struct queued_entry {
+    dir_entry_view entry;
+    size_t seq;
+  };
+
+  std::deque<queued_entry> queue;
+  std::vector<bool> prefetched(ir_.num_blocks(), false);
+  size_t num_prefetched{0};
+
+  meta_.walk_data_order([&](dir_entry_view e) {
+    if (auto iv = e.inode(); iv.is_regular_file()) {
+      std::error_code ec;
+      auto chunks = meta_.get_chunks(iv.inode_num(), ec);
+
+      if (!ec) {
+        auto const limit =
+            (queue.empty() ? num_prefetched : queue.front().seq) +
+            prefetch_blocks;
+
+        // For huge files, only prefetch up to the window size; the rest
+        // will be taken care of by regular readahead.
+        for (auto const& chunk : chunks) {
+          if (num_prefetched >= limit) {
+            break;
+          }
+
+          size_t block = chunk.block();
+
+          if (block < prefetched.size() && !prefetched[block]) {
+            prefetched[block] = true;
+            ir_.prefetch_block(block);
+            ++num_prefetched;
+          }
+        }
+      }
+    }
+
+    queue.push_back({std::move(e), num_prefetched});
+
+    while (!queue.empty() &&
+           (queue.front().seq + prefetch_blocks <= num_prefetched ||
+            queue.size() > kMaxHeldBackEntries)) {
+      func(std::move(queue.front().entry));
+      queue.pop_front();
+    }
+  });
+
+  for (auto& qe : queue) {
+    func(std::move(qe.entry));
+  }
+}
+
+template <typename LoggerPolicy>
+void filesystem_<LoggerPolicy>::walk_parallel(
+    std::function<void(dir_entry_view)> const& func, size_t num_threads) const {
+  worker_group wg(LOG_GET_LOGGER, os_, "fswalk", num_threads);
+  meta_.walk_parallel(wg, func);
+}
+
 template <typename LoggerPolicy>
 std::optional<inode_view>
 filesystem_<LoggerPolicy>::find(const char* path) const {
@@ -1004,6 +1091,19 @@ filesystem_<LoggerPolicy>::readv(uint32_t inode, size_t size,
       [&](std::error_code& ec) { return readv_ec(inode, size, offset, ec); });
 }
 
+template <typename LoggerPolicy>
+void filesystem_<LoggerPolicy>::read_batch(
+    std::span<read_request const> requests,
+    read_callback const& callback) const {
+  PERFMON_CLS_SCOPED_SECTION(read_batch)
+  ir_.read_batch(
+      requests,
+      [this](uint32_t inode, std::error_code& ec) {
+        return meta_.get_chunks(inode, ec);
+      },
+      callback);
+}
+
 template <typename LoggerPolicy>
 std::optional<std::span<uint8_t const>>
 filesystem_<LoggerPolicy>::header() const {
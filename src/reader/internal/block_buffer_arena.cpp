@@ -0,0 +1,258 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <folly/portability/Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <dwarfs/reader/internal/block_buffer_arena.h>
+
+namespace dwarfs::reader::internal {
+
+namespace {
+
+size_t get_page_size() {
+#ifdef _WIN32
+  ::SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return info.dwPageSize;
+#else
+  return ::sysconf(_SC_PAGESIZE);
+#endif
+}
+
+size_t round_up(size_t size, size_t align) {
+  return (size + align - 1) / align * align;
+}
+
+class arena_byte_buffer final : public mutable_byte_buffer {
+ public:
+  explicit arena_byte_buffer(std::shared_ptr<block_buffer_arena> arena)
+      : arena_{std::move(arena)} {}
+
+  ~arena_byte_buffer() override {
+    if (data_) {
+      arena_->release(data_, capacity_);
+    }
+  }
+
+  arena_byte_buffer(arena_byte_buffer const&) = delete;
+  arena_byte_buffer& operator=(arena_byte_buffer const&) = delete;
+
+  uint8_t* data() override { return data_; }
+  uint8_t const* data() const override { return data_; }
+  size_t size() const override { return size_; }
+  size_t capacity() const override { return capacity_; }
+
+  void reserve(size_t size) override {
+    if (size > capacity_) {
+      // This won't happen for decompressors that know the uncompressed
+      // size up front, but make sure we do the right thing anyway
+      auto [data, capacity] = arena_->acquire(size);
+
+      if (data_) {
+        std::memcpy(data, data_, size_);
+        arena_->release(data_, capacity_);
+      }
+
+      data_ = data;
+      capacity_ = capacity;
+    }
+  }
+
+  void resize(size_t size) override {
+    reserve(size);
+    size_ = size;
+  }
+
+  void clear() override { size_ = 0; }
+
+ private:
+  std::shared_ptr<block_buffer_arena> arena_;
+  uint8_t* data_{nullptr};
+  size_t size_{0};
+  size_t capacity_{0};
+};
+
+} // namespace
+
+block_buffer_arena::block_buffer_arena(block_allocator_mode mode,
+                                       size_t max_free_bytes)
+    : mode_{mode}
+    , max_free_bytes_{max_free_bytes}
+    , page_size_{get_page_size()} {}
+
+block_buffer_arena::~block_buffer_arena() {
+  for (auto const& [size, slabs] : free_) {
+    for (auto slab : slabs) {
+      unmap_slab(slab, size);
+    }
+  }
+}
+
+std::unique_ptr<mutable_byte_buffer> block_buffer_arena::make_buffer() {
+  return std::make_unique<arena_byte_buffer>(shared_from_this());
+}
+
+size_t block_buffer_arena::slab_size(size_t size) const {
+  if (mode_ != block_allocator_mode::ARENA && size >= huge_page_size) {
+    return round_up(size, huge_page_size);
+  }
+
+  return round_up(std::max<size_t>(size, 1), page_size_);
+}
+
+std::pair<uint8_t*, size_t> block_buffer_arena::acquire(size_t size) {
+  auto const slab = slab_size(size);
+
+  {
+    std::lock_guard lock(mx_);
+
+    if (auto it = free_.find(slab); it != free_.end() && !it->second.empty()) {
+      auto data = it->second.back();
+      it->second.pop_back();
+      stats_.free_bytes -= slab;
+      ++stats_.slabs_reused;
+      return {data, slab};
+    }
+  }
+
+  bool hugetlb_failed{false};
+  auto data = map_slab(slab, hugetlb_failed);
+
+  std::lock_guard lock(mx_);
+
+  stats_.mapped_bytes += slab;
+  stats_.peak_mapped_bytes =
+      std::max(stats_.peak_mapped_bytes, stats_.mapped_bytes);
+  ++stats_.slabs_mapped;
+
+  if (hugetlb_failed) {
+    ++stats_.hugetlb_failures;
+  }
+
+  return {data, slab};
+}
+
+void block_buffer_arena::release(uint8_t* data, size_t slab_size) {
+  {
+    std::lock_guard lock(mx_);
+
+    if (stats_.free_bytes + slab_size <= max_free_bytes_) {
+      free_[slab_size].push_back(data);
+      stats_.free_bytes += slab_size;
+      return;
+    }
+
+    stats_.mapped_bytes -= slab_size;
+  }
+
+  unmap_slab(data, slab_size);
+}
+
+auto block_buffer_arena::get_stats() const -> stats {
+  std::lock_guard lock(mx_);
+  return stats_;
+}
+
+uint8_t* block_buffer_arena::map_slab(size_t size,
+                                      bool& hugetlb_failed
+                                      [[maybe_unused]]) const {
+#ifdef _WIN32
+  // No huge page support on Windows yet, as it requires special privileges
+  if (auto p = ::VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE,
+                              PAGE_READWRITE)) {
+    return static_cast<uint8_t*>(p);
+  }
+  throw std::bad_alloc();
+#else
+  static constexpr int prot{PROT_READ | PROT_WRITE};
+  static constexpr int flags{MAP_PRIVATE | MAP_ANONYMOUS};
+
+  bool const huge =
+      mode_ != block_allocator_mode::ARENA && size % huge_page_size == 0;
+
+  if (huge && mode_ == block_allocator_mode::ARENA_HUGETLB) {
+#ifdef MAP_HUGETLB
+    if (auto p = ::mmap(nullptr, size, prot, flags | MAP_HUGETLB, -1, 0);
+        p != MAP_FAILED) {
+      return static_cast<uint8_t*>(p);
+    }
+#endif
+    // Most likely, no huge pages have been reserved; fall back to
+    // transparent huge pages
+    hugetlb_failed = true;
+  }
+
+  if (!huge) {
+    if (auto p = ::mmap(nullptr, size, prot, flags, -1, 0); p != MAP_FAILED) {
+      return static_cast<uint8_t*>(p);
+    }
+    throw std::bad_alloc();
+  }
+
+  // Transparent huge pages need a suitably aligned mapping, so map a bit
+  // more than we need and trim the excess on both sides
+  auto const map_size = size + huge_page_size;
+  auto p = ::mmap(nullptr, map_size, prot, flags, -1, 0);
+
+  if (p == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+
+  auto const base = reinterpret_cast<uintptr_t>(p);
+  auto const aligned = round_up(base, huge_page_size);
+  auto data = reinterpret_cast<uint8_t*>(aligned);
+
+  if (auto head = aligned - base; head > 0) {
+    ::munmap(p, head);
+  }
+
+  if (auto tail = base + map_size - (aligned + size); tail > 0) {
+    ::munmap(data + size, tail);
+  }
+
+#ifdef MADV_HUGEPAGE
+  ::madvise(data, size, MADV_HUGEPAGE);
+#endif
+
+  return data;
+#endif
+}
+
+void block_buffer_arena::unmap_slab(uint8_t* data,
+                                    size_t size [[maybe_unused]]) {
+#ifdef _WIN32
+  ::VirtualFree(data, 0, MEM_RELEASE);
+#else
+  ::munmap(data, size);
+#endif
+}
+
+} // namespace dwarfs::reader::internal
@@ -20,6 +20,7 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
 #include <chrono>
@@ -27,11 +28,16 @@
 #include <exception>
 #include <future>
 #include <iterator>
+#include <limits>
 #include <mutex>
 #include <new>
+#include <optional>
 #include <shared_mutex>
+#include <span>
 #include <thread>
+#include <unordered_map>
 #include <utility>
+#include <variant>
 #include <vector>
 
 #include <fmt/format.h>
@@ -42,6 +48,7 @@
 #include <folly/system/ThreadName.h>
 
 #include <dwarfs/logger.h>
+#include <dwarfs/match.h>
 #include <dwarfs/mmif.h>
 #include <dwarfs/performance_monitor.h>
 #include <dwarfs/reader/block_cache_options.h>
@@ -51,8 +58,13 @@
 
 #include <dwarfs/internal/fs_section.h>
 #include <dwarfs/internal/worker_group.h>
+#include <dwarfs/reader/internal/block_buffer_arena.h>
 #include <dwarfs/reader/internal/block_cache.h>
+#include <dwarfs/reader/internal/block_pin.h>
 #include <dwarfs/reader/internal/cached_block.h>
+#include <dwarfs/reader/internal/compressed_cache.h>
+#include <dwarfs/reader/internal/memory_pressure_controller.h>
+#include <dwarfs/reader/internal/range_completion.h>
 
 namespace dwarfs::reader::internal {
 
@@ -87,10 +99,19 @@ class lru_sequential_access_detector : public sequential_access_detector {
     num_blocks_ = num_blocks;
     lru_.clear();
     is_sequential_.reset();
+    last_touched_.store(kNoBlock, std::memory_order_relaxed);
   }
 
   void touch(size_t block_no) override {
+    // Touching the most recently used block again doesn't change anything,
+    // so don't bother taking the lock in that case. This matters for many
+    // threads reading from the same hot block.
+    if (last_touched_.load(std::memory_order_relaxed) == block_no) {
+      return;
+    }
+
     std::lock_guard lock(mx_);
+    last_touched_.store(block_no, std::memory_order_relaxed);
     lru_.set(block_no, block_no, true,
              [this](size_t, size_t&&) { is_sequential_.reset(); });
   }
@@ -125,21 +146,100 @@ class lru_sequential_access_detector : public sequential_access_detector {
  private:
   using lru_type = folly::EvictingCacheMap<size_t, size_t>;
 
+  static constexpr size_t kNoBlock{std::numeric_limits<size_t>::max()};
+
   std::mutex mutable mx_;
+  std::atomic<size_t> last_touched_{kNoBlock};
   lru_type lru_;
   std::optional<bool> mutable is_sequential_;
   size_t num_blocks_{0};
   size_t const seq_blocks_;
 };
 
+// Where the result of a block_request ends up. Prefetches don't need a
+// result at all, and synchronous readers use a range_completion slot
+// instead of a promise to avoid the shared state allocation.
+//
+// A target that is destroyed without having been completed fails its
+// slot, the same way a std::promise reports a broken promise, so the
+// waiting reader can never hang.
+class range_target {
+ public:
+  range_target() = default;
+
+  explicit range_target(std::promise<block_range>&& promise)
+      : target_{std::move(promise)} {}
+
+  explicit range_target(range_completion::slot& slot)
+      : target_{&slot} {
+    slot.claim();
+  }
+
+  range_target(range_target&& other) noexcept
+      : target_{std::exchange(other.target_, std::monostate{})} {}
+
+  range_target& operator=(range_target&& other) noexcept {
+    if (this != &other) {
+      abandon();
+      target_ = std::exchange(other.target_, std::monostate{});
+    }
+    return *this;
+  }
+
+  ~range_target() { abandon(); }
+
+  bool discard() const {
+    return std::holds_alternative<std::monostate>(target_);
+  }
+
+  void set_value(block_range&& br) {
+    target_ | match{
+                  [](std::monostate) {},
+                  [&br](std::promise<block_range>& p) {
+                    p.set_value(std::move(br));
+                  },
+                  [&br](range_completion::slot* s) {
+                    s->set_value(std::move(br));
+                  },
+              };
+    target_ = std::monostate{};
+  }
+
+  void set_exception(std::exception_ptr ep) {
+    target_ | match{
+                  [](std::monostate) {},
+                  [&ep](std::promise<block_range>& p) {
+                    p.set_exception(std::move(ep));
+                  },
+                  [&ep](range_completion::slot* s) {
+                    s->set_exception(std::move(ep));
+                  },
+              };
+    target_ = std::monostate{};
+  }
+
+ private:
+  void abandon() {
+    if (auto s = std::get_if<range_completion::slot*>(&target_)) {
+      (*s)->set_exception(std::make_exception_ptr(
+          runtime_error("block request abandoned", __FILE__, __LINE__)));
+      target_ = std::monostate{};
+    }
+  }
+
+  std::variant<std::monostate, std::promise<block_range>,
+               range_completion::slot*>
+      target_;
+};
+
 class block_request {
  public:
   block_request() = default;
 
-  block_request(size_t begin, size_t end, std::promise<block_range>&& promise)
+  block_request(size_t begin, size_t end, range_target&& target)
       : begin_(begin)
       , end_(end)
-      , promise_(std::move(promise)) {
+      , target_(std::move(target)) {
     DWARFS_CHECK(begin_ < end_, "invalid block_request");
   }
 
@@ -151,15 +251,19 @@ class block_request {
   size_t end() const { return end_; }
 
   void fulfill(std::shared_ptr<cached_block const> block) {
-    promise_.set_value(block_range(std::move(block), begin_, end_ - begin_));
+    if (!target_.discard()) {
+      target_.set_value(block_range(std::move(block), begin_, end_ - begin_));
+    }
   }
 
-  void error(std::exception_ptr error) { promise_.set_exception(error); }
+  void error(std::exception_ptr error) {
+    target_.set_exception(std::move(error));
+  }
 
  private:
   size_t begin_{0};
   size_t end_{0};
-  std::promise<block_range> promise_;
+  range_target target_;
 };
 
 class block_request_set {
@@ -173,12 +277,16 @@ class block_request_set {
 
   size_t range_end() const { return range_end_; }
 
-  void add(size_t begin, size_t end, std::promise<block_range>&& promise) {
+  void add(size_t begin, size_t end, range_target&& target) {
     if (end > range_end_) {
       range_end_ = end;
     }
 
-    queue_.emplace_back(begin, end, std::move(promise));
+    if (end < min_range_end_) {
+      min_range_end_ = end;
+    }
+
+    queue_.emplace_back(begin, end, std::move(target));
     std::push_heap(queue_.begin(), queue_.end());
   }
 
@@ -189,6 +297,8 @@ class block_request_set {
     other.queue_.clear();
     std::make_heap(queue_.begin(), queue_.end());
     range_end_ = std::max(range_end_, other.range_end_);
+    min_range_end_ = std::min(min_range_end_, other.min_range_end_);
+    bypass_cache_ = bypass_cache_ && other.bypass_cache_;
   }
 
   block_request get() {
@@ -204,13 +314,93 @@ class block_request_set {
 
   size_t block_no() const { return block_no_; }
 
+  // If set, the block won't be inserted into the cache once all requests
+  // have been processed, provided that all of them started at the beginning
+  // of the block and min_range_end() turns out to cover the whole block
+  bool bypass_cache() const { return bypass_cache_; }
+
+  size_t min_range_end() const { return min_range_end_; }
+
+  void set_bypass_cache(bool bypass) { bypass_cache_ = bypass; }
+
+  // Only set while the set is queued as a speculative job
+  worker_group::job_ticket const& ticket() const { return ticket_; }
+
+  void set_ticket(worker_group::job_ticket ticket) {
+    ticket_ = std::move(ticket);
+  }
+
+  // Must only be called after the job has been cancelled
+  void cancel() {
+    while (!queue_.empty()) {
+      get().error(std::make_exception_ptr(
+          runtime_error("block request cancelled", __FILE__, __LINE__)));
+    }
+    ticket_.reset();
+  }
+
  private:
   std::vector<block_request> queue_;
   size_t range_end_;
+  size_t min_range_end_{std::numeric_limits<size_t>::max()};
   std::shared_ptr<cached_block> block_;
   const size_t block_no_;
+  worker_group::job_ticket ticket_;
+  bool bypass_cache_{false};
 };
 
+// Per-thread table of pinned, fully decompressed blocks. Each table is
+// mostly accessed by its owning thread, so its mutex is uncontended except
+// while pins are being released because a block left the cache.
+class pin_table {
+ public:
+  static constexpr size_t num_slots{8};
+
+  // Every so often, a pinned block is looked up in the cache again so it
+  // is kept at the front of the LRU queue as long as it is hot.
+  static constexpr size_t refresh_interval{64};
+
+  struct slot {
+    size_t block_no{0};
+    size_t hits{0};
+    block_pin* pin{nullptr};
+  };
+
+  pin_table() = default;
+
+  ~pin_table() {
+    for (auto& s : slots_) {
+      if (s.pin) {
+        s.pin->unref();
+      }
+    }
+  }
+
+  pin_table(pin_table const&) = delete;
+  pin_table& operator=(pin_table const&) = delete;
+
+  slot& get(size_t block_no) { return slots_[block_no % num_slots]; }
+
+  // Drops all pins on `block`, or all pins if `block` is null; must be
+  // called with `mx` held
+  void release(cached_block const* block) {
+    for (auto& s : slots_) {
+      if (s.pin && (!block || &s.pin->block() == block)) {
+        s.pin->unref();
+        s.pin = nullptr;
+      }
+    }
+  }
+
+  std::mutex mx;
+  size_t pinned_hits{0};
+
+ private:
+  std::array<slot, num_slots> slots_;
+};
+
+std::atomic<uint64_t> next_cache_id{1};
+
 // multi-threaded block cache
 template <typename LoggerPolicy>
 class block_cache_ final : public block_cache::impl {
@@ -225,18 +415,33 @@ class block_cache_ final : public block_cache::impl {
       // clang-format off
       PERFMON_CLS_PROXY_INIT(perfmon, "block_cache")
       PERFMON_CLS_TIMER_INIT(get, "block_no", "offset", "size")
+      PERFMON_CLS_TIMER_INIT(get_batch, "block_no", "num_ranges")
       PERFMON_CLS_TIMER_INIT(process, "block_no")
       PERFMON_CLS_TIMER_INIT(decompress, "range_end") // clang-format on
       , seq_access_detector_{create_seq_access_detector(
             options.sequential_access_detector_threshold)}
       , os_{os}
-      , options_(options) {
+      , options_(options)
+      , pin_accounting_{
+            std::make_shared<block_pin_accounting>(options.max_bytes)} {
+    if (options.allocator != block_allocator_mode::MALLOC) {
+      // Keep a few slabs around so replacing an evicted block is cheap
+      arena_ = std::make_shared<block_buffer_arena>(options.allocator,
+                                                    options.max_bytes / 8);
+    }
+
+    if (options.max_compressed_bytes > 0) {
+      compressed_cache_ =
+          std::make_unique<compressed_cache>(options.max_compressed_bytes);
+    }
+
     if (options.init_workers) {
-      wg_ = worker_group(lgr, os_, "blkcache",
-                         std::max(options.num_workers > 0
-                                      ? options.num_workers
-                                      : hardware_concurrency(),
-                                  static_cast<size_t>(1)));
+      auto const num_workers =
+          std::max(options.num_workers > 0 ? options.num_workers
+                                           : hardware_concurrency(),
+                   static_cast<size_t>(1));
+      wg_ = worker_group(lgr, os_, "blkcache", num_workers);
+      wg_.set_max_speculative_workers(max_speculative_workers(num_workers));
     }
   }
 
@@ -248,6 +453,7 @@ class block_cache_ final : public block_cache::impl {
     }
 
     if (wg_) {
+      cancel_speculative();
       wg_.stop();
     }
 
@@ -255,6 +461,15 @@ class block_cache_ final : public block_cache::impl {
       return;
     }
 
+    size_t pinned_hits{0};
+
+    for (auto const& [tid, table] : pin_tables_) {
+      pinned_hits += table->pinned_hits;
+    }
+
+    range_requests_ += pinned_hits;
+    cache_hits_fast_ += pinned_hits;
+
     LOG_DEBUG << "cached blocks:";
 
     for (const auto& cb : cache_) {
@@ -279,13 +494,23 @@ class block_cache_ final : public block_cache::impl {
     LOG_VERBOSE << "blocks created: " << blocks_created_.load();
     LOG_VERBOSE << "blocks evicted: " << blocks_evicted_.load();
     LOG_VERBOSE << "blocks tidied: " << blocks_tidied_.load();
+    LOG_VERBOSE << "blocks not cached: " << blocks_bypassed_.load();
+    LOG_VERBOSE << "direct block reads: " << direct_reads_.load();
+    LOG_VERBOSE << "shared direct block reads: "
+                << direct_reads_shared_.load();
     LOG_VERBOSE << "request sets merged: " << sets_merged_.load();
     LOG_VERBOSE << "total requests: " << range_requests_.load();
+    LOG_VERBOSE << "batched requests: " << batch_requests_.load();
     LOG_VERBOSE << "sequential prefetches: " << sequential_prefetches_.load();
+    LOG_VERBOSE << "explicit prefetches: " << explicit_prefetches_.load();
     LOG_VERBOSE << "active hits (fast): " << active_hits_fast_.load();
     LOG_VERBOSE << "active hits (slow): " << active_hits_slow_.load();
     LOG_VERBOSE << "cache hits (fast): " << cache_hits_fast_.load();
     LOG_VERBOSE << "cache hits (slow): " << cache_hits_slow_.load();
+    LOG_VERBOSE << "pinned hits: " << pinned_hits;
+    LOG_VERBOSE << "peak pinned bytes: "
+                << pin_accounting_->peak_pinned_bytes();
+    LOG_VERBOSE << "rejected pins: " << pin_accounting_->rejected();
 
     LOG_VERBOSE << "total bytes decompressed: " << total_decompressed_bytes_;
     LOG_VERBOSE << "average block decompression: "
@@ -298,6 +523,45 @@ class block_cache_ final : public block_cache::impl {
     LOG_VERBOSE << "miss rate: " << fmt::format("{:.3f}", miss_rate) << "%";
 
     LOG_VERBOSE << "expired active requests: " << active_expired_.load();
+    LOG_VERBOSE << "promoted speculative jobs: " << promoted_.load();
+    LOG_VERBOSE << "cancelled speculative jobs: " << cancelled_.load();
+    LOG_VERBOSE << "memory pressure adjustments: "
+                << pressure_adjustments_.load();
+
+    if (compressed_cache_) {
+      auto st = compressed_cache_->get_stats();
+      LOG_VERBOSE << "compressed cache hits: " << st.hits
+                  << ", misses: " << st.misses
+                  << ", evictions: " << st.evictions
+                  << ", peak size: " << size_with_unit(st.peak_bytes);
+    }
+
+    if (arena_) {
+      auto st = arena_->get_stats();
+      LOG_VERBOSE << "arena slabs mapped: " << st.slabs_mapped
+                  << ", reused: " << st.slabs_reused
+                  << ", peak mapped: " << size_with_unit(st.peak_mapped_bytes)
+                  << ", huge page failures: " << st.hugetlb_failures;
+    }
+
+    if (wg_) {
+      using enum worker_group::job_priority;
+
+      static constexpr std::array classes{
+          std::pair{"demand", demand}, std::pair{"speculative", speculative}};
+
+      for (auto [name, prio] : classes) {
+        auto st = wg_.get_queue_stats(prio);
+        auto avg = std::chrono::nanoseconds::zero();
+        if (st.jobs > 0) {
+          avg = st.total_delay / st.jobs;
+        }
+        LOG_VERBOSE << name << " jobs: " << st.jobs
+                    << ", cancelled: " << st.cancelled
+                    << ", queueing delay avg: " << time_with_unit(avg)
+                    << ", max: " << time_with_unit(st.max_delay);
+      }
+    }
 
     auto active_pct = [&](double p) {
       return active_set_size_.getPercentileEstimate(p);
@@ -321,17 +585,15 @@ class block_cache_ final : public block_cache::impl {
     if (size == 0) {
       DWARFS_THROW(runtime_error, "block size is zero");
     }
-    auto max_blocks = std::max<size_t>(options_.max_bytes / size, 1);
-
-    if (!block_.empty() && max_blocks > block_.size()) {
-      max_blocks = block_.size();
-    }
 
     std::lock_guard lock(mx_);
+    block_size_ = size;
     cache_.~lru_type();
-    new (&cache_) lru_type(max_blocks);
+    new (&cache_) lru_type(max_blocks_for(cache_bytes()));
+    release_pins(nullptr);
     cache_.setPruneHook(
         [this](size_t block_no, std::shared_ptr<cached_block>&& block) {
+          release_pins(block.get());
           LOG_DEBUG << "evicting block " << block_no
                     << " from cache, decompression ratio = "
                     << double(block->range_end()) /
@@ -342,6 +604,11 @@ class block_cache_ final : public block_cache::impl {
   }
 
   void set_num_workers(size_t num) override {
+    if (wg_) {
+      // No point in running these on the old workers
+      cancel_speculative();
+    }
+
     std::unique_lock lock(mx_wg_);
 
     if (wg_) {
@@ -349,6 +616,7 @@ class block_cache_ final : public block_cache::impl {
     }
 
     wg_ = worker_group(LOG_GET_LOGGER, os_, "blkcache", num);
+    wg_.set_max_speculative_workers(max_speculative_workers(wg_.size()));
   }
 
   void set_tidy_config(cache_tidy_config const& cfg) override {
@@ -356,6 +624,10 @@ class block_cache_ final : public block_cache::impl {
       if (tidy_running_) {
         stop_tidy_thread();
       }
+
+      std::lock_guard lock(mx_);
+
+      set_pressure_control(cfg);
     } else {
       if (cfg.interval == std::chrono::milliseconds::zero()) {
         DWARFS_THROW(runtime_error, "tidy interval is zero");
@@ -364,6 +636,7 @@ class block_cache_ final : public block_cache::impl {
       std::lock_guard lock(mx_);
 
       tidy_config_ = cfg;
+      set_pressure_control(cfg);
 
       if (tidy_running_) {
         tidy_cond_.notify_all();
@@ -376,27 +649,335 @@ class block_cache_ final : public block_cache::impl {
 
   std::future<block_range>
   get(size_t block_no, size_t offset, size_t size) const override {
-    PERFMON_CLS_SCOPED_SECTION(get)
-    PERFMON_SET_CONTEXT(block_no, offset, size)
+    std::promise<block_range> promise;
+    auto future = promise.get_future();
+    get_impl(block_no, offset, size, range_target{std::move(promise)});
+    return future;
+  }
+
+  void get(size_t block_no, size_t offset, size_t size,
+           range_completion::slot& slot) const override {
+    get_impl(block_no, offset, size, range_target{slot});
+  }
+
+  std::vector<std::future<block_range>>
+  get(size_t block_no,
+      std::span<block_cache::range_request const> ranges) const override {
+    PERFMON_CLS_SCOPED_SECTION(get_batch)
+    PERFMON_SET_CONTEXT(block_no, ranges.size())
+
+    std::vector<std::promise<block_range>> promises(ranges.size());
+    std::vector<std::future<block_range>> futures;
+    futures.reserve(ranges.size());
+
+    for (auto& p : promises) {
+      futures.emplace_back(p.get_future());
+    }
+
+    if (ranges.empty()) {
+      return futures;
+    }
 
     seq_access_detector_->touch(block_no);
 
-    scope_exit do_prefetch{[&] {
-      if (auto next = seq_access_detector_->prefetch()) {
-        sequential_prefetches_.fetch_add(1, std::memory_order_relaxed);
+    scope_exit do_prefetch{[this] { sequential_prefetch(); }};
+
+    range_requests_.fetch_add(ranges.size(), std::memory_order_relaxed);
+    batch_requests_.fetch_add(1, std::memory_order_relaxed);
+
+    auto set_exception = [&](std::exception_ptr ep) {
+      for (auto& p : promises) {
+        p.set_exception(ep);
+      }
+    };
+
+    try {
+      if (block_no >= block_.size()) {
+        DWARFS_THROW(runtime_error,
+                     fmt::format("block number out of range {0} >= {1}",
+                                 block_no, block_.size()));
+      }
+
+      auto const& section = DWARFS_NOTHROW(block_.at(block_no));
+
+      if (section.compression() == compression_type::NONE) {
+        LOG_TRACE << "block " << block_no
+                  << " is uncompressed, bypassing cache";
+        auto data = section.data(*mm_).data();
+        for (size_t i = 0; i < ranges.size(); ++i) {
+          promises[i].set_value(
+              block_range(data, ranges[i].offset, ranges[i].size));
+        }
+        return futures;
+      }
+    } catch (...) {
+      set_exception(std::current_exception());
+      return futures;
+    }
+
+    std::lock_guard lock(mx_);
+
+    // Any live request set will do, we only need the block itself; the
+    // worker will merge our set with the one currently being processed.
+    std::shared_ptr<cached_block> block;
+    std::atomic<size_t>* fast_hits{nullptr};
+    std::atomic<size_t>* slow_hits{nullptr};
+
+    if (auto ia = active_.find(block_no); ia != active_.end()) {
+      for (auto const& wp : ia->second) {
+        if (auto rs = wp.lock()) {
+          rs->set_bypass_cache(false);
+          block = rs->block();
+          fast_hits = &active_hits_fast_;
+          slow_hits = &active_hits_slow_;
+          break;
+        }
+      }
+    }
+
+    if (!block) {
+      if (auto ic = cache_.find(block_no); ic != cache_.end()) {
+        block = ic->second;
+        fast_hits = &cache_hits_fast_;
+        slow_hits = &cache_hits_slow_;
+      }
+    }
+
+    if (!block) {
+      LOG_TRACE << "block " << block_no << " not found";
+
+      try {
+        block = make_block(block_no);
+        blocks_created_.fetch_add(1, std::memory_order_relaxed);
+      } catch (...) {
+        set_exception(std::current_exception());
+        return futures;
+      }
+    }
+
+    std::shared_ptr<block_request_set> brs;
+
+    for (size_t i = 0; i < ranges.size(); ++i) {
+      auto const offset = ranges[i].offset;
+      auto const range_end = offset + ranges[i].size;
+
+      if (range_end <= block->range_end()) {
+        promises[i].set_value(block_range(block, offset, ranges[i].size));
+
+        if (fast_hits) {
+          fast_hits->fetch_add(1, std::memory_order_relaxed);
+        }
+      } else {
+        if (!brs) {
+          brs = std::make_shared<block_request_set>(block, block_no);
+        }
+
+        brs->add(offset, range_end, range_target{std::move(promises[i])});
 
-        {
-          std::lock_guard lock(mx_);
-          create_cached_block(*next, std::promise<block_range>{}, 0,
-                              std::numeric_limits<size_t>::max());
+        if (slow_hits) {
+          slow_hits->fetch_add(1, std::memory_order_relaxed);
         }
       }
+    }
+
+    if (brs) {
+      activate(std::move(brs));
+    }
+
+    return futures;
+  }
+
+  void prefetch(size_t block_no, size_t range_end) const override {
+    if (block_no >= block_.size() ||
+        block_[block_no].compression() == compression_type::NONE ||
+        range_end == 0) {
+      return;
+    }
+
+    std::lock_guard lock(mx_);
+
+    if (active_.find(block_no) != active_.end()) {
+      return;
+    }
+
+    if (auto ic = cache_.find(block_no); ic != cache_.end()) {
+      auto block = ic->second;
+
+      if (range_end <= block->range_end()) {
+        return;
+      }
+
+      LOG_TRACE << "extending block " << block_no << " up to " << range_end;
+
+      auto brs =
+          std::make_shared<block_request_set>(std::move(block), block_no);
+      brs->add(0, range_end, range_target{});
+      activate(std::move(brs), worker_group::job_priority::speculative);
+    } else {
+      LOG_TRACE << "prefetching block " << block_no;
+
+      create_cached_block(block_no, range_target{}, 0, range_end,
+                          worker_group::job_priority::speculative);
+    }
+
+    explicit_prefetches_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  bool read_uncached(size_t block_no, std::span<uint8_t> dest) const override {
+    if (!options_.bypass_whole_block_reads || block_no >= block_.size()) {
+      return false;
+    }
+
+    auto const& section = block_[block_no];
+
+    if (section.compression() == compression_type::NONE) {
+      // These never end up in the cache anyway
+      return false;
+    }
+
+    {
+      std::lock_guard lock(mx_);
+
+      if (dest.size() > block_size_ || active_.count(block_no) > 0 ||
+          cache_.exists(block_no)) {
+        return false;
+      }
+    }
+
+    // If another thread is already reading the same block directly, wait
+    // for it and copy its result instead of decompressing the block again
+    bool owner{false};
+    std::shared_ptr<direct_read> dr;
+
+    {
+      std::lock_guard lock_dec(mx_dec_);
+
+      if (auto it = direct_active_.find(block_no);
+          it != direct_active_.end()) {
+        std::lock_guard lock(it->second->mx);
+        ++it->second->readers;
+        dr = it->second;
+      } else {
+        dr = std::make_shared<direct_read>();
+        direct_active_.emplace(block_no, dr);
+        owner = true;
+      }
+    }
+
+    if (!owner) {
+      return copy_direct_read(*dr, dest);
+    }
+
+    bool ok{false};
+
+    // Whatever happens, unregister and wait until all threads that joined
+    // this read are done copying from `dest`
+    scope_exit publish{[&] {
+      {
+        std::lock_guard lock_dec(mx_dec_);
+        direct_active_.erase(block_no);
+      }
+
+      std::unique_lock lock(dr->mx);
+      dr->done = true;
+      if (ok) {
+        dr->data = dest;
+      }
+      dr->cond.notify_all();
+      dr->cond.wait(lock, [&] { return dr->readers == 0; });
     }};
 
-    range_requests_.fetch_add(1, std::memory_order_relaxed);
+    auto const compressed = compressed_data(block_no);
+    auto const data = compressed ? std::span<uint8_t const>{*compressed}
+                                 : section.data(*mm_);
+    span_byte_buffer buffer{dest};
+    block_decompressor bd(section.compression(), data.data(), data.size(),
+                          buffer);
 
-    std::promise<block_range> promise;
-    auto future = promise.get_future();
+    if (bd.uncompressed_size() != dest.size()) {
+      return false;
+    }
+
+    if (!compressed && !options_.disable_block_integrity_check &&
+        !section.check(*mm_)) {
+      DWARFS_THROW(runtime_error, "block data integrity check failed");
+    }
+
+    LOG_TRACE << "decompressing block " << block_no << " directly";
+
+    bd.decompress_frame(dest.size());
+
+    if (buffer.size() != dest.size()) {
+      DWARFS_THROW(runtime_error,
+                   fmt::format("short read from block {}: {} < {}", block_no,
+                               buffer.size(), dest.size()));
+    }
+
+    if (!compressed) {
+      release_section(section);
+    }
+
+    direct_reads_.fetch_add(1, std::memory_order_relaxed);
+    ok = true;
+
+    return true;
+  }
+
+ private:
+  // A block that is being decompressed straight into a caller's buffer
+  struct direct_read {
+    std::mutex mx;
+    std::condition_variable cond;
+    std::span<uint8_t const> data;
+    size_t readers{0};
+    bool done{false};
+  };
+
+  // Copies the result of a direct read by another thread. If that read
+  // failed, the caller falls back to reading through the cache.
+  bool copy_direct_read(direct_read& dr, std::span<uint8_t> dest) const {
+    std::unique_lock lock(dr.mx);
+    dr.cond.wait(lock, [&] { return dr.done; });
+
+    bool const ok = dr.data.size() == dest.size();
+
+    if (ok) {
+      std::copy(dr.data.begin(), dr.data.end(), dest.begin());
+      direct_reads_shared_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (--dr.readers == 0) {
+      dr.cond.notify_all();
+    }
+
+    return ok;
+  }
+
+  static std::unique_ptr<sequential_access_detector>
+  create_seq_access_detector(size_t threshold) {
+    if (threshold == 0) {
+      return std::make_unique<no_sequential_access_detector>();
+    }
+
+    return std::make_unique<lru_sequential_access_detector>(threshold);
+  }
+
+  void get_impl(size_t block_no, size_t offset, size_t size,
+                range_target&& target) const {
+    PERFMON_CLS_SCOPED_SECTION(get)
+    PERFMON_SET_CONTEXT(block_no, offset, size)
+
+    seq_access_detector_->touch(block_no);
+
+    // A pinned block must have been accessed recently by this thread, so
+    // we can skip the sequential prefetch check for now.
+    if (get_pinned(block_no, offset, size, target)) {
+      return;
+    }
+
+    scope_exit do_prefetch{[this] { sequential_prefetch(); }};
+
+    range_requests_.fetch_add(1, std::memory_order_relaxed);
 
     // First, let's see if it's an uncompressed block, in which case we
     // can completely bypass the cache
@@ -412,12 +993,13 @@ class block_cache_ final : public block_cache::impl {
       if (section.compression() == compression_type::NONE) {
         LOG_TRACE << "block " << block_no
                   << " is uncompressed, bypassing cache";
-        promise.set_value(block_range(section.data(*mm_).data(), offset, size));
-        return future;
+        target.set_value(
+            block_range(section.data(*mm_).data(), offset, size));
+        return;
       }
     } catch (...) {
-      promise.set_exception(std::current_exception());
-      return future;
+      target.set_exception(std::current_exception());
+      return;
     }
 
     // That is a mighty long lock, let's see how it works...
@@ -468,16 +1050,20 @@ class block_cache_ final : public block_cache::impl {
         // That's the one
         // Check if by any chance the block has already
         // been decompressed far enough to fulfill the
-        // promise immediately, otherwise add a new
+        // request immediately, otherwise add a new
         // request to the request set.
 
         LOG_TRACE << "block " << block_no << " found in active set";
 
+        // The block is obviously being reused, so make sure it ends up
+        // in the cache
+        brs->set_bypass_cache(false);
+
         auto block = brs->block();
 
         if (range_end <= block->range_end()) {
-          // We can immediately satisfy the promise
-          promise.set_value(block_range(std::move(block), offset, size));
+          // We can immediately satisfy the request
+          target.set_value(block_range(std::move(block), offset, size));
           active_hits_fast_.fetch_add(1, std::memory_order_relaxed);
         } else {
           if (!add_to_set) {
@@ -486,18 +1072,21 @@ class block_cache_ final : public block_cache::impl {
                 std::make_shared<block_request_set>(std::move(block), block_no);
           }
 
-          // Promise will be fulfilled asynchronously
-          brs->add(offset, range_end, std::move(promise));
+          // Request will be fulfilled asynchronously
+          brs->add(offset, range_end, std::move(target));
           active_hits_slow_.fetch_add(1, std::memory_order_relaxed);
 
-          if (!add_to_set) {
+          if (add_to_set) {
+            // Someone's waiting for this set now
+            promote(*brs);
+          } else {
             ia->second.emplace_back(brs);
             active_set_size_.addValue(ia->second.size());
             enqueue_job(std::move(brs));
           }
         }
 
-        return future;
+        return;
       }
 
       LOG_TRACE << "block " << block_no << " not found in active set";
@@ -514,69 +1103,318 @@ class block_cache_ final : public block_cache::impl {
       auto block = ic->second;
 
       if (range_end <= block->range_end()) {
-        // We can immediately satisfy the promise
-        promise.set_value(block_range(std::move(block), offset, size));
+        // We can immediately satisfy the request
+        pin_block(block_no, block);
+        target.set_value(block_range(std::move(block), offset, size));
         cache_hits_fast_.fetch_add(1, std::memory_order_relaxed);
       } else {
         // Make a new set for the block
         brs = std::make_shared<block_request_set>(std::move(block), block_no);
 
-        // Promise will be fulfilled asynchronously
-        brs->add(offset, range_end, std::move(promise));
+        // Request will be fulfilled asynchronously
+        brs->add(offset, range_end, std::move(target));
         cache_hits_slow_.fetch_add(1, std::memory_order_relaxed);
 
-        auto& active = active_[block_no];
-        active.emplace_back(brs);
-        active_set_size_.addValue(active.size());
-        enqueue_job(std::move(brs));
+        activate(std::move(brs));
       }
 
-      return future;
+      return;
     }
 
     // Bummer. We don't know anything about the block.
 
     LOG_TRACE << "block " << block_no << " not found";
 
-    create_cached_block(block_no, std::move(promise), offset, range_end);
+    create_cached_block(block_no, std::move(target), offset, range_end);
+  }
 
-    return future;
+  pin_table& thread_pin_table() const {
+    struct table_ref {
+      uint64_t cache_id{0};
+      pin_table* table{nullptr};
+    };
+
+    static thread_local std::array<table_ref, 4> tls_tables{};
+    static thread_local size_t tls_next{0};
+
+    for (auto const& ref : tls_tables) {
+      if (ref.cache_id == cache_id_) {
+        return *ref.table;
+      }
+    }
+
+    pin_table* table;
+
+    {
+      std::lock_guard lock(mx_pin_);
+      auto& tp = pin_tables_[std::this_thread::get_id()];
+      if (!tp) {
+        tp = std::make_unique<pin_table>();
+      }
+      table = tp.get();
+    }
+
+    tls_tables[tls_next++ % tls_tables.size()] = {cache_id_, table};
+
+    return *table;
   }
 
- private:
-  static std::unique_ptr<sequential_access_detector>
-  create_seq_access_detector(size_t threshold) {
-    if (threshold == 0) {
-      return std::make_unique<no_sequential_access_detector>();
+  // Lock-free fast path for fully decompressed blocks pinned by this
+  // thread. In the common case, this doesn't write to any shared state.
+  bool get_pinned(size_t block_no, size_t offset, size_t size,
+                  range_target& target) const {
+    auto& table = thread_pin_table();
+    std::lock_guard lock(table.mx);
+    auto& s = table.get(block_no);
+
+    if (!s.pin || s.block_no != block_no ||
+        ++s.hits % pin_table::refresh_interval == 0) {
+      return false;
     }
 
-    return std::make_unique<lru_sequential_access_detector>(threshold);
+    try {
+      target.set_value(block_range(*s.pin, offset, size));
+    } catch (...) {
+      target.set_exception(std::current_exception());
+    }
+
+    ++table.pinned_hits;
+
+    return true;
+  }
+
+  // must be called with mx_ held
+  void
+  pin_block(size_t block_no, std::shared_ptr<cached_block> const& block) const {
+    // Only fully decompressed blocks are immutable
+    if (block->range_end() < block->uncompressed_size()) {
+      return;
+    }
+
+    auto& table = thread_pin_table();
+    std::lock_guard lock(table.mx);
+    auto& s = table.get(block_no);
+
+    s.block_no = block_no;
+    s.hits = 0;
+
+    if (s.pin && &s.pin->block() == block.get()) {
+      return;
+    }
+
+    if (s.pin) {
+      s.pin->unref();
+    }
+
+    // This will fail if we're running out of budget for pinned blocks
+    s.pin = block_pin::create(block, pin_accounting_);
+  }
+
+  // Pins must not keep a block alive once it has left the cache, even if
+  // the owning thread never comes back to its pin table. Must be called
+  // with mx_ held.
+  void release_pins(cached_block const* block) const {
+    std::lock_guard lock(mx_pin_);
+
+    for (auto const& [tid, table] : pin_tables_) {
+      std::lock_guard table_lock(table->mx);
+      table->release(block);
+    }
   }
 
-  void create_cached_block(size_t block_no, std::promise<block_range>&& promise,
-                           size_t offset, size_t range_end) const {
+  void create_cached_block(size_t block_no, range_target&& target,
+                           size_t offset, size_t range_end,
+                           worker_group::job_priority prio =
+                               worker_group::job_priority::demand) const {
     try {
-      std::shared_ptr<cached_block> block = cached_block::create(
-          LOG_GET_LOGGER, DWARFS_NOTHROW(block_.at(block_no)), mm_,
-          options_.mm_release, options_.disable_block_integrity_check);
+      std::shared_ptr<cached_block> block = make_block(block_no);
       blocks_created_.fetch_add(1, std::memory_order_relaxed);
 
+      // A block that is read in its entirety by a single request is
+      // unlikely to be read again any time soon, so don't admit it to
+      // the cache. We don't know the size of the block until it has been
+      // loaded by the worker, which will make the final decision.
+      bool const bypass = options_.bypass_whole_block_reads &&
+                          prio == worker_group::job_priority::demand &&
+                          offset == 0;
+
       // Make a new set for the block
       auto brs =
           std::make_shared<block_request_set>(std::move(block), block_no);
 
-      // Promise will be fulfilled asynchronously
-      brs->add(offset, range_end, std::move(promise));
+      // Request will be fulfilled asynchronously
+      brs->add(offset, range_end, std::move(target));
+      brs->set_bypass_cache(bypass);
 
-      auto& active = active_[block_no];
-      active.emplace_back(brs);
-      active_set_size_.addValue(active.size());
-      enqueue_job(std::move(brs));
+      activate(std::move(brs), prio);
     } catch (...) {
-      promise.set_exception(std::current_exception());
+      target.set_exception(std::current_exception());
+    }
+  }
+
+  void sequential_prefetch() const {
+    if (auto next = seq_access_detector_->prefetch()) {
+      sequential_prefetches_.fetch_add(1, std::memory_order_relaxed);
+
+      {
+        std::lock_guard lock(mx_);
+        create_cached_block(*next, range_target{}, 0,
+                            std::numeric_limits<size_t>::max(),
+                            worker_group::job_priority::speculative);
+      }
+    }
+  }
+
+  // must be called with mx_ held
+  void activate(std::shared_ptr<block_request_set> brs,
+                worker_group::job_priority prio =
+                    worker_group::job_priority::demand) const {
+    auto& active = active_[brs->block_no()];
+    active.emplace_back(brs);
+    active_set_size_.addValue(active.size());
+    enqueue_job(std::move(brs), prio);
+  }
+
+  // must be called with mx_ held
+  void promote(block_request_set& brs) const {
+    if (brs.ticket()) {
+      std::shared_lock lock(mx_wg_);
+      if (wg_.promote(brs.ticket())) {
+        promoted_.fetch_add(1, std::memory_order_relaxed);
+      }
+      brs.set_ticket(nullptr);
+    }
+  }
+
+  // Drop all speculative jobs that haven't been started yet
+  void cancel_speculative() const {
+    std::lock_guard lock(mx_);
+    std::shared_lock lock_wg(mx_wg_);
+
+    for (auto const& [block_no, sets] : active_) {
+      for (auto const& wp : sets) {
+        if (auto brs = wp.lock()) {
+          if (brs->ticket() && wg_.cancel(brs->ticket())) {
+            brs->cancel();
+            cancelled_.fetch_add(1, std::memory_order_relaxed);
+          }
+        }
+      }
+    }
+  }
+
+  // This is called with mx_ held, so it must not touch the image. All
+  // fetching and checking happens when the worker loads the block.
+  std::unique_ptr<cached_block> make_block(size_t block_no) const {
+    cached_block::compressed_data_loader load_compressed;
+
+    if (compressed_cache_) {
+      load_compressed = [this, block_no] { return compressed_data(block_no); };
+    }
+
+    return cached_block::create(LOG_GET_LOGGER,
+                                DWARFS_NOTHROW(block_.at(block_no)), mm_,
+                                make_buffer(), std::move(load_compressed),
+                                options_.mm_release,
+                                options_.disable_block_integrity_check);
+  }
+
+  // Returns an in-memory copy of the compressed data of a block, fetching
+  // it from the image if necessary, or nullptr if there's no compressed
+  // cache or the block isn't compressed. Must be called without mx_ held.
+  cached_block::compressed_data_ptr compressed_data(size_t block_no) const {
+    if (!compressed_cache_) {
+      return nullptr;
+    }
+
+    auto const& section = DWARFS_NOTHROW(block_.at(block_no));
+
+    if (section.compression() == compression_type::NONE) {
+      return nullptr;
+    }
+
+    if (auto data = compressed_cache_->get(block_no)) {
+      return data;
+    }
+
+    if (!options_.disable_block_integrity_check && !section.check(*mm_)) {
+      DWARFS_THROW(runtime_error, "block data integrity check failed");
+    }
+
+    auto data = compressed_cache_->put(block_no, section.data(*mm_));
+
+    if (data) {
+      // We've got our own copy now
+      release_section(section);
+    }
+
+    return data;
+  }
+
+  void release_section(fs_section const& section) const {
+    if (options_.mm_release) {
+      if (auto ec = mm_->release(section.start(), section.length())) {
+        LOG_INFO << "madvise() failed: " << ec.message();
+      }
+    }
+  }
+
+  std::unique_ptr<mutable_byte_buffer> make_buffer() const {
+    if (arena_) {
+      return arena_->make_buffer();
+    }
+    return std::make_unique<vector_byte_buffer>();
+  }
+
+  static size_t max_speculative_workers(size_t num_workers) {
+    // Always leave some workers for requests that someone is waiting for
+    return std::max<size_t>(num_workers / 2, 1);
+  }
+
+  // All of the following must be called with mx_ held
+
+  size_t cache_bytes() const {
+    return pressure_ctrl_ ? pressure_ctrl_->effective_bytes()
+                          : options_.max_bytes;
+  }
+
+  size_t max_blocks_for(size_t bytes) const {
+    auto max_blocks = std::max<size_t>(bytes / block_size_, 1);
+
+    if (!block_.empty() && max_blocks > block_.size()) {
+      max_blocks = block_.size();
+    }
+
+    return max_blocks;
+  }
+
+  void resize_cache() {
+    if (block_size_ == 0) {
+      return;
+    }
+
+    // Pinned blocks can't hold more memory than the cache itself
+    pin_accounting_->set_budget(cache_bytes());
+
+    if (auto max_blocks = max_blocks_for(cache_bytes());
+        max_blocks != cache_.getMaxSize()) {
+      LOG_DEBUG << "adjusting cache size to " << max_blocks << " blocks";
+      // evicted blocks are passed to the prune hook
+      cache_.setMaxSize(max_blocks);
     }
   }
 
+  void set_pressure_control(cache_tidy_config const& cfg) {
+    if (cfg.strategy == cache_tidy_strategy::MEMORY_PRESSURE) {
+      pressure_ctrl_.emplace(options_.max_bytes, cfg.max_stall_pct,
+                             cfg.max_memory_usage);
+    } else {
+      pressure_ctrl_.reset();
+    }
+
+    resize_cache();
+  }
+
   void stop_tidy_thread() {
     {
       std::lock_guard lock(mx_);
@@ -596,13 +1434,22 @@ class block_cache_ final : public block_cache::impl {
                                  std::memory_order_relaxed);
   }
 
-  void enqueue_job(std::shared_ptr<block_request_set> brs) const {
+  // must be called with mx_ held
+  void enqueue_job(std::shared_ptr<block_request_set> brs,
+                   worker_group::job_priority prio =
+                       worker_group::job_priority::demand) const {
     std::shared_lock lock(mx_wg_);
 
     // Lambda needs to be mutable so we can actually move out of it
-    wg_.add_job([this, brs = std::move(brs)]() mutable {
-      process_job(std::move(brs));
-    });
+    auto job = [this, brs]() mutable { process_job(std::move(brs)); };
+
+    if (prio == worker_group::job_priority::speculative) {
+      // The ticket is only ever accessed with mx_ held, so it doesn't
+      // matter if the job is already running at this point
+      brs->set_ticket(wg_.add_speculative_job(std::move(job)));
+    } else {
+      wg_.add_job(std::move(job));
+    }
   }
 
   void process_job(std::shared_ptr<block_request_set> brs) const {
@@ -635,6 +1482,9 @@ class block_cache_ final : public block_cache::impl {
     }
 
     auto block = brs->block();
+    bool bypass_cache{false};
+    size_t bypass_end{0};
+    std::exception_ptr load_error;
 
     for (;;) {
       block_request req;
@@ -645,6 +1495,9 @@ class block_cache_ final : public block_cache::impl {
         std::lock_guard lock(mx_);
 
         if (brs->empty()) {
+          bypass_cache = brs->bypass_cache();
+          bypass_end = brs->min_range_end();
+
           // This is absolutely crucial! At this point, we can no longer
           // allow other code to add to this request set, so we need to
           // expire all weak pointer from within this critial section.
@@ -658,23 +1511,40 @@ class block_cache_ final : public block_cache::impl {
 
       // Process this request!
 
-      size_t range_end = req.end();
-      auto max_end = block->uncompressed_size();
+      // Fetching and checking the compressed data happens here rather
+      // than when the block is created, so it doesn't hold up anyone
+      // waiting for mx_. If this fails, don't try again for every single
+      // request.
+      if (!load_error) {
+        try {
+          block->load();
+        } catch (...) {
+          load_error = std::current_exception();
+        }
+      }
 
-      if (range_end == std::numeric_limits<size_t>::max()) {
-        range_end = max_end;
+      if (load_error) {
+        req.error(load_error);
+        continue;
       }
 
-      if (is_last_req) {
-        double ratio = double(range_end) / double(max_end);
-        if (ratio > options_.decompress_ratio) {
-          LOG_TRACE << "block " << block_no << " over ratio: " << ratio << " > "
-                    << options_.decompress_ratio;
+      try {
+        size_t range_end = req.end();
+        auto max_end = block->uncompressed_size();
+
+        if (range_end == std::numeric_limits<size_t>::max()) {
           range_end = max_end;
         }
-      }
 
-      try {
+        if (is_last_req) {
+          double ratio = double(range_end) / double(max_end);
+          if (ratio > options_.decompress_ratio) {
+            LOG_TRACE << "block " << block_no << " over ratio: " << ratio
+                      << " > " << options_.decompress_ratio;
+            range_end = max_end;
+          }
+        }
+
         if (range_end > block->range_end()) {
           PERFMON_CLS_SCOPED_SECTION(decompress)
           PERFMON_SET_CONTEXT(range_end)
@@ -691,6 +1561,17 @@ class block_cache_ final : public block_cache::impl {
       }
     }
 
+    if (load_error) {
+      // Don't cache a block that doesn't work
+      return;
+    }
+
+    if (bypass_cache && bypass_end == block->uncompressed_size()) {
+      LOG_TRACE << "not caching block " << block_no;
+      blocks_bypassed_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
     // Finally, put the block into the cache; it might already be
     // in there, in which case we just promote it to the front of
     // the LRU queue.
@@ -701,6 +1582,13 @@ class block_cache_ final : public block_cache::impl {
         block->touch();
       }
 
+      // Replacing a different instance of the same block doesn't go
+      // through the prune hook
+      if (auto it = cache_.findWithoutPromotion(block_no);
+          it != cache_.end() && it->second != block) {
+        release_pins(it->second.get());
+      }
+
       cache_.set(block_no, std::move(block));
     }
   }
@@ -711,6 +1599,7 @@ class block_cache_ final : public block_cache::impl {
 
     while (it != cache_.end()) {
       if (predicate(*it->second)) {
+        release_pins(it->second.get());
         it = cache_.erase(it);
         blocks_tidied_.fetch_add(1, std::memory_order_relaxed);
       } else {
@@ -743,6 +1632,26 @@ class block_cache_ final : public block_cache::impl {
           });
         } break;
 
+        case cache_tidy_strategy::MEMORY_PRESSURE: {
+          // This may have to read from a couple of files, so don't hold
+          // up any readers while doing so
+          lock.unlock();
+          auto const mp = os_.get_memory_pressure();
+          lock.lock();
+
+          if (pressure_ctrl_) {
+            auto const prev = pressure_ctrl_->effective_bytes();
+
+            if (auto const bytes = pressure_ctrl_->update(mp); bytes != prev) {
+              LOG_DEBUG << "memory pressure: changing cache size from "
+                        << size_with_unit(prev) << " to "
+                        << size_with_unit(bytes);
+              pressure_adjustments_.fetch_add(1, std::memory_order_relaxed);
+              resize_cache();
+            }
+          }
+        } break;
+
         default:
           break;
         }
@@ -761,15 +1670,25 @@ class block_cache_ final : public block_cache::impl {
   std::thread tidy_thread_;
   std::condition_variable tidy_cond_;
   bool tidy_running_{false};
+  size_t block_size_{0};
+  std::optional<memory_pressure_controller> pressure_ctrl_;
+
+  uint64_t const cache_id_{next_cache_id.fetch_add(1)};
+  mutable std::mutex mx_pin_;
+  mutable std::unordered_map<std::thread::id, std::unique_ptr<pin_table>>
+      pin_tables_;
 
   mutable std::mutex mx_dec_;
   mutable folly::F14FastMap<size_t, std::weak_ptr<block_request_set>>
       decompressing_;
+  mutable folly::F14FastMap<size_t, std::shared_ptr<direct_read>>
+      direct_active_;
 
   mutable std::atomic<size_t> blocks_created_{0};
   mutable std::atomic<size_t> blocks_evicted_{0};
   mutable std::atomic<size_t> sets_merged_{0};
   mutable std::atomic<size_t> range_requests_{0};
+  mutable std::atomic<size_t> batch_requests_{0};
   mutable std::atomic<size_t> active_hits_fast_{0};
   mutable std::atomic<size_t> active_hits_slow_{0};
   mutable std::atomic<size_t> cache_hits_fast_{0};
@@ -780,6 +1699,13 @@ class block_cache_ final : public block_cache::impl {
   mutable std::atomic<size_t> blocks_tidied_{0};
   mutable std::atomic<size_t> active_expired_{0};
   mutable std::atomic<size_t> sequential_prefetches_{0};
+  mutable std::atomic<size_t> explicit_prefetches_{0};
+  mutable std::atomic<size_t> promoted_{0};
+  mutable std::atomic<size_t> cancelled_{0};
+  mutable std::atomic<size_t> pressure_adjustments_{0};
+  mutable std::atomic<size_t> blocks_bypassed_{0};
+  mutable std::atomic<size_t> direct_reads_{0};
+  mutable std::atomic<size_t> direct_reads_shared_{0};
   mutable folly::Histogram<size_t> active_set_size_{1, 0, 1024};
 
   mutable std::shared_mutex mx_wg_;
@@ -789,12 +1715,16 @@ class block_cache_ final : public block_cache::impl {
   LOG_PROXY_DECL(LoggerPolicy);
   PERFMON_CLS_PROXY_DECL
   PERFMON_CLS_TIMER_DECL(get)
+  PERFMON_CLS_TIMER_DECL(get_batch)
   PERFMON_CLS_TIMER_DECL(process)
   PERFMON_CLS_TIMER_DECL(decompress)
   std::unique_ptr<sequential_access_detector> seq_access_detector_;
   os_access const& os_;
   const block_cache_options options_;
   cache_tidy_config tidy_config_;
+  std::shared_ptr<block_pin_accounting> pin_accounting_;
+  std::shared_ptr<block_buffer_arena> arena_;
+  std::unique_ptr<compressed_cache> compressed_cache_;
 };
 
 } // namespace
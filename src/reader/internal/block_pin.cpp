@@ -0,0 +1,77 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dwarfs/reader/internal/block_pin.h>
+#include <dwarfs/reader/internal/cached_block.h>
+
+namespace dwarfs::reader::internal {
+
+bool block_pin_accounting::try_add(cached_block const& block) {
+  std::lock_guard lock(mx_);
+
+  if (auto it = pins_.find(&block); it != pins_.end()) {
+    ++it->second;
+    return true;
+  }
+
+  auto const size = block.uncompressed_size();
+  auto const pinned = pinned_bytes_.load(std::memory_order_relaxed);
+
+  if (pinned + size > budget_.load(std::memory_order_relaxed)) {
+    rejected_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  pins_.emplace(&block, 1);
+  pinned_bytes_.store(pinned + size, std::memory_order_relaxed);
+
+  if (pinned + size > peak_pinned_bytes_.load(std::memory_order_relaxed)) {
+    peak_pinned_bytes_.store(pinned + size, std::memory_order_relaxed);
+  }
+
+  return true;
+}
+
+void block_pin_accounting::remove(cached_block const& block) {
+  std::lock_guard lock(mx_);
+
+  auto it = pins_.find(&block);
+
+  if (it != pins_.end() && --it->second == 0) {
+    pins_.erase(it);
+    pinned_bytes_.fetch_sub(block.uncompressed_size(),
+                            std::memory_order_relaxed);
+  }
+}
+
+block_pin*
+block_pin::create(std::shared_ptr<cached_block const> block,
+                  std::shared_ptr<block_pin_accounting> accounting) {
+  if (!accounting->try_add(*block)) {
+    return nullptr;
+  }
+
+  return new block_pin(std::move(block), std::move(accounting));
+}
+
+block_pin::~block_pin() { accounting_->remove(*block_); }
+
+} // namespace dwarfs::reader::internal
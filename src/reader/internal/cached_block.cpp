@@ -26,6 +26,7 @@
 #endif
 
 #include <dwarfs/block_compressor.h>
+#include <dwarfs/byte_buffer.h>
 #include <dwarfs/error.h>
 #include <dwarfs/logger.h>
 #include <dwarfs/mmif.h>
@@ -43,18 +44,16 @@ template <typename LoggerPolicy>
 class cached_block_ final : public cached_block {
  public:
   cached_block_(logger& lgr, fs_section const& b, std::shared_ptr<mmif> mm,
-                bool release, bool disable_integrity_check)
-      : decompressor_(std::make_unique<block_decompressor>(
-            b.compression(), mm->as<uint8_t>(b.start()), b.length(), data_))
+                std::unique_ptr<mutable_byte_buffer> buffer,
+                compressed_data_loader load_compressed, bool release,
+                bool disable_integrity_check)
+      : data_{std::move(buffer)}
+      , load_compressed_{std::move(load_compressed)}
       , mm_(std::move(mm))
       , section_(b)
       , LOG_PROXY_INIT(lgr)
       , release_(release)
-      , uncompressed_size_{decompressor_->uncompressed_size()} {
-    if (!disable_integrity_check && !section_.check(*mm_)) {
-      DWARFS_THROW(runtime_error, "block data integrity check failed");
-    }
-  }
+      , disable_integrity_check_{disable_integrity_check} {}
 
   ~cached_block_() override {
     if (decompressor_) {
@@ -62,15 +61,41 @@ class cached_block_ final : public cached_block {
     }
   }
 
+  void load() override {
+    if (loaded_) {
+      return;
+    }
+
+    if (load_compressed_) {
+      compressed_ = load_compressed_();
+    }
+
+    // In-memory copies of compressed data have already been checked
+    // when they were fetched from the image.
+    if (!compressed_ && !disable_integrity_check_ && !section_.check(*mm_)) {
+      DWARFS_THROW(runtime_error, "block data integrity check failed");
+    }
+
+    decompressor_ = std::make_unique<block_decompressor>(
+        section_.compression(),
+        compressed_ ? compressed_->data() : mm_->as<uint8_t>(section_.start()),
+        compressed_ ? compressed_->size() : section_.length(), *data_);
+
+    uncompressed_size_ = decompressor_->uncompressed_size();
+    release_ = release_ && !compressed_;
+    load_compressed_ = nullptr;
+    loaded_ = true;
+  }
+
   // once the block is fully decompressed, we can reset the decompressor_
 
   // This can be called from any thread
   size_t range_end() const override { return range_end_.load(); }
 
-  const uint8_t* data() const override { return data_.data(); }
+  const uint8_t* data() const override { return data_->data(); }
 
   void decompress_until(size_t end) override {
-    while (data_.size() < end) {
+    while (data_->size() < end) {
       if (!decompressor_) {
         DWARFS_THROW(runtime_error, "no decompressor for block");
       }
@@ -78,12 +103,13 @@ class cached_block_ final : public cached_block {
       if (decompressor_->decompress_frame()) {
         // We're done, free the memory
         decompressor_.reset();
+        compressed_.reset();
 
         // And release the memory from the mapping
         try_release();
       }
 
-      range_end_ = data_.size();
+      range_end_ = data_->size();
     }
   }
 
@@ -101,8 +127,8 @@ class cached_block_ final : public cached_block {
 #if !(defined(_WIN32) || defined(__APPLE__))
     // TODO: should be possible to do this on Windows and macOS as well
     auto page_size = ::sysconf(_SC_PAGESIZE);
-    tmp.resize((data_.size() + page_size - 1) / page_size);
-    if (::mincore(const_cast<uint8_t*>(data_.data()), data_.size(),
+    tmp.resize((data_->size() + page_size - 1) / page_size);
+    if (::mincore(const_cast<uint8_t*>(data_->data()), data_->size(),
                   tmp.data()) == 0) {
       // i&1 == 1 means resident in memory
       return std::any_of(tmp.begin(), tmp.end(),
@@ -122,13 +148,17 @@ class cached_block_ final : public cached_block {
   }
 
   std::atomic<size_t> range_end_{0};
-  std::vector<uint8_t> data_;
+  std::unique_ptr<mutable_byte_buffer> data_;
+  compressed_data_loader load_compressed_;
+  compressed_data_ptr compressed_;
   std::unique_ptr<block_decompressor> decompressor_;
   std::shared_ptr<mmif> mm_;
   fs_section section_;
   LOG_PROXY_DECL(LoggerPolicy);
-  bool const release_;
-  size_t const uncompressed_size_;
+  bool release_;
+  bool const disable_integrity_check_;
+  bool loaded_{false};
+  size_t uncompressed_size_{0};
   std::chrono::steady_clock::time_point last_access_;
 };
 
@@ -136,10 +166,13 @@ class cached_block_ final : public cached_block {
 
 std::unique_ptr<cached_block>
 cached_block::create(logger& lgr, fs_section const& b, std::shared_ptr<mmif> mm,
-                     bool release, bool disable_integrity_check) {
+                     std::unique_ptr<mutable_byte_buffer> buffer,
+                     compressed_data_loader load_compressed, bool release,
+                     bool disable_integrity_check) {
   return make_unique_logging_object<cached_block, cached_block_,
                                     logger_policies>(
-      lgr, b, std::move(mm), release, disable_integrity_check);
+      lgr, b, std::move(mm), std::move(buffer), std::move(load_compressed),
+      release, disable_integrity_check);
 }
 
 } // namespace dwarfs::reader::internal
@@ -0,0 +1,85 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include <dwarfs/reader/internal/compressed_cache.h>
+
+namespace dwarfs::reader::internal {
+
+auto compressed_cache::get(size_t block_no) -> data_ptr {
+  std::lock_guard lock(mx_);
+
+  auto it = entries_.find(block_no);
+
+  if (it == entries_.end()) {
+    ++stats_.misses;
+    return nullptr;
+  }
+
+  lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+  ++stats_.hits;
+
+  return it->second.data;
+}
+
+auto compressed_cache::put(size_t block_no, std::span<uint8_t const> data)
+    -> data_ptr {
+  if (data.size() > max_bytes_) {
+    return nullptr;
+  }
+
+  // Copy outside of the lock, this can take a while if the data has to
+  // be paged in first
+  auto copy = std::make_shared<std::vector<uint8_t> const>(data.begin(),
+                                                           data.end());
+
+  std::lock_guard lock(mx_);
+
+  if (auto it = entries_.find(block_no); it != entries_.end()) {
+    // Someone else was faster
+    lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+    return it->second.data;
+  }
+
+  while (stats_.bytes + copy->size() > max_bytes_) {
+    auto victim = lru_.back();
+    lru_.pop_back();
+    auto it = entries_.find(victim);
+    stats_.bytes -= it->second.data->size();
+    entries_.erase(it);
+    ++stats_.evictions;
+  }
+
+  lru_.push_front(block_no);
+  entries_.emplace(block_no, entry{copy, lru_.begin()});
+  stats_.bytes += copy->size();
+  stats_.peak_bytes = std::max(stats_.peak_bytes, stats_.bytes);
+
+  return copy;
+}
+
+auto compressed_cache::get_stats() const -> stats {
+  std::lock_guard lock(mx_);
+  return stats_;
+}
+
+} // namespace dwarfs::reader::internal
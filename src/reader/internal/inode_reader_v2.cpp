@@ -23,7 +23,9 @@
 #include <cstdint>
 #include <cstring>
 #include <future>
+#include <map>
 #include <mutex>
+#include <optional>
 #include <ostream>
 #include <utility>
 #include <vector>
@@ -38,11 +40,13 @@
 #include <dwarfs/performance_monitor.h>
 #include <dwarfs/reader/inode_reader_options.h>
 #include <dwarfs/reader/iovec_read_buf.h>
+#include <dwarfs/small_vector.h>
 #include <dwarfs/util.h>
 
 #include <dwarfs/reader/internal/block_cache.h>
 #include <dwarfs/reader/internal/inode_reader_v2.h>
 #include <dwarfs/reader/internal/offset_cache.h>
+#include <dwarfs/reader/internal/range_completion.h>
 
 namespace dwarfs::reader::internal {
 
@@ -106,7 +110,8 @@ class inode_reader_ final : public inode_reader_v2::impl {
       PERFMON_CLS_TIMER_INIT(read, "offset", "size")
       PERFMON_CLS_TIMER_INIT(read_string, "offset", "size")
       PERFMON_CLS_TIMER_INIT(readv_iovec, "offset", "size")
-      PERFMON_CLS_TIMER_INIT(readv_future, "offset", "size") // clang-format on
+      PERFMON_CLS_TIMER_INIT(readv_future, "offset", "size")
+      PERFMON_CLS_TIMER_INIT(read_batch, "requests") // clang-format on
       , offset_cache_{offset_cache_size}
       , readahead_cache_{readahead_cache_size}
       , iovec_sizes_(1, 0, 256) {}
@@ -134,8 +139,14 @@ class inode_reader_ final : public inode_reader_v2::impl {
   std::vector<std::future<block_range>>
   readv(uint32_t inode, size_t size, file_off_t offset, chunk_range chunks,
         std::error_code& ec) const override;
+  void read_batch(std::span<read_request const> requests,
+                  chunk_getter const& get_chunks,
+                  read_callback const& callback) const override;
   void dump(std::ostream& os, const std::string& indent,
             chunk_range chunks) const override;
+  void prefetch_block(size_t block_no) const override {
+    cache_.prefetch(block_no);
+  }
   void set_num_workers(size_t num) override { cache_.set_num_workers(num); }
   void set_cache_tidy_config(cache_tidy_config const& cfg) override {
     cache_.set_tidy_config(cfg);
@@ -150,14 +161,33 @@ class inode_reader_ final : public inode_reader_v2::impl {
 
   using readahead_cache_type = folly::EvictingCacheMap<uint32_t, file_off_t>;
 
+  struct range_ref {
+    size_t block_no;
+    size_t offset;
+    size_t size;
+  };
+
+  template <typename RangeFunc, typename SubmitFunc>
+  void walk_chunks(uint32_t inode, size_t size, file_off_t read_offset,
+                   chunk_range chunks, bool readahead, std::error_code& ec,
+                   RangeFunc const& add_range, SubmitFunc const& submit) const;
+
   std::vector<std::future<block_range>>
   read_internal(uint32_t inode, size_t size, file_off_t offset,
                 chunk_range chunks, std::error_code& ec) const;
 
+  template <typename HandleFunc>
+  void read_sync(uint32_t inode, size_t size, file_off_t read_offset,
+                 chunk_range chunks, std::error_code& ec,
+                 HandleFunc const& handle, char* direct = nullptr) const;
+
   template <typename StoreFunc>
   size_t read_internal(uint32_t inode, size_t size, file_off_t read_offset,
                        chunk_range chunks, std::error_code& ec,
-                       const StoreFunc& store) const;
+                       const StoreFunc& store, char* direct = nullptr) const;
+
+  void read_direct(range_ref const& r, uint8_t* dest,
+                   range_completion::slot& slot) const;
 
   void do_readahead(uint32_t inode, chunk_range::iterator it,
                     chunk_range::iterator end, file_off_t read_offset,
@@ -171,6 +201,7 @@ class inode_reader_ final : public inode_reader_v2::impl {
   PERFMON_CLS_TIMER_DECL(read_string)
   PERFMON_CLS_TIMER_DECL(readv_iovec)
   PERFMON_CLS_TIMER_DECL(readv_future)
+  PERFMON_CLS_TIMER_DECL(read_batch)
   mutable offset_cache_type offset_cache_;
   mutable std::mutex readahead_cache_mutex_;
   mutable readahead_cache_type readahead_cache_;
@@ -220,7 +251,7 @@ void inode_reader_<LoggerPolicy>::do_readahead(uint32_t inode,
 
   while (it != end) {
     if (it_offset + it->size() >= readahead_pos) {
-      cache_.get(it->block(), it->offset(), it->size());
+      cache_.prefetch(it->block(), it->offset() + it->size());
     }
 
     it_offset += it->size();
@@ -234,27 +265,25 @@ void inode_reader_<LoggerPolicy>::do_readahead(uint32_t inode,
 }
 
 template <typename LoggerPolicy>
-std::vector<std::future<block_range>>
-inode_reader_<LoggerPolicy>::read_internal(uint32_t inode, size_t const size,
-                                           file_off_t const read_offset,
-                                           chunk_range chunks,
-                                           std::error_code& ec) const {
-  std::vector<std::future<block_range>> ranges;
-
+template <typename RangeFunc, typename SubmitFunc>
+void inode_reader_<LoggerPolicy>::walk_chunks(
+    uint32_t inode, size_t const size, file_off_t const read_offset,
+    chunk_range chunks, bool readahead, std::error_code& ec,
+    RangeFunc const& add_range, SubmitFunc const& submit) const {
   auto offset = read_offset;
 
   if (offset < 0) {
     // This is exactly how lseek(2) behaves when seeking before the start of
     // the file.
     ec = std::make_error_code(std::errc::invalid_argument);
-    return ranges;
+    return;
   }
 
   // request ranges from block cache
 
   if (size == 0 || chunks.empty()) {
     ec.clear();
-    return ranges;
+    return;
   }
 
   auto it = chunks.begin();
@@ -295,7 +324,7 @@ inode_reader_<LoggerPolicy>::read_internal(uint32_t inode, size_t const size,
     // Offset behind end of file. This is exactly how lseek(2) and read(2)
     // behave when seeking behind the end of the file and reading past EOF.
     ec.clear();
-    return ranges;
+    return;
   }
 
   size_t num_read = 0;
@@ -311,7 +340,7 @@ inode_reader_<LoggerPolicy>::read_internal(uint32_t inode, size_t const size,
       copysize = size - num_read;
     }
 
-    ranges.emplace_back(cache_.get(it->block(), copyoff, copysize));
+    add_range(it->block(), copyoff, copysize);
 
     num_read += copysize;
 
@@ -321,10 +350,6 @@ inode_reader_<LoggerPolicy>::read_internal(uint32_t inode, size_t const size,
         offset_cache_.set(inode, std::move(oc_ent));
       }
 
-      if (opts_.readahead > 0) {
-        do_readahead(inode, it, end, read_offset, size, it_offset);
-      }
-
       break;
     }
 
@@ -335,39 +360,152 @@ inode_reader_<LoggerPolicy>::read_internal(uint32_t inode, size_t const size,
     oc_upd.add_offset(++it_index, it_offset);
   }
 
-  return ranges;
+  // Make sure the actual request is queued before the readahead
+  submit();
+
+  if (readahead && num_read == size && opts_.readahead > 0) {
+    do_readahead(inode, it, end, read_offset, size, it_offset);
+  }
 }
 
 template <typename LoggerPolicy>
-template <typename StoreFunc>
-size_t
-inode_reader_<LoggerPolicy>::read_internal(uint32_t inode, size_t size,
-                                           file_off_t offset,
+std::vector<std::future<block_range>>
+inode_reader_<LoggerPolicy>::read_internal(uint32_t inode, size_t const size,
+                                           file_off_t const read_offset,
                                            chunk_range chunks,
-                                           std::error_code& ec,
-                                           const StoreFunc& store) const {
-  auto ranges = read_internal(inode, size, offset, chunks, ec);
+                                           std::error_code& ec) const {
+  std::vector<std::future<block_range>> ranges;
 
-  if (ec) {
-    return 0;
+  walk_chunks(inode, size, read_offset, chunks, true, ec,
+              [&](size_t block_no, size_t block_offset, size_t range_size) {
+                ranges.emplace_back(
+                    cache_.get(block_no, block_offset, range_size));
+              },
+              [] {});
+
+  return ranges;
+}
+
+template <typename LoggerPolicy>
+void inode_reader_<LoggerPolicy>::read_direct(
+    range_ref const& r, uint8_t* dest, range_completion::slot& slot) const {
+  try {
+    if (cache_.read_uncached(r.block_no, {dest, r.size})) {
+      slot.set_value(block_range(dest, 0, r.size));
+      return;
+    }
+  } catch (...) {
+    slot.set_exception(std::current_exception());
+    return;
   }
 
+  cache_.get(r.block_no, r.offset, r.size, slot);
+}
+
+template <typename LoggerPolicy>
+template <typename HandleFunc>
+void inode_reader_<LoggerPolicy>::read_sync(uint32_t inode, size_t const size,
+                                            file_off_t const read_offset,
+                                            chunk_range chunks,
+                                            std::error_code& ec,
+                                            HandleFunc const& handle,
+                                            char* direct) const {
+  // This is the hot path for FUSE reads, so we try hard not to touch the
+  // heap here: ranges are collected on the stack and completions are
+  // signalled through a stack-allocated range_completion instead of a
+  // promise/future pair per range.
+  small_vector<range_ref, range_completion::inline_storage> ranges;
+  std::optional<range_completion> rc;
+  bool have_direct{false};
+
+  // Ranges starting at the beginning of a block may cover the whole
+  // block, in which case they can be decompressed straight into the
+  // destination buffer
+  auto is_direct = [&](range_ref const& r) {
+    return direct != nullptr && r.offset == 0;
+  };
+
   try {
-    // now fill the buffer
-    size_t num_read = 0;
-    for (auto& r : ranges) {
-      auto br = r.get();
-      store(num_read, br);
-      num_read += br.size();
+    walk_chunks(
+        inode, size, read_offset, chunks, true, ec,
+        [&](size_t block_no, size_t block_offset, size_t range_size) {
+          ranges.push_back({block_no, block_offset, range_size});
+        },
+        [&] {
+          rc.emplace(ranges.size());
+          for (size_t i = 0; i < ranges.size(); ++i) {
+            auto const& r = ranges[i];
+            if (is_direct(r)) {
+              have_direct = true;
+            } else {
+              cache_.get(r.block_no, r.offset, r.size, (*rc)[i]);
+            }
+          }
+        });
+
+    if (ec || !rc) {
+      return;
+    }
+
+    if (have_direct) {
+      // Everything else has been queued by now, so the workers can get
+      // going while we're decompressing in this thread
+      size_t pos{0};
+
+      for (size_t i = 0; i < ranges.size(); ++i) {
+        auto const& r = ranges[i];
+        if (is_direct(r)) {
+          read_direct(r, reinterpret_cast<uint8_t*>(direct) + pos, (*rc)[i]);
+        }
+        pos += r.size;
+      }
     }
-    return num_read;
+  } catch (...) {
+    // Slots already handed to the cache will be completed by the cache;
+    // fail the rest so the range_completion destructor doesn't block.
+    if (rc) {
+      rc->abandon(std::current_exception());
+    }
+    throw;
+  }
+
+  rc->wait();
+
+  try {
+    handle(*rc);
+    return;
   } catch (...) {
     LOG_ERROR << exception_str(std::current_exception());
   }
 
   ec = std::make_error_code(std::errc::io_error);
+}
 
-  return 0;
+template <typename LoggerPolicy>
+template <typename StoreFunc>
+size_t
+inode_reader_<LoggerPolicy>::read_internal(uint32_t inode, size_t size,
+                                           file_off_t offset,
+                                           chunk_range chunks,
+                                           std::error_code& ec,
+                                           const StoreFunc& store,
+                                           char* direct) const {
+  size_t num_read = 0;
+
+  read_sync(
+      inode, size, offset, chunks, ec,
+      [&](range_completion& rc) {
+        // now fill the buffer
+        for (auto& slot : rc) {
+          auto& br = slot.get();
+          auto const br_size = br.size();
+          store(num_read, br);
+          num_read += br_size;
+        }
+      },
+      direct);
+
+  return ec ? 0 : num_read;
 }
 
 template <typename LoggerPolicy>
@@ -378,27 +516,22 @@ inode_reader_<LoggerPolicy>::read_string(uint32_t inode, size_t size,
   PERFMON_CLS_SCOPED_SECTION(read_string)
   PERFMON_SET_CONTEXT(static_cast<uint64_t>(offset), size);
 
-  auto ranges = read_internal(inode, size, offset, chunks, ec);
-
   std::string res;
 
-  if (!ec) {
-    try {
-      std::vector<block_range> brs(ranges.size());
-      size_t size{0};
-      for (auto& r : ranges) {
-        auto br = r.get();
-        size += br.size();
-        brs.emplace_back(std::move(br));
-      }
-      res.reserve(size);
-      for (auto const& br : brs) {
-        res.append(reinterpret_cast<char const*>(br.data()), br.size());
-      }
-    } catch (...) {
-      LOG_ERROR << exception_str(std::current_exception());
-      ec = std::make_error_code(std::errc::io_error);
+  read_sync(inode, size, offset, chunks, ec, [&](range_completion& rc) {
+    size_t total{0};
+    for (auto& slot : rc) {
+      total += slot.get().size();
+    }
+    res.reserve(total);
+    for (auto& slot : rc) {
+      auto const& br = slot.get();
+      res.append(reinterpret_cast<char const*>(br.data()), br.size());
     }
+  });
+
+  if (ec) {
+    res.clear();
   }
 
   return res;
@@ -411,10 +544,16 @@ size_t inode_reader_<LoggerPolicy>::read(char* buf, uint32_t inode, size_t size,
   PERFMON_CLS_SCOPED_SECTION(read)
   PERFMON_SET_CONTEXT(static_cast<uint64_t>(offset), size);
 
-  return read_internal(inode, size, offset, chunks, ec,
-                       [&](size_t num_read, const block_range& br) {
-                         ::memcpy(buf + num_read, br.data(), br.size());
-                       });
+  return read_internal(
+      inode, size, offset, chunks, ec,
+      [&](size_t num_read, const block_range& br) {
+        // Skip ranges that have been decompressed directly into `buf`
+        if (auto dest = buf + num_read;
+            br.data() != reinterpret_cast<uint8_t const*>(dest)) {
+          ::memcpy(dest, br.data(), br.size());
+        }
+      },
+      buf);
 }
 
 template <typename LoggerPolicy>
@@ -437,11 +576,11 @@ size_t inode_reader_<LoggerPolicy>::readv(iovec_read_buf& buf, uint32_t inode,
   PERFMON_SET_CONTEXT(static_cast<uint64_t>(offset), size);
 
   auto rv = read_internal(inode, size, offset, chunks, ec,
-                          [&](size_t, const block_range& br) {
+                          [&](size_t, block_range& br) {
                             auto& iov = buf.buf.emplace_back();
                             iov.iov_base = const_cast<uint8_t*>(br.data());
                             iov.iov_len = br.size();
-                            buf.ranges.emplace_back(br);
+                            buf.ranges.emplace_back(std::move(br));
                           });
 
   {
@@ -452,6 +591,92 @@ size_t inode_reader_<LoggerPolicy>::readv(iovec_read_buf& buf, uint32_t inode,
   return rv;
 }
 
+template <typename LoggerPolicy>
+void inode_reader_<LoggerPolicy>::read_batch(
+    std::span<read_request const> requests, chunk_getter const& get_chunks,
+    read_callback const& callback) const {
+  PERFMON_CLS_SCOPED_SECTION(read_batch)
+  PERFMON_SET_CONTEXT(requests.size())
+
+  struct pending_result {
+    read_result result;
+    size_t remaining{0};
+  };
+
+  struct range_slot {
+    size_t request;
+    size_t range;
+  };
+
+  struct block_job {
+    std::vector<block_cache::range_request> ranges;
+    std::vector<range_slot> slots;
+    std::vector<std::future<block_range>> futures;
+  };
+
+  std::vector<pending_result> pending(requests.size());
+
+  // Ordered by block number, so we submit and collect in data order
+  std::map<size_t, block_job> jobs;
+
+  for (size_t i = 0; i < requests.size(); ++i) {
+    auto const& req = requests[i];
+    auto& p = pending[i];
+
+    p.result.index = i;
+
+    auto chunks = get_chunks(req.inode, p.result.ec);
+
+    if (!p.result.ec) {
+      // No readahead here, we already know exactly what is going to be read
+      walk_chunks(req.inode, req.size, req.offset, chunks, false, p.result.ec,
+                  [&](size_t block_no, size_t block_offset,
+                      size_t range_size) {
+                    auto& job = jobs[block_no];
+                    job.ranges.push_back({block_offset, range_size});
+                    job.slots.push_back({i, p.remaining++});
+                  },
+                  [] {});
+    }
+
+    if (p.remaining == 0) {
+      callback(std::move(p.result));
+    } else {
+      p.result.ranges.resize(p.remaining);
+    }
+  }
+
+  LOG_TRACE << "batch read of " << requests.size() << " requests touches "
+            << jobs.size() << " blocks";
+
+  // Submit everything first so all blocks can be decompressed in parallel
+  for (auto& [block_no, job] : jobs) {
+    job.futures = cache_.get(block_no, job.ranges);
+  }
+
+  for (auto& [block_no, job] : jobs) {
+    for (size_t i = 0; i < job.slots.size(); ++i) {
+      auto const& slot = job.slots[i];
+      auto& p = pending[slot.request];
+
+      try {
+        p.result.ranges[slot.range] = job.futures[i].get();
+      } catch (...) {
+        LOG_ERROR << exception_str(std::current_exception());
+        p.result.ec = std::make_error_code(std::errc::io_error);
+      }
+
+      if (--p.remaining == 0) {
+        if (p.result.ec) {
+          p.result.ranges.clear();
+        }
+
+        callback(std::move(p.result));
+      }
+    }
+  }
+}
+
 inode_reader_v2::inode_reader_v2(
     logger& lgr, block_cache&& bc, inode_reader_options const& opts,
     std::shared_ptr<performance_monitor const> perfmon)
@@ -0,0 +1,80 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include <dwarfs/reader/internal/memory_pressure_controller.h>
+
+namespace dwarfs::reader::internal {
+
+namespace {
+
+// Pressure must drop below this fraction of the thresholds before the
+// cache is allowed to grow again
+constexpr double kRelaxFactor{0.5};
+constexpr double kRelaxUsageMargin{0.05};
+
+// Growing back happens in steps of max_bytes / kGrowthSteps
+constexpr size_t kGrowthSteps{8};
+
+} // namespace
+
+bool memory_pressure_controller::under_pressure(
+    memory_pressure const& mp) const {
+  if (mp.stall_pct && *mp.stall_pct >= max_stall_pct_) {
+    return true;
+  }
+
+  if (mp.current_bytes && mp.limit_bytes && *mp.limit_bytes > 0) {
+    return static_cast<double>(*mp.current_bytes) >=
+           max_memory_usage_ * static_cast<double>(*mp.limit_bytes);
+  }
+
+  return false;
+}
+
+bool memory_pressure_controller::relaxed(memory_pressure const& mp) const {
+  if (mp.stall_pct && *mp.stall_pct >= kRelaxFactor * max_stall_pct_) {
+    return false;
+  }
+
+  if (mp.current_bytes && mp.limit_bytes && *mp.limit_bytes > 0) {
+    return static_cast<double>(*mp.current_bytes) <
+           (max_memory_usage_ - kRelaxUsageMargin) *
+               static_cast<double>(*mp.limit_bytes);
+  }
+
+  return true;
+}
+
+size_t memory_pressure_controller::update(memory_pressure const& mp) {
+  if (under_pressure(mp)) {
+    effective_bytes_ /= 2;
+  } else if (relaxed(mp)) {
+    effective_bytes_ = std::min(
+        max_bytes_,
+        effective_bytes_ + std::max<size_t>(max_bytes_ / kGrowthSteps, 1));
+  }
+
+  return effective_bytes_;
+}
+
+} // namespace dwarfs::reader::internal
@@ -25,7 +25,9 @@
 #include <climits>
 #include <cstring>
 #include <ctime>
+#include <exception>
 #include <filesystem>
+#include <mutex>
 #include <numeric>
 #include <ostream>
 
@@ -58,6 +60,7 @@
 
 #include <dwarfs/internal/features.h>
 #include <dwarfs/internal/string_table.h>
+#include <dwarfs/internal/worker_group.h>
 #include <dwarfs/reader/internal/metadata_v2.h>
 
 #include <dwarfs/gen-cpp2/metadata_layouts.h>
@@ -490,6 +493,10 @@ class metadata_ final : public metadata_v2::impl {
     walk_data_order_impl(func);
   }
 
+  void walk_parallel(
+      worker_group& wg,
+      std::function<void(dir_entry_view)> const& func) const override;
+
   std::optional<inode_view> find(const char* path) const override;
   std::optional<inode_view> find(int inode) const override;
   std::optional<inode_view> find(int inode, const char* name) const override;
@@ -1406,6 +1413,68 @@ void metadata_<LoggerPolicy>::walk(uint32_t self_index, uint32_t parent_index,
   }
 }
 
+template <typename LoggerPolicy>
+void metadata_<LoggerPolicy>::walk_parallel(
+    worker_group& wg, std::function<void(dir_entry_view)> const& func) const {
+  std::mutex mx;
+  std::exception_ptr error;
+
+  // Each job handles all entries of a single directory and spawns a new job
+  // for each subdirectory, so independent subtrees are walked in parallel.
+  // As there's no shared `seen` set, each job carries its list of ancestor
+  // directories for cycle detection.
+  std::function<void(uint32_t, uint32_t, std::vector<uint32_t>)> walk_dir;
+
+  walk_dir = [&](uint32_t self_index, uint32_t parent_index,
+                 std::vector<uint32_t> ancestors) {
+    try {
+      auto dir_inode = make_dir_entry_view(self_index, parent_index).inode();
+      auto inode = dir_inode.inode_num();
+
+      if (std::find(ancestors.begin(), ancestors.end(), inode) !=
+          ancestors.end()) {
+        DWARFS_THROW(runtime_error, "cycle detected during directory walk");
+      }
+
+      ancestors.push_back(inode);
+
+      auto dir = make_directory_view(dir_inode);
+
+      for (auto cur_index : dir.entry_range()) {
+        auto entry = make_dir_entry_view(cur_index, self_index);
+        auto is_dir = entry.inode().is_directory();
+
+        func(std::move(entry));
+
+        if (is_dir) {
+          wg.add_job([&walk_dir, cur_index, self_index, ancestors] {
+            walk_dir(cur_index, self_index, ancestors);
+          });
+        }
+      }
+    } catch (...) {
+      std::lock_guard lock(mx);
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  };
+
+  auto root = make_dir_entry_view(0, 0);
+  auto root_is_dir = root.inode().is_directory();
+
+  func(std::move(root));
+
+  if (root_is_dir) {
+    wg.add_job([&walk_dir] { walk_dir(0, 0, {}); });
+    wg.wait();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
 template <typename LoggerPolicy>
 void metadata_<LoggerPolicy>::walk_data_order_impl(
     std::function<void(dir_entry_view)> const& func) const {
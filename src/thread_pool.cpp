@@ -34,6 +34,15 @@ thread_pool::thread_pool(logger& lgr, os_access const& os,
     : wg_{std::make_unique<internal::worker_group>(
           lgr, os, group_name, num_workers, max_queue_len, niceness)} {}
 
+thread_pool::thread_pool(logger& lgr, os_access const& os,
+                         const char* group_name,
+                         std::shared_ptr<cpu_budget> budget,
+                         size_t num_workers, size_t max_queue_len,
+                         int niceness)
+    : wg_{std::make_unique<internal::worker_group>(
+          lgr, os, group_name, std::move(budget), num_workers, max_queue_len,
+          niceness)} {}
+
 bool thread_pool::add_job(job_type job) { return wg_->add_job(std::move(job)); }
 
 void thread_pool::stop() { wg_->stop(); }
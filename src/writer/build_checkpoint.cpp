@@ -0,0 +1,631 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <dwarfs/checksum.h>
+#include <dwarfs/error.h>
+#include <dwarfs/file_access.h>
+#include <dwarfs/logger.h>
+#include <dwarfs/util.h>
+#include <dwarfs/version.h>
+#include <dwarfs/writer/build_checkpoint.h>
+
+namespace dwarfs::writer {
+
+namespace internal {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::array<char, 8> const kMagic{'D', 'W', 'C', 'H',
+                                           'K', 'P', 'N', 'T'};
+constexpr uint32_t const kVersion{1};
+constexpr uint32_t const kByteOrderMark{0x01020304};
+
+// Test hook: terminate the process right after this many blocks have been
+// added to the journal, as if the build had been killed
+constexpr char const* const kEnvVarAbortAfterBlocks{
+    "DWARFS_CHECKPOINT_ABORT_AFTER_BLOCKS"};
+
+enum class record_type : uint32_t {
+  block = 1,
+  ordering = 2,
+};
+
+// Like the hash cache, the journal is only ever read on the machine that
+// wrote it, so we just use the native byte order.
+struct file_header {
+  std::array<char, 8> magic;
+  uint32_t version;
+  uint32_t byte_order;
+};
+
+struct record_header {
+  record_type type;
+  // compression type for blocks, unused otherwise
+  uint32_t aux;
+  build_checkpoint::key_type key;
+  uint64_t size;
+  uint64_t data_hash;
+  // covers all of the above, so we can detect a torn header
+  uint64_t header_hash;
+};
+
+static_assert(sizeof(record_header) == 48);
+
+uint64_t xxh3_64(void const* data, size_t size) {
+  uint64_t rv;
+  checksum cs(checksum::algorithm::XXH3_64);
+  cs.update(data, size);
+  cs.finalize(&rv);
+  return rv;
+}
+
+uint64_t compute_header_hash(record_header const& rh) {
+  return xxh3_64(&rh, offsetof(record_header, header_hash));
+}
+
+void write_file_header(std::ostream& os) {
+  file_header const fh{kMagic, kVersion, kByteOrderMark};
+  os.write(reinterpret_cast<char const*>(&fh), sizeof(fh));
+}
+
+// returns the size of the record
+uint64_t write_record(std::ostream& os, record_type type, uint32_t aux,
+                      build_checkpoint::key_type const& key,
+                      std::span<uint8_t const> data, uint64_t data_hash) {
+  record_header rh{type, aux, key, data.size(), data_hash, 0};
+  rh.header_hash = compute_header_hash(rh);
+
+  os.write(reinterpret_cast<char const*>(&rh), sizeof(rh));
+  os.write(reinterpret_cast<char const*>(data.data()), data.size());
+
+  return sizeof(rh) + data.size();
+}
+
+size_t abort_after_blocks() {
+  size_t value{0};
+
+  if (auto var = std::getenv(kEnvVarAbortAfterBlocks)) {
+    std::string_view const str{var};
+    std::from_chars(str.data(), str.data() + str.size(), value);
+  }
+
+  return value;
+}
+
+} // namespace
+
+template <typename LoggerPolicy>
+class build_checkpoint_ final : public build_checkpoint::impl {
+ public:
+  using key_type = build_checkpoint::key_type;
+
+  build_checkpoint_(logger& lgr, std::shared_ptr<file_access const> fa,
+                    fs::path const& dir, std::string_view config)
+      : LOG_PROXY_INIT(lgr)
+      , fa_{std::move(fa)}
+      , dir_{dir}
+      , config_{fmt::format("{}\n{}", DWARFS_GIT_ID, config)}
+      , abort_after_blocks_{abort_after_blocks()} {
+    std::error_code ec;
+
+    fa_->create_directories(dir_, ec);
+
+    if (ec) {
+      DWARFS_THROW(runtime_error,
+                   fmt::format("cannot create checkpoint directory '{}': {}",
+                               dir_.string(), ec.message()));
+    }
+
+    // Each build appends to a journal segment of its own, so segments
+    // written by previous builds are never modified while they may still
+    // be needed. Instead, they are compacted into a single segment first.
+    while (fa_->exists(segment_path(inputs_.size()))) {
+      load(inputs_.size());
+    }
+
+    if (inputs_.size() > 1 || stats_.discarded_bytes > 0) {
+      compact();
+    }
+
+    auto const path = segment_path(inputs_.size());
+
+    os_ = fa_->open_output_binary(path, ec);
+
+    if (ec) {
+      DWARFS_THROW(runtime_error,
+                   fmt::format("cannot open checkpoint journal '{}': {}",
+                               path.string(), ec.message()));
+    }
+
+    write_file_header(os_->os());
+    os_->os().flush();
+    size_ = sizeof(file_header);
+
+    // opened on first use, see read_locked()
+    inputs_.emplace_back();
+
+    if (resumed_) {
+      LOG_INFO << "resuming from checkpoint '" << dir_.string() << "' ("
+               << stats_.loaded_blocks << " compressed blocks, "
+               << stats_.loaded_orderings << " orderings)";
+    }
+  }
+
+  fs::path const& path() const override { return dir_; }
+
+  fs::path hash_cache_path() const override { return dir_ / "hash-cache"; }
+
+  bool resumed() const override { return resumed_; }
+
+  std::optional<build_checkpoint::compressed_block>
+  find_block(key_type const& key) override {
+    std::lock_guard lock(mx_);
+
+    auto it = blocks_.find(key);
+
+    if (it == blocks_.end()) {
+      return std::nullopt;
+    }
+
+    auto data = read_locked(it->second);
+
+    if (!data) {
+      blocks_.erase(it);
+      return std::nullopt;
+    }
+
+    ++stats_.reused_blocks;
+    stats_.reused_bytes += data->size();
+
+    return build_checkpoint::compressed_block{it->second.compression,
+                                              std::move(*data)};
+  }
+
+  void add_block(key_type const& key, compression_type compression,
+                 std::span<uint8_t const> data) override {
+    std::lock_guard lock(mx_);
+
+    if (!blocks_.contains(key)) {
+      if (auto e = append_locked(record_type::block,
+                                 static_cast<uint32_t>(compression), key,
+                                 data)) {
+        blocks_.emplace(key, *e);
+        ++stats_.added_blocks;
+
+        if (stats_.added_blocks == abort_after_blocks_) {
+          std::_Exit(EXIT_FAILURE);
+        }
+      }
+    }
+  }
+
+  std::optional<std::vector<uint32_t>>
+  find_ordering(key_type const& key) override {
+    std::lock_guard lock(mx_);
+
+    auto it = orderings_.find(ordering_key(key));
+
+    if (it == orderings_.end()) {
+      return std::nullopt;
+    }
+
+    auto data = read_locked(it->second);
+
+    if (!data || data->size() % sizeof(uint32_t) != 0) {
+      orderings_.erase(it);
+      return std::nullopt;
+    }
+
+    std::vector<uint32_t> index(data->size() / sizeof(uint32_t));
+    std::memcpy(index.data(), data->data(), data->size());
+
+    ++stats_.reused_orderings;
+
+    return index;
+  }
+
+  void add_ordering(key_type const& key,
+                    std::span<uint32_t const> index) override {
+    std::lock_guard lock(mx_);
+
+    auto const okey = ordering_key(key);
+
+    if (!orderings_.contains(okey)) {
+      if (auto e = append_locked(
+              record_type::ordering, 0, okey,
+              {reinterpret_cast<uint8_t const*>(index.data()),
+               index.size_bytes()})) {
+        orderings_.emplace(okey, *e);
+        ++stats_.added_orderings;
+      }
+    }
+  }
+
+  void remove() override {
+    std::lock_guard lock(mx_);
+
+    std::error_code ec;
+
+    for (auto& is : inputs_) {
+      if (is) {
+        is->close(ec);
+      }
+    }
+
+    inputs_.clear();
+
+    if (os_) {
+      os_->close(ec);
+      os_.reset();
+    }
+
+    failed_ = true;
+    ec.clear();
+
+    fa_->remove_all(dir_, ec);
+
+    if (ec) {
+      LOG_WARN << "cannot remove checkpoint '" << dir_.string()
+               << "': " << ec.message();
+    }
+  }
+
+  build_checkpoint::stats get_stats() const override {
+    std::lock_guard lock(mx_);
+    return stats_;
+  }
+
+ private:
+  struct entry {
+    size_t segment;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t data_hash;
+    compression_type compression;
+  };
+
+  struct key_hasher {
+    size_t operator()(key_type const& key) const {
+      // the keys are hashes already
+      return static_cast<size_t>(key[0]);
+    }
+  };
+
+  using entry_map = std::unordered_map<key_type, entry, key_hasher>;
+
+  fs::path segment_path(size_t segment) const {
+    return dir_ / fmt::format("journal.{}", segment);
+  }
+
+  void load(size_t segment);
+  void compact();
+  std::optional<std::vector<uint8_t>> read_locked(entry const& e);
+  std::optional<entry>
+  append_locked(record_type type, uint32_t aux, key_type const& key,
+                std::span<uint8_t const> data);
+  key_type ordering_key(key_type const& key) const;
+
+  LOG_PROXY_DECL(LoggerPolicy);
+  std::shared_ptr<file_access const> const fa_;
+  fs::path const dir_;
+  std::string const config_;
+  size_t const abort_after_blocks_;
+  std::mutex mutable mx_;
+  // one per journal segment, the last one is the segment we append to
+  std::vector<std::unique_ptr<input_stream>> inputs_;
+  std::unique_ptr<output_stream> os_;
+  uint64_t size_{0};
+  bool resumed_{false};
+  bool failed_{false};
+  entry_map blocks_;
+  entry_map orderings_;
+  build_checkpoint::stats stats_;
+};
+
+template <typename LoggerPolicy>
+void build_checkpoint_<LoggerPolicy>::load(size_t segment) {
+  auto const path = segment_path(segment);
+  auto input = fa_->open_input_binary(path);
+  auto& is = input->is();
+
+  is.seekg(0, std::ios::end);
+  auto const file_size = static_cast<uint64_t>(is.tellg());
+  is.seekg(0);
+
+  uint64_t pos{0};
+  file_header fh;
+
+  if (is.read(reinterpret_cast<char*>(&fh), sizeof(fh))) {
+    if (fh.magic != kMagic || fh.version != kVersion ||
+        fh.byte_order != kByteOrderMark) {
+      DWARFS_THROW(runtime_error,
+                   fmt::format("'{}' is not a compatible checkpoint journal",
+                               path.string()));
+    }
+
+    pos = sizeof(fh);
+    record_header rh;
+
+    while (is.read(reinterpret_cast<char*>(&rh), sizeof(rh))) {
+      auto const data_offset = pos + sizeof(rh);
+
+      if (rh.header_hash != compute_header_hash(rh) ||
+          rh.size > file_size - data_offset) {
+        break;
+      }
+
+      entry const e{segment, data_offset, rh.size, rh.data_hash,
+                    static_cast<compression_type>(rh.aux)};
+
+      switch (rh.type) {
+      case record_type::block:
+        blocks_.emplace(rh.key, e);
+        ++stats_.loaded_blocks;
+        break;
+
+      case record_type::ordering:
+        orderings_.emplace(rh.key, e);
+        ++stats_.loaded_orderings;
+        break;
+      }
+
+      pos = data_offset + rh.size;
+      is.seekg(pos);
+    }
+  }
+
+  // Whatever follows the last complete record was being written when
+  // the previous build was interrupted. It is dropped when the journal
+  // is compacted.
+  if (pos < file_size) {
+    stats_.discarded_bytes += file_size - pos;
+    LOG_WARN << "ignoring " << size_with_unit(file_size - pos)
+             << " of incomplete data at the end of checkpoint journal '"
+             << path.string() << "'";
+  }
+
+  is.clear();
+  inputs_.push_back(std::move(input));
+
+  resumed_ = !blocks_.empty() || !orderings_.empty();
+}
+
+/**
+ * Merge all journal segments into a single one
+ *
+ * Only the complete records are copied, so incomplete data at the end of
+ * the segments is dropped. The merged segment replaces the first segment
+ * atomically, and the others are removed afterwards, highest first, so
+ * an interrupted compaction leaves a valid journal behind.
+ */
+template <typename LoggerPolicy>
+void build_checkpoint_<LoggerPolicy>::compact() {
+  auto const tmp_path = dir_ / "journal.tmp";
+  auto const num_segments = inputs_.size();
+  std::error_code ec;
+
+  auto output = fa_->open_output_binary(tmp_path, ec);
+
+  if (ec) {
+    DWARFS_THROW(runtime_error,
+                 fmt::format("cannot open checkpoint journal '{}': {}",
+                             tmp_path.string(), ec.message()));
+  }
+
+  auto& os = output->os();
+
+  write_file_header(os);
+  uint64_t size{sizeof(file_header)};
+
+  auto copy = [&](entry_map& records, record_type type) {
+    // copy the records in the order they were written
+    std::vector<typename entry_map::iterator> todo;
+    todo.reserve(records.size());
+
+    for (auto it = records.begin(); it != records.end(); ++it) {
+      todo.push_back(it);
+    }
+
+    std::ranges::sort(todo, [](auto const& a, auto const& b) {
+      return std::tie(a->second.segment, a->second.offset) <
+             std::tie(b->second.segment, b->second.offset);
+    });
+
+    for (auto it : todo) {
+      auto& e = it->second;
+
+      if (auto data = read_locked(e)) {
+        auto const record_size =
+            write_record(os, type, static_cast<uint32_t>(e.compression),
+                         it->first, *data, e.data_hash);
+        e.segment = 0;
+        e.offset = size + sizeof(record_header);
+        size += record_size;
+      } else {
+        records.erase(it);
+      }
+    }
+  };
+
+  copy(blocks_, record_type::block);
+  copy(orderings_, record_type::ordering);
+
+  for (auto& is : inputs_) {
+    if (is) {
+      is->close(ec);
+    }
+  }
+
+  inputs_.clear();
+  // opened on first use, see read_locked()
+  inputs_.emplace_back();
+
+  ec.clear();
+  output->close(ec);
+
+  if (!ec) {
+    fa_->rename(tmp_path, segment_path(0), ec);
+  }
+
+  if (ec) {
+    DWARFS_THROW(runtime_error,
+                 fmt::format("cannot write checkpoint journal '{}': {}",
+                             tmp_path.string(), ec.message()));
+  }
+
+  for (auto segment = num_segments - 1; segment > 0; --segment) {
+    fa_->remove_all(segment_path(segment), ec);
+
+    if (ec) {
+      DWARFS_THROW(runtime_error,
+                   fmt::format("cannot remove checkpoint journal '{}': {}",
+                               segment_path(segment).string(), ec.message()));
+    }
+  }
+
+  LOG_VERBOSE << "compacted " << num_segments
+              << " checkpoint journal segment(s) into "
+              << size_with_unit(size);
+}
+
+template <typename LoggerPolicy>
+auto build_checkpoint_<LoggerPolicy>::read_locked(entry const& e)
+    -> std::optional<std::vector<uint8_t>> {
+  auto& input = inputs_.at(e.segment);
+
+  if (!input) {
+    std::error_code ec;
+    input = fa_->open_input_binary(segment_path(e.segment), ec);
+
+    if (ec) {
+      LOG_WARN << "cannot read checkpoint journal '"
+               << segment_path(e.segment).string() << "': " << ec.message();
+      return std::nullopt;
+    }
+  }
+
+  auto& is = input->is();
+  std::vector<uint8_t> data(e.size);
+
+  is.clear();
+  is.seekg(e.offset);
+
+  if (!is.read(reinterpret_cast<char*>(data.data()), data.size()) ||
+      xxh3_64(data.data(), data.size()) != e.data_hash) {
+    LOG_WARN << "ignoring corrupt record at offset " << e.offset
+             << " of checkpoint journal '" << segment_path(e.segment).string()
+             << "'";
+    return std::nullopt;
+  }
+
+  return data;
+}
+
+template <typename LoggerPolicy>
+auto build_checkpoint_<LoggerPolicy>::append_locked(
+    record_type type, uint32_t aux, key_type const& key,
+    std::span<uint8_t const> data) -> std::optional<entry> {
+  if (failed_) {
+    return std::nullopt;
+  }
+
+  auto const data_hash = xxh3_64(data.data(), data.size());
+  auto& os = os_->os();
+
+  write_record(os, type, aux, key, data, data_hash);
+  os.flush();
+
+  if (!os) {
+    LOG_ERROR << "cannot write to checkpoint journal '"
+              << segment_path(inputs_.size() - 1).string()
+              << "', disabling checkpoints";
+    failed_ = true;
+    return std::nullopt;
+  }
+
+  entry const e{inputs_.size() - 1, size_ + sizeof(record_header),
+                data.size(), data_hash, static_cast<compression_type>(aux)};
+
+  size_ = e.offset + e.size;
+
+  return e;
+}
+
+template <typename LoggerPolicy>
+auto build_checkpoint_<LoggerPolicy>::ordering_key(key_type const& key) const
+    -> key_type {
+  key_type rv;
+  checksum cs(checksum::algorithm::XXH3_128);
+  cs.update(config_.data(), config_.size());
+  cs.update(key.data(), sizeof(key));
+  cs.finalize(rv.data());
+  return rv;
+}
+
+} // namespace internal
+
+build_checkpoint::build_checkpoint(logger& lgr,
+                                   std::shared_ptr<file_access const> fa,
+                                   std::filesystem::path const& dir,
+                                   std::string_view config)
+    : impl_{make_unique_logging_object<impl, internal::build_checkpoint_,
+                                       logger_policies>(lgr, std::move(fa),
+                                                        dir, config)} {}
+
+auto build_checkpoint::block_key(std::string_view compressor,
+                                 std::optional<std::string> const& meta,
+                                 std::span<uint8_t const> data) -> key_type {
+  // include the sizes so the parts cannot be confused with one another
+  uint64_t const sizes[] = {compressor.size(),
+                            meta ? meta->size() : UINT64_MAX, data.size()};
+
+  key_type key;
+  checksum cs(checksum::algorithm::XXH3_128);
+  cs.update(sizes, sizeof(sizes));
+  cs.update(compressor.data(), compressor.size());
+  if (meta) {
+    cs.update(meta->data(), meta->size());
+  }
+  cs.update(data.data(), data.size());
+  cs.finalize(key.data());
+
+  return key;
+}
+
+} // namespace dwarfs::writer
@@ -31,16 +31,21 @@
 #include <thread>
 #include <unordered_map>
 
+#include <fmt/format.h>
+
 #include <folly/system/ThreadName.h>
 
 #include <dwarfs/block_compressor.h>
 #include <dwarfs/checksum.h>
+#include <dwarfs/cpu_budget.h>
 #include <dwarfs/logger.h>
 #include <dwarfs/thread_pool.h>
 #include <dwarfs/util.h>
+#include <dwarfs/writer/build_checkpoint.h>
 #include <dwarfs/writer/compression_metadata_requirements.h>
 #include <dwarfs/writer/filesystem_writer.h>
 #include <dwarfs/writer/filesystem_writer_options.h>
+#include <dwarfs/writer/memory_budget.h>
 #include <dwarfs/writer/writer_progress.h>
 
 #include <dwarfs/internal/fs_section.h>
@@ -121,7 +126,9 @@ class fsblock {
   fsblock(section_type type, block_compressor const& bc,
           std::shared_ptr<block_data>&& data,
           std::shared_ptr<compression_progress> pctx,
-          folly::Function<void(size_t)> set_block_cb = nullptr);
+          folly::Function<void(size_t)> set_block_cb = nullptr,
+          memory_budget::reservation mem = {},
+          std::shared_ptr<build_checkpoint> checkpoint = nullptr);
 
   fsblock(section_type type, compression_type compression,
           std::span<uint8_t const> data);
@@ -184,7 +191,7 @@ class fsblock_merger_policy {
     return fsb->size();
   }
 
-  size_t worst_case_source_block_size(fragment_category /*source_id*/) const {
+  size_t worst_case_source_block_size(size_t /*source_id*/) const {
     return worst_case_block_size_;
   }
 
@@ -197,14 +204,18 @@ class raw_fsblock : public fsblock::impl {
   raw_fsblock(section_type type, const block_compressor& bc,
               std::shared_ptr<block_data>&& data,
               std::shared_ptr<compression_progress> pctx,
-              folly::Function<void(size_t)> set_block_cb)
+              folly::Function<void(size_t)> set_block_cb,
+              memory_budget::reservation mem,
+              std::shared_ptr<build_checkpoint> checkpoint)
       : type_{type}
       , bc_{bc}
       , uncompressed_size_{data->size()}
       , data_{std::move(data)}
       , comp_type_{bc_.type()}
       , pctx_{std::move(pctx)}
-      , set_block_cb_{std::move(set_block_cb)} {
+      , set_block_cb_{std::move(set_block_cb)}
+      , mem_{std::move(mem)}
+      , checkpoint_{std::move(checkpoint)} {
     DWARFS_CHECK(bc_, "block_compressor must not be null");
   }
 
@@ -214,10 +225,20 @@ class raw_fsblock : public fsblock::impl {
 
     wg.add_job([this, prom = std::move(prom),
                 meta = std::move(meta)]() mutable {
+      std::optional<build_checkpoint::key_type> key;
+
+      if (checkpoint_ && comp_type_ != compression_type::NONE) {
+        key = build_checkpoint::block_key(bc_.describe(), meta, data_->vec());
+      }
+
       try {
         std::shared_ptr<block_data> tmp;
 
-        if (meta) {
+        if (auto cached = key ? checkpoint_->find_block(*key) : std::nullopt) {
+          key.reset();
+          comp_type_ = cached->compression;
+          tmp = std::make_shared<block_data>(std::move(cached->data));
+        } else if (meta) {
           tmp = std::make_shared<block_data>(bc_.compress(data_->vec(), *meta));
         } else {
           tmp = std::make_shared<block_data>(bc_.compress(data_->vec()));
@@ -234,6 +255,14 @@ class raw_fsblock : public fsblock::impl {
         comp_type_ = compression_type::NONE;
       }
 
+      if (key) {
+        checkpoint_->add_block(*key, comp_type_, data_->vec());
+      }
+
+      // the uncompressed data is gone, only the block that is waiting
+      // to be written remains
+      mem_.transfer(memory_budget::component::write_queue, size());
+
       prom.set_value();
     });
   }
@@ -295,6 +324,8 @@ class raw_fsblock : public fsblock::impl {
   compression_type comp_type_;
   std::shared_ptr<compression_progress> pctx_;
   folly::Function<void(size_t)> set_block_cb_;
+  memory_budget::reservation mem_;
+  std::shared_ptr<build_checkpoint> checkpoint_;
 };
 
 class compressed_fsblock : public fsblock::impl {
@@ -473,10 +504,12 @@ class rewritten_fsblock : public fsblock::impl {
 fsblock::fsblock(section_type type, block_compressor const& bc,
                  std::shared_ptr<block_data>&& data,
                  std::shared_ptr<compression_progress> pctx,
-                 folly::Function<void(size_t)> set_block_cb)
-    : impl_(std::make_unique<raw_fsblock>(type, bc, std::move(data),
-                                          std::move(pctx),
-                                          std::move(set_block_cb))) {}
+                 folly::Function<void(size_t)> set_block_cb,
+                 memory_budget::reservation mem,
+                 std::shared_ptr<build_checkpoint> checkpoint)
+    : impl_(std::make_unique<raw_fsblock>(
+          type, bc, std::move(data), std::move(pctx), std::move(set_block_cb),
+          std::move(mem), std::move(checkpoint))) {}
 
 fsblock::fsblock(section_type type, compression_type compression,
                  std::span<uint8_t const> data)
@@ -563,13 +596,14 @@ class filesystem_writer_ final : public filesystem_writer_detail {
       section_type type,
       std::optional<fragment_category::value_type> cat) const override;
   void configure(std::vector<fragment_category> const& expected_categories,
-                 size_t max_active_slots) override;
+                 size_t max_active_slots,
+                 std::vector<size_t> const& shards_per_category) override;
   void configure_rewrite(size_t filesystem_size, size_t block_count) override;
   void copy_header(std::span<uint8_t const> header) override;
   void write_block(fragment_category cat, std::shared_ptr<block_data>&& data,
                    physical_block_cb_type physical_block_cb,
-                   std::optional<std::string> meta) override;
-  void finish_category(fragment_category cat) override;
+                   std::optional<std::string> meta, size_t shard) override;
+  void finish_category(fragment_category cat, size_t shard) override;
   void write_metadata_v2_schema(std::shared_ptr<block_data>&& data) override;
   void write_metadata_v2(std::shared_ptr<block_data>&& data) override;
   void write_history(std::shared_ptr<block_data>&& data) override;
@@ -585,17 +619,21 @@ class filesystem_writer_ final : public filesystem_writer_detail {
   size_t size() const override { return image_size_; }
 
  private:
+  // Each category is split into one or more shards, each of which is
+  // a separate source for the merger. Sources are numbered in category
+  // order first, then in shard order.
   using block_merger_type =
-      multi_queue_block_merger<fragment_category, std::unique_ptr<fsblock>,
+      multi_queue_block_merger<size_t, std::unique_ptr<fsblock>,
                                fsblock_merger_policy>;
   using block_holder_type = block_merger_type::block_holder_type;
 
   block_compressor const&
   compressor_for_category(fragment_category::value_type cat) const;
+  size_t merger_source(fragment_category cat, size_t shard) const;
   void
   write_block_impl(fragment_category cat, std::shared_ptr<block_data>&& data,
                    block_compressor const& bc, std::optional<std::string> meta,
-                   physical_block_cb_type physical_block_cb);
+                   physical_block_cb_type physical_block_cb, size_t shard);
   void on_block_merged(block_holder_type holder);
   void
   write_section_impl(section_type type, std::shared_ptr<block_data>&& data);
@@ -630,6 +668,8 @@ class filesystem_writer_ final : public filesystem_writer_detail {
   std::vector<uint64_t> section_index_;
   std::ostream::pos_type header_size_{0};
   std::unique_ptr<block_merger_type> merger_;
+  std::unordered_map<fragment_category, std::pair<size_t, size_t>>
+      category_sources_;
 };
 
 // TODO: Maybe we can factor out the logic to find the right compressor
@@ -772,10 +812,8 @@ template <typename LoggerPolicy>
 void filesystem_writer_<LoggerPolicy>::write_block_impl(
     fragment_category cat, std::shared_ptr<block_data>&& data,
     block_compressor const& bc, std::optional<std::string> meta,
-    physical_block_cb_type physical_block_cb) {
-  if (!merger_) {
-    DWARFS_THROW(runtime_error, "filesystem_writer not configured");
-  }
+    physical_block_cb_type physical_block_cb, size_t shard) {
+  auto const source = merger_source(cat, shard);
 
   std::shared_ptr<compression_progress> pctx;
 
@@ -789,12 +827,23 @@ void filesystem_writer_<LoggerPolicy>::write_block_impl(
     pctx = pctx_;
   }
 
+  memory_budget::reservation mem;
+
+  // Handing over a block for compression applies backpressure to the
+  // segmenter; this only ever waits for memory held by compression or
+  // scanning, which is released independently of the segmenter.
+  if (options_.memory) {
+    mem = options_.memory->reserve(memory_budget::component::compression,
+                                   data->size());
+  }
+
   auto fsb = std::make_unique<fsblock>(section_type::BLOCK, bc, std::move(data),
-                                       pctx, std::move(physical_block_cb));
+                                       pctx, std::move(physical_block_cb),
+                                       std::move(mem), options_.checkpoint);
 
   fsb->compress(wg_, meta);
 
-  merger_->add(cat, std::move(fsb));
+  merger_->add(source, std::move(fsb));
 }
 
 template <typename LoggerPolicy>
@@ -821,12 +870,35 @@ void filesystem_writer_<LoggerPolicy>::on_block_merged(
 }
 
 template <typename LoggerPolicy>
-void filesystem_writer_<LoggerPolicy>::finish_category(fragment_category cat) {
+void filesystem_writer_<LoggerPolicy>::finish_category(fragment_category cat,
+                                                       size_t shard) {
+  merger_->finish(merger_source(cat, shard));
+}
+
+template <typename LoggerPolicy>
+size_t
+filesystem_writer_<LoggerPolicy>::merger_source(fragment_category cat,
+                                                size_t shard) const {
   if (!merger_) {
     DWARFS_THROW(runtime_error, "filesystem_writer not configured");
   }
 
-  merger_->finish(cat);
+  auto it = category_sources_.find(cat);
+
+  if (it == category_sources_.end()) {
+    DWARFS_THROW(runtime_error,
+                 fmt::format("unexpected category {}", cat.value()));
+  }
+
+  auto const [first, count] = it->second;
+
+  if (shard >= count) {
+    DWARFS_THROW(runtime_error,
+                 fmt::format("invalid shard {} for category {} ({} shards)",
+                             shard, cat.value(), count));
+  }
+
+  return first + shard;
 }
 
 template <typename LoggerPolicy>
@@ -900,9 +972,9 @@ void filesystem_writer_<LoggerPolicy>::write_section(
     }
 
     // TODO: do we still need this with the merger in place?
-    while (mem_used() > options_.max_queue_size) {
-      cond_.wait(lock);
-    }
+    cpu_budget::wait(cond_, lock, [this] {
+      return mem_used() <= options_.max_queue_size;
+    });
 
     auto& bc = get_compressor(type, cat);
 
@@ -1026,13 +1098,31 @@ block_compressor const& filesystem_writer_<LoggerPolicy>::get_compressor(
 template <typename LoggerPolicy>
 void filesystem_writer_<LoggerPolicy>::configure(
     std::vector<fragment_category> const& expected_categories,
-    size_t max_active_slots) {
+    size_t max_active_slots, std::vector<size_t> const& shards_per_category) {
   if (merger_) {
     DWARFS_THROW(runtime_error, "filesystem_writer already configured");
   }
 
+  if (!shards_per_category.empty() &&
+      shards_per_category.size() != expected_categories.size()) {
+    DWARFS_THROW(runtime_error, "inconsistent number of category shards");
+  }
+
+  std::vector<size_t> sources;
+
+  for (size_t i = 0; i < expected_categories.size(); ++i) {
+    auto const count =
+        shards_per_category.empty() ? 1 : shards_per_category[i];
+    DWARFS_CHECK(count > 0, "category must have at least one shard");
+    category_sources_.emplace(expected_categories[i],
+                              std::make_pair(sources.size(), count));
+    for (size_t k = 0; k < count; ++k) {
+      sources.push_back(sources.size());
+    }
+  }
+
   merger_ = std::make_unique<block_merger_type>(
-      max_active_slots, options_.max_queue_size, expected_categories,
+      max_active_slots, options_.max_queue_size, sources,
       [this](auto&& holder) { on_block_merged(std::move(holder)); },
       fsblock_merger_policy{options_.worst_case_block_size});
 }
@@ -1061,9 +1151,10 @@ void filesystem_writer_<LoggerPolicy>::copy_header(
 template <typename LoggerPolicy>
 void filesystem_writer_<LoggerPolicy>::write_block(
     fragment_category cat, std::shared_ptr<block_data>&& data,
-    physical_block_cb_type physical_block_cb, std::optional<std::string> meta) {
+    physical_block_cb_type physical_block_cb, std::optional<std::string> meta,
+    size_t shard) {
   write_block_impl(cat, std::move(data), compressor_for_category(cat.value()),
-                   std::move(meta), std::move(physical_block_cb));
+                   std::move(meta), std::move(physical_block_cb), shard);
 }
 
 template <typename LoggerPolicy>
@@ -0,0 +1,497 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <xxhash.h>
+
+#include <dwarfs/compression_constraints.h>
+#include <dwarfs/error.h>
+#include <dwarfs/logger.h>
+#include <dwarfs/util.h>
+#include <dwarfs/writer/memory_budget.h>
+
+#include <dwarfs/writer/internal/block_data.h>
+#include <dwarfs/writer/internal/block_manager.h>
+#include <dwarfs/writer/internal/cdc_segmenter.h>
+#include <dwarfs/writer/internal/chunk_index.h>
+#include <dwarfs/writer/internal/chunkable.h>
+#include <dwarfs/writer/internal/progress.h>
+#include <dwarfs/writer/internal/segmenter_progress.h>
+
+namespace dwarfs::writer::internal {
+
+namespace {
+
+/**
+ * Content-defined chunking
+ *
+ * Rather than looking for matches of a fixed-size window in a limited
+ * number of recent blocks, this segmenter cuts the input into chunks at
+ * positions determined by the data itself (FastCDC). Identical data will
+ * be cut into identical chunks no matter where it is located, so a single
+ * fingerprint per chunk is enough to find duplicates. The fingerprints of
+ * all chunks written are kept for the whole lifetime of the segmenter,
+ * i.e. duplicates are found across the whole category, not just within
+ * the lookback window.
+ *
+ * The downside is that matches are only found at chunk granularity, so
+ * small or slightly modified repetitions are missed that the rolling hash
+ * segmenter would find.
+ *
+ * Duplicates are looked up by their 128-bit XXH3 hash and size, and their
+ * data is compared before they are referenced. This is only possible as
+ * long as the earlier copy is in the current block or one of the most
+ * recent `max_active_blocks` blocks retained by the chunk index. Earlier
+ * copies in older blocks are stored again, and the index is updated to
+ * point to the new copy, unless `cdc_hash_only` is set, in which case the
+ * hash alone is trusted.
+ *
+ * Cut points are determined using a gear hash and "normalized chunking":
+ * up to the average chunk size, a mask with more bits is used, making a
+ * cut less likely; beyond it, a mask with fewer bits is used. This keeps
+ * the chunk size distribution close to the average. Chunks are never
+ * larger than eight times the average size and, except at the end of a
+ * chunkable, never smaller than a quarter of it. All cut points are
+ * multiples of the granularity.
+ */
+
+constexpr std::array<uint64_t, 256> make_gear_table() {
+  // splitmix64 with a fixed seed; the table must never change, otherwise
+  // chunk boundaries (and thus images) would change as well
+  std::array<uint64_t, 256> table{};
+  uint64_t state{0};
+
+  for (auto& v : table) {
+    state += UINT64_C(0x9E3779B97F4A7C15);
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+    v = z ^ (z >> 31);
+  }
+
+  return table;
+}
+
+constexpr auto kGearTable = make_gear_table();
+
+constexpr unsigned kMinChunkSizeBits{6};
+
+// Rough estimate of the memory used per index entry, including hash map
+// overhead
+constexpr size_t kIndexEntryFootprint{48};
+
+constexpr uint64_t high_bits_mask(unsigned bits) {
+  return bits == 0 ? 0 : ~UINT64_C(0) << (64 - bits);
+}
+
+using chunk_location = chunk_index::location;
+
+template <typename LoggerPolicy>
+class cdc_segmenter_ final : public segmenter::impl {
+ public:
+  cdc_segmenter_(logger& lgr, progress& prog,
+                 std::shared_ptr<block_manager> blkmgr,
+                 segmenter::config const& cfg, size_t total_size,
+                 segmenter::block_ready_cb block_ready, uint32_t granularity);
+
+  void add_chunkable(chunkable& chkable) override;
+  void finish() override;
+
+  segmenter::stats get_stats() const override {
+    segmenter::stats st;
+    st.chunks = stats_.chunks;
+    st.duplicate_chunks = stats_.duplicate_chunks;
+    st.duplicate_bytes = stats_.duplicate_bytes;
+    return st;
+  }
+
+ private:
+  size_t round_down(size_t size) const {
+    return std::max<size_t>(granularity_, size - size % granularity_);
+  }
+
+  size_t round_up(size_t size) const {
+    return size + (granularity_ - size % granularity_) % granularity_;
+  }
+
+  unsigned avg_size_bits() const {
+    return static_cast<unsigned>(std::bit_width(avg_size_)) - 1;
+  }
+
+  size_t next_cut(std::span<uint8_t const> data) const;
+  std::optional<bool> verify(chunk_location const& loc,
+                             std::span<uint8_t const> data) const;
+  chunk_location append_to_block(chunkable& chkable, size_t offset,
+                                 std::span<uint8_t const> data);
+  void add_chunk(chunkable& chkable, chunk_location const& loc);
+  void finish_chunk(chunkable& chkable);
+  void block_ready();
+
+  LOG_PROXY_DECL(LoggerPolicy);
+  progress& prog_;
+  std::shared_ptr<block_manager> blkmgr_;
+  segmenter::config const cfg_;
+  segmenter::block_ready_cb block_ready_;
+  std::shared_ptr<segmenter_progress> pctx_;
+  size_t const granularity_;
+  size_t const block_size_;
+  size_t const avg_size_;
+  size_t const min_size_;
+  size_t const max_size_;
+  uint64_t const mask_small_;
+  uint64_t const mask_large_;
+
+  std::shared_ptr<block_data> block_;
+  size_t block_num_{0};
+  std::optional<chunk_location> chunk_;
+  std::shared_ptr<chunk_index> index_;
+  std::vector<size_t> own_blocks_;
+  memory_budget::reservation mem_;
+
+  struct {
+    size_t chunks{0};
+    size_t new_chunks{0};
+    size_t duplicate_chunks{0};
+    size_t duplicate_bytes{0};
+    size_t foreign_chunks{0};
+    size_t foreign_bytes{0};
+    size_t unindexed_chunks{0};
+    size_t unverified_chunks{0};
+  } stats_;
+};
+
+template <typename LoggerPolicy>
+cdc_segmenter_<LoggerPolicy>::cdc_segmenter_(
+    logger& lgr, progress& prog, std::shared_ptr<block_manager> blkmgr,
+    segmenter::config const& cfg, size_t total_size,
+    segmenter::block_ready_cb block_ready, uint32_t granularity)
+    : LOG_PROXY_INIT(lgr)
+    , prog_{prog}
+    , blkmgr_{std::move(blkmgr)}
+    , cfg_{cfg}
+    , block_ready_{std::move(block_ready)}
+    , pctx_{prog.create_context<segmenter_progress>(cfg.context, total_size)}
+    , granularity_{granularity}
+    , block_size_{round_down(static_cast<size_t>(1) << cfg.block_size_bits)}
+    , avg_size_{std::min(
+          round_down(static_cast<size_t>(1)
+                     << std::max(cfg.cdc_chunk_size_bits, kMinChunkSizeBits)),
+          round_down(block_size_ / 8))}
+    , min_size_{round_down(avg_size_ / 4)}
+    , max_size_{std::min(round_down(avg_size_ * 8), block_size_)}
+    , mask_small_{high_bits_mask(avg_size_bits() + 2)}
+    , mask_large_{high_bits_mask(avg_size_bits() - 2)}
+    , index_{cfg.shared_chunk_index ? cfg.shared_chunk_index
+                                    : std::make_shared<chunk_index>()} {
+  if (cfg_.memory) {
+    mem_ = cfg_.memory->account(memory_budget::component::segmenter,
+                                block_size_);
+  }
+
+  LOG_VERBOSE << cfg_.context << "using content-defined chunking with "
+              << size_with_unit(avg_size_) << " average chunk size ("
+              << size_with_unit(min_size_) << " min, "
+              << size_with_unit(max_size_) << " max) and " << granularity_
+              << "-byte frames"
+              << (cfg_.shared_chunk_index ? " using the shared chunk index"
+                                          : "");
+}
+
+template <typename LoggerPolicy>
+size_t
+cdc_segmenter_<LoggerPolicy>::next_cut(std::span<uint8_t const> data) const {
+  auto const size = data.size();
+
+  if (size <= min_size_) {
+    return size;
+  }
+
+  auto const normal = std::min(avg_size_, size);
+  auto const end = std::min(max_size_, size);
+  uint64_t fp{0};
+  size_t i = min_size_;
+
+  for (; i < normal; ++i) {
+    fp = (fp << 1) + kGearTable[data[i]];
+    if ((fp & mask_small_) == 0) [[unlikely]] {
+      return std::min(round_up(i + 1), end);
+    }
+  }
+
+  for (; i < end; ++i) {
+    fp = (fp << 1) + kGearTable[data[i]];
+    if ((fp & mask_large_) == 0) [[unlikely]] {
+      return std::min(round_up(i + 1), end);
+    }
+  }
+
+  return end;
+}
+
+template <typename LoggerPolicy>
+void cdc_segmenter_<LoggerPolicy>::add_chunkable(chunkable& chkable) {
+  auto const size = chkable.size();
+
+  if (size == 0) {
+    return;
+  }
+
+  DWARFS_CHECK(size % granularity_ == 0,
+               fmt::format("unexpected size {} for given granularity {}",
+                           size, granularity_));
+
+  LOG_TRACE << cfg_.context << "adding " << chkable.description();
+
+  pctx_->current_file = chkable.get_file();
+
+  auto const data = chkable.span();
+  size_t offset = 0;
+
+  while (offset < size) {
+    auto const piece = data.subspan(offset, next_cut(data.subspan(offset)));
+    auto const h = XXH3_128bits(piece.data(), piece.size());
+    chunk_index::fingerprint const fp{h.low64, h.high64};
+
+    ++stats_.chunks;
+
+    auto dup = index_->find(fp);
+    bool collision{false};
+    bool replace{false};
+
+    if (dup) {
+      auto const same = dup->size == piece.size() ? verify(*dup, piece)
+                                                  : std::optional{false};
+
+      if (same == false) {
+        LOG_WARN << cfg_.context << "hash collision for " << piece.size()
+                 << " byte chunk with chunk at block " << dup->block << " @ "
+                 << dup->offset;
+        collision = true;
+        dup.reset();
+      } else if (!same && !cfg_.cdc_hash_only) {
+        // the earlier copy is gone, store the chunk again
+        ++stats_.unverified_chunks;
+        replace = true;
+        dup.reset();
+      }
+    }
+
+    // Pieces are always cut at frame boundaries of this category, so a
+    // duplicate found in the shared index is safe to reference even if it
+    // was stored by a category with a different granularity: the data
+    // written to our own blocks stays frame aligned.
+    if (dup) {
+      LOG_TRACE << cfg_.context << "found " << piece.size()
+                << " byte duplicate at block " << dup->block << " @ "
+                << dup->offset;
+      add_chunk(chkable, *dup);
+      ++stats_.duplicate_chunks;
+      stats_.duplicate_bytes += piece.size();
+      prog_.saved_by_segmentation += piece.size();
+
+      if (!std::binary_search(own_blocks_.begin(), own_blocks_.end(),
+                              dup->block)) {
+        ++stats_.foreign_chunks;
+        stats_.foreign_bytes += piece.size();
+      }
+    } else {
+      auto const loc = append_to_block(chkable, offset, piece);
+
+      // Another segmenter sharing the index may have stored the same chunk
+      // after our lookup. The scanner prevents this by segmenting serially
+      // with a shared index, but if it does happen, the copy we just wrote
+      // is still valid; it just isn't indexed.
+      if (replace) {
+        index_->replace(fp, loc);
+      } else if (collision) {
+        // keep the entry for the chunk we collided with
+      } else if (index_->insert(fp, loc)) {
+        ++stats_.new_chunks;
+      } else {
+        LOG_TRACE << cfg_.context << "chunk was added concurrently";
+        ++stats_.unindexed_chunks;
+      }
+
+      add_chunk(chkable, loc);
+    }
+
+    offset += piece.size();
+    prog_.total_bytes_read += piece.size();
+    pctx_->bytes_processed += piece.size();
+  }
+
+  finish_chunk(chkable);
+
+  if (mem_) {
+    auto const retained =
+        std::min(own_blocks_.size(), cfg_.max_active_blocks + 1);
+    auto const footprint =
+        retained * block_size_ + stats_.new_chunks * kIndexEntryFootprint;
+    if (footprint > mem_.size()) {
+      mem_.grow(footprint - mem_.size());
+    }
+  }
+}
+
+template <typename LoggerPolicy>
+std::optional<bool>
+cdc_segmenter_<LoggerPolicy>::verify(chunk_location const& loc,
+                                     std::span<uint8_t const> data) const {
+  std::shared_ptr<block_data const> blk;
+
+  if (block_ && loc.block == block_num_) {
+    blk = block_;
+  } else {
+    blk = index_->find_block(loc.block);
+  }
+
+  if (!blk) {
+    return std::nullopt;
+  }
+
+  auto const copy =
+      std::span<uint8_t const>(blk->vec()).subspan(loc.offset, loc.size);
+
+  return std::equal(copy.begin(), copy.end(), data.begin(), data.end());
+}
+
+template <typename LoggerPolicy>
+chunk_location cdc_segmenter_<LoggerPolicy>::append_to_block(
+    chunkable& chkable, size_t offset, std::span<uint8_t const> data) {
+  // Chunks never straddle blocks, so that each of them can be referenced
+  // by a single block/offset/size triple.
+  if (block_ && block_->size() + data.size() > block_size_) {
+    chkable.release_until(offset);
+    finish_chunk(chkable);
+    block_ready();
+  }
+
+  if (!block_) {
+    block_ = std::make_shared<block_data>();
+    block_->reserve(block_size_);
+    block_num_ = blkmgr_->get_logical_block();
+    own_blocks_.push_back(block_num_);
+  }
+
+  chunk_location const loc{block_num_,
+                           static_cast<uint32_t>(block_->size()),
+                           static_cast<uint32_t>(data.size())};
+
+  block_->vec().insert(block_->vec().end(), data.begin(), data.end());
+  prog_.filesystem_size += data.size();
+
+  return loc;
+}
+
+template <typename LoggerPolicy>
+void cdc_segmenter_<LoggerPolicy>::add_chunk(chunkable& chkable,
+                                             chunk_location const& loc) {
+  // Merge with the previous chunk if they are adjacent; this is always
+  // the case for runs of new data written to the same block.
+  if (chunk_ && chunk_->block == loc.block &&
+      chunk_->offset + chunk_->size == loc.offset) {
+    chunk_->size += loc.size;
+    return;
+  }
+
+  finish_chunk(chkable);
+  chunk_ = loc;
+}
+
+template <typename LoggerPolicy>
+void cdc_segmenter_<LoggerPolicy>::finish_chunk(chunkable& chkable) {
+  if (chunk_) {
+    chkable.add_chunk(chunk_->block, chunk_->offset, chunk_->size);
+    chunk_.reset();
+    prog_.chunk_count++;
+  }
+}
+
+template <typename LoggerPolicy>
+void cdc_segmenter_<LoggerPolicy>::block_ready() {
+  index_->retain_block(block_num_, block_, cfg_.max_active_blocks);
+  block_ready_(std::move(block_), block_num_);
+  block_.reset();
+  ++prog_.block_count;
+}
+
+template <typename LoggerPolicy>
+void cdc_segmenter_<LoggerPolicy>::finish() {
+  if (block_ && !block_->empty()) {
+    block_ready();
+  }
+
+  if (stats_.chunks > 0) {
+    LOG_VERBOSE << cfg_.context << "content-defined chunking: "
+                << stats_.duplicate_chunks << "/" << stats_.chunks
+                << " duplicate chunks ("
+                << size_with_unit(stats_.duplicate_bytes) << " saved), "
+                << stats_.new_chunks << " index entries";
+
+    if (cfg_.shared_chunk_index) {
+      LOG_VERBOSE << cfg_.context << "found " << stats_.foreign_chunks
+                  << " chunks (" << size_with_unit(stats_.foreign_bytes)
+                  << ") in blocks of other categories";
+    }
+
+    if (stats_.unverified_chunks > 0) {
+      LOG_VERBOSE << cfg_.context << stats_.unverified_chunks
+                  << " duplicate chunks were stored again as their earlier"
+                     " copy was no longer available for comparison";
+    }
+
+    if (stats_.unindexed_chunks > 0) {
+      LOG_WARN << cfg_.context << stats_.unindexed_chunks
+               << " chunks were stored concurrently by another segmenter";
+    }
+  }
+
+  // a shared index is kept alive by the segmenter factory
+  index_.reset();
+  mem_.release();
+}
+
+} // namespace
+
+std::unique_ptr<segmenter::impl>
+create_cdc_segmenter(logger& lgr, progress& prog,
+                     std::shared_ptr<block_manager> blkmgr,
+                     segmenter::config const& cfg,
+                     compression_constraints const& cc, size_t total_size,
+                     segmenter::block_ready_cb block_ready) {
+  return make_unique_logging_object<segmenter::impl, cdc_segmenter_,
+                                    logger_policies>(
+      lgr, prog, std::move(blkmgr), cfg, total_size, std::move(block_ready),
+      cc.granularity.value_or(1));
+}
+
+} // namespace dwarfs::writer::internal
@@ -0,0 +1,77 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include <dwarfs/writer/internal/block_data.h>
+#include <dwarfs/writer/internal/chunk_index.h>
+
+namespace dwarfs::writer::internal {
+
+auto chunk_index::find(fingerprint const& fp) const -> std::optional<location> {
+  std::lock_guard lock(mx_);
+
+  if (auto it = index_.find(fp); it != index_.end()) {
+    return it->second;
+  }
+
+  return std::nullopt;
+}
+
+bool chunk_index::insert(fingerprint const& fp, location const& loc) {
+  std::lock_guard lock(mx_);
+  return index_.emplace(fp, loc).second;
+}
+
+void chunk_index::replace(fingerprint const& fp, location const& loc) {
+  std::lock_guard lock(mx_);
+  index_.insert_or_assign(fp, loc);
+}
+
+size_t chunk_index::size() const {
+  std::lock_guard lock(mx_);
+  return index_.size();
+}
+
+void chunk_index::retain_block(size_t block,
+                               std::shared_ptr<block_data const> data,
+                               size_t keep) {
+  std::lock_guard lock(mx_);
+
+  if (keep > 0) {
+    blocks_.emplace_back(block, std::move(data));
+  }
+
+  while (blocks_.size() > keep) {
+    blocks_.pop_front();
+  }
+}
+
+std::shared_ptr<block_data const> chunk_index::find_block(size_t block) const {
+  std::lock_guard lock(mx_);
+
+  auto it = std::find_if(blocks_.begin(), blocks_.end(),
+                         [block](auto const& b) { return b.first == block; });
+
+  return it != blocks_.end() ? it->second : nullptr;
+}
+
+} // namespace dwarfs::writer::internal
@@ -0,0 +1,255 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <array>
+
+#include <dwarfs/compiler.h>
+#include <dwarfs/error.h>
+
+#include <dwarfs/writer/internal/cyclic_hash.h>
+
+#ifdef DWARFS_MULTIVERSIONING
+#include <immintrin.h>
+#endif
+
+namespace dwarfs::writer::internal {
+
+namespace {
+
+/**
+ * The rolling hash of a window of `len` bytes is updated like this:
+ *
+ *   a[i] = a[i-1] - out[i] + in[i]
+ *   b[i] = b[i-1] - len * out[i] + a[i]
+ *
+ * So both `a` and `b` are just prefix sums (modulo 2^16) over a sequence
+ * that can be computed independently for each position, which allows us
+ * to compute the hashes for a whole vector of positions at once.
+ */
+
+#ifdef DWARFS_MULTIVERSIONING
+
+__attribute__((target("avx2"))) inline __m256i
+prefix_sum_epi16_avx2(__m256i x) {
+  x = _mm256_add_epi16(x, _mm256_slli_si256(x, 2));
+  x = _mm256_add_epi16(x, _mm256_slli_si256(x, 4));
+  x = _mm256_add_epi16(x, _mm256_slli_si256(x, 8));
+  // carry the sum of the lower 128-bit lane over to the upper lane
+  auto const last = _mm256_shuffle_epi8(x, _mm256_set1_epi16(0x0F0E));
+  return _mm256_add_epi16(x, _mm256_permute2x128_si256(last, last, 0x08));
+}
+
+__attribute__((target("avx2"))) size_t
+update_batch_avx2(uint16_t& a, uint16_t& b, uint16_t len, uint8_t const* out,
+                  uint8_t const* in, size_t count, uint32_t* hashes) {
+  static constexpr size_t kLanes{16};
+
+  auto const vlen = _mm256_set1_epi16(static_cast<int16_t>(len));
+  size_t i = 0;
+
+  for (; i + kLanes <= count; i += kLanes) {
+    auto const vin = _mm256_cvtepu8_epi16(
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(in + i)));
+    auto const vout = _mm256_cvtepu8_epi16(
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(out + i)));
+    auto const va =
+        _mm256_add_epi16(_mm256_set1_epi16(static_cast<int16_t>(a)),
+                         prefix_sum_epi16_avx2(_mm256_sub_epi16(vin, vout)));
+    auto const vb = _mm256_add_epi16(
+        _mm256_set1_epi16(static_cast<int16_t>(b)),
+        prefix_sum_epi16_avx2(
+            _mm256_sub_epi16(va, _mm256_mullo_epi16(vlen, vout))));
+    auto const lo = _mm256_unpacklo_epi16(va, vb);
+    auto const hi = _mm256_unpackhi_epi16(va, vb);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(hashes + i),
+                        _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(hashes + i + 8),
+                        _mm256_permute2x128_si256(lo, hi, 0x31));
+
+    auto const last = hashes[i + kLanes - 1];
+    a = static_cast<uint16_t>(last);
+    b = static_cast<uint16_t>(last >> 16);
+  }
+
+  return i;
+}
+
+constexpr std::array<uint16_t, 32> make_lane_array() {
+  std::array<uint16_t, 32> idx{};
+  for (size_t i = 0; i < idx.size(); ++i) {
+    idx[i] = static_cast<uint16_t>(i);
+  }
+  return idx;
+}
+
+constexpr std::array<uint16_t, 32> make_interleave_array(size_t first) {
+  std::array<uint16_t, 32> idx{};
+  for (size_t i = 0; i < idx.size(); i += 2) {
+    idx[i] = static_cast<uint16_t>(first + i / 2);
+    idx[i + 1] = static_cast<uint16_t>(first + i / 2 + 32);
+  }
+  return idx;
+}
+
+alignas(64) constexpr auto kLaneIndex = make_lane_array();
+alignas(64) constexpr auto kInterleaveLo = make_interleave_array(0);
+alignas(64) constexpr auto kInterleaveHi = make_interleave_array(16);
+
+template <int Shift>
+__attribute__((target("avx512bw"))) inline __m512i
+prefix_sum_step_avx512(__m512i x, __m512i lane) {
+  auto const idx = _mm512_sub_epi16(lane, _mm512_set1_epi16(Shift));
+  auto const mask = static_cast<__mmask32>(~((uint32_t{1} << Shift) - 1));
+  return _mm512_add_epi16(x, _mm512_maskz_permutexvar_epi16(mask, idx, x));
+}
+
+__attribute__((target("avx512bw"))) inline __m512i
+prefix_sum_epi16_avx512(__m512i x, __m512i lane) {
+  x = prefix_sum_step_avx512<1>(x, lane);
+  x = prefix_sum_step_avx512<2>(x, lane);
+  x = prefix_sum_step_avx512<4>(x, lane);
+  x = prefix_sum_step_avx512<8>(x, lane);
+  return prefix_sum_step_avx512<16>(x, lane);
+}
+
+__attribute__((target("avx512bw"))) size_t
+update_batch_avx512(uint16_t& a, uint16_t& b, uint16_t len, uint8_t const* out,
+                    uint8_t const* in, size_t count, uint32_t* hashes) {
+  static constexpr size_t kLanes{32};
+
+  auto const lane = _mm512_load_si512(kLaneIndex.data());
+  auto const ilo = _mm512_load_si512(kInterleaveLo.data());
+  auto const ihi = _mm512_load_si512(kInterleaveHi.data());
+  auto const vlen = _mm512_set1_epi16(static_cast<int16_t>(len));
+  size_t i = 0;
+
+  for (; i + kLanes <= count; i += kLanes) {
+    auto const vin = _mm512_cvtepu8_epi16(
+        _mm256_loadu_si256(reinterpret_cast<__m256i const*>(in + i)));
+    auto const vout = _mm512_cvtepu8_epi16(
+        _mm256_loadu_si256(reinterpret_cast<__m256i const*>(out + i)));
+    auto const va = _mm512_add_epi16(
+        _mm512_set1_epi16(static_cast<int16_t>(a)),
+        prefix_sum_epi16_avx512(_mm512_sub_epi16(vin, vout), lane));
+    auto const vb = _mm512_add_epi16(
+        _mm512_set1_epi16(static_cast<int16_t>(b)),
+        prefix_sum_epi16_avx512(
+            _mm512_sub_epi16(va, _mm512_mullo_epi16(vlen, vout)), lane));
+
+    _mm512_storeu_si512(hashes + i, _mm512_permutex2var_epi16(va, ilo, vb));
+    _mm512_storeu_si512(hashes + i + 16,
+                        _mm512_permutex2var_epi16(va, ihi, vb));
+
+    auto const last = hashes[i + kLanes - 1];
+    a = static_cast<uint16_t>(last);
+    b = static_cast<uint16_t>(last >> 16);
+  }
+
+  return i;
+}
+
+#endif
+
+rsync_hash::cpu_variant best_cpu_variant_init() {
+#ifdef DWARFS_MULTIVERSIONING
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512bw")) {
+    return rsync_hash::cpu_variant::has_avx512bw;
+  }
+
+  if (__builtin_cpu_supports("avx2")) {
+    return rsync_hash::cpu_variant::has_avx2;
+  }
+#endif
+
+  return rsync_hash::cpu_variant::fallback;
+}
+
+} // namespace
+
+rsync_hash::cpu_variant rsync_hash::best_cpu_variant() {
+  static cpu_variant const variant = best_cpu_variant_init();
+  return variant;
+}
+
+bool rsync_hash::is_supported(cpu_variant cpu) {
+  switch (cpu) {
+  case cpu_variant::fallback:
+    return true;
+
+  case cpu_variant::has_avx2:
+    return best_cpu_variant() != cpu_variant::fallback;
+
+  case cpu_variant::has_avx512bw:
+    return best_cpu_variant() == cpu_variant::has_avx512bw;
+  }
+
+  return false;
+}
+
+std::string_view rsync_hash::cpu_variant_name(cpu_variant cpu) {
+  switch (cpu) {
+  case cpu_variant::fallback:
+    return "fallback";
+
+  case cpu_variant::has_avx2:
+    return "AVX2";
+
+  case cpu_variant::has_avx512bw:
+    return "AVX512BW";
+  }
+
+  return "unknown";
+}
+
+void rsync_hash::update_batch(cpu_variant cpu, uint8_t const* out,
+                              uint8_t const* in, size_t count,
+                              uint32_t* hashes) {
+  DWARFS_CHECK(is_supported(cpu), "unsupported CPU variant");
+
+  size_t done = 0;
+
+#ifdef DWARFS_MULTIVERSIONING
+  auto const len = static_cast<uint16_t>(len_);
+
+  switch (cpu) {
+  case cpu_variant::has_avx512bw:
+    done = update_batch_avx512(a_, b_, len, out, in, count, hashes);
+    break;
+
+  case cpu_variant::has_avx2:
+    done = update_batch_avx2(a_, b_, len, out, in, count, hashes);
+    break;
+
+  default:
+    break;
+  }
+#endif
+
+  for (; done < count; ++done) {
+    update(out[done], in[done]);
+    hashes[done] = (*this)();
+  }
+}
+
+} // namespace dwarfs::writer::internal
@@ -269,13 +269,20 @@ void file::scan(mmif* mm, progress& prog,
       cs.update(mm->as<void>(offset), s);
     }
 
-    data_->hash.resize(cs.digest_size());
-
-    DWARFS_CHECK(cs.finalize(data_->hash.data()),
-                 "checksum computation failed");
+    set_hash(cs);
   }
 }
 
+void file::set_hash(checksum const& cs) {
+  data_->hash.resize(cs.digest_size());
+
+  DWARFS_CHECK(cs.finalize(data_->hash.data()), "checksum computation failed");
+}
+
+void file::set_hash(std::string_view hash) {
+  data_->hash.assign(hash.begin(), hash.end());
+}
+
 uint32_t file::unique_file_id() const { return inode_->num(); }
 
 void file::set_inode_num(uint32_t inode_num) {
@@ -33,15 +33,19 @@
 #include <range/v3/view/drop.hpp>
 
 #include <dwarfs/checksum.h>
+#include <dwarfs/cpu_budget.h>
 #include <dwarfs/format.h>
 #include <dwarfs/logger.h>
 #include <dwarfs/mmif.h>
 #include <dwarfs/os_access.h>
 #include <dwarfs/util.h>
+#include <dwarfs/writer/memory_budget.h>
 
 #include <dwarfs/internal/worker_group.h>
 #include <dwarfs/writer/internal/entry.h>
 #include <dwarfs/writer/internal/file_scanner.h>
+#include <dwarfs/writer/internal/file_stream.h>
+#include <dwarfs/writer/internal/hash_cache.h>
 #include <dwarfs/writer/internal/inode.h>
 #include <dwarfs/writer/internal/inode_manager.h>
 #include <dwarfs/writer/internal/progress.h>
@@ -73,8 +77,8 @@ class file_scanner_ final : public file_scanner::impl {
 
  private:
   void scan_dedupe(file* p);
-  void hash_file(file* p);
-  void add_inode(file* p, int lineno);
+  std::unique_ptr<mmif> hash_file(file* p);
+  void add_inode(file* p, int lineno, inode_manager::scan_request req = {});
 
   template <typename Lookup>
   void finalize_hardlinks(Lookup&& lookup);
@@ -136,6 +140,10 @@ class file_scanner_ final : public file_scanner::impl {
   // We need this lookup table to later find the unique_size_ entry
   // given just a file pointer.
   folly::F14FastMap<file const*, uint64_t> file_start_hash_;
+  // In single pass mode, the first file of each (size, start_hash) is
+  // hashed while its inode is scanned. We need to wait for this to
+  // finish before we can look at its hash.
+  folly::F14FastMap<file const*, std::shared_ptr<std::latch>> first_scanned_;
   folly::F14FastMap<std::pair<uint64_t, uint64_t>, std::shared_ptr<std::latch>>
       first_file_hashed_;
   folly::F14FastMap<uint64_t, inode::files_vector> by_raw_inode_;
@@ -219,6 +227,10 @@ void file_scanner_<LoggerPolicy>::scan(file* p) {
 
   prog_.original_size += p->size();
 
+  if (opts_.stream) {
+    opts_.stream->add(p);
+  }
+
   if (opts_.hash_algo) {
     scan_dedupe(p);
   } else {
@@ -275,17 +287,31 @@ void file_scanner_<LoggerPolicy>::scan_dedupe(file* p) {
 
   if (size >= kLargeFileThreshold) {
     if (!p->is_invalid()) {
-      try {
-        auto mm = os_.map_file(p->fs_path(), kLargeFileStartHashSize);
-        checksum cs(checksum::algorithm::XXH3_64);
-        cs.update(mm->addr(), kLargeFileStartHashSize);
-        cs.finalize(&start_hash);
-      } catch (...) {
-        LOG_ERROR << "failed to map file " << p->path_as_string() << ": "
-                  << exception_str(std::current_exception())
-                  << ", creating empty file";
-        ++prog_.errors;
-        p->set_invalid();
+      std::optional<uint64_t> cached;
+
+      if (opts_.cache) {
+        cached = opts_.cache->find_start_hash(*p);
+      }
+
+      if (cached) {
+        start_hash = *cached;
+      } else {
+        try {
+          auto mm = os_.map_file(p->fs_path(), kLargeFileStartHashSize);
+          checksum cs(checksum::algorithm::XXH3_64);
+          cs.update(mm->addr(), kLargeFileStartHashSize);
+          cs.finalize(&start_hash);
+
+          if (opts_.cache) {
+            opts_.cache->set_start_hash(*p, start_hash);
+          }
+        } catch (...) {
+          LOG_ERROR << "failed to map file " << p->path_as_string() << ": "
+                    << exception_str(std::current_exception())
+                    << ", creating empty file";
+          ++prog_.errors;
+          p->set_invalid();
+        }
       }
     }
 
@@ -301,9 +327,21 @@ void file_scanner_<LoggerPolicy>::scan_dedupe(file* p) {
     // create a new inode and we'll keep track of the file.
     it->second.push_back(p);
 
+    inode_manager::scan_request req;
+
+    if (opts_.single_pass) {
+      // Hash the file while it's being scanned anyway, so we don't have
+      // to read it again if another file of this (size, start_hash) shows
+      // up later.
+      auto scanned = std::make_shared<std::latch>(1);
+      first_scanned_.emplace(p, scanned);
+      req.hash_algo = opts_.hash_algo;
+      req.done = [scanned] { scanned->count_down(); };
+    }
+
     {
       std::lock_guard lock(mx_);
-      add_inode(p, __LINE__);
+      add_inode(p, __LINE__, std::move(req));
     }
   } else {
     // This file (size, start_hash) has been seen before, so this is potentially
@@ -333,9 +371,29 @@ void file_scanner_<LoggerPolicy>::scan_dedupe(file* p) {
                      "internal error: first file hashed latch already exists");
       }
 
+      auto first = it->second.front();
+      std::shared_ptr<std::latch> scanned;
+
+      if (auto fsi = first_scanned_.find(first); fsi != first_scanned_.end()) {
+        scanned = std::move(fsi->second);
+        first_scanned_.erase(fsi);
+      }
+
       // Add a job for the first file
-      wg_.add_job([this, p = it->second.front(), latch, unique_key] {
-        hash_file(p);
+      wg_.add_job([this, p = first, latch, unique_key, scanned] {
+        if (scanned) {
+          // The file is scanned by a job that was added before this one.
+          cpu_budget::blocking_section bs;
+          scanned->wait();
+        }
+
+        // The file may not have been hashed while scanning, e.g. if
+        // the scan didn't need to read the file at all
+        if (!scanned || p->hash().empty()) {
+          hash_file(p);
+        } else if (opts_.cache) {
+          opts_.cache->set_hash(*p, p->hash());
+        }
 
         {
           std::lock_guard lock(mx_);
@@ -365,11 +423,18 @@ void file_scanner_<LoggerPolicy>::scan_dedupe(file* p) {
 
     // Add a job for any subsequent files
     wg_.add_job([this, p, latch] {
-      hash_file(p);
+      auto mm = hash_file(p);
+
+      // In single pass mode, we keep the file mapped so we can scan
+      // it right away if it turns out not to be a duplicate
+      if (!opts_.single_pass) {
+        mm.reset();
+      }
 
       if (latch) {
         // Wait until the first file of this (size, start_hash) has been added
         // to `by_hash_`.
+        cpu_budget::blocking_section bs;
         latch->wait();
       }
 
@@ -384,11 +449,14 @@ void file_scanner_<LoggerPolicy>::scan_dedupe(file* p) {
 
           if (ref.empty()) {
             // This is *not* a duplicate. We must allocate a new inode.
-            add_inode(p, __LINE__);
+            add_inode(p, __LINE__, {.mm = std::move(mm)});
           } else {
             auto inode = ref.front()->get_inode();
             assert(inode);
             p->set_inode(inode);
+            if (opts_.stream) {
+              opts_.stream->set_ready(p);
+            }
             ++prog_.files_scanned;
             ++prog_.duplicate_files;
             prog_.saved_by_deduplication += p->size();
@@ -402,15 +470,27 @@ void file_scanner_<LoggerPolicy>::scan_dedupe(file* p) {
 }
 
 template <typename LoggerPolicy>
-void file_scanner_<LoggerPolicy>::hash_file(file* p) {
+std::unique_ptr<mmif> file_scanner_<LoggerPolicy>::hash_file(file* p) {
   if (p->is_invalid()) {
-    return;
+    return nullptr;
+  }
+
+  if (opts_.cache) {
+    if (auto hash = opts_.cache->find_hash(*p)) {
+      p->set_hash(*hash);
+      return nullptr;
+    }
   }
 
   auto const size = p->size();
   std::unique_ptr<mmif> mm;
+  memory_budget::reservation mem;
 
   if (size > 0) {
+    if (opts_.memory) {
+      mem = opts_.memory->reserve(memory_budget::component::scan, size);
+    }
+
     try {
       mm = os_.map_file(p->fs_path(), size);
     } catch (...) {
@@ -419,16 +499,23 @@ void file_scanner_<LoggerPolicy>::hash_file(file* p) {
                 << ", creating empty file";
       ++prog_.errors;
       p->set_invalid();
-      return;
+      return nullptr;
     }
   }
 
   prog_.current.store(p);
   p->scan(mm.get(), prog_, opts_.hash_algo);
+
+  if (opts_.cache) {
+    opts_.cache->set_hash(*p, p->hash());
+  }
+
+  return mm;
 }
 
 template <typename LoggerPolicy>
-void file_scanner_<LoggerPolicy>::add_inode(file* p, int lineno) {
+void file_scanner_<LoggerPolicy>::add_inode(file* p, int lineno,
+                                            inode_manager::scan_request req) {
   assert(!p->get_inode());
 
   auto inode = im_.create_inode();
@@ -439,7 +526,11 @@ void file_scanner_<LoggerPolicy>::add_inode(file* p, int lineno) {
     debug_inode_create_.push_back({inode.get(), p, lineno});
   }
 
-  im_.scan_background(wg_, os_, std::move(inode), p);
+  im_.scan_background(wg_, os_, std::move(inode), p, std::move(req));
+
+  if (opts_.stream) {
+    opts_.stream->set_ready(p);
+  }
 }
 
 template <typename LoggerPolicy>
@@ -0,0 +1,83 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dwarfs/cpu_budget.h>
+
+#include <dwarfs/writer/internal/file_stream.h>
+
+namespace dwarfs::writer::internal {
+
+void file_stream::add(file* p) {
+  std::lock_guard lock(mx_);
+  queue_.push_back(p);
+}
+
+void file_stream::set_ready(file const* p) {
+  bool notify{false};
+
+  {
+    std::lock_guard lock(mx_);
+    ready_.insert(p);
+    notify = !queue_.empty() && queue_.front() == p;
+  }
+
+  // only the file at the front can unblock the consumer
+  if (notify) {
+    cv_.notify_one();
+  }
+}
+
+void file_stream::close() {
+  {
+    std::lock_guard lock(mx_);
+    closed_ = true;
+  }
+
+  cv_.notify_one();
+}
+
+file* file_stream::next() {
+  std::unique_lock lock(mx_);
+
+  auto front_ready = [this] {
+    return !queue_.empty() && ready_.contains(queue_.front());
+  };
+
+  // Don't hold on to a CPU slot while waiting for the scanner
+  cpu_budget::wait(cv_, lock, [&] { return closed_ || front_ready(); });
+
+  if (!front_ready()) {
+    return nullptr;
+  }
+
+  auto p = queue_.front();
+  queue_.pop_front();
+  ready_.erase(p);
+
+  return p;
+}
+
+size_t file_stream::pending() const {
+  std::lock_guard lock(mx_);
+  return queue_.size();
+}
+
+} // namespace dwarfs::writer::internal
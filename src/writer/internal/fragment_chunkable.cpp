@@ -34,20 +34,31 @@ namespace dwarfs::writer::internal {
 fragment_chunkable::fragment_chunkable(inode const& ino,
                                        single_inode_fragment& frag,
                                        file_off_t offset, mmif& mm,
-                                       categorizer_manager const* catmgr)
+                                       categorizer_manager const* catmgr,
+                                       file const* fp)
     : ino_{ino}
     , frag_{frag}
     , offset_{offset}
     , mm_{mm}
-    , catmgr_{catmgr} {}
+    , catmgr_{catmgr}
+    , fp_{fp} {}
 
 fragment_chunkable::~fragment_chunkable() = default;
 
-file const* fragment_chunkable::get_file() const { return ino_.any(); }
+file const* fragment_chunkable::get_file() const {
+  return fp_ ? fp_ : ino_.any();
+}
 
 size_t fragment_chunkable::size() const { return frag_.size(); }
 
 std::string fragment_chunkable::description() const {
+  if (fp_) {
+    // the inode number isn't known yet either
+    return fmt::format("{}fragment at offset {} of [{}] - size: {}",
+                       category_prefix(catmgr_, frag_.category()), offset_,
+                       fp_->name(), size());
+  }
+
   return fmt::format("{}fragment at offset {} of inode {} [{}] - size: {}",
                      category_prefix(catmgr_, frag_.category()), offset_,
                      ino_.num(), ino_.any()->name(), size());
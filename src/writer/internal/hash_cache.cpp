@@ -0,0 +1,428 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <array>
+#include <istream>
+#include <numeric>
+#include <ostream>
+#include <vector>
+
+#include <folly/hash/Hash.h>
+
+#include <dwarfs/error.h>
+#include <dwarfs/match.h>
+
+#include <dwarfs/writer/internal/entry.h>
+#include <dwarfs/writer/internal/hash_cache.h>
+
+namespace dwarfs::writer::internal {
+
+namespace {
+
+constexpr std::array<char, 8> const kMagic{'D', 'W', 'H', 'C',
+                                           'A', 'C', 'H', 'E'};
+constexpr uint32_t const kVersion{1};
+constexpr uint32_t const kByteOrderMark{0x01020304};
+
+constexpr uint8_t const kHasStartHash{1 << 0};
+constexpr uint8_t const kHasScanResult{1 << 1};
+
+enum class similarity_kind : uint8_t { none, basic, nilsimsa };
+
+// The cache is only ever read on the machine that wrote it, so we just
+// use the native byte order and reject files with a different one.
+class cache_writer {
+ public:
+  explicit cache_writer(std::ostream& os)
+      : os_{os} {}
+
+  template <typename T>
+  void put(T const& v) {
+    os_.write(reinterpret_cast<char const*>(&v), sizeof(v));
+  }
+
+  void put(std::string_view str) {
+    put(static_cast<uint32_t>(str.size()));
+    os_.write(str.data(), str.size());
+  }
+
+  void put(fragment_category const& cat) {
+    put(cat.empty() ? fragment_category::uninitialized : cat.value());
+  }
+
+ private:
+  std::ostream& os_;
+};
+
+class cache_reader {
+ public:
+  explicit cache_reader(std::istream& is)
+      : is_{is} {}
+
+  template <typename T>
+  T get() {
+    T v;
+    read(&v, sizeof(v));
+    return v;
+  }
+
+  std::string get_string() {
+    auto const size = get<uint32_t>();
+    std::string str(size, '\0');
+    read(str.data(), size);
+    return str;
+  }
+
+  fragment_category get_category() {
+    auto const v = get<fragment_category::value_type>();
+    return v == fragment_category::uninitialized ? fragment_category()
+                                                 : fragment_category(v);
+  }
+
+ private:
+  void read(void* data, size_t size) {
+    if (!is_.read(static_cast<char*>(data), size)) {
+      DWARFS_THROW(runtime_error, "hash cache is truncated");
+    }
+  }
+
+  std::istream& is_;
+};
+
+} // namespace
+
+size_t hash_cache::key_hasher::operator()(key const& k) const {
+  return folly::hash::hash_combine(k.dev, k.ino, k.size, k.mtime, k.ctime);
+}
+
+hash_cache::hash_cache(std::string_view hash_algo, std::string_view config,
+                       std::time_t build_time)
+    : hash_algo_{hash_algo}
+    , config_{config}
+    , build_time_{build_time} {}
+
+hash_cache::~hash_cache() = default;
+
+auto hash_cache::make_key(file const& f) const -> std::optional<key> {
+  auto const& st = f.status();
+
+  try {
+    st.ensure_valid(file_stat::dev_valid | file_stat::ino_valid |
+                    file_stat::size_valid | file_stat::mtime_valid |
+                    file_stat::ctime_valid);
+  } catch (...) {
+    return std::nullopt;
+  }
+
+  return key{st.dev(), st.ino(), st.size(), st.mtime(), st.ctime()};
+}
+
+bool hash_cache::read(std::istream& is, entry_map& entries) const {
+  cache_reader rd(is);
+
+  std::array<char, kMagic.size()> magic;
+  for (auto& c : magic) {
+    c = rd.get<char>();
+  }
+
+  if (magic != kMagic) {
+    DWARFS_THROW(runtime_error, "not a hash cache file");
+  }
+
+  if (rd.get<uint32_t>() != kVersion ||
+      rd.get<uint32_t>() != kByteOrderMark) {
+    return false;
+  }
+
+  bool const same_algo = rd.get_string() == hash_algo_;
+  bool const same_config = rd.get_string() == config_;
+  auto const count = rd.get<uint64_t>();
+
+  for (uint64_t i = 0; i < count; ++i) {
+    key k;
+    k.dev = rd.get<file_stat::dev_type>();
+    k.ino = rd.get<file_stat::ino_type>();
+    k.size = rd.get<file_stat::off_type>();
+    k.mtime = rd.get<file_stat::time_type>();
+    k.ctime = rd.get<file_stat::time_type>();
+
+    entry e;
+    e.hash = rd.get_string();
+    auto const flags = rd.get<uint8_t>();
+
+    if (flags & kHasStartHash) {
+      e.start_hash = rd.get<uint64_t>();
+    }
+
+    if (flags & kHasScanResult) {
+      auto& res = e.scan.emplace();
+
+      for (auto n = rd.get<uint32_t>(); n > 0; --n) {
+        auto const cat = rd.get_category();
+        res.fragments.emplace_back(cat, rd.get<file_off_t>());
+      }
+
+      for (auto n = rd.get<uint32_t>(); n > 0; --n) {
+        auto const cat = rd.get_category();
+        inode_scan_result::similarity_type sim;
+
+        switch (static_cast<similarity_kind>(rd.get<uint8_t>())) {
+        case similarity_kind::none:
+          break;
+        case similarity_kind::basic:
+          sim = rd.get<uint32_t>();
+          break;
+        case similarity_kind::nilsimsa:
+          sim = rd.get<nilsimsa::hash_type>();
+          break;
+        default:
+          DWARFS_THROW(runtime_error, "invalid similarity hash in hash cache");
+        }
+
+        res.similarity.emplace_back(cat, sim);
+      }
+
+      auto const total = std::accumulate(
+          res.fragments.begin(), res.fragments.end(), file_off_t{0},
+          [](file_off_t sum, auto const& f) { return sum + f.second; });
+
+      if (res.fragments.empty() || total != k.size) {
+        DWARFS_THROW(runtime_error, "inconsistent fragments in hash cache");
+      }
+    }
+
+    if (!same_algo) {
+      e.hash.clear();
+    }
+
+    if (!same_config) {
+      e.scan.reset();
+    }
+
+    if (!e.hash.empty() || e.start_hash || e.scan) {
+      entries.insert_or_assign(k, std::move(e));
+    }
+  }
+
+  return true;
+}
+
+void hash_cache::load(std::istream& is) {
+  entry_map entries;
+
+  read(is, entries);
+
+  std::lock_guard lock(mx_);
+
+  for (auto const& [k, _] : entries) {
+    loaded_keys_.insert(k);
+  }
+
+  stats_.loaded_entries = entries.size();
+  loaded_ = std::move(entries);
+}
+
+void hash_cache::save(std::ostream& os, std::istream* current) {
+  entry_map concurrent;
+
+  if (current) {
+    try {
+      read(*current, concurrent);
+    } catch (...) {
+      // If the current file is broken, there's nothing worth preserving
+      concurrent.clear();
+    }
+  }
+
+  std::lock_guard lock(mx_);
+
+  std::vector<std::pair<key const*, entry const*>> out;
+
+  for (auto const& [k, e] : current_) {
+    if (!e.hash.empty() || e.start_hash || e.scan) {
+      out.emplace_back(&k, &e);
+    }
+  }
+
+  // Keep entries added by other builds, but not the ones we loaded and
+  // didn't need; these are most likely stale.
+  for (auto const& [k, e] : concurrent) {
+    if (loaded_keys_.count(k) == 0 && current_.count(k) == 0) {
+      out.emplace_back(&k, &e);
+    }
+  }
+
+  cache_writer wr(os);
+
+  for (auto c : kMagic) {
+    wr.put(c);
+  }
+
+  wr.put(kVersion);
+  wr.put(kByteOrderMark);
+  wr.put(std::string_view{hash_algo_});
+  wr.put(std::string_view{config_});
+  wr.put(static_cast<uint64_t>(out.size()));
+
+  for (auto const& [k, e] : out) {
+    wr.put(k->dev);
+    wr.put(k->ino);
+    wr.put(k->size);
+    wr.put(k->mtime);
+    wr.put(k->ctime);
+    wr.put(std::string_view{e->hash});
+    wr.put(static_cast<uint8_t>((e->start_hash ? kHasStartHash : 0) |
+                                (e->scan ? kHasScanResult : 0)));
+
+    if (e->start_hash) {
+      wr.put(*e->start_hash);
+    }
+
+    if (e->scan) {
+      wr.put(static_cast<uint32_t>(e->scan->fragments.size()));
+
+      for (auto const& [cat, size] : e->scan->fragments) {
+        wr.put(cat);
+        wr.put(size);
+      }
+
+      wr.put(static_cast<uint32_t>(e->scan->similarity.size()));
+
+      for (auto const& [cat, sim] : e->scan->similarity) {
+        wr.put(cat);
+        sim | match{
+                  [&wr](std::monostate const&) {
+                    wr.put(similarity_kind::none);
+                  },
+                  [&wr](uint32_t v) {
+                    wr.put(similarity_kind::basic);
+                    wr.put(v);
+                  },
+                  [&wr](nilsimsa::hash_type const& v) {
+                    wr.put(similarity_kind::nilsimsa);
+                    wr.put(v);
+                  },
+              };
+      }
+    }
+  }
+
+  stats_.saved_entries = out.size();
+}
+
+auto hash_cache::find_locked(key const& k) -> entry* {
+  if (auto it = current_.find(k); it != current_.end()) {
+    return &it->second;
+  }
+
+  if (auto it = loaded_.find(k); it != loaded_.end()) {
+    // Move the entry over, so it will be saved again
+    auto& e = current_[k];
+    e = std::move(it->second);
+    loaded_.erase(it);
+    return &e;
+  }
+
+  return nullptr;
+}
+
+auto hash_cache::current_locked(key const& k) -> entry& {
+  if (auto e = find_locked(k)) {
+    return *e;
+  }
+
+  return current_[k];
+}
+
+std::optional<std::string> hash_cache::find_hash(file const& f) {
+  if (auto k = make_key(f)) {
+    std::lock_guard lock(mx_);
+
+    if (auto e = find_locked(*k); e && !e->hash.empty()) {
+      ++stats_.hash_hits;
+      return e->hash;
+    }
+  }
+
+  return std::nullopt;
+}
+
+std::optional<uint64_t> hash_cache::find_start_hash(file const& f) {
+  if (auto k = make_key(f)) {
+    std::lock_guard lock(mx_);
+
+    if (auto e = find_locked(*k); e && e->start_hash) {
+      ++stats_.start_hash_hits;
+      return e->start_hash;
+    }
+  }
+
+  return std::nullopt;
+}
+
+std::optional<inode_scan_result> hash_cache::find_scan_result(file const& f) {
+  if (auto k = make_key(f)) {
+    std::lock_guard lock(mx_);
+
+    if (auto e = find_locked(*k); e && e->scan) {
+      ++stats_.scan_hits;
+      return e->scan;
+    }
+  }
+
+  return std::nullopt;
+}
+
+bool hash_cache::is_cacheable(key const& k) const {
+  // Like git's "racy" files: if the file was changed within the same
+  // second the build started, it could still change without its key
+  // changing.
+  return std::max(k.mtime, k.ctime) < build_time_;
+}
+
+void hash_cache::set_hash(file const& f, std::string_view hash) {
+  if (auto k = make_key(f); k && is_cacheable(*k)) {
+    std::lock_guard lock(mx_);
+    current_locked(*k).hash = hash;
+  }
+}
+
+void hash_cache::set_start_hash(file const& f, uint64_t start_hash) {
+  if (auto k = make_key(f); k && is_cacheable(*k)) {
+    std::lock_guard lock(mx_);
+    current_locked(*k).start_hash = start_hash;
+  }
+}
+
+void hash_cache::set_scan_result(file const& f, inode_scan_result const& res) {
+  if (auto k = make_key(f); k && is_cacheable(*k)) {
+    std::lock_guard lock(mx_);
+    current_locked(*k).scan = res;
+  }
+}
+
+auto hash_cache::get_stats() const -> stats {
+  std::lock_guard lock(mx_);
+  return stats_;
+}
+
+} // namespace dwarfs::writer::internal
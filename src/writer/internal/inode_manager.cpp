@@ -40,18 +40,23 @@
 #include <folly/Demangle.h>
 #include <folly/sorted_vector_types.h>
 
+#include <dwarfs/checksum.h>
 #include <dwarfs/compiler.h>
 #include <dwarfs/error.h>
 #include <dwarfs/logger.h>
 #include <dwarfs/match.h>
 #include <dwarfs/mmif.h>
 #include <dwarfs/os_access.h>
+#include <dwarfs/scope_exit.h>
 #include <dwarfs/util.h>
+#include <dwarfs/writer/build_checkpoint.h>
 #include <dwarfs/writer/categorizer.h>
 #include <dwarfs/writer/inode_options.h>
+#include <dwarfs/writer/memory_budget.h>
 
 #include <dwarfs/internal/worker_group.h>
 #include <dwarfs/writer/internal/entry.h>
+#include <dwarfs/writer/internal/hash_cache.h>
 #include <dwarfs/writer/internal/inode_manager.h>
 #include <dwarfs/writer/internal/inode_ordering.h>
 #include <dwarfs/writer/internal/nilsimsa.h>
@@ -60,6 +65,7 @@
 #include <dwarfs/writer/internal/scanner_progress.h>
 #include <dwarfs/writer/internal/similarity.h>
 #include <dwarfs/writer/internal/similarity_ordering.h>
+#include <dwarfs/writer/internal/staging_area.h>
 
 #include <dwarfs/gen-cpp2/metadata_types.h>
 
@@ -72,6 +78,47 @@ namespace {
 constexpr std::string_view const kScanContext{"[scanning] "};
 constexpr std::string_view const kCategorizeContext{"[categorizing] "};
 
+// Passes the data of a file to a scan tap in order, including any parts
+// of the file that were skipped while scanning
+class tap_feeder {
+ public:
+  tap_feeder(inode::scan_tap const* tap, mmif* mm)
+      : tap_{tap}
+      , mm_{mm} {}
+
+  void scanned(size_t offset, size_t size) {
+    if (tap_) {
+      if (auto const end = offset + size; end > next_) {
+        (*tap_)(mm_->span(next_, end - next_));
+        next_ = end;
+      }
+    }
+  }
+
+  void finish() {
+    if (mm_) {
+      scanned(0, mm_->size());
+    }
+  }
+
+ private:
+  inode::scan_tap const* tap_;
+  mmif* mm_;
+  size_t next_{0};
+};
+
+size_t num_distinct_categories(inode_fragments const& frags) {
+  std::vector<fragment_category> cats;
+
+  for (auto const& f : frags.span()) {
+    if (std::find(cats.begin(), cats.end(), f.category()) == cats.end()) {
+      cats.push_back(f.category());
+    }
+  }
+
+  return cats.size();
+}
+
 } // namespace
 
 class inode_ : public inode {
@@ -125,9 +172,12 @@ class inode_ : public inode {
     fragments_.emplace_back(categorizer_manager::default_category(), size);
   }
 
-  void scan(mmif* mm, inode_options const& opts, progress& prog) override {
+  void scan(mmif* mm, inode_options const& opts, progress& prog,
+            scan_tap const* tap) override {
     assert(fragments_.empty());
 
+    tap_feeder tf(tap, mm);
+
     categorizer_job catjob;
 
     // No job if categorizers are disabled
@@ -169,7 +219,7 @@ class inode_ : public inode {
           auto sp = make_progress_context(kCategorizeContext, mm, prog,
                                           4 * chunk_size);
           progress::scan_updater supd(prog.categorize, mm->size());
-          scan_range(mm, sp.get(), chunk_size, [&catjob](auto span) {
+          scan_range(mm, sp.get(), tf, chunk_size, [&catjob](auto span) {
             catjob.categorize_sequential(span);
           });
         }
@@ -181,7 +231,7 @@ class inode_ : public inode {
           auto sp =
               make_progress_context(kScanContext, mm, prog, 4 * chunk_size);
           progress::scan_updater supd(prog.similarity, mm->size());
-          scan_fragments(mm, sp.get(), opts, chunk_size);
+          scan_fragments(mm, sp.get(), tf, opts, chunk_size);
         }
       }
     }
@@ -197,8 +247,10 @@ class inode_ : public inode {
       auto const chunk_size = prog.similarity.chunk_size.load();
       auto sp = make_progress_context(kScanContext, mm, prog, 4 * chunk_size);
       progress::scan_updater supd(prog.similarity, size);
-      scan_full(mm, sp.get(), opts, chunk_size);
+      scan_full(mm, sp.get(), tf, opts, chunk_size);
     }
+
+    tf.finish();
   }
 
   size_t size() const override { return any()->size(); }
@@ -236,6 +288,67 @@ class inode_ : public inode {
 
   inode_fragments& fragments() override { return fragments_; }
 
+  std::optional<inode_scan_result> scan_result() const override {
+    inode_scan_result res;
+
+    for (auto const& f : fragments_.span()) {
+      // Subcategories are assigned by the categorizers at runtime, so
+      // they cannot be restored in a different run.
+      if (f.category().has_subcategory()) {
+        return std::nullopt;
+      }
+
+      res.fragments.emplace_back(f.category(), f.length());
+    }
+
+    similarity_ |
+        match{
+            [](std::monostate const&) {},
+            [&res](similarity_map_type const& map) {
+              for (auto const& [cat, val] : map) {
+                res.similarity.emplace_back(
+                    cat, val | match{[](auto const& v) {
+                           return inode_scan_result::similarity_type{v};
+                         }});
+              }
+            },
+            [this, &res](auto const& val) {
+              res.similarity.emplace_back(fragments_.get_single_category(),
+                                          val);
+            },
+        };
+
+    return res;
+  }
+
+  void restore(inode_scan_result const& res) override {
+    assert(fragments_.empty());
+
+    for (auto const& [cat, size] : res.fragments) {
+      fragments_.emplace_back(cat, size);
+    }
+
+    if (res.similarity.empty()) {
+      return;
+    }
+
+    if (fragments_.size() == 1) {
+      res.similarity.front().second |
+          match{[this](auto const& v) { similarity_ = v; }};
+    } else {
+      similarity_map_type map;
+
+      for (auto const& [cat, sim] : res.similarity) {
+        sim | match{
+                  [](std::monostate const&) {},
+                  [&map, c = cat](auto const& v) { map.emplace(c, v); },
+              };
+      }
+
+      similarity_.emplace<similarity_map_type>(std::move(map));
+    }
+  }
+
   void dump(std::ostream& os, inode_options const& options) const override {
     auto dump_category = [&os, &options](fragment_category const& cat) {
       if (options.categorizer_mgr) {
@@ -381,10 +494,11 @@ class inode_ : public inode {
   }
 
   template <typename T>
-  void scan_range(mmif* mm, scanner_progress* sprog, size_t offset, size_t size,
-                  size_t chunk_size, T&& scanner) {
+  void scan_range(mmif* mm, scanner_progress* sprog, tap_feeder& tf,
+                  size_t offset, size_t size, size_t chunk_size, T&& scanner) {
     while (size >= chunk_size) {
       scanner(mm->span(offset, chunk_size));
+      tf.scanned(offset, chunk_size);
       mm->release_until(offset);
       offset += chunk_size;
       size -= chunk_size;
@@ -394,18 +508,20 @@ class inode_ : public inode {
     }
 
     scanner(mm->span(offset, size));
+    tf.scanned(offset, size);
     if (sprog) {
       sprog->bytes_processed += size;
     }
   }
 
   template <typename T>
-  void scan_range(mmif* mm, scanner_progress* sprog, size_t chunk_size,
-                  T&& scanner) {
-    scan_range(mm, sprog, 0, mm->size(), chunk_size, std::forward<T>(scanner));
+  void scan_range(mmif* mm, scanner_progress* sprog, tap_feeder& tf,
+                  size_t chunk_size, T&& scanner) {
+    scan_range(mm, sprog, tf, 0, mm->size(), chunk_size,
+               std::forward<T>(scanner));
   }
 
-  void scan_fragments(mmif* mm, scanner_progress* sprog,
+  void scan_fragments(mmif* mm, scanner_progress* sprog, tap_feeder& tf,
                       inode_options const& opts, size_t chunk_size) {
     assert(mm);
     assert(fragments_.size() > 1);
@@ -443,9 +559,9 @@ class inode_ : public inode {
       auto const size = f.length();
 
       if (auto i = sc.find(f.category()); i != sc.end()) {
-        scan_range(mm, sprog, pos, size, chunk_size, i->second);
+        scan_range(mm, sprog, tf, pos, size, chunk_size, i->second);
       } else if (auto i = nc.find(f.category()); i != nc.end()) {
-        scan_range(mm, sprog, pos, size, chunk_size, i->second);
+        scan_range(mm, sprog, tf, pos, size, chunk_size, i->second);
       }
 
       pos += size;
@@ -467,8 +583,8 @@ class inode_ : public inode {
     similarity_.emplace<similarity_map_type>(std::move(tmp_map));
   }
 
-  void scan_full(mmif* mm, scanner_progress* sprog, inode_options const& opts,
-                 size_t chunk_size) {
+  void scan_full(mmif* mm, scanner_progress* sprog, tap_feeder& tf,
+                 inode_options const& opts, size_t chunk_size) {
     assert(fragments_.size() <= 1);
 
     if (mm) {
@@ -491,7 +607,7 @@ class inode_ : public inode {
     case fragment_order_mode::SIMILARITY: {
       similarity sc;
       if (mm) {
-        scan_range(mm, sprog, chunk_size, sc);
+        scan_range(mm, sprog, tf, chunk_size, sc);
       }
       similarity_.emplace<uint32_t>(sc.finalize());
     } break;
@@ -499,7 +615,7 @@ class inode_ : public inode {
     case fragment_order_mode::NILSIMSA: {
       nilsimsa nc;
       if (mm) {
-        scan_range(mm, sprog, chunk_size, nc);
+        scan_range(mm, sprog, tf, chunk_size, nc);
       }
       // TODO: can we finalize in-place?
       nilsimsa::hash_type hash;
@@ -538,10 +654,18 @@ class inode_ : public inode {
 template <typename LoggerPolicy>
 class inode_manager_ final : public inode_manager::impl {
  public:
-  inode_manager_(logger& lgr, progress& prog, inode_options const& opts)
+  inode_manager_(logger& lgr, progress& prog, inode_options const& opts,
+                 std::shared_ptr<memory_budget> memory,
+                 std::shared_ptr<staging_area> staging,
+                 std::shared_ptr<hash_cache> cache,
+                 std::shared_ptr<build_checkpoint> checkpoint)
       : LOG_PROXY_INIT(lgr)
       , prog_(prog)
       , opts_{opts}
+      , memory_{std::move(memory)}
+      , staging_{std::move(staging)}
+      , cache_{std::move(cache)}
+      , checkpoint_{std::move(checkpoint)}
       , inodes_need_scanning_{inodes_need_scanning(opts_)} {}
 
   std::shared_ptr<inode> create_inode() override {
@@ -612,7 +736,8 @@ class inode_manager_ final : public inode_manager::impl {
   }
 
   void scan_background(worker_group& wg, os_access const& os,
-                       std::shared_ptr<inode> ino, file* p) const override;
+                       std::shared_ptr<inode> ino, file* p,
+                       scan_request req) const override;
 
   bool has_invalid_inodes() const override;
 
@@ -647,10 +772,18 @@ class inode_manager_ final : public inode_manager::impl {
     });
   }
 
+  std::optional<build_checkpoint::key_type>
+  ordering_key(fragment_category cat, fragment_order_options const& opts,
+               sortable_inode_span const& span) const;
+
   LOG_PROXY_DECL(LoggerPolicy);
   std::vector<std::shared_ptr<inode>> inodes_;
   progress& prog_;
   inode_options opts_;
+  std::shared_ptr<memory_budget> memory_;
+  std::shared_ptr<staging_area> staging_;
+  std::shared_ptr<hash_cache> cache_;
+  std::shared_ptr<build_checkpoint> checkpoint_;
   bool const inodes_need_scanning_;
   std::atomic<size_t> mutable num_invalid_inodes_{0};
 };
@@ -659,21 +792,63 @@ template <typename LoggerPolicy>
 void inode_manager_<LoggerPolicy>::scan_background(worker_group& wg,
                                                    os_access const& os,
                                                    std::shared_ptr<inode> ino,
-                                                   file* p) const {
+                                                   file* p,
+                                                   scan_request req) const {
+  bool const stage = staging_ && staging_->accepts(p->size());
+
   // TODO: I think the size check makes everything more complex.
   //       If we don't check the size, we get the code to run
   //       that ensures `fragments_` is updated. Also, there
   //       should only ever be one empty inode, so the check
   //       doesn't actually make much of a difference.
-  if (inodes_need_scanning_ /* && p->size() > 0 */) {
-    wg.add_job([this, &os, p, ino = std::move(ino)] {
+  if (inodes_need_scanning_ /* && p->size() > 0 */ || stage) {
+    wg.add_job([this, &os, p, ino = std::move(ino), req = std::move(req),
+                stage]() mutable {
+      scope_exit done{[&req] {
+        if (req.done) {
+          req.done();
+        }
+      }};
+
       auto const size = p->size();
-      std::shared_ptr<mmif> mm;
 
-      if (size > 0 && !p->is_invalid()) {
+      if (cache_ && inodes_need_scanning_ && !p->is_invalid()) {
+        if (auto res = cache_->find_scan_result(*p)) {
+          // The file hasn't changed since the last build, so we don't
+          // need to read it now. If its hash is still needed and not
+          // cached, it'll be computed separately.
+          ino->restore(*res);
+
+          if (req.hash_algo) {
+            if (auto hash = cache_->find_hash(*p)) {
+              p->set_hash(*hash);
+            }
+          }
+
+          update_prog(ino, p);
+          return;
+        }
+      }
+
+      std::shared_ptr<mmif> mm = std::move(req.mm);
+      memory_budget::reservation mem;
+
+      if (!mm && size > 0 && !p->is_invalid()) {
+        if (memory_) {
+          mem = memory_->reserve(memory_budget::component::scan, size);
+        }
+
         try {
           mm = os.map_file(p->fs_path(), size);
         } catch (...) {
+          if (!inodes_need_scanning_) {
+            // We were only going to stage the file. Leave it to the
+            // segmenter to report the error.
+            ino->populate(size);
+            update_prog(ino, p);
+            return;
+          }
+
           p->set_invalid();
           // If this file *was* successfully mapped before, there's a slight
           // chance that there's another file with the same hash. We can only
@@ -685,12 +860,52 @@ void inode_manager_<LoggerPolicy>::scan_background(worker_group& wg,
         }
       }
 
-      ino->scan(mm.get(), opts_, prog_);
+      std::optional<checksum> cs;
+      std::optional<progress::scan_updater> supd;
+      inode::scan_tap tap;
+
+      if (req.hash_algo && mm) {
+        cs.emplace(*req.hash_algo);
+        supd.emplace(prog_.hash, size);
+        tap = [&cs](std::span<uint8_t const> data) {
+          cs->update(data.data(), data.size());
+        };
+      }
+
+      if (inodes_need_scanning_) {
+        ino->scan(mm.get(), opts_, prog_, tap ? &tap : nullptr);
+
+        if (cache_ && !p->is_invalid()) {
+          if (auto res = ino->scan_result()) {
+            cache_->set_scan_result(*p, *res);
+          }
+        }
+      } else {
+        ino->populate(size);
+        if (tap) {
+          tap(mm->span());
+        }
+      }
+
+      if (cs) {
+        p->set_hash(*cs);
+      }
+
+      // Only stage the file once we know its fragments, as the segmenter
+      // will ask for the contents once per category.
+      if (stage && mm && !p->is_invalid()) {
+        staging_->stage(*ino, *mm, num_distinct_categories(ino->fragments()));
+      }
+
       update_prog(ino, p);
     });
   } else {
     ino->populate(p->size());
     update_prog(ino, p);
+
+    if (req.done) {
+      req.done();
+    }
   }
 }
 
@@ -721,7 +936,7 @@ void inode_manager_<LoggerPolicy>::try_scan_invalid(worker_group& wg,
 
           // TODO: p = p is a workaround for older Clang versions
           wg.add_job([this, p = p, ino, mm = std::move(mm)] {
-            ino->scan(mm.get(), opts_, prog_);
+            ino->scan(mm.get(), opts_, prog_, nullptr);
             update_prog(ino, p);
           });
 
@@ -733,7 +948,7 @@ void inode_manager_<LoggerPolicy>::try_scan_invalid(worker_group& wg,
 
       assert(ino->any()->is_invalid());
 
-      ino->scan(nullptr, opts_, prog_);
+      ino->scan(nullptr, opts_, prog_, nullptr);
       update_prog(ino, ino->any());
 
       errors.emplace_back(scan_err.value());
@@ -762,6 +977,27 @@ auto inode_manager_<LoggerPolicy>::ordered_span(
   auto span = sortable_span();
   span.select([cat](auto const& v) { return v->has_category(cat); });
 
+  std::optional<build_checkpoint::key_type> key;
+
+  if (checkpoint_ && opts.mode != fragment_order_mode::NONE) {
+    key = ordering_key(cat, opts, span);
+  }
+
+  if (key) {
+    if (auto index = checkpoint_->find_ordering(*key)) {
+      auto sorted = *index;
+      std::sort(sorted.begin(), sorted.end());
+
+      // only accept a permutation of exactly the selected inodes
+      if (sorted == span.index()) {
+        span.index() = std::move(*index);
+        LOG_VERBOSE << prefix << "restored order of " << span.size()
+                    << " inodes from checkpoint";
+        return span;
+      }
+    }
+  }
+
   inode_ordering order(LOG_GET_LOGGER, prog_, opts_);
 
   switch (opts.mode) {
@@ -810,12 +1046,61 @@ auto inode_manager_<LoggerPolicy>::ordered_span(
   }
   }
 
+  if (key) {
+    checkpoint_->add_ordering(*key, span.index());
+  }
+
   return span;
 }
 
+template <typename LoggerPolicy>
+auto inode_manager_<LoggerPolicy>::ordering_key(
+    fragment_category cat, fragment_order_options const& opts,
+    sortable_inode_span const& span) const
+    -> std::optional<build_checkpoint::key_type> {
+  uint64_t const params[] = {
+      cat.value(),
+      cat.has_subcategory() ? cat.subcategory() : UINT64_MAX,
+      static_cast<uint64_t>(opts.mode),
+      static_cast<uint64_t>(opts.nilsimsa_max_children),
+      static_cast<uint64_t>(opts.nilsimsa_max_cluster_size),
+      span.size()};
+
+  checksum cs(checksum::algorithm::XXH3_128);
+  cs.update(params, sizeof(params));
+
+  for (size_t i = 0; i < span.size(); ++i) {
+    auto const& ino = span[i];
+    auto const* fp = ino->any();
+    auto const path = fp->path_as_string();
+    auto const hash = fp->hash();
+
+    // without a content hash, we cannot tell if the input has changed
+    if (hash.empty()) {
+      return std::nullopt;
+    }
+
+    uint64_t const sizes[] = {ino->size(), path.size(), hash.size()};
+    cs.update(sizes, sizeof(sizes));
+    cs.update(path.data(), path.size());
+    cs.update(hash.data(), hash.size());
+  }
+
+  build_checkpoint::key_type key;
+  cs.finalize(key.data());
+
+  return key;
+}
+
 inode_manager::inode_manager(logger& lgr, progress& prog,
-                             inode_options const& opts)
+                             inode_options const& opts,
+                             std::shared_ptr<memory_budget> memory,
+                             std::shared_ptr<staging_area> staging,
+                             std::shared_ptr<hash_cache> cache,
+                             std::shared_ptr<build_checkpoint> checkpoint)
     : impl_(make_unique_logging_object<impl, internal::inode_manager_,
-                                       logger_policies>(lgr, prog, opts)) {}
+                                       logger_policies>(
+          lgr, prog, opts, std::move(memory), std::move(staging),
+          std::move(cache), std::move(checkpoint))) {}
 
 } // namespace dwarfs::writer::internal
@@ -21,6 +21,7 @@
 
 #include <algorithm>
 
+#include <dwarfs/cpu_budget.h>
 #include <dwarfs/logger.h>
 #include <dwarfs/writer/inode_options.h>
 
@@ -202,6 +203,13 @@ void inode_ordering_<LoggerPolicy>::by_nilsimsa_impl(
   auto sim_order = similarity_ordering(LOG_GET_LOGGER, prog_, wg, opts);
   sim_order.order_nilsimsa(ev, make_receiver(std::move(promise)),
                            std::move(index));
+
+  {
+    // The ordering jobs may need our CPU budget slot
+    cpu_budget::blocking_section bs;
+    future.wait();
+  }
+
   future.get().swap(index);
 }
 
@@ -0,0 +1,47 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dwarfs/writer/internal/entry.h>
+#include <dwarfs/writer/internal/segmenter_progress.h>
+
+namespace dwarfs::writer::internal {
+
+segmenter_progress::segmenter_progress(std::string context, size_t total_size)
+    : context_{std::move(context)}
+    , bytes_total_{total_size} {}
+
+auto segmenter_progress::get_status() const -> status {
+  auto f = current_file.load();
+  status st;
+  st.color = termcolor::GREEN;
+  st.context = context_;
+  if (f) {
+    st.path.emplace(f->path_as_string());
+  }
+  st.bytes_processed.emplace(bytes_processed.load());
+  // the total size is unknown when segmenting while scanning
+  if (bytes_total_ > 0) {
+    st.bytes_total.emplace(bytes_total_);
+  }
+  return st;
+}
+
+} // namespace dwarfs::writer::internal
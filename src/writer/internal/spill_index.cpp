@@ -0,0 +1,157 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <fmt/format.h>
+
+#include <dwarfs/error.h>
+
+#include <dwarfs/writer/internal/spill_index.h>
+
+namespace dwarfs::writer::internal {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t kInitialCapacityBits{16};
+
+// Spilled block data is stored in segments of this size, unless a single
+// block is larger. Segment files are sparse on most file systems, so the
+// unused part of the last segment doesn't take up any space.
+constexpr size_t kSegmentSize{static_cast<size_t>(256) << 20};
+
+// Identical data in many retired blocks would otherwise lead to long
+// probe sequences; it's sufficient to be able to find a few of them.
+constexpr size_t kMaxEntriesPerHash{8};
+
+boost::iostreams::mapped_file create_mapping(fs::path const& path,
+                                            size_t size) {
+  boost::iostreams::mapped_file_params params;
+  params.path = path.string();
+  params.flags = boost::iostreams::mapped_file::readwrite;
+  params.new_file_size = size;
+
+  // newly created files are zero-filled, i.e. all slots are empty
+  boost::iostreams::mapped_file mf;
+
+  try {
+    mf.open(params);
+  } catch (std::exception const& e) {
+    DWARFS_THROW(runtime_error, fmt::format("cannot create spill file {}: {}",
+                                            path.string(), e.what()));
+  }
+
+  return mf;
+}
+
+} // namespace
+
+spill_index::spill_index(fs::path const& dir)
+    : dir_{"dwarfs-spill", dir}
+    , table_path_{dir_.path() / "index.0"}
+    , capacity_bits_{kInitialCapacityBits}
+    , capacity_{static_cast<size_t>(1) << capacity_bits_} {
+  table_ = create_mapping(table_path_, capacity_ * sizeof(slot));
+}
+
+spill_index::~spill_index() {
+  table_.close();
+
+  for (auto& seg : segments_) {
+    seg.file.close();
+  }
+}
+
+void spill_index::add_block(size_t block_num, std::span<uint8_t const> data) {
+  // Blocks never straddle segments
+  if (segments_.empty() ||
+      segments_.back().size + data.size() > segments_.back().file.size()) {
+    auto const path = dir_.path() / fmt::format("data.{}", segments_.size());
+    segments_.push_back(
+        {create_mapping(path, std::max(kSegmentSize, data.size())), 0});
+  }
+
+  auto& seg = segments_.back();
+
+  std::memcpy(seg.file.data() + seg.size, data.data(), data.size());
+
+  blocks_.push_back({block_num, segments_.size() - 1, seg.size, data.size()});
+  seg.size += data.size();
+  data_size_ += data.size();
+}
+
+void spill_index::add(uint32_t hash, uint32_t offset) {
+  if (2 * (size_ + 1) > capacity_) {
+    grow();
+  }
+
+  insert({hash, static_cast<uint32_t>(blocks_.size()), offset});
+}
+
+std::span<uint8_t const>
+spill_index::block_span(spilled_block const& blk) const {
+  auto const* const base = reinterpret_cast<uint8_t const*>(
+      segments_[blk.segment].file.const_data());
+  return {base + blk.offset, blk.size};
+}
+
+void spill_index::insert(slot const& s) {
+  auto* const slots = table();
+  size_t same_hash = 0;
+  auto i = slot_index(s.hash);
+
+  for (; slots[i].block != 0; i = (i + 1) & (capacity_ - 1)) {
+    if (slots[i].hash == s.hash && ++same_hash >= kMaxEntriesPerHash) {
+      return;
+    }
+  }
+
+  slots[i] = s;
+  ++size_;
+}
+
+void spill_index::grow() {
+  auto old_table = std::move(table_);
+  auto old_path = table_path_;
+  auto const old_capacity = capacity_;
+  auto const* const old_slots =
+      reinterpret_cast<slot const*>(old_table.const_data());
+
+  ++capacity_bits_;
+  capacity_ = static_cast<size_t>(1) << capacity_bits_;
+  table_path_ = dir_.path() / fmt::format("index.{}", capacity_bits_);
+  table_ = create_mapping(table_path_, capacity_ * sizeof(slot));
+  size_ = 0;
+
+  for (size_t i = 0; i < old_capacity; ++i) {
+    if (old_slots[i].block != 0) {
+      insert(old_slots[i]);
+    }
+  }
+
+  old_table.close();
+  fs::remove(old_path);
+}
+
+} // namespace dwarfs::writer::internal
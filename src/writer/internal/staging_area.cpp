@@ -0,0 +1,114 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <dwarfs/mmif.h>
+
+#include <dwarfs/writer/internal/staging_area.h>
+
+namespace dwarfs::writer::internal {
+
+class staging_area::staged_file : public mmif {
+ public:
+  explicit staged_file(mmif const& mm)
+      : data_(mm.span().begin(), mm.span().end())
+      , path_{mm.path()} {}
+
+  void const* addr() const override { return data_.data(); }
+  size_t size() const override { return data_.size(); }
+
+  std::error_code lock(file_off_t, size_t) override { return {}; }
+  std::error_code release(file_off_t, size_t) override { return {}; }
+  std::error_code release_until(file_off_t) override { return {}; }
+
+  std::error_code advise(advice) override { return {}; }
+  std::error_code advise(advice, file_off_t, size_t) override { return {}; }
+
+  std::filesystem::path const& path() const override { return path_; }
+
+ private:
+  std::vector<uint8_t> data_;
+  std::filesystem::path path_;
+};
+
+staging_area::staging_area(size_t max_bytes, size_t max_file_size)
+    : max_bytes_{max_bytes}
+    , max_file_size_{max_file_size} {}
+
+staging_area::~staging_area() = default;
+
+bool staging_area::stage(inode const& ino, mmif const& mm, size_t num_uses) {
+  auto const size = mm.size();
+
+  if (!accepts(size) || num_uses == 0) {
+    return false;
+  }
+
+  {
+    std::lock_guard lock(mx_);
+
+    if (bytes_ + size > max_bytes_) {
+      ++stats_.rejected_files;
+      return false;
+    }
+
+    // reserve the space before copying outside of the lock
+    bytes_ += size;
+    stats_.peak_bytes = std::max(stats_.peak_bytes, bytes_);
+  }
+
+  auto sf = std::make_shared<staged_file>(mm);
+
+  std::lock_guard lock(mx_);
+  files_.emplace(&ino, entry{std::move(sf), num_uses});
+  ++stats_.staged_files;
+
+  return true;
+}
+
+std::shared_ptr<mmif> staging_area::take(inode const& ino) {
+  std::lock_guard lock(mx_);
+
+  auto it = files_.find(&ino);
+
+  if (it == files_.end()) {
+    return nullptr;
+  }
+
+  std::shared_ptr<mmif> mm = it->second.file;
+
+  if (--it->second.uses_left == 0) {
+    files_.erase(it);
+    bytes_ -= mm->size();
+    ++stats_.taken_files;
+  }
+
+  return mm;
+}
+
+auto staging_area::get_stats() const -> stats {
+  std::lock_guard lock(mx_);
+  return stats_;
+}
+
+} // namespace dwarfs::writer::internal
@@ -0,0 +1,187 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+#include <dwarfs/cpu_budget.h>
+#include <dwarfs/writer/memory_budget.h>
+
+namespace dwarfs::writer {
+
+namespace {
+
+size_t index(memory_budget::component c) { return static_cast<size_t>(c); }
+
+} // namespace
+
+std::string_view memory_budget::component_name(component c) {
+  switch (c) {
+  case component::scan:
+    return "scan";
+  case component::segmenter:
+    return "segmenter";
+  case component::compression:
+    return "compression";
+  case component::write_queue:
+    return "write queue";
+  }
+  return "unknown";
+}
+
+memory_budget::reservation::reservation(reservation&& other) noexcept
+    : budget_{std::exchange(other.budget_, nullptr)}
+    , component_{other.component_}
+    , size_{std::exchange(other.size_, 0)} {}
+
+auto memory_budget::reservation::operator=(reservation&& other) noexcept
+    -> reservation& {
+  if (this != &other) {
+    release();
+    budget_ = std::exchange(other.budget_, nullptr);
+    component_ = other.component_;
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+}
+
+void memory_budget::reservation::grow(size_t bytes) {
+  if (budget_ && bytes > 0) {
+    budget_->grow(component_, bytes, size_, true);
+    size_ += bytes;
+  }
+}
+
+void memory_budget::reservation::resize(size_t bytes) {
+  if (budget_) {
+    if (bytes > size_) {
+      budget_->grow(component_, bytes - size_, size_, false);
+    } else if (bytes < size_) {
+      budget_->shrink(component_, size_ - bytes);
+    }
+    size_ = bytes;
+  }
+}
+
+void memory_budget::reservation::transfer(component c, size_t bytes) {
+  if (budget_) {
+    budget_->transfer(component_, size_, c, bytes);
+    component_ = c;
+    size_ = bytes;
+  }
+}
+
+void memory_budget::reservation::release() {
+  if (budget_) {
+    budget_->shrink(component_, size_);
+    budget_ = nullptr;
+    size_ = 0;
+  }
+}
+
+memory_budget::memory_budget(size_t limit)
+    : limit_{limit} {}
+
+auto memory_budget::reserve(component c, size_t bytes) -> reservation {
+  reservation r(*this, c);
+  r.grow(bytes);
+  return r;
+}
+
+auto memory_budget::account(component c, size_t bytes) -> reservation {
+  reservation r(*this, c);
+  r.resize(bytes);
+  return r;
+}
+
+auto memory_budget::get_stats() const -> stats {
+  std::lock_guard lock(mx_);
+  return stats_;
+}
+
+bool memory_budget::is_drainable(component c) {
+  return c == component::scan || c == component::compression;
+}
+
+size_t memory_budget::drainable() const {
+  return stats_.components[index(component::scan)].current +
+         stats_.components[index(component::compression)].current;
+}
+
+void memory_budget::grow(component c, size_t bytes, size_t own, bool wait) {
+  std::unique_lock lock(mx_);
+
+  if (wait && limit_ > 0) {
+    auto const own_drainable = is_drainable(c) ? own : 0;
+    auto const can_proceed = [&] {
+      return stats_.current + bytes <= limit_ || drainable() <= own_drainable;
+    };
+
+    if (!can_proceed()) {
+      ++stats_.waits;
+      cpu_budget::wait(cv_, lock, can_proceed);
+    }
+  }
+
+  stats_.components[index(c)].current += bytes;
+  stats_.current += bytes;
+  update_peaks(c);
+}
+
+void memory_budget::shrink(component c, size_t bytes) {
+  if (bytes == 0) {
+    return;
+  }
+
+  {
+    std::lock_guard lock(mx_);
+    auto& cs = stats_.components[index(c)];
+    assert(cs.current >= bytes);
+    cs.current -= bytes;
+    stats_.current -= bytes;
+  }
+
+  cv_.notify_all();
+}
+
+void memory_budget::transfer(component from, size_t from_bytes, component to,
+                             size_t to_bytes) {
+  {
+    std::lock_guard lock(mx_);
+    auto& fcs = stats_.components[index(from)];
+    assert(fcs.current >= from_bytes);
+    fcs.current -= from_bytes;
+    stats_.components[index(to)].current += to_bytes;
+    stats_.current = stats_.current - from_bytes + to_bytes;
+    update_peaks(to);
+  }
+
+  cv_.notify_all();
+}
+
+void memory_budget::update_peaks(component c) {
+  auto& cs = stats_.components[index(c)];
+  cs.peak = std::max(cs.peak, cs.current);
+  stats_.peak = std::max(stats_.peak, stats_.current);
+}
+
+} // namespace dwarfs::writer
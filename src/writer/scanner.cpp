@@ -21,29 +21,41 @@
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <cstring>
 #include <ctime>
 #include <deque>
+#include <exception>
 #include <functional>
+#include <future>
 #include <iterator>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <optional>
+#include <random>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <system_error>
+#include <tuple>
 #include <utility>
 #include <vector>
 
+#include <folly/container/F14Set.h>
 #include <folly/system/HardwareConcurrency.h>
 
 #include <fmt/format.h>
 
+#include <dwarfs/cpu_budget.h>
 #include <dwarfs/error.h>
 #include <dwarfs/file_access.h>
 #include <dwarfs/history.h>
 #include <dwarfs/logger.h>
 #include <dwarfs/mmif.h>
 #include <dwarfs/os_access.h>
+#include <dwarfs/scope_exit.h>
 #include <dwarfs/thread_pool.h>
 #include <dwarfs/util.h>
 #include <dwarfs/version.h>
@@ -64,14 +76,17 @@
 #include <dwarfs/writer/internal/block_manager.h>
 #include <dwarfs/writer/internal/entry.h>
 #include <dwarfs/writer/internal/file_scanner.h>
+#include <dwarfs/writer/internal/file_stream.h>
 #include <dwarfs/writer/internal/filesystem_writer_detail.h>
 #include <dwarfs/writer/internal/fragment_chunkable.h>
 #include <dwarfs/writer/internal/global_entry_data.h>
+#include <dwarfs/writer/internal/hash_cache.h>
 #include <dwarfs/writer/internal/inode.h>
 #include <dwarfs/writer/internal/inode_manager.h>
 #include <dwarfs/writer/internal/inode_ordering.h>
 #include <dwarfs/writer/internal/metadata_freezer.h>
 #include <dwarfs/writer/internal/progress.h>
+#include <dwarfs/writer/internal/staging_area.h>
 
 #include <dwarfs/gen-cpp2/metadata_types.h>
 
@@ -88,6 +103,57 @@ constexpr std::string_view kEnvVarDumpFilesRaw{"DWARFS_DUMP_FILES_RAW"};
 constexpr std::string_view kEnvVarDumpFilesFinal{"DWARFS_DUMP_FILES_FINAL"};
 constexpr std::string_view kEnvVarDumpInodes{"DWARFS_DUMP_INODES"};
 
+// Larger files are read again by the segmenter in single pass mode
+constexpr size_t const kMaxStagedFileSize{1 << 20};
+
+// Categories are only split into shards for parallel segmenting if
+// each shard gets at least this many blocks worth of data
+constexpr size_t const kMinBlocksPerShard{16};
+
+// Number of directories each discovery worker may read ahead of the walk
+constexpr size_t const kMaxDiscoveriesPerWorker{8};
+
+uint64_t category_data_size(inode& ino, fragment_category category) {
+  uint64_t size{0};
+
+  for (auto& frag : ino.fragments()) {
+    if (frag.category() == category) {
+      size += frag.size();
+    }
+  }
+
+  return size;
+}
+
+// Splits the ordered inodes of a category into `num_shards` contiguous
+// ranges holding roughly the same amount of data. The result only
+// depends on the input order, so the output image is reproducible.
+std::vector<size_t>
+shard_boundaries(sortable_inode_span const& span, fragment_category category,
+                 size_t num_shards) {
+  uint64_t total{0};
+
+  for (size_t i = 0; i < span.size(); ++i) {
+    total += category_data_size(*span[i], category);
+  }
+
+  std::vector<size_t> bounds{0};
+  uint64_t current{0};
+
+  for (size_t i = 0; i < span.size() && bounds.size() < num_shards; ++i) {
+    current += category_data_size(*span[i], category);
+
+    while (bounds.size() < num_shards &&
+           current * num_shards >= total * bounds.size()) {
+      bounds.push_back(i + 1);
+    }
+  }
+
+  bounds.resize(num_shards + 1, span.size());
+
+  return bounds;
+}
+
 class visitor_base : public entry_visitor {
  public:
   void visit(file*) override {}
@@ -306,6 +372,24 @@ class scanner_ final : public scanner::impl {
             std::shared_ptr<file_access const> fa) override;
 
  private:
+  // An entry read from a directory, but not yet added to the tree
+  struct discovered_entry {
+    std::filesystem::path name;
+    std::shared_ptr<entry> pe;
+    std::exception_ptr error;
+  };
+
+  struct discovered_dir {
+    std::vector<discovered_entry> entries;
+    std::exception_ptr error;
+  };
+
+  discovered_entry
+  discover_entry(std::filesystem::path const& name,
+                 std::shared_ptr<dir> const& parent) const;
+
+  discovered_dir discover_dir(std::shared_ptr<dir> const& parent) const;
+
   std::shared_ptr<entry> scan_tree(std::filesystem::path const& path,
                                    progress& prog, file_scanner& fs);
 
@@ -317,10 +401,23 @@ class scanner_ final : public scanner::impl {
   add_entry(std::filesystem::path const& name, std::shared_ptr<dir> parent,
             progress& prog, file_scanner& fs, bool debug_filter = false);
 
+  std::shared_ptr<entry>
+  add_entry(discovered_entry const& de, std::shared_ptr<dir> parent,
+            progress& prog, file_scanner& fs, bool debug_filter = false);
+
   void dump_state(std::string_view env_var, std::string_view what,
                   std::shared_ptr<file_access const> fa,
                   std::function<void(std::ostream&)> dumper) const;
 
+  std::shared_ptr<hash_cache>
+  load_hash_cache(std::shared_ptr<file_access const> const& fa) const;
+  void save_hash_cache(hash_cache& cache, file_access const& fa) const;
+
+  bool can_stream() const;
+  void segment_stream(file_stream& stream, filesystem_writer_detail& fsw,
+                      std::shared_ptr<block_manager> blockmgr,
+                      progress& prog) const;
+
   LOG_PROXY_DECL(LoggerPolicy);
   worker_group& wg_;
   scanner_options const& options_;
@@ -354,13 +451,62 @@ scanner_<LoggerPolicy>::scanner_(logger& lgr, worker_group& wg,
     , entry_factory_{ef}
     , os_{os} {}
 
+template <typename LoggerPolicy>
+auto scanner_<LoggerPolicy>::discover_entry(
+    std::filesystem::path const& name,
+    std::shared_ptr<dir> const& parent) const -> discovered_entry {
+  discovered_entry de{.name = name};
+
+  try {
+    de.pe = entry_factory_.create(os_, name, parent);
+  } catch (...) {
+    de.error = std::current_exception();
+  }
+
+  return de;
+}
+
+template <typename LoggerPolicy>
+auto scanner_<LoggerPolicy>::discover_dir(
+    std::shared_ptr<dir> const& parent) const -> discovered_dir {
+  discovered_dir dd;
+
+  try {
+    auto d = os_.opendir(parent->fs_path());
+    std::filesystem::path name;
+
+    while (d->read(name)) {
+      dd.entries.push_back(discover_entry(name, parent));
+    }
+  } catch (...) {
+    dd.error = std::current_exception();
+  }
+
+  return dd;
+}
+
 template <typename LoggerPolicy>
 std::shared_ptr<entry>
 scanner_<LoggerPolicy>::add_entry(std::filesystem::path const& name,
                                   std::shared_ptr<dir> parent, progress& prog,
                                   file_scanner& fs, bool debug_filter) {
+  return add_entry(discover_entry(name, parent), std::move(parent), prog, fs,
+                   debug_filter);
+}
+
+template <typename LoggerPolicy>
+std::shared_ptr<entry>
+scanner_<LoggerPolicy>::add_entry(discovered_entry const& de,
+                                  std::shared_ptr<dir> parent, progress& prog,
+                                  file_scanner& fs, bool debug_filter) {
+  auto const& name = de.name;
+
   try {
-    auto pe = entry_factory_.create(os_, name, parent);
+    if (de.error) {
+      std::rethrow_exception(de.error);
+    }
+
+    auto pe = de.pe;
     bool const exclude =
         std::any_of(filters_.begin(), filters_.end(), [&pe](auto const& f) {
           return f->filter(*pe) == filter_action::remove;
@@ -484,6 +630,192 @@ void scanner_<LoggerPolicy>::dump_state(
   }
 }
 
+template <typename LoggerPolicy>
+std::shared_ptr<hash_cache> scanner_<LoggerPolicy>::load_hash_cache(
+    std::shared_ptr<file_access const> const& fa) const {
+  if (!options_.hash_cache) {
+    return nullptr;
+  }
+
+  if (!fa) {
+    LOG_ERROR << "cannot use hash cache: no file access";
+    return nullptr;
+  }
+
+  auto const& path = *options_.hash_cache;
+  auto cache = std::make_shared<hash_cache>(
+      options_.file_hash_algorithm.value_or(std::string()),
+      fmt::format("{}\n{}", DWARFS_GIT_ID, options_.hash_cache_config),
+      std::time(nullptr));
+
+  if (fa->exists(path)) {
+    std::error_code ec;
+    auto ifs = fa->open_input_binary(path, ec);
+
+    if (ec) {
+      LOG_WARN << "cannot open hash cache '" << path.string()
+               << "': " << ec.message();
+    } else {
+      try {
+        cache->load(ifs->is());
+      } catch (...) {
+        LOG_WARN << "ignoring hash cache '" << path.string()
+                 << "': " << exception_str(std::current_exception());
+      }
+    }
+  }
+
+  return cache;
+}
+
+template <typename LoggerPolicy>
+void scanner_<LoggerPolicy>::save_hash_cache(hash_cache& cache,
+                                             file_access const& fa) const {
+  auto const& path = *options_.hash_cache;
+
+  // Other builds may be using the same cache concurrently, so we merge
+  // with whatever is in the cache file right now and atomically replace
+  // it. Readers will always see a complete cache file.
+  auto tmp = path;
+  tmp += fmt::format(".tmp{:08x}", std::random_device{}());
+
+  std::error_code ec;
+
+  {
+    std::error_code ignored;
+    auto current = fa.open_input_binary(path, ignored);
+    auto ofs = fa.open_output_binary(tmp, ec);
+
+    if (!ec) {
+      cache.save(ofs->os(), current ? &current->is() : nullptr);
+      ofs->close(ec);
+    }
+  }
+
+  if (!ec) {
+    fa.rename(tmp, path, ec);
+  }
+
+  if (ec) {
+    LOG_WARN << "cannot write hash cache '" << path.string()
+             << "': " << ec.message();
+    return;
+  }
+
+  auto const st = cache.get_stats();
+
+  LOG_VERBOSE << "hash cache: " << st.loaded_entries << " entries loaded, "
+              << st.hash_hits << " hashes, " << st.start_hash_hits
+              << " start hashes, " << st.scan_hits << " scan results reused, "
+              << st.saved_entries << " entries saved";
+}
+
+template <typename LoggerPolicy>
+bool scanner_<LoggerPolicy>::can_stream() const {
+  if (!options_.pipelined || options_.debug_filter_function) {
+    return false;
+  }
+
+  // Segmenting while scanning requires that the contents of a file can
+  // be segmented as soon as we know it's not a duplicate, i.e. we must
+  // neither wait for its categories to be known nor for all inodes to be
+  // ordered globally. Files are segmented in the order they are
+  // discovered, which can't reproduce any ordering other than `none`.
+  // A checkpoint relies on the inode orderings being reproduced exactly
+  // when resuming, so it also requires the regular build.
+  std::string reason;
+
+  if (options_.inode.categorizer_mgr) {
+    reason = "categorization";
+  } else if (options_.single_pass) {
+    reason = "single-pass mode";
+  } else if (options_.checkpoint) {
+    reason = "a build checkpoint";
+  } else if (auto mode = options_.inode.fragment_order.get().mode;
+             mode != fragment_order_mode::NONE) {
+    std::ostringstream oss;
+    oss << "'" << mode << "' ordering";
+    reason = oss.str();
+  }
+
+  if (!reason.empty()) {
+    LOG_WARN << "cannot segment while scanning with " << reason
+             << ", segmenting after scanning instead";
+    return false;
+  }
+
+  return true;
+}
+
+template <typename LoggerPolicy>
+void scanner_<LoggerPolicy>::segment_stream(
+    file_stream& stream, filesystem_writer_detail& fsw,
+    std::shared_ptr<block_manager> blockmgr, progress& prog) const {
+  auto const category = categorizer_manager::default_category();
+  std::string const meta;
+  auto cc = fsw.get_compression_constraints(category.value(), meta);
+
+  auto tv = LOG_CPU_TIMED_VERBOSE;
+
+  // The total size isn't known yet
+  auto seg = segmenter_factory_.create(
+      category, 0, cc, blockmgr,
+      [category, meta, blockmgr, &fsw](auto block, auto logical_block_num) {
+        fsw.write_block(
+            category, std::move(block),
+            [blockmgr, logical_block_num, category](auto physical_block_num) {
+              blockmgr->set_written_block(logical_block_num,
+                                          physical_block_num, category.value());
+            },
+            meta, 0);
+      });
+
+  // Duplicates are handed out as well, but their inode has already
+  // been segmented along with the first file that refers to it.
+  folly::F14FastSet<inode const*> seen;
+
+  while (auto p = stream.next()) {
+    auto ino = p->get_inode();
+
+    if (!seen.insert(ino.get()).second) {
+      continue;
+    }
+
+    // The inode's files are not known yet, so we read from this file
+    if (auto size = p->size(); size > 0 && !p->is_invalid()) {
+      std::unique_ptr<mmif> mm;
+
+      try {
+        mm = os_.map_file(p->fs_path(), size);
+      } catch (...) {
+        LOG_ERROR << "failed to map file " << p->path_as_string() << ": "
+                  << exception_str(std::current_exception())
+                  << ", creating empty inode";
+        ++prog.errors;
+        prog.fragments_found -= ino->fragments().size();
+      }
+
+      if (mm) {
+        file_off_t offset{0};
+
+        for (auto& frag : ino->fragments()) {
+          fragment_chunkable fc(*ino, frag, offset, *mm, nullptr, p);
+          seg.add_chunkable(fc);
+          prog.fragments_written++;
+          offset += frag.size();
+        }
+      }
+    }
+
+    prog.inodes_written++;
+  }
+
+  seg.finish();
+  fsw.finish_category(category, 0);
+
+  tv << "segmenting finished";
+}
+
 template <typename LoggerPolicy>
 std::shared_ptr<entry>
 scanner_<LoggerPolicy>::scan_tree(std::filesystem::path const& path,
@@ -500,34 +832,101 @@ scanner_<LoggerPolicy>::scan_tree(std::filesystem::path const& path,
     t->transform(*root);
   }
 
-  std::deque<std::shared_ptr<entry>> queue({root});
+  // Reading directories and stat'ing their entries is done by the
+  // discovery workers, ahead of the time the entries are needed.
+  // Everything else, i.e. filtering, transforming, adding entries to
+  // the tree and starting the file scanner, happens right here in the
+  // same order as a sequential walk, so the resulting tree and inode
+  // numbers don't depend on the number of discovery workers.
+  worker_group wg_discovery;
+
+  if (options_.num_discovery_workers > 1) {
+    wg_discovery = worker_group(LOG_GET_LOGGER, os_, "discovery",
+                                options_.num_discovery_workers);
+  }
+
+  auto discover = [&](std::shared_ptr<dir> d) {
+    if (!wg_discovery) {
+      return std::async(std::launch::deferred,
+                        [this, d = std::move(d)] { return discover_dir(d); });
+    }
+
+    std::promise<discovered_dir> prom;
+    auto future = prom.get_future();
+
+    wg_discovery.add_job(
+        [this, d = std::move(d), prom = std::move(prom)]() mutable {
+          prom.set_value(discover_dir(d));
+        });
+
+    return future;
+  };
+
+  struct queue_entry {
+    std::shared_ptr<dir> d;
+    std::optional<std::future<discovered_dir>> dd;
+  };
+
+  auto root_dir = std::dynamic_pointer_cast<dir>(root);
+
+  DWARFS_CHECK(root_dir, "expected directory");
+
+  std::deque<queue_entry> queue;
+  queue.push_back({root_dir, std::nullopt});
   prog.dirs_found++;
 
+  // The results are consumed in walk order, so only the directories at
+  // the front of the queue are discovered ahead of time. Otherwise, the
+  // results for all directories of a wide tree could pile up.
+  size_t const max_in_flight =
+      kMaxDiscoveriesPerWorker *
+      std::max<size_t>(1, options_.num_discovery_workers);
+  size_t in_flight{0};
+
+  auto start_discoveries = [&] {
+    for (auto it = queue.begin();
+         it != queue.end() && in_flight < max_in_flight; ++it) {
+      if (!it->dd) {
+        it->dd = discover(it->d);
+        ++in_flight;
+      }
+    }
+  };
+
   while (!queue.empty()) {
-    auto parent = std::dynamic_pointer_cast<dir>(queue.front());
+    start_discoveries();
 
-    DWARFS_CHECK(parent, "expected directory");
+    auto parent = std::move(queue.front().d);
+    auto dd = queue.front().dd->get();
 
     queue.pop_front();
-    auto ppath = parent->fs_path();
+    --in_flight;
 
-    try {
-      auto d = os_.opendir(ppath);
-      std::filesystem::path name;
-      std::vector<std::shared_ptr<entry>> subdirs;
-
-      while (d->read(name)) {
-        if (auto pe = add_entry(name, parent, prog, fs, debug_filter)) {
-          if (pe->type() == entry::E_DIR) {
-            subdirs.push_back(pe);
-          }
+    std::vector<queue_entry> subdirs;
+
+    for (auto const& de : dd.entries) {
+      if (auto pe = add_entry(de, parent, prog, fs, debug_filter)) {
+        if (pe->type() == entry::E_DIR) {
+          auto d = std::dynamic_pointer_cast<dir>(pe);
+
+          DWARFS_CHECK(d, "expected directory");
+
+          subdirs.push_back({std::move(d), std::nullopt});
         }
       }
+    }
 
-      queue.insert(queue.begin(), subdirs.begin(), subdirs.end());
+    try {
+      if (dd.error) {
+        std::rethrow_exception(dd.error);
+      }
+
+      queue.insert(queue.begin(), std::make_move_iterator(subdirs.begin()),
+                   std::make_move_iterator(subdirs.end()));
 
       prog.dirs_scanned++;
     } catch (const std::system_error& e) {
+      auto ppath = parent->fs_path();
       LOG_ERROR << "cannot read directory `" << ppath
                 << "`: " << exception_str(e);
       prog.errors++;
@@ -633,14 +1032,56 @@ void scanner_<LoggerPolicy>::scan(
 
   prog.set_status_function(status_string);
 
-  inode_manager im(LOG_GET_LOGGER, prog, options_.inode);
+  std::shared_ptr<staging_area> staging;
+
+  if (options_.single_pass) {
+    staging = std::make_shared<staging_area>(options_.staging_size,
+                                             kMaxStagedFileSize);
+  }
+
+  auto cache = load_hash_cache(fa);
+  auto blockmgr = std::make_shared<block_manager>();
+  std::shared_ptr<file_stream> stream;
+  std::exception_ptr stream_error;
+  worker_group wg_stream;
+
+  if (can_stream()) {
+    LOG_INFO << "segmenting while scanning...";
+
+    stream = std::make_shared<file_stream>();
+    fsw.configure({categorizer_manager::default_category()}, 1, {1});
+    wg_stream = worker_group(LOG_GET_LOGGER, os_, "blockify", options_.budget,
+                             1);
+    wg_stream.add_job([this, stream, blockmgr, &fsw, &prog, &stream_error] {
+      // rethrown once scanning is done
+      try {
+        segment_stream(*stream, fsw, blockmgr, prog);
+      } catch (...) {
+        stream_error = std::current_exception();
+      }
+    });
+  }
+
+  // don't leave the segmenter waiting for files if scanning fails
+  scope_exit close_stream{[&stream] {
+    if (stream) {
+      stream->close();
+    }
+  }};
+
+  inode_manager im(LOG_GET_LOGGER, prog, options_.inode, options_.memory,
+                   staging, cache, options_.checkpoint);
   file_scanner fs(LOG_GET_LOGGER, wg_, os_, im, prog,
                   {.hash_algo = options_.file_hash_algorithm,
                    .debug_inode_create = os_.getenv(kEnvVarDumpFilesRaw) ||
-                                         os_.getenv(kEnvVarDumpFilesFinal)});
+                                         os_.getenv(kEnvVarDumpFilesFinal),
+                   .memory = options_.memory,
+                   .single_pass = options_.single_pass,
+                   .cache = cache,
+                   .stream = stream});
 
-  auto root =
-      list ? scan_list(path, *list, prog, fs) : scan_tree(path, prog, fs);
+  auto root = list ? scan_list(path, *list, prog, fs)
+                   : scan_tree(path, prog, fs);
 
   if (options_.debug_filter_function) {
     return;
@@ -666,6 +1107,11 @@ void scanner_<LoggerPolicy>::scan(
 
   wg_.wait();
 
+  // all files have been added and their inodes are known
+  if (stream) {
+    stream->close();
+  }
+
   LOG_INFO << "scanning CPU time: "
            << time_with_unit(wg_.try_get_cpu_time().value_or(0ns));
 
@@ -687,6 +1133,12 @@ void scanner_<LoggerPolicy>::scan(
     wg_.wait();
   }
 
+  // All scan results are known at this point. Persist them right away
+  // rather than at the end so they survive an interrupted build.
+  if (cache) {
+    save_hash_cache(*cache, *fa);
+  }
+
   LOG_INFO << "saved " << size_with_unit(prog.saved_by_deduplication) << " / "
            << size_with_unit(prog.original_size) << " in "
            << prog.duplicate_files << "/" << prog.files_found
@@ -739,27 +1191,98 @@ void scanner_<LoggerPolicy>::scan(
     });
   });
 
+  if (stream) {
+    LOG_INFO << "waiting for segmenting/blockifying to finish...";
+
+    wg_stream.wait();
+
+    if (stream_error) {
+      std::rethrow_exception(stream_error);
+    }
+
+    DWARFS_CHECK(stream->pending() == 0,
+                 "internal error: files left in stream after segmenting");
+
+    LOG_INFO << "total segmenting CPU time: "
+             << time_with_unit(wg_stream.try_get_cpu_time().value_or(0ns));
+  }
+
   dump_state(kEnvVarDumpInodes, "inodes", fa, [&im](auto& os) { im.dump(os); });
 
-  LOG_INFO << "building blocks...";
+  if (!stream) {
+    LOG_INFO << "building blocks...";
 
-  // TODO:
-  // - get rid of multiple worker groups
-  // - instead, introduce "batches" to which work can be added, and
-  //   which gets run on a worker groups; each batch keeps track of
-  //   its CPU time and affects thread naming
+    // If there's a CPU budget, these share it with the scanner and
+    // compression workers, so the number of concurrently running jobs
+    // is balanced across all stages.
+    size_t num_threads = options_.num_segmenter_workers;
 
-  auto blockmgr = std::make_shared<block_manager>();
+    if (num_threads > 1 && segmenter_factory_.requires_serial_segmenting()) {
+      LOG_VERBOSE << "segmenting serially because of shared segmenter state";
+      num_threads = 1;
+    }
 
-  {
-    size_t const num_threads = options_.num_segmenter_workers;
-    worker_group wg_ordering(LOG_GET_LOGGER, os_, "ordering", num_threads);
-    worker_group wg_blockify(LOG_GET_LOGGER, os_, "blockify", num_threads);
+    worker_group wg_ordering(LOG_GET_LOGGER, os_, "ordering", options_.budget,
+                             num_threads);
+    worker_group wg_blockify(LOG_GET_LOGGER, os_, "blockify", options_.budget,
+                             num_threads);
 
-    fsw.configure(frag_info.categories, num_threads);
+    auto const min_shard_size =
+        kMinBlocksPerShard * segmenter_factory_.get_block_size();
+    std::vector<size_t> num_shards;
 
     for (auto category : frag_info.categories) {
-      auto cat_size = frag_info.category_size.at(category);
+      auto const cat_size = frag_info.category_size.at(category);
+      num_shards.push_back(std::max<size_t>(
+          1, std::min<size_t>(cat_size / min_shard_size,
+                              options_.segmenter_shards)));
+    }
+
+    fsw.configure(frag_info.categories, num_threads, num_shards);
+
+    // The first shard job of a category to run orders the inodes for all
+    // shards. The other shard jobs must not hold on to their CPU slots
+    // while waiting, as ordering may need them.
+    struct category_state {
+      template <typename F>
+      void order_once(F&& order) {
+        std::unique_lock lock(mx);
+
+        if (!ordering) {
+          ordering = true;
+          lock.unlock();
+
+          try {
+            order();
+          } catch (...) {
+            error = std::current_exception();
+          }
+
+          lock.lock();
+          ordered = true;
+          cv.notify_all();
+        } else {
+          cpu_budget::wait(cv, lock, [this] { return ordered; });
+        }
+
+        if (error) {
+          std::rethrow_exception(error);
+        }
+      }
+
+      std::mutex mx;
+      std::condition_variable cv;
+      bool ordering{false};
+      bool ordered{false};
+      std::exception_ptr error;
+      std::optional<sortable_inode_span> span;
+      std::vector<size_t> bounds;
+    };
+
+    for (size_t cat_index = 0; cat_index < frag_info.categories.size();
+         ++cat_index) {
+      auto const category = frag_info.categories[cat_index];
+      auto const shards = num_shards[cat_index];
       auto catmgr = options_.inode.categorizer_mgr.get();
       std::string meta;
 
@@ -771,72 +1294,112 @@ void scanner_<LoggerPolicy>::scan(
         }
       }
 
-      auto cc = fsw.get_compression_constraints(category.value(), meta);
+      if (shards > 1) {
+        LOG_VERBOSE << category_prefix(catmgr, category) << "segmenting in "
+                    << shards << " shards";
+      }
 
-      wg_blockify.add_job([this, catmgr, blockmgr, category, cat_size, meta, cc,
-                           &prog, &fsw, &im, &wg_ordering] {
-        auto span = im.ordered_span(category, wg_ordering);
-        auto tv = LOG_CPU_TIMED_VERBOSE;
-
-        auto seg = segmenter_factory_.create(
-            category, cat_size, cc, blockmgr,
-            [category, meta, blockmgr, &fsw](auto block,
-                                             auto logical_block_num) {
-              fsw.write_block(
-                  category, std::move(block),
-                  [blockmgr, logical_block_num,
-                   category](auto physical_block_num) {
-                    blockmgr->set_written_block(logical_block_num,
-                                                physical_block_num,
-                                                category.value());
-                  },
-                  meta);
-            });
-
-        for (auto ino : span) {
-          prog.current.store(ino.get());
-
-          // TODO: factor this code out
-          auto f = ino->any();
-
-          if (auto size = f->size(); size > 0 && !f->is_invalid()) {
-            auto [mm, _, errors] = ino->mmap_any(os_);
-
-            if (mm) {
-              file_off_t offset{0};
-
-              for (auto& frag : ino->fragments()) {
-                if (frag.category() == category) {
-                  fragment_chunkable fc(*ino, frag, offset, *mm, catmgr);
-                  seg.add_chunkable(fc);
-                  prog.fragments_written++;
-                }
+      auto cc = fsw.get_compression_constraints(category.value(), meta);
+      auto state = std::make_shared<category_state>();
+
+      // Shard jobs must be added in the same order as the merger sources,
+      // otherwise the merger might wait for a source that never runs.
+      for (size_t shard = 0; shard < shards; ++shard) {
+        wg_blockify.add_job([this, catmgr, blockmgr, category, shard, shards,
+                             meta, cc, state, staging, &prog, &fsw, &im,
+                             &wg_ordering] {
+          state->order_once([&] {
+            state->span.emplace(im.ordered_span(category, wg_ordering));
+            state->bounds = shard_boundaries(*state->span, category, shards);
+          });
+
+          auto const& span = *state->span;
+          auto const begin = state->bounds[shard];
+          auto const end = state->bounds[shard + 1];
+          uint64_t shard_size{0};
+
+          for (size_t i = begin; i < end; ++i) {
+            shard_size += category_data_size(*span[i], category);
+          }
 
-                offset += frag.size();
+          auto tv = LOG_CPU_TIMED_VERBOSE;
+
+          auto seg = segmenter_factory_.create(
+              category, shard_size, cc, blockmgr,
+              [category, shard, meta, blockmgr, &fsw](auto block,
+                                                      auto logical_block_num) {
+                fsw.write_block(
+                    category, std::move(block),
+                    [blockmgr, logical_block_num,
+                     category](auto physical_block_num) {
+                      blockmgr->set_written_block(logical_block_num,
+                                                  physical_block_num,
+                                                  category.value());
+                    },
+                    meta, shard);
+              });
+
+          for (size_t i = begin; i < end; ++i) {
+            auto const& ino = span[i];
+
+            prog.current.store(ino.get());
+
+            // TODO: factor this code out
+            auto f = ino->any();
+
+            if (auto size = f->size(); size > 0 && !f->is_invalid()) {
+              std::shared_ptr<mmif> mm;
+              std::vector<std::pair<file const*, std::exception_ptr>> errors;
+
+              if (staging) {
+                mm = staging->take(*ino);
               }
-            } else {
-              for (auto& [fp, e] : errors) {
-                LOG_ERROR << "failed to map file " << fp->path_as_string()
-                          << ": " << exception_str(e)
-                          << ", creating empty inode";
-                ++prog.errors;
+
+              if (!mm) {
+                std::tie(mm, std::ignore, errors) = ino->mmap_any(os_);
               }
-              for (auto& frag : ino->fragments()) {
-                if (frag.category() == category) {
-                  prog.fragments_found--;
+
+              if (mm) {
+                file_off_t offset{0};
+
+                for (auto& frag : ino->fragments()) {
+                  if (frag.category() == category) {
+                    fragment_chunkable fc(*ino, frag, offset, *mm, catmgr);
+                    seg.add_chunkable(fc);
+                    prog.fragments_written++;
+                  }
+
+                  offset += frag.size();
+                }
+              } else {
+                for (auto& [fp, e] : errors) {
+                  LOG_ERROR << "failed to map file " << fp->path_as_string()
+                            << ": " << exception_str(e)
+                            << ", creating empty inode";
+                  ++prog.errors;
+                }
+                for (auto& frag : ino->fragments()) {
+                  if (frag.category() == category) {
+                    prog.fragments_found--;
+                  }
                 }
               }
             }
-          }
 
-          prog.inodes_written++; // TODO: remove?
-        }
+            prog.inodes_written++; // TODO: remove?
+          }
 
-        seg.finish();
-        fsw.finish_category(category);
+          seg.finish();
+          fsw.finish_category(category, shard);
 
-        tv << category_prefix(catmgr, category) << "segmenting finished";
-      });
+          if (shards > 1) {
+            tv << category_prefix(catmgr, category) << "segmenting shard "
+               << (shard + 1) << "/" << shards << " finished";
+          } else {
+            tv << category_prefix(catmgr, category) << "segmenting finished";
+          }
+        });
+      }
     }
 
     LOG_INFO << "waiting for segmenting/blockifying to finish...";
@@ -851,6 +1414,14 @@ void scanner_<LoggerPolicy>::scan(
 
     LOG_INFO << "total segmenting CPU time: "
              << time_with_unit(wg_blockify.try_get_cpu_time().value_or(0ns));
+
+    if (staging) {
+      auto const st = staging->get_stats();
+      LOG_VERBOSE << "staging area: " << st.staged_files << " files staged, "
+                  << st.taken_files << " files used, " << st.rejected_files
+                  << " files rejected, peak usage: "
+                  << size_with_unit(st.peak_bytes);
+    }
   }
 
   // seg.finish();
@@ -20,11 +20,13 @@
  */
 
 #include <algorithm>
+#include <array>
 #include <bit>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
 #include <deque>
+#include <optional>
 #include <string>
 #include <type_traits>
 #include <utility>
@@ -46,15 +48,19 @@
 #include <dwarfs/error.h>
 #include <dwarfs/logger.h>
 #include <dwarfs/util.h>
+#include <dwarfs/writer/memory_budget.h>
 #include <dwarfs/writer/segmenter.h>
 #include <dwarfs/writer/writer_progress.h>
 
 #include <dwarfs/writer/internal/block_data.h>
 #include <dwarfs/writer/internal/block_manager.h>
+#include <dwarfs/writer/internal/cdc_segmenter.h>
 #include <dwarfs/writer/internal/chunkable.h>
 #include <dwarfs/writer/internal/cyclic_hash.h>
 #include <dwarfs/writer/internal/entry.h>
 #include <dwarfs/writer/internal/progress.h>
+#include <dwarfs/writer/internal/segmenter_progress.h>
+#include <dwarfs/writer/internal/spill_index.h>
 
 namespace dwarfs::writer {
 
@@ -97,9 +103,37 @@ struct segmenter_stats {
   size_t bloom_lookups{0};
   size_t bloom_hits{0};
   size_t bloom_true_positives{0};
+  size_t runs{0};
+  size_t run_bytes{0};
+  size_t global_filter_rebuilds{0};
+  size_t spilled_blocks{0};
+  size_t spill_filter_rebuilds{0};
+  size_t spill_matches{0};
+  size_t spill_match_bytes{0};
   folly::Histogram<size_t> l2_collision_vec_size;
 };
 
+/**
+ * Long runs of a repeated byte or short pattern (e.g. unused space in disk
+ * images or pre-allocated database files) are not segmented like regular
+ * data. Instead of matching window after window against the same small
+ * segment, the whole run is found using plain memory comparisons. A single
+ * copy of (up to) `kRunTemplateSize` bytes of the run is stored and all the
+ * remaining data of the run is represented by chunks referencing that copy.
+ */
+constexpr size_t const kMaxRunPeriod{16};
+constexpr size_t const kMinRunSize{64 << 10};
+constexpr size_t const kRunTemplateSize{1 << 20};
+constexpr size_t const kRunCompareSize{4096};
+
+// Number of rolling hash values computed at once by rsync_hash::update_batch
+constexpr size_t const kHashBatchSize{256};
+
+// Upper limit for the size (in bits) of the bloom filter for spilled blocks,
+// i.e. 512 MiB; beyond this, the false positive rate goes up as more blocks
+// are spilled
+constexpr size_t const kMaxSpillFilterSize{static_cast<size_t>(1) << 32};
+
 template <typename KeyT, typename ValT, size_t MaxCollInline = 2>
 class fast_multimap {
  private:
@@ -225,23 +259,20 @@ class alignas(64) bloom_filter {
            (static_cast<bits_type>(1) << (ix & value_mask));
   }
 
+  DWARFS_FORCE_INLINE void prefetch(size_t ix) const {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(&bits_[(ix >> index_shift) & index_mask_]);
+#else
+    static_cast<void>(ix);
+#endif
+  }
+
   // size in bits
   DWARFS_FORCE_INLINE size_t size() const { return size_; }
 
   void clear() { std::fill(begin(), end(), 0); }
 
-  void merge(bloom_filter const& other) {
-    if (size() != other.size()) {
-      throw std::runtime_error("size mismatch");
-    }
-    std::transform(cbegin(), cend(), other.cbegin(), begin(), std::bit_or<>{});
-  }
-
  private:
-  DWARFS_FORCE_INLINE bits_type const* cbegin() const { return bits_; }
-  DWARFS_FORCE_INLINE bits_type const* cend() const {
-    return bits_ + (size_ >> index_shift);
-  }
   DWARFS_FORCE_INLINE bits_type* begin() { return bits_; }
   DWARFS_FORCE_INLINE bits_type* end() {
     return bits_ + (size_ >> index_shift);
@@ -304,10 +335,11 @@ class ConstantGranularityPolicy : private GranularityPolicyBase {
                         window_step, bloom_filter_size);
   }
 
-  template <typename T, typename U>
+  template <typename T>
   static DWARFS_FORCE_INLINE void
-  add_match(T& matches, U const* block, uint32_t off) {
-    matches.emplace_back(block, off);
+  add_match(T& matches, size_t block_num, std::span<uint8_t const> block_data,
+            uint32_t off) {
+    matches.emplace_back(block_num, block_data, off);
   }
 
   static DWARFS_FORCE_INLINE bool is_valid_granularity_size(auto size) {
@@ -358,6 +390,9 @@ class ConstantGranularityPolicy : private GranularityPolicyBase {
   }
 
   static DWARFS_FORCE_INLINE bool compile_time_granularity() { return true; }
+
+  // Hash values can only be computed in batches if each frame is one byte
+  static constexpr bool batch_hashing() { return N == 1; }
 };
 
 class VariableGranularityPolicy : private GranularityPolicyBase {
@@ -376,10 +411,11 @@ class VariableGranularityPolicy : private GranularityPolicyBase {
                         window_step, bloom_filter_size, granularity_);
   }
 
-  template <typename T, typename U>
+  template <typename T>
   DWARFS_FORCE_INLINE void
-  add_match(T& matches, U const* block, uint32_t off) const {
-    matches.emplace_back(block, off, granularity_);
+  add_match(T& matches, size_t block_num, std::span<uint8_t const> block_data,
+            uint32_t off) const {
+    matches.emplace_back(block_num, block_data, off, granularity_);
   }
 
   DWARFS_FORCE_INLINE bool is_valid_granularity_size(auto size) const {
@@ -427,6 +463,8 @@ class VariableGranularityPolicy : private GranularityPolicyBase {
 
   static DWARFS_FORCE_INLINE bool compile_time_granularity() { return false; }
 
+  static constexpr bool batch_hashing() { return false; }
+
  private:
   uint_fast32_t const granularity_;
 };
@@ -446,6 +484,14 @@ class granular_span_adapter : private GranularityPolicy {
 
   DWARFS_FORCE_INLINE std::span<T> raw() const { return s_; }
 
+  DWARFS_FORCE_INLINE int
+  compare(size_t offset,
+          granular_span_adapter<T const, GranularityPolicy> const& span) const {
+    auto raw = span.raw();
+    return std::memcmp(s_.data() + this->frames_to_bytes(offset), raw.data(),
+                       raw.size());
+  }
+
   DWARFS_FORCE_INLINE granular_span_adapter subspan(size_t offset,
                                                     size_t count) const {
     return this->template create<granular_span_adapter<T, GranularityPolicy>>(
@@ -589,6 +635,10 @@ class active_block : private GranularityPolicy {
 
   DWARFS_FORCE_INLINE std::shared_ptr<block_data> data() const { return data_; }
 
+  DWARFS_FORCE_INLINE std::span<uint8_t const> span() const {
+    return data_->vec();
+  }
+
   DWARFS_FORCE_INLINE void
   append_bytes(std::span<uint8_t const> data, bloom_filter& global_filter);
 
@@ -617,11 +667,29 @@ class active_block : private GranularityPolicy {
     }
   }
 
-  DWARFS_FORCE_INLINE bloom_filter const& filter() const { return filter_; }
+  void add_hashes_to(bloom_filter& filter) const {
+    // keys with collisions are always also in values()
+    for (auto const& [hashval, offset] : offsets_.values()) {
+      filter.add(hashval);
+    }
+  }
+
+  template <typename F>
+  void for_each_hash(F&& func) const {
+    for (auto const& [hashval, offset] : offsets_.values()) {
+      func(hashval, offset);
+    }
+    for (auto const& [hashval, offsets] : offsets_.collisions()) {
+      for (auto offset : offsets) {
+        func(hashval, offset);
+      }
+    }
+  }
 
  private:
   DWARFS_FORCE_INLINE bool
   is_existing_repeating_sequence(hash_t hashval, size_t offset);
+  void append_hashes_batched(size_t offset, bloom_filter& global_filter);
 
   static constexpr size_t num_inline_offsets = 4;
 
@@ -635,35 +703,6 @@ class active_block : private GranularityPolicy {
   std::shared_ptr<block_data> data_;
 };
 
-class segmenter_progress : public progress::context {
- public:
-  using status = progress::context::status;
-
-  segmenter_progress(std::string context, size_t total_size)
-      : context_{std::move(context)}
-      , bytes_total_{total_size} {}
-
-  status get_status() const override {
-    auto f = current_file.load();
-    status st;
-    st.color = termcolor::GREEN;
-    st.context = context_;
-    if (f) {
-      st.path.emplace(f->path_as_string());
-    }
-    st.bytes_processed.emplace(bytes_processed.load());
-    st.bytes_total.emplace(bytes_total_);
-    return st;
-  }
-
-  std::atomic<file const*> current_file{nullptr};
-  std::atomic<size_t> bytes_processed{0};
-
- private:
-  std::string const context_;
-  size_t const bytes_total_;
-};
-
 template <typename LoggerPolicy, typename SegmentingPolicy>
 class segmenter_ final : public segmenter::impl, private SegmentingPolicy {
  private:
@@ -694,7 +733,19 @@ class segmenter_ final : public segmenter::impl, private SegmentingPolicy {
       , window_step_{window_step(cfg)}
       , block_size_in_frames_{block_size_in_frames(cfg)}
       , global_filter_{bloom_filter_size(cfg)}
+      , block_filter_size_{block_bloom_filter_size(cfg)}
       , match_counts_{1, 0, 128} {
+    if (cfg_.memory) {
+      mem_ = cfg_.memory->account(memory_budget::component::segmenter,
+                                  global_filter_.size() / 8);
+    }
+
+    if constexpr (is_segmentation_enabled()) {
+      if (!cfg_.spill_dir.empty()) {
+        spill_ = std::make_unique<spill_index>(cfg_.spill_dir);
+      }
+    }
+
     if constexpr (is_segmentation_enabled()) {
       LOG_VERBOSE << cfg_.context << "using a "
                   << size_with_unit(frames_to_bytes(window_size_))
@@ -705,7 +756,8 @@ class segmenter_ final : public segmenter::impl, private SegmentingPolicy {
                   << "-time " << granularity_bytes()
                   << "-byte frames for segment analysis";
       LOG_VERBOSE << cfg_.context << "bloom filter size: "
-                  << size_with_unit(global_filter_.size() / 8);
+                  << size_with_unit(global_filter_.size() / 8) << " global, "
+                  << size_with_unit(block_filter_size_ / 8) << " per block";
 
       for (int i = 0; i < 256; ++i) {
         auto val =
@@ -719,12 +771,30 @@ class segmenter_ final : public segmenter::impl, private SegmentingPolicy {
   void add_chunkable(chunkable& chkable) override;
   void finish() override;
 
+  segmenter::stats get_stats() const override {
+    segmenter::stats st;
+    st.total_matches = stats_.total_matches;
+    st.good_matches = stats_.good_matches;
+    st.bad_matches = stats_.bad_matches;
+    st.bloom_lookups = stats_.bloom_lookups;
+    st.bloom_hits = stats_.bloom_hits;
+    return st;
+  }
+
  private:
   struct chunk_state {
     size_t offset_in_frames{0};
     size_t size_in_frames{0};
   };
 
+  struct run_info {
+    size_t begin_in_frames;
+    size_t end_in_frames;
+    size_t period_in_frames;
+  };
+
+  using active_block_type = active_block<LoggerPolicy, GranularityPolicyT>;
+
   DWARFS_FORCE_INLINE void block_ready();
   void finish_chunk(chunkable& chkable);
   DWARFS_FORCE_INLINE void
@@ -734,6 +804,11 @@ class segmenter_ final : public segmenter::impl, private SegmentingPolicy {
   add_data(chunkable& chkable, size_t offset_in_frames, size_t size_in_frames);
   DWARFS_FORCE_INLINE void
   segment_and_add_data(chunkable& chkable, size_t size_in_frames);
+  std::optional<run_info>
+  find_run(std::span<uint8_t const> data, size_t window_offset_in_frames,
+           size_t min_offset_in_frames) const;
+  void add_run(chunkable& chkable, run_info run);
+  void spill_block(active_block_type const& block);
 
   DWARFS_FORCE_INLINE size_t
   bloom_filter_size(const segmenter::config& cfg) const {
@@ -747,6 +822,35 @@ class segmenter_ final : public segmenter::impl, private SegmentingPolicy {
     return 0;
   }
 
+  // Each block only needs a filter for its own hashes. These are only
+  // looked at after a hit in the global filter.
+  DWARFS_FORCE_INLINE size_t
+  block_bloom_filter_size(const segmenter::config& cfg) const {
+    if constexpr (is_segmentation_enabled()) {
+      auto hash_count = std::bit_ceil(
+          std::max<size_t>(1, block_size_in_frames(cfg) / window_step(cfg)));
+      return (static_cast<size_t>(1) << cfg.bloom_filter_size) * hash_count;
+    }
+
+    return 0;
+  }
+
+  // Hashes of blocks that have dropped out of the lookback stay in the
+  // global filter until it is rebuilt. Rebuilding only after a quarter of
+  // the lookback blocks have expired keeps the cost per block independent
+  // of the lookback, at the price of a few more false positives.
+  size_t global_filter_rebuild_interval() const {
+    return std::max<size_t>(1, cfg_.max_active_blocks / 4);
+  }
+
+  // The spill filter grows along with the spill index, but unlike the
+  // index, it has to be kept in memory, so its size is capped.
+  size_t spill_filter_size() const {
+    return std::min(kMaxSpillFilterSize,
+                    (static_cast<size_t>(1) << cfg_.bloom_filter_size) *
+                        spill_->capacity());
+  }
+
   static DWARFS_FORCE_INLINE size_t window_size(const segmenter::config& cfg) {
     return cfg.blockhash_window_size > 0
                ? static_cast<size_t>(1) << cfg.blockhash_window_size
@@ -763,6 +867,29 @@ class segmenter_ final : public segmenter::impl, private SegmentingPolicy {
     return bytes_to_frames(constrained_block_size(raw_size));
   }
 
+  // Runs are only collapsed if the template fits comfortably into a block
+  size_t run_template_frames() const {
+    auto frames = std::min(kRunTemplateSize / granularity_bytes(),
+                           block_size_in_frames_ / 4);
+    return frames >= kMinRunSize / granularity_bytes() ? frames : 0;
+  }
+
+  size_t min_run_frames() const {
+    return std::max(kMinRunSize / granularity_bytes(),
+                    2 * (window_size_ + window_step_));
+  }
+
+  // Estimate of the memory used by a single active block, including its
+  // bloom filter and the offsets of all hashes
+  size_t active_block_footprint() const {
+    auto bytes = frames_to_bytes(block_size_in_frames_);
+    if constexpr (is_segmentation_enabled()) {
+      bytes += block_filter_size_ / 8;
+      bytes += (block_size_in_frames_ / window_step_) * 2 * sizeof(uint32_t);
+    }
+    return bytes;
+  }
+
   LOG_PROXY_DECL(LoggerPolicy);
   progress& prog_;
   std::shared_ptr<block_manager> blkmgr_;
@@ -773,14 +900,23 @@ class segmenter_ final : public segmenter::impl, private SegmentingPolicy {
   size_t const window_size_;
   size_t const window_step_;
   size_t const block_size_in_frames_;
+  size_t const run_template_frames_{run_template_frames()};
+  size_t const min_run_frames_{min_run_frames()};
 
   chunk_state chunk_;
 
   bloom_filter global_filter_;
+  size_t const block_filter_size_;
+  size_t expired_blocks_{0};
+
+  // Blocks that drop out of the lookback are moved to the spill index if
+  // a spill directory is configured.
+  std::unique_ptr<spill_index> spill_;
+  std::unique_ptr<bloom_filter> spill_filter_;
 
   segmenter_stats stats_;
 
-  using active_block_type = active_block<LoggerPolicy, GranularityPolicyT>;
+  memory_budget::reservation mem_;
 
   // Active blocks are blocks that can still be referenced from new chunks.
   // Up to N blocks (configurable) can be active and are kept in this queue.
@@ -797,13 +933,13 @@ class segmenter_ final : public segmenter::impl, private SegmentingPolicy {
 template <typename LoggerPolicy, typename GranularityPolicy>
 class segment_match : private GranularityPolicy {
  public:
-  using active_block_type = active_block<LoggerPolicy, GranularityPolicy>;
-
   template <typename... PolicyArgs>
-  DWARFS_FORCE_INLINE segment_match(active_block_type const* blk, uint32_t off,
-                                    PolicyArgs&&... args) noexcept
+  DWARFS_FORCE_INLINE
+  segment_match(size_t block_num, std::span<uint8_t const> block_data,
+                uint32_t off, PolicyArgs&&... args) noexcept
       : GranularityPolicy(std::forward<PolicyArgs>(args)...)
-      , block_{blk}
+      , block_num_{block_num}
+      , block_data_{block_data}
       , offset_{off} {}
 
   void verify_and_extend(
@@ -813,17 +949,18 @@ class segment_match : private GranularityPolicy {
   DWARFS_FORCE_INLINE bool operator<(segment_match const& rhs) const {
     return size_ < rhs.size_ ||
            (size_ == rhs.size_ &&
-            (block_->num() < rhs.block_->num() ||
-             (block_->num() == rhs.block_->num() && offset_ < rhs.offset_)));
+            (block_num_ < rhs.block_num_ ||
+             (block_num_ == rhs.block_num_ && offset_ < rhs.offset_)));
   }
 
   DWARFS_FORCE_INLINE size_t pos() const { return pos_; }
   DWARFS_FORCE_INLINE uint32_t size() const { return size_; }
   DWARFS_FORCE_INLINE uint32_t offset() const { return offset_; }
-  DWARFS_FORCE_INLINE size_t block_num() const { return block_->num(); }
+  DWARFS_FORCE_INLINE size_t block_num() const { return block_num_; }
 
  private:
-  active_block_type const* block_;
+  size_t block_num_;
+  std::span<uint8_t const> block_data_;
   uint32_t offset_;
   uint32_t size_{0};
   size_t pos_{0};
@@ -887,6 +1024,13 @@ active_block<LoggerPolicy, GranularityPolicy>::append_bytes(
 
   if (window_size_ > 0) {
     while (offset < v.size()) {
+      if constexpr (GranularityPolicy::batch_hashing()) {
+        if (offset >= window_size_) [[likely]] {
+          append_hashes_batched(offset, global_filter);
+          break;
+        }
+      }
+
       if (offset < window_size_) [[unlikely]] {
         v.update_hash(hasher_, offset);
       } else {
@@ -907,13 +1051,43 @@ active_block<LoggerPolicy, GranularityPolicy>::append_bytes(
   }
 }
 
+template <typename LoggerPolicy, typename GranularityPolicy>
+void active_block<LoggerPolicy, GranularityPolicy>::append_hashes_batched(
+    size_t offset, bloom_filter& global_filter) {
+  auto const* const p = data_->vec().data();
+  auto const size = data_->size();
+  std::array<hash_t, kHashBatchSize> hashes;
+
+  while (offset < size) {
+    auto const count = std::min(kHashBatchSize, size - offset);
+
+    hasher_.update_batch(p + offset - window_size_, p + offset, count,
+                         hashes.data());
+
+    // hashes[i] is the hash of the window ending at offset + i + 1
+    auto const end = offset + count;
+
+    for (auto next = (offset + window_step_mask_ + 1) & ~window_step_mask_;
+         next <= end; next += window_step_mask_ + 1) {
+      auto const hashval = hashes[next - offset - 1];
+      if (!is_existing_repeating_sequence(hashval, next - window_size_))
+          [[likely]] {
+        offsets_.insert(hashval, next - window_size_);
+        filter_.add(hashval);
+        global_filter.add(hashval);
+      }
+    }
+
+    offset = end;
+  }
+}
+
 template <typename LoggerPolicy, typename GranularityPolicy>
 void segment_match<LoggerPolicy, GranularityPolicy>::verify_and_extend(
     granular_span_adapter<uint8_t const, GranularityPolicy> const& data,
     size_t pos, size_t len, size_t begin, size_t end) {
   auto v = this->template create<
-      granular_vector_adapter<uint8_t, GranularityPolicy>>(
-      block_->data()->vec());
+      granular_span_adapter<uint8_t const, GranularityPolicy>>(block_data_);
 
   // First, check if the regions actually match
   if (v.compare(offset_, data.subspan(pos, len)) == 0) {
@@ -1014,6 +1188,30 @@ void segmenter_<LoggerPolicy, SegmentingPolicy>::finish() {
               << ", p75: " << pct(0.75) << ", p90: " << pct(0.9)
               << ", p95: " << pct(0.95) << ", p99: " << pct(0.99);
 
+  if (stats_.global_filter_rebuilds > 0) {
+    LOG_VERBOSE << cfg_.context << "global bloom filter rebuilt "
+                << stats_.global_filter_rebuilds << " times";
+  }
+
+  if (spill_) {
+    LOG_VERBOSE << cfg_.context << "spilled " << stats_.spilled_blocks
+                << " blocks (" << size_with_unit(spill_->data_size()) << ", "
+                << spill_->size() << " hashes), found " << stats_.spill_matches
+                << " matches (" << size_with_unit(stats_.spill_match_bytes)
+                << ") in spilled blocks, spill bloom filter rebuilt "
+                << stats_.spill_filter_rebuilds << " times";
+
+    // no need to keep the spill files around until we're destroyed
+    spill_filter_.reset();
+    spill_.reset();
+  }
+
+  if (stats_.runs > 0) {
+    LOG_VERBOSE << cfg_.context << "collapsed " << stats_.runs
+                << " runs of repeated data ("
+                << size_with_unit(stats_.run_bytes) << ")";
+  }
+
   for (auto [k, v] : repeating_collisions_) {
     LOG_VERBOSE << cfg_.context
                 << fmt::format(
@@ -1037,13 +1235,25 @@ segmenter_<LoggerPolicy, SegmentingPolicy>::append_to_block(
     chunkable& chkable, size_t offset_in_frames, size_t size_in_frames) {
   if (blocks_.empty() or blocks_.back().full()) [[unlikely]] {
     if (blocks_.size() >= std::max<size_t>(1, cfg_.max_active_blocks)) {
+      if (spill_) {
+        spill_block(blocks_.front());
+      }
       blocks_.pop_front();
+      ++expired_blocks_;
+    } else if (mem_) {
+      mem_.grow(active_block_footprint());
     }
 
     if constexpr (is_segmentation_enabled()) {
-      global_filter_.clear();
-      for (auto const& b : blocks_) {
-        global_filter_.merge(b.filter());
+      // New hashes are added to the global filter incrementally, so it
+      // only needs to be rebuilt to get rid of expired hashes.
+      if (expired_blocks_ >= global_filter_rebuild_interval()) {
+        global_filter_.clear();
+        for (auto const& b : blocks_) {
+          b.add_hashes_to(global_filter_);
+        }
+        expired_blocks_ = 0;
+        ++stats_.global_filter_rebuilds;
       }
     }
 
@@ -1051,7 +1261,7 @@ segmenter_<LoggerPolicy, SegmentingPolicy>::append_to_block(
                   repeating_collisions_, blkmgr_->get_logical_block(),
                   block_size_in_frames_,
                   cfg_.max_active_blocks > 0 ? window_size_ : 0, window_step_,
-                  global_filter_.size());
+                  block_filter_size_);
   }
 
   auto const offset_in_bytes = frames_to_bytes(offset_in_frames);
@@ -1076,6 +1286,43 @@ segmenter_<LoggerPolicy, SegmentingPolicy>::append_to_block(
   }
 }
 
+template <typename LoggerPolicy, typename SegmentingPolicy>
+void segmenter_<LoggerPolicy, SegmentingPolicy>::spill_block(
+    active_block_type const& block) {
+  LOG_TRACE << cfg_.context << "spilling block " << block.num();
+
+  spill_->add_block(block.num(), block.span());
+  block.for_each_hash(
+      [this](auto hashval, auto offset) { spill_->add(hashval, offset); });
+  ++stats_.spilled_blocks;
+
+  if (auto const size = spill_filter_size();
+      !spill_filter_ || spill_filter_->size() < size) {
+    auto const old_size = spill_filter_ ? spill_filter_->size() : 0;
+
+    if (mem_) {
+      mem_.grow((size - old_size) / 8);
+    }
+
+    spill_filter_ = std::make_unique<bloom_filter>(size);
+    spill_->for_each_hash(
+        [this](auto hashval) { spill_filter_->add(hashval); });
+
+    if (old_size > 0) {
+      ++stats_.spill_filter_rebuilds;
+    }
+
+    if (size == kMaxSpillFilterSize) {
+      LOG_WARN << cfg_.context
+               << "spill bloom filter has reached its maximum size of "
+               << size_with_unit(size / 8)
+               << ", matching against spilled blocks will slow down";
+    }
+  } else {
+    block.add_hashes_to(*spill_filter_);
+  }
+}
+
 template <typename LoggerPolicy, typename SegmentingPolicy>
 void segmenter_<LoggerPolicy, SegmentingPolicy>::add_data(
     chunkable& chkable, size_t offset_in_frames, size_t size_in_frames) {
@@ -1131,6 +1378,13 @@ segmenter_<LoggerPolicy, SegmentingPolicy>::segment_and_add_data(
     data.update_hash(hasher, offset_in_frames);
   }
 
+  // The hash of the window ending at offset_in_frames. With batch hashing,
+  // the hasher runs ahead and the values are taken from hash_batch.
+  uint32_t hashval = hasher();
+  std::array<uint32_t, kHashBatchSize> hash_batch;
+  size_t batch_index = 0;
+  size_t batch_size = 0;
+
   folly::small_vector<segment_match<LoggerPolicy, GranularityPolicyT>, 1>
       matches;
 
@@ -1151,34 +1405,104 @@ segmenter_<LoggerPolicy, SegmentingPolicy>::segment_and_add_data(
         last_offset = offset;
       };
 
+  // Restart hashing after all data up to frames_written has been consumed
+  // by a match or a run. Returns false if there's not enough data left to
+  // fill another window.
+  auto restart_at_frames_written = [&] {
+    offset_in_frames = frames_written;
+
+    if (size_in_frames - frames_written < window_size_) {
+      return false;
+    }
+
+    hasher.clear();
+
+    for (; offset_in_frames < frames_written + window_size_;
+         ++offset_in_frames) {
+      data.update_hash(hasher, offset_in_frames);
+    }
+
+    update_progress(offset_in_frames);
+
+    hashval = hasher();
+    batch_index = 0;
+    batch_size = 0;
+
+    next_hash_offset_in_frames = frames_written + lookback_size_in_frames +
+                                 blocks_.back().next_hash_distance_in_frames();
+
+    return true;
+  };
+
+  // Don't look for another run before the end of the last short run
+  size_t no_run_before_in_frames = 0;
+
   while (offset_in_frames < size_in_frames) {
     ++stats_.bloom_lookups;
 
-    if (global_filter_.test(hasher())) [[unlikely]] {
+    if (global_filter_.test(hashval) ||
+        (spill_filter_ && spill_filter_->test(hashval))) [[unlikely]] {
       ++stats_.bloom_hits;
 
       if constexpr (is_multi_block_mode()) {
         for (auto const& block : blocks_) {
-          block.for_each_offset_filter(hasher(), [&, this](auto off) {
-            this->add_match(matches, &block, off);
+          block.for_each_offset_filter(hashval, [&, this](auto off) {
+            this->add_match(matches, block.num(), block.span(), off);
           });
         }
       } else {
         auto& block = blocks_.front();
-        block.for_each_offset(hasher(), [&, this](auto off) {
-          this->add_match(matches, &block, off);
+        block.for_each_offset(hashval, [&, this](auto off) {
+          this->add_match(matches, block.num(), block.span(), off);
         });
       }
 
+      if (spill_filter_ && spill_filter_->test(hashval)) [[unlikely]] {
+        spill_->for_each_offset(
+            hashval, [&, this](size_t num, auto block_data, auto off) {
+              this->add_match(matches, num, block_data, off);
+            });
+      }
+
       if (!matches.empty()) [[unlikely]] {
         ++stats_.bloom_true_positives;
         match_counts_.addValue(matches.size());
 
+        // A run is very likely to match its own first windows as soon as
+        // they have been added to the block, so this is the only place we
+        // need to check for runs. This is deliberately only done for hashes
+        // that are actually indexed, not for every bloom filter hit. The
+        // global filter keeps hashes of expired blocks until it is rebuilt,
+        // and the segmenting results must not depend on that.
+        if (run_template_frames_ > 0 &&
+            offset_in_frames >= no_run_before_in_frames) {
+          if (auto run =
+                  find_run(chkable.span(), offset_in_frames - window_size_,
+                           frames_written)) {
+            if (run->end_in_frames - run->begin_in_frames >= min_run_frames_) {
+              matches.clear();
+              add_data(chkable, frames_written,
+                       run->begin_in_frames - frames_written);
+              finish_chunk(chkable);
+              add_run(chkable, *run);
+              frames_written = run->end_in_frames;
+
+              if (!restart_at_frames_written()) {
+                break;
+              }
+
+              continue;
+            }
+
+            no_run_before_in_frames = run->end_in_frames;
+          }
+        }
+
         LOG_TRACE << cfg_.context << "[" << blocks_.back().num() << " @ "
                   << frames_to_bytes(blocks_.back().size_in_frames())
                   << ", chunkable @ " << frames_to_bytes(offset_in_frames)
                   << "] found " << matches.size()
-                  << " matches (hash=" << fmt::format("{:08x}", hasher())
+                  << " matches (hash=" << fmt::format("{:08x}", hashval)
                   << ", window size=" << window_size_ << ")";
 
         for (auto& m : matches) {
@@ -1209,6 +1533,13 @@ segmenter_<LoggerPolicy, SegmentingPolicy>::segment_and_add_data(
           auto match_off = best->offset();
           auto num_to_write = best->pos() - frames_written;
 
+          // Logical block numbers are increasing, so anything older than
+          // the oldest active block must have been spilled
+          if (spill_ && block_num < blocks_.front().num()) {
+            ++stats_.spill_matches;
+            stats_.spill_match_bytes += frames_to_bytes(match_len);
+          }
+
           // best->block can be invalidated by this call to add_data()!
           add_data(chkable, frames_written, num_to_write);
           frames_written += num_to_write;
@@ -1222,24 +1553,9 @@ segmenter_<LoggerPolicy, SegmentingPolicy>::segment_and_add_data(
 
           prog_.saved_by_segmentation += frames_to_bytes(match_len);
 
-          offset_in_frames = frames_written;
-
-          if (size_in_frames - frames_written < window_size_) {
+          if (!restart_at_frames_written()) {
             break;
           }
-
-          hasher.clear();
-
-          for (; offset_in_frames < frames_written + window_size_;
-               ++offset_in_frames) {
-            data.update_hash(hasher, offset_in_frames);
-          }
-
-          update_progress(offset_in_frames);
-
-          next_hash_offset_in_frames =
-              frames_written + lookback_size_in_frames +
-              blocks_.back().next_hash_distance_in_frames();
         }
 
         matches.clear();
@@ -1263,7 +1579,27 @@ segmenter_<LoggerPolicy, SegmentingPolicy>::segment_and_add_data(
       update_progress(offset_in_frames);
     }
 
-    data.update_hash(hasher, offset_in_frames - window_size_, offset_in_frames);
+    if constexpr (GranularityPolicyT::batch_hashing()) {
+      if (batch_index == batch_size) [[unlikely]] {
+        auto const* const p = chkable.span().data();
+        batch_size =
+            std::min(kHashBatchSize, size_in_frames - offset_in_frames);
+        hasher.update_batch(p + offset_in_frames - window_size_,
+                            p + offset_in_frames, batch_size,
+                            hash_batch.data());
+        for (size_t i = 0; i < batch_size; ++i) {
+          global_filter_.prefetch(hash_batch[i]);
+        }
+        batch_index = 0;
+      }
+
+      hashval = hash_batch[batch_index++];
+    } else {
+      data.update_hash(hasher, offset_in_frames - window_size_,
+                       offset_in_frames);
+      hashval = hasher();
+    }
+
     ++offset_in_frames;
   }
 
@@ -1273,6 +1609,117 @@ segmenter_<LoggerPolicy, SegmentingPolicy>::segment_and_add_data(
   finish_chunk(chkable);
 }
 
+template <typename LoggerPolicy, typename SegmentingPolicy>
+auto segmenter_<LoggerPolicy, SegmentingPolicy>::find_run(
+    std::span<uint8_t const> data, size_t window_offset_in_frames,
+    size_t min_offset_in_frames) const -> std::optional<run_info> {
+  auto const granularity = granularity_bytes();
+  auto const* const p = data.data();
+  auto const window_begin = frames_to_bytes(window_offset_in_frames);
+  auto const window_end = window_begin + frames_to_bytes(window_size_);
+  auto const max_period = std::max<size_t>(kMaxRunPeriod, granularity);
+
+  for (size_t period_in_frames = 1;
+       frames_to_bytes(period_in_frames) <= max_period; ++period_in_frames) {
+    auto const period = frames_to_bytes(period_in_frames);
+
+    if (period >= window_end - window_begin) {
+      break;
+    }
+
+    // memcmp() will bail out early for anything that's not a run
+    if (std::memcmp(p + window_begin, p + window_begin + period,
+                    window_end - window_begin - period) != 0) {
+      continue;
+    }
+
+    auto end = window_end;
+
+    while (end < data.size()) {
+      auto const len = std::min(kRunCompareSize, data.size() - end);
+
+      if (std::memcmp(p + end, p + end - period, len) != 0) {
+        while (p[end] == p[end - period]) {
+          ++end;
+        }
+        break;
+      }
+
+      end += len;
+    }
+
+    auto begin = window_offset_in_frames;
+
+    while (begin > min_offset_in_frames &&
+           std::memcmp(p + frames_to_bytes(begin - 1),
+                       p + frames_to_bytes(begin - 1 + period_in_frames),
+                       granularity) == 0) {
+      --begin;
+    }
+
+    return run_info{begin, end / granularity, period_in_frames};
+  }
+
+  return std::nullopt;
+}
+
+template <typename LoggerPolicy, typename SegmentingPolicy>
+void segmenter_<LoggerPolicy, SegmentingPolicy>::add_run(chunkable& chkable,
+                                                         run_info run) {
+  auto const period = run.period_in_frames;
+  auto length = run.end_in_frames - run.begin_in_frames;
+  auto const run_bytes = frames_to_bytes(length);
+  auto template_size =
+      std::min(length, run_template_frames_) / period * period;
+
+  // The template must be contiguous, so it has to fit into a single block
+  if (!blocks_.empty() && !blocks_.back().full()) {
+    auto const space = block_size_in_frames_ - blocks_.back().size_in_frames();
+
+    if (space < template_size) {
+      if (space >= template_size / 4) {
+        template_size = space / period * period;
+      } else {
+        // Not worth it, fill up the block with the start of the run
+        add_data(chkable, run.begin_in_frames, space);
+        run.begin_in_frames += space;
+        length -= space;
+        template_size = std::min(length, template_size) / period * period;
+      }
+    }
+  }
+
+  auto const template_offset = blocks_.empty() || blocks_.back().full()
+                                   ? 0
+                                   : blocks_.back().size_in_frames();
+
+  add_data(chkable, run.begin_in_frames, template_size);
+
+  auto const block_num = blocks_.back().num();
+
+  finish_chunk(chkable);
+
+  LOG_TRACE << cfg_.context << "collapsing run of "
+            << frames_to_bytes(length) << " bytes with period "
+            << frames_to_bytes(period) << " into block " << block_num << " @ "
+            << frames_to_bytes(template_offset);
+
+  for (auto pos = run.begin_in_frames + template_size;
+       pos < run.end_in_frames;) {
+    auto const size = std::min(template_size, run.end_in_frames - pos);
+
+    chkable.add_chunk(block_num, frames_to_bytes(template_offset),
+                      frames_to_bytes(size));
+
+    prog_.chunk_count++;
+    prog_.saved_by_segmentation += frames_to_bytes(size);
+    pos += size;
+  }
+
+  ++stats_.runs;
+  stats_.run_bytes += run_bytes;
+}
+
 template <template <typename> typename SegmentingPolicy, size_t N>
 struct constant_granularity_segmenter_ {
   template <typename LoggerPolicy>
@@ -1358,8 +1805,12 @@ segmenter::segmenter(logger& lgr, writer_progress& prog,
                      std::shared_ptr<internal::block_manager> blkmgr,
                      config const& cfg, compression_constraints const& cc,
                      size_t total_size, block_ready_cb block_ready)
-    : impl_(internal::create_segmenter(lgr, prog.get_internal(),
-                                       std::move(blkmgr), cfg, cc, total_size,
-                                       std::move(block_ready))) {}
+    : impl_(cfg.cdc_chunk_size_bits > 0
+                ? internal::create_cdc_segmenter(
+                      lgr, prog.get_internal(), std::move(blkmgr), cfg, cc,
+                      total_size, std::move(block_ready))
+                : internal::create_segmenter(
+                      lgr, prog.get_internal(), std::move(blkmgr), cfg, cc,
+                      total_size, std::move(block_ready))) {}
 
 } // namespace dwarfs::writer
@@ -22,6 +22,8 @@
 #include <dwarfs/writer/categorizer.h>
 #include <dwarfs/writer/segmenter_factory.h>
 
+#include <dwarfs/writer/internal/chunk_index.h>
+
 namespace dwarfs::writer {
 
 namespace internal {
@@ -34,7 +36,11 @@ class segmenter_factory_ final : public segmenter_factory::impl {
       : lgr_{lgr}
       , prog_{prog}
       , catmgr_{catmgr}
-      , cfg_{cfg} {}
+      , cfg_{cfg} {
+    if (cfg_.shared_chunk_index) {
+      shared_chunk_index_ = std::make_shared<chunk_index>();
+    }
+  }
 
   segmenter create(fragment_category cat, size_t cat_size,
                    compression_constraints const& cc,
@@ -50,7 +56,13 @@ class segmenter_factory_ final : public segmenter_factory::impl {
     cfg.window_increment_shift = cfg_.window_increment_shift.get(cat);
     cfg.max_active_blocks = cfg_.max_active_blocks.get(cat);
     cfg.bloom_filter_size = cfg_.bloom_filter_size.get(cat);
+    cfg.cdc_chunk_size_bits =
+        cfg_.cdc_chunk_size_bits.get_optional(cat).value_or(0);
+    cfg.cdc_hash_only = cfg_.cdc_hash_only;
     cfg.block_size_bits = cfg_.block_size_bits;
+    cfg.memory = cfg_.memory;
+    cfg.spill_dir = cfg_.spill_dir;
+    cfg.shared_chunk_index = shared_chunk_index_;
 
     return segmenter(lgr_, prog_, std::move(blkmgr), cfg, cc, cat_size,
                      std::move(block_ready));
@@ -60,11 +72,17 @@ class segmenter_factory_ final : public segmenter_factory::impl {
     return static_cast<size_t>(1) << cfg_.block_size_bits;
   }
 
+  bool requires_serial_segmenting() const override {
+    // which category stores a shared chunk first must not depend on timing
+    return shared_chunk_index_ != nullptr;
+  }
+
  private:
   logger& lgr_;
   writer_progress& prog_;
   std::shared_ptr<categorizer_manager> catmgr_;
   segmenter_factory::config cfg_;
+  std::shared_ptr<chunk_index> shared_chunk_index_;
 };
 
 } // namespace internal
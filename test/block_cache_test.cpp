@@ -21,12 +21,18 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdio>
 #include <numeric>
 #include <optional>
 #include <random>
 #include <span>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
+#include <fmt/format.h>
+
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
@@ -39,10 +45,17 @@
 #include <dwarfs/reader/cache_tidy_config.h>
 #include <dwarfs/reader/filesystem_options.h>
 #include <dwarfs/reader/filesystem_v2.h>
+#include <dwarfs/reader/iovec_read_buf.h>
 #include <dwarfs/tool/main_adapter.h>
+#include <dwarfs/util.h>
 #include <dwarfs_tool_main.h>
 
+#include <dwarfs/reader/internal/block_buffer_arena.h>
+#include <dwarfs/reader/internal/block_pin.h>
 #include <dwarfs/reader/internal/cached_block.h>
+#include <dwarfs/reader/internal/compressed_cache.h>
+#include <dwarfs/reader/internal/memory_pressure_controller.h>
+#include <dwarfs/reader/internal/range_completion.h>
 
 #include "mmap_mock.h"
 #include "test_helpers.h"
@@ -58,12 +71,13 @@ class mock_cached_block : public reader::internal::cached_block {
   mock_cached_block(std::span<uint8_t const> span)
       : span_{span} {}
 
+  void load() override {}
   size_t range_end() const override { return span_ ? span_->size() : 0; }
   const uint8_t* data() const override {
     return span_ ? span_->data() : nullptr;
   }
   void decompress_until(size_t) override {}
-  size_t uncompressed_size() const override { return 0; }
+  size_t uncompressed_size() const override { return range_end(); }
   void touch() override {}
   bool last_used_before(std::chrono::steady_clock::time_point) const override {
     return false;
@@ -136,6 +150,684 @@ TEST(block_range, compressed) {
           ::testing::HasSubstr("block_range: size out of range (101 > 100)")));
 }
 
+TEST(block_range, pinned) {
+  using reader::internal::block_pin;
+  using reader::internal::block_pin_accounting;
+
+  std::vector<uint8_t> data(100);
+  std::iota(data.begin(), data.end(), 0);
+
+  auto acct = std::make_shared<block_pin_accounting>(150);
+  auto b1 = std::make_shared<mock_cached_block>(data);
+  auto b2 = std::make_shared<mock_cached_block>(data);
+
+  auto p1 = block_pin::create(b1, acct);
+  ASSERT_TRUE(p1);
+  EXPECT_EQ(acct->pinned_bytes(), 100);
+
+  // Pinning the same block again doesn't consume more budget
+  auto p1b = block_pin::create(b1, acct);
+  ASSERT_TRUE(p1b);
+  EXPECT_EQ(acct->pinned_bytes(), 100);
+
+  // ...but pinning another block does
+  EXPECT_EQ(block_pin::create(b2, acct), nullptr);
+  EXPECT_EQ(acct->rejected(), 1);
+
+  {
+    reader::block_range range{*p1, 10, 20};
+    p1->unref();
+    p1b->unref();
+
+    // The range still holds a reference to the pin
+    EXPECT_EQ(acct->pinned_bytes(), 100);
+
+    auto copy = range;
+    EXPECT_EQ(copy.size(), 20);
+    EXPECT_TRUE(std::equal(copy.begin(), copy.end(), data.begin() + 10));
+
+    auto moved = std::move(copy);
+    EXPECT_EQ(moved.data(), range.data());
+  }
+
+  EXPECT_EQ(acct->pinned_bytes(), 0);
+
+  auto p2 = block_pin::create(b2, acct);
+  ASSERT_TRUE(p2);
+
+  EXPECT_THAT(
+      [&] { reader::block_range range(*p2, 100, 1); },
+      ::testing::ThrowsMessage<dwarfs::runtime_error>(
+          ::testing::HasSubstr("block_range: size out of range (101 > 100)")));
+
+  p2->unref();
+
+  EXPECT_EQ(acct->pinned_bytes(), 0);
+  EXPECT_EQ(acct->peak_pinned_bytes(), 100);
+}
+
+TEST(range_completion, basic) {
+  std::vector<uint8_t> data(100);
+  std::iota(data.begin(), data.end(), 0);
+
+  static constexpr size_t num_ranges{
+      2 * reader::internal::range_completion::inline_storage};
+
+  reader::internal::range_completion rc(num_ranges);
+  EXPECT_EQ(rc.size(), num_ranges);
+
+  std::vector<std::thread> threads;
+
+  for (size_t i = 0; i < num_ranges; ++i) {
+    threads.emplace_back([&, i] {
+      if (i == 7) {
+        rc[i].set_exception(std::make_exception_ptr(
+            dwarfs::runtime_error("oops", __FILE__, __LINE__)));
+      } else {
+        rc[i].set_value(reader::block_range{data.data(), i, 10});
+      }
+    });
+  }
+
+  rc.wait();
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  for (size_t i = 0; i < num_ranges; ++i) {
+    if (i == 7) {
+      EXPECT_THAT([&] { rc[i].get(); },
+                  ::testing::ThrowsMessage<dwarfs::runtime_error>(
+                      ::testing::HasSubstr("oops")));
+    } else {
+      auto& br = rc[i].get();
+      EXPECT_EQ(br.size(), 10);
+      EXPECT_EQ(br.data(), data.data() + i);
+    }
+  }
+}
+
+TEST(range_completion, abandon) {
+  std::vector<uint8_t> data(100);
+
+  reader::internal::range_completion rc(4);
+
+  // slot 0 is owned by a producer, slot 1 is completed by the caller,
+  // slots 2 and 3 are never handed out
+  rc[0].claim();
+  rc[1].set_value(reader::block_range{data.data(), 0, 10});
+
+  rc.abandon(std::make_exception_ptr(
+      dwarfs::runtime_error("abandoned", __FILE__, __LINE__)));
+
+  std::thread producer(
+      [&] { rc[0].set_value(reader::block_range{data.data(), 10, 10}); });
+
+  rc.wait();
+  producer.join();
+
+  EXPECT_EQ(rc[0].get().data(), data.data() + 10);
+  EXPECT_EQ(rc[1].get().data(), data.data());
+
+  for (size_t i = 2; i < 4; ++i) {
+    EXPECT_THAT([&] { rc[i].get(); },
+                ::testing::ThrowsMessage<dwarfs::runtime_error>(
+                    ::testing::HasSubstr("abandoned")));
+  }
+}
+
+TEST(block_buffer_arena, slabs) {
+  using reader::internal::block_buffer_arena;
+  using mode = reader::block_allocator_mode;
+
+  for (auto m : {mode::ARENA, mode::ARENA_THP, mode::ARENA_HUGETLB}) {
+    auto arena = std::make_shared<block_buffer_arena>(m, 16 << 20);
+    auto const huge = m != mode::ARENA;
+
+    EXPECT_EQ(huge ? 4 << 20 : 3 << 20, arena->slab_size(3 << 20));
+
+    // small blocks never use huge pages
+    EXPECT_GE(arena->slab_size(100 << 10), 100 << 10);
+    EXPECT_LT(arena->slab_size(100 << 10), 1 << 20);
+
+    auto buf = arena->make_buffer();
+    EXPECT_EQ(0, buf->size());
+    EXPECT_EQ(0, buf->capacity());
+
+    buf->reserve(3 << 20);
+    EXPECT_EQ(arena->slab_size(3 << 20), buf->capacity());
+    auto const* const data = buf->data();
+
+    buf->resize(1000);
+    std::iota(buf->data(), buf->data() + buf->size(), uint8_t{0});
+
+    // growing beyond the slab moves the data to a new slab
+    buf->resize(5 << 20);
+    EXPECT_NE(data, buf->data());
+    EXPECT_EQ(5 << 20, buf->size());
+    for (size_t i = 0; i < 1000; ++i) {
+      ASSERT_EQ(static_cast<uint8_t>(i), (*buf)[i]) << i;
+    }
+
+    auto st = arena->get_stats();
+    EXPECT_EQ(2, st.slabs_mapped);
+    EXPECT_EQ(0, st.slabs_reused);
+    EXPECT_EQ(arena->slab_size(3 << 20), st.free_bytes);
+
+    buf.reset();
+
+    // both slabs are kept for reuse
+    st = arena->get_stats();
+    EXPECT_EQ(arena->slab_size(3 << 20) + arena->slab_size(5 << 20),
+              st.free_bytes);
+    EXPECT_EQ(st.free_bytes, st.mapped_bytes);
+
+    {
+      auto buf2 = arena->make_buffer();
+      buf2->resize(3 << 20);
+      EXPECT_EQ(data, buf2->data());
+      EXPECT_EQ(1, arena->get_stats().slabs_reused);
+
+      // exceeds the free list limit, so some slabs are unmapped
+      std::vector<std::unique_ptr<mutable_byte_buffer>> bufs;
+      for (int i = 0; i < 4; ++i) {
+        bufs.push_back(arena->make_buffer());
+        bufs.back()->resize(3 << 20);
+      }
+    }
+
+    st = arena->get_stats();
+    EXPECT_LE(st.free_bytes, 16 << 20);
+    EXPECT_EQ(st.free_bytes, st.mapped_bytes);
+    EXPECT_GE(st.peak_mapped_bytes, 5 * arena->slab_size(3 << 20));
+  }
+}
+
+TEST(block_cache, bypass_whole_block_reads) {
+  static constexpr size_t num_files{4};
+  static constexpr size_t file_size{256 * 1024};
+
+  auto os = std::make_shared<test::os_access_mock>();
+  std::vector<std::string> contents;
+
+  {
+    std::mt19937_64 rng{42};
+
+    os->add("", {1, 040755, 1, 0, 0, 10, 42, 0, 0, 0});
+
+    for (size_t x = 0; x < num_files; ++x) {
+      contents.push_back(test::create_random_string(file_size, 32, 127, rng));
+      os->add_file(std::to_string(x), contents.back());
+    }
+  }
+
+  std::shared_ptr<mmif> mm;
+
+  {
+    auto fa = std::make_shared<test::test_file_access>();
+    test::test_iolayer iol{os, fa};
+
+    std::vector<std::string> args{"mkdwarfs", "-i", "/",   "-o",
+                                  "-",        "-l1", "-S16"};
+    EXPECT_EQ(0, tool::main_adapter(tool::mkdwarfs_main)(args, iol.get()));
+
+    mm = std::make_shared<test::mmap_mock>(iol.out());
+  }
+
+  test::test_logger lgr(logger::VERBOSE);
+
+  {
+    reader::filesystem_options opts{
+        .block_cache = {.max_bytes = 1024 * 1024,
+                        .num_workers = 2,
+                        .bypass_whole_block_reads = true},
+    };
+    reader::filesystem_v2 fs(lgr, *os, mm, opts);
+
+    for (size_t x = 0; x < num_files; ++x) {
+      auto iv = fs.find(fmt::format("/{}", x).c_str());
+      ASSERT_TRUE(iv);
+      auto const inode = iv->inode_num();
+      std::error_code ec;
+
+      // decompressed straight into the buffer
+      std::string buf(file_size, '\0');
+      EXPECT_EQ(file_size, fs.read(inode, buf.data(), file_size, 0, ec));
+      EXPECT_FALSE(ec) << ec.message();
+      EXPECT_EQ(contents[x], buf);
+
+      // partial reads still go through the cache
+      EXPECT_EQ(contents[x].substr(1000, 100000),
+                fs.read_string(inode, 100000, 1000));
+
+      // the remaining blocks won't be added to the cache
+      reader::iovec_read_buf iov;
+      EXPECT_EQ(file_size, fs.readv(inode, iov, file_size, 0, ec));
+      EXPECT_FALSE(ec) << ec.message();
+
+      std::string data;
+      for (auto const& v : iov.buf) {
+        data.append(static_cast<char const*>(v.iov_base), v.iov_len);
+      }
+      EXPECT_EQ(contents[x], data);
+    }
+  }
+
+  auto get_count = [&](std::string_view prefix) -> size_t {
+    for (auto const& e : lgr.get_log()) {
+      if (e.output.starts_with(prefix)) {
+        return std::stoul(e.output.substr(prefix.size()));
+      }
+    }
+    return 0;
+  };
+
+  EXPECT_EQ(num_files * file_size / (64 * 1024),
+            get_count("direct block reads: "));
+  EXPECT_EQ(2 * num_files, get_count("blocks not cached: "));
+}
+
+TEST(block_cache, concurrent_whole_block_reads) {
+  static constexpr size_t block_size{64 * 1024};
+  static constexpr size_t num_threads{8};
+  static constexpr size_t num_reads{50};
+
+  auto os = std::make_shared<test::os_access_mock>();
+  std::string contents;
+
+  {
+    std::mt19937_64 rng{42};
+    os->add("", {1, 040755, 1, 0, 0, 10, 42, 0, 0, 0});
+    contents = test::create_random_string(block_size, 32, 127, rng);
+    os->add_file("file", contents);
+  }
+
+  std::shared_ptr<mmif> mm;
+
+  {
+    auto fa = std::make_shared<test::test_file_access>();
+    test::test_iolayer iol{os, fa};
+
+    std::vector<std::string> args{"mkdwarfs", "-i", "/",   "-o",
+                                  "-",        "-l1", "-S16"};
+    EXPECT_EQ(0, tool::main_adapter(tool::mkdwarfs_main)(args, iol.get()));
+
+    mm = std::make_shared<test::mmap_mock>(iol.out());
+  }
+
+  test::test_logger lgr(logger::VERBOSE);
+
+  {
+    reader::filesystem_options opts{
+        .block_cache = {.max_bytes = 1024 * 1024,
+                        .num_workers = 2,
+                        .bypass_whole_block_reads = true},
+    };
+    reader::filesystem_v2 fs(lgr, *os, mm, opts);
+
+    auto iv = fs.find("/file");
+    ASSERT_TRUE(iv);
+    auto const inode = iv->inode_num();
+
+    std::vector<std::thread> threads;
+
+    for (size_t t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&] {
+        for (size_t i = 0; i < num_reads; ++i) {
+          std::error_code ec;
+          std::string buf(block_size, '\0');
+          EXPECT_EQ(block_size, fs.read(inode, buf.data(), block_size, 0, ec));
+          EXPECT_FALSE(ec) << ec.message();
+          EXPECT_EQ(contents, buf);
+        }
+      });
+    }
+
+    for (auto& t : threads) {
+      t.join();
+    }
+
+    // The cache only reports its statistics if it has created blocks
+    EXPECT_EQ(contents.substr(0, 100), fs.read_string(inode, 100, 0));
+  }
+
+  auto get_count = [&](std::string_view prefix) -> size_t {
+    for (auto const& e : lgr.get_log()) {
+      if (e.output.starts_with(prefix)) {
+        return std::stoul(e.output.substr(prefix.size()));
+      }
+    }
+    return 0;
+  };
+
+  // Every read was either decompressed directly or copied from a
+  // concurrent direct read of the same block
+  auto const direct = get_count("direct block reads: ");
+  auto const shared = get_count("shared direct block reads: ");
+
+  EXPECT_EQ(num_threads * num_reads, direct + shared);
+}
+
+TEST(compressed_cache, lru) {
+  reader::internal::compressed_cache cc(1000);
+
+  std::vector<uint8_t> const data(400, 42);
+
+  EXPECT_FALSE(cc.get(0));
+  auto p0 = cc.put(0, data);
+  ASSERT_TRUE(p0);
+  EXPECT_EQ(data, *p0);
+  EXPECT_TRUE(cc.put(1, data));
+
+  // make block 1 the least recently used one
+  EXPECT_EQ(p0, cc.get(0));
+
+  // this will evict block 1
+  EXPECT_TRUE(cc.put(2, data));
+  EXPECT_TRUE(cc.get(0));
+  EXPECT_FALSE(cc.get(1));
+  EXPECT_TRUE(cc.get(2));
+
+  // evicted data stays valid as long as it's referenced
+  EXPECT_TRUE(cc.put(3, data));
+  EXPECT_FALSE(cc.get(0));
+  EXPECT_EQ(data, *p0);
+
+  // too large to be cached at all
+  EXPECT_FALSE(cc.put(4, std::vector<uint8_t>(1001)));
+
+  auto st = cc.get_stats();
+  EXPECT_EQ(3, st.hits);
+  EXPECT_EQ(3, st.misses);
+  EXPECT_EQ(2, st.evictions);
+  EXPECT_EQ(800, st.bytes);
+  EXPECT_EQ(800, st.peak_bytes);
+}
+
+TEST(block_cache, compressed_cache) {
+  static constexpr size_t num_files{4};
+  static constexpr size_t file_size{256 * 1024};
+  static constexpr size_t num_blocks{num_files * file_size / (64 * 1024)};
+
+  auto os = std::make_shared<test::os_access_mock>();
+  std::vector<std::string> contents;
+
+  {
+    std::mt19937_64 rng{42};
+
+    os->add("", {1, 040755, 1, 0, 0, 10, 42, 0, 0, 0});
+
+    for (size_t x = 0; x < num_files; ++x) {
+      contents.push_back(test::create_random_string(file_size, 32, 127, rng));
+      os->add_file(std::to_string(x), contents.back());
+    }
+  }
+
+  std::shared_ptr<mmif> mm;
+
+  {
+    auto fa = std::make_shared<test::test_file_access>();
+    test::test_iolayer iol{os, fa};
+
+    std::vector<std::string> args{"mkdwarfs", "-i", "/",   "-o",
+                                  "-",        "-l1", "-S16"};
+    EXPECT_EQ(0, tool::main_adapter(tool::mkdwarfs_main)(args, iol.get()));
+
+    mm = std::make_shared<test::mmap_mock>(iol.out());
+  }
+
+  test::test_logger lgr(logger::VERBOSE);
+
+  {
+    // the block cache only holds a single block
+    reader::filesystem_options opts{
+        .block_cache = {.max_bytes = 64 * 1024,
+                        .num_workers = 2,
+                        .max_compressed_bytes = 16 * 1024 * 1024},
+    };
+    reader::filesystem_v2 fs(lgr, *os, mm, opts);
+
+    for (int pass = 0; pass < 2; ++pass) {
+      for (size_t x = 0; x < num_files; ++x) {
+        auto iv = fs.find(fmt::format("/{}", x).c_str());
+        ASSERT_TRUE(iv);
+        EXPECT_EQ(contents[x], fs.read_string(iv->inode_num()));
+      }
+    }
+  }
+
+  std::optional<std::array<size_t, 3>> counts;
+
+  for (auto const& e : lgr.get_log()) {
+    std::array<size_t, 3> c;
+    if (std::sscanf(e.output.c_str(),
+                    "compressed cache hits: %zu, misses: %zu, evictions: %zu",
+                    &c[0], &c[1], &c[2]) == 3) {
+      counts = c;
+    }
+  }
+
+  ASSERT_TRUE(counts);
+
+  auto [hits, misses, evictions] = *counts;
+
+  // every block is fetched from the image exactly once
+  EXPECT_EQ(num_blocks, misses);
+  EXPECT_GE(hits, num_blocks);
+  EXPECT_EQ(0, evictions);
+}
+
+TEST(memory_pressure_controller, basic) {
+  static constexpr size_t max_bytes{1024};
+  reader::internal::memory_pressure_controller ctrl(max_bytes, 10.0, 0.9);
+
+  EXPECT_EQ(max_bytes, ctrl.effective_bytes());
+
+  // no information, no change
+  EXPECT_EQ(max_bytes, ctrl.update({}));
+
+  // stalls
+  EXPECT_EQ(512, ctrl.update({.stall_pct = 12.0}));
+  EXPECT_EQ(256, ctrl.update({.stall_pct = 10.0}));
+
+  // between thresholds, keep size
+  EXPECT_EQ(256, ctrl.update({.stall_pct = 6.0}));
+
+  // grow back slowly
+  EXPECT_EQ(384, ctrl.update({.stall_pct = 1.0}));
+  EXPECT_EQ(512, ctrl.update({.stall_pct = 1.0}));
+
+  // memory usage relative to limit
+  EXPECT_EQ(256, ctrl.update({.current_bytes = 950, .limit_bytes = 1000}));
+  EXPECT_EQ(256, ctrl.update({.current_bytes = 870, .limit_bytes = 1000}));
+  EXPECT_EQ(384, ctrl.update({.current_bytes = 500, .limit_bytes = 1000}));
+
+  // usage is ignored if there's no limit
+  EXPECT_EQ(512, ctrl.update({.current_bytes = 5000}));
+
+  // both stall and usage must be relaxed to grow
+  EXPECT_EQ(512, ctrl.update({.stall_pct = 8.0,
+                              .current_bytes = 100,
+                              .limit_bytes = 1000}));
+
+  for (int i = 0; i < 20; ++i) {
+    ctrl.update({.stall_pct = 0.0});
+  }
+
+  EXPECT_EQ(max_bytes, ctrl.effective_bytes());
+
+  for (int i = 0; i < 20; ++i) {
+    ctrl.update({.stall_pct = 100.0});
+  }
+
+  EXPECT_EQ(0, ctrl.effective_bytes());
+  EXPECT_EQ(128, ctrl.update({}));
+}
+
+TEST(block_cache, memory_pressure_tidy) {
+  static constexpr size_t block_size{64 * 1024};
+  static constexpr size_t cache_size{8 * block_size};
+
+  auto os = std::make_shared<test::os_access_mock>();
+
+  {
+    std::mt19937_64 rng{42};
+
+    os->add("", {1, 040755, 1, 0, 0, 10, 42, 0, 0, 0});
+
+    for (size_t x = 0; x < 64; ++x) {
+      os->add_file(std::to_string(x),
+                   test::create_random_string(16 * 1024, 32, 127, rng));
+    }
+  }
+
+  std::shared_ptr<mmif> mm;
+
+  {
+    auto fa = std::make_shared<test::test_file_access>();
+    test::test_iolayer iol{os, fa};
+
+    std::vector<std::string> args{"mkdwarfs", "-i", "/",   "-o",
+                                  "-",        "-l1", "-S16"};
+    EXPECT_EQ(0, tool::main_adapter(tool::mkdwarfs_main)(args, iol.get()));
+
+    mm = std::make_shared<test::mmap_mock>(iol.out());
+  }
+
+  test::test_logger lgr(logger::DEBUG);
+  reader::filesystem_options opts{
+      .block_cache = {.max_bytes = cache_size, .num_workers = 2},
+  };
+  reader::filesystem_v2 fs(lgr, *os, mm, opts);
+
+  auto read_all = [&] {
+    fs.walk([&](auto e) {
+      auto iv = e.inode();
+      if (iv.is_regular_file()) {
+        EXPECT_EQ(16 * 1024, fs.read_string(iv.inode_num()).size());
+      }
+    });
+  };
+
+  auto wait_for_queries = [&](size_t count) {
+    auto const target = os->memory_pressure_queries() + count;
+    while (os->memory_pressure_queries() < target) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  };
+
+  read_all();
+
+  os->set_memory_pressure({.stall_pct = 50.0});
+
+  fs.set_cache_tidy_config({
+      .strategy = reader::cache_tidy_strategy::MEMORY_PRESSURE,
+      .interval = std::chrono::milliseconds(1),
+  });
+
+  wait_for_queries(8);
+
+  read_all();
+
+  os->set_memory_pressure({.stall_pct = 0.0});
+
+  wait_for_queries(16);
+
+  // stops the tidy thread, so the log is safe to read
+  fs.set_cache_tidy_config({.strategy = reader::cache_tidy_strategy::NONE});
+
+  std::vector<std::string> sizes;
+
+  for (auto const& e : lgr.get_log()) {
+    if (e.output.starts_with("adjusting cache size to ")) {
+      sizes.push_back(e.output.substr(24));
+    }
+  }
+
+  auto shrunk = std::ranges::find(sizes, "1 blocks");
+  ASSERT_NE(sizes.end(), shrunk);
+  EXPECT_EQ("4 blocks", sizes.front());
+  EXPECT_EQ("8 blocks", sizes.back());
+
+  EXPECT_TRUE(std::ranges::any_of(lgr.get_log(), [](auto const& e) {
+    return e.output.ends_with("to " + size_with_unit(cache_size));
+  }));
+
+  read_all();
+}
+
+TEST(block_cache, idle_thread_pins_released_on_eviction) {
+  static constexpr size_t block_size{64 * 1024};
+  static constexpr size_t cache_size{4 * block_size};
+  static constexpr size_t num_files{64};
+
+  auto os = std::make_shared<test::os_access_mock>();
+
+  {
+    std::mt19937_64 rng{42};
+
+    os->add("", {1, 040755, 1, 0, 0, 10, 42, 0, 0, 0});
+
+    for (size_t x = 0; x < num_files; ++x) {
+      os->add_file(fmt::format("{:02}", x),
+                   test::create_random_string(16 * 1024, 32, 127, rng));
+    }
+  }
+
+  std::shared_ptr<mmif> mm;
+
+  {
+    auto fa = std::make_shared<test::test_file_access>();
+    test::test_iolayer iol{os, fa};
+
+    std::vector<std::string> args{"mkdwarfs", "-i", "/",   "-o",
+                                  "-",        "-l1", "-S16"};
+    EXPECT_EQ(0, tool::main_adapter(tool::mkdwarfs_main)(args, iol.get()));
+
+    mm = std::make_shared<test::mmap_mock>(iol.out());
+  }
+
+  test::test_logger lgr(logger::VERBOSE);
+
+  {
+    reader::filesystem_options opts{
+        .block_cache = {.max_bytes = cache_size, .num_workers = 2},
+    };
+    reader::filesystem_v2 fs(lgr, *os, mm, opts);
+
+    auto read_files = [&](size_t first, size_t last) {
+      for (size_t pass = 0; pass < 2; ++pass) {
+        for (size_t x = first; x < last; ++x) {
+          auto iv = fs.find(fmt::format("/{:02}", x).c_str());
+          ASSERT_TRUE(iv);
+          EXPECT_EQ(16 * 1024, fs.read_string(iv->inode_num()).size());
+        }
+      }
+    };
+
+    // This thread pins a few blocks and then goes idle for good
+    std::thread reader([&] { read_files(0, 16); });
+    reader.join();
+
+    // Evicting those blocks must release the idle thread's pins, so
+    // they don't eat up the budget for pins of this thread
+    read_files(16, num_files);
+  }
+
+  auto get_count = [&](std::string_view prefix) -> size_t {
+    for (auto const& e : lgr.get_log()) {
+      if (e.output.starts_with(prefix)) {
+        return std::stoul(e.output.substr(prefix.size()));
+      }
+    }
+    return 0;
+  };
+
+  EXPECT_EQ(0, get_count("rejected pins: "));
+  EXPECT_LE(get_count("peak pinned bytes: "), cache_size);
+}
+
 class options_test
     : public ::testing::TestWithParam<reader::block_cache_options> {
   DWARFS_SLOW_FIXTURE
@@ -261,18 +953,28 @@ TEST_P(options_test, cache_stress) {
       for (auto const& req : *preqs) {
         auto fh = fs.open(req.inode);
         std::error_code ec;
-        auto ranges = fs.readv(fh, req.size, req.offset, ec);
-        if (ec) {
-          std::cerr << "read failed: " << ec.message() << std::endl;
-          std::terminate();
-        }
-        try {
-          for (auto& b : ranges) {
-            b.get();
+        if (succ % 2 == 0) {
+          auto ranges = fs.readv(fh, req.size, req.offset, ec);
+          if (ec) {
+            std::cerr << "read failed: " << ec.message() << std::endl;
+            std::terminate();
+          }
+          try {
+            for (auto& b : ranges) {
+              b.get();
+            }
+          } catch (std::exception const& e) {
+            std::cerr << "read failed: " << e.what() << std::endl;
+            std::terminate();
+          }
+        } else {
+          // exercise the synchronous, promise-free read path as well
+          reader::iovec_read_buf buf;
+          auto num = fs.readv(fh, buf, req.size, req.offset, ec);
+          if (ec || num != req.size) {
+            std::cerr << "read failed: " << ec.message() << std::endl;
+            std::terminate();
           }
-        } catch (std::exception const& e) {
-          std::cerr << "read failed: " << e.what() << std::endl;
-          std::terminate();
         }
         ++succ;
       }
@@ -309,6 +1011,17 @@ constexpr std::array const cache_options{
                         .num_workers = 4,
                         .mm_release = false,
                         .disable_block_integrity_check = true},
+    block_cache_options{
+        .max_bytes = 1024 * 1024,
+        .num_workers = 5,
+        .allocator = reader::block_allocator_mode::ARENA,
+    },
+    block_cache_options{
+        .max_bytes = 512 * 1024,
+        .num_workers = 3,
+        .decompress_ratio = 0.5,
+        .allocator = reader::block_allocator_mode::ARENA_HUGETLB,
+    },
 };
 
 } // namespace
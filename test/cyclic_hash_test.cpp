@@ -0,0 +1,126 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <dwarfs/writer/internal/cyclic_hash.h>
+
+using namespace dwarfs::writer::internal;
+
+namespace {
+
+using cpu_variant = rsync_hash::cpu_variant;
+
+std::vector<uint8_t> random_bytes(size_t size, std::mt19937_64& rng) {
+  std::uniform_int_distribution<int> dist(0, 255);
+  std::vector<uint8_t> data(size);
+  for (auto& b : data) {
+    b = static_cast<uint8_t>(dist(rng));
+  }
+  return data;
+}
+
+class cyclic_hash_test : public ::testing::TestWithParam<cpu_variant> {};
+
+} // namespace
+
+TEST_P(cyclic_hash_test, update_batch_matches_scalar) {
+  auto const cpu = GetParam();
+
+  if (!rsync_hash::is_supported(cpu)) {
+    GTEST_SKIP() << rsync_hash::cpu_variant_name(cpu) << " not supported";
+  }
+
+  std::mt19937_64 rng(42);
+
+  // Odd window sizes and batch lengths make sure the scalar tail of the
+  // vectorized code is exercised, as well as batches shorter than a vector
+  for (size_t window : {1, 3, 7, 31, 255, 1000, 4095}) {
+    auto const data = random_bytes(window + 10'000, rng);
+
+    rsync_hash scalar;
+    rsync_hash batch;
+
+    for (size_t i = 0; i < window; ++i) {
+      scalar.update(data[i]);
+      batch.update(data[i]);
+    }
+
+    std::vector<uint32_t> hashes;
+    size_t pos = window;
+
+    for (size_t count : {1, 15, 17, 33, 63, 65, 127, 129, 255, 256, 3, 77}) {
+      ASSERT_LE(pos + count, data.size());
+
+      hashes.assign(count, 0);
+      batch.update_batch(cpu, data.data() + pos - window, data.data() + pos,
+                         count, hashes.data());
+
+      for (size_t i = 0; i < count; ++i, ++pos) {
+        scalar.update(data[pos - window], data[pos]);
+        ASSERT_EQ(scalar(), hashes[i])
+            << rsync_hash::cpu_variant_name(cpu) << ", window=" << window
+            << ", count=" << count << ", i=" << i;
+      }
+
+      EXPECT_EQ(scalar(), batch());
+    }
+  }
+}
+
+TEST_P(cyclic_hash_test, update_batch_repeating_window) {
+  auto const cpu = GetParam();
+
+  if (!rsync_hash::is_supported(cpu)) {
+    GTEST_SKIP() << rsync_hash::cpu_variant_name(cpu) << " not supported";
+  }
+
+  // Saturated input makes the 16-bit sums wrap around in every lane
+  static constexpr size_t kWindow{4097};
+  std::vector<uint8_t> const data(kWindow + 333, 0xff);
+
+  rsync_hash hash;
+
+  for (size_t i = 0; i < kWindow; ++i) {
+    hash.update(data[i]);
+  }
+
+  std::vector<uint32_t> hashes(333);
+  hash.update_batch(cpu, data.data(), data.data() + kWindow, hashes.size(),
+                    hashes.data());
+
+  for (auto h : hashes) {
+    EXPECT_EQ(rsync_hash::repeating_window(0xff, kWindow), h);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(dwarfs, cyclic_hash_test,
+                         ::testing::Values(cpu_variant::fallback,
+                                           cpu_variant::has_avx2,
+                                           cpu_variant::has_avx512bw),
+                         [](auto const& info) {
+                           return std::string(
+                               rsync_hash::cpu_variant_name(info.param));
+                         });
@@ -19,6 +19,9 @@
  * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <atomic>
+#include <cstdlib>
+#include <new>
 #include <sstream>
 
 #include <benchmark/benchmark.h>
@@ -28,6 +31,7 @@
 #include <dwarfs/block_compressor.h>
 #include <dwarfs/file_stat.h>
 #include <dwarfs/logger.h>
+#include <dwarfs/reader/batch_read.h>
 #include <dwarfs/reader/filesystem_options.h>
 #include <dwarfs/reader/filesystem_v2.h>
 #include <dwarfs/reader/getattr_options.h>
@@ -52,8 +56,45 @@
 
 namespace {
 
+// Counts all (non-aligned) heap allocations, so we can keep an eye on the
+// number of allocations in the read path
+std::atomic<size_t> g_num_allocations{0};
+
+} // namespace
+
+void* operator new(std::size_t size) {
+  g_num_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
 using namespace dwarfs;
 
+class allocation_counter {
+ public:
+  explicit allocation_counter(::benchmark::State& state)
+      : state_{state}
+      , start_{g_num_allocations.load()} {}
+
+  ~allocation_counter() {
+    state_.counters["allocs"] =
+        ::benchmark::Counter(g_num_allocations.load() - start_,
+                             ::benchmark::Counter::kAvgIterations);
+  }
+
+ private:
+  ::benchmark::State& state_;
+  size_t const start_;
+};
+
 void PackParams(::benchmark::internal::Benchmark* b) {
   for (auto pack_directories : {false, true}) {
     for (auto plain_tables : {false, true}) {
@@ -231,6 +272,7 @@ class filesystem : public ::benchmark::Fixture {
     std::string buf;
     auto size = st.size();
     buf.resize(size);
+    allocation_counter ac(state);
 
     for (auto _ : state) {
       auto r = fs->read(i, buf.data(), size);
@@ -241,6 +283,7 @@ class filesystem : public ::benchmark::Fixture {
   void read_string_bench(::benchmark::State& state, const char* file) {
     auto iv = fs->find(file);
     auto i = fs->open(*iv);
+    allocation_counter ac(state);
 
     for (auto _ : state) {
       auto r = fs->read_string(i);
@@ -251,6 +294,7 @@ class filesystem : public ::benchmark::Fixture {
   void readv_bench(::benchmark::State& state, char const* file) {
     auto iv = fs->find(file);
     auto i = fs->open(*iv);
+    allocation_counter ac(state);
 
     for (auto _ : state) {
       reader::iovec_read_buf buf;
@@ -262,6 +306,7 @@ class filesystem : public ::benchmark::Fixture {
   void readv_future_bench(::benchmark::State& state, char const* file) {
     auto iv = fs->find(file);
     auto i = fs->open(*iv);
+    allocation_counter ac(state);
 
     for (auto _ : state) {
       auto x = fs->readv(i);
@@ -272,6 +317,55 @@ class filesystem : public ::benchmark::Fixture {
     }
   }
 
+  std::vector<reader::read_request> data_order_requests() const {
+    std::vector<reader::read_request> reqs;
+    fs->walk_data_order([&](reader::dir_entry_view e) {
+      if (auto iv = e.inode(); iv.is_regular_file()) {
+        reqs.push_back({.inode = iv.inode_num()});
+      }
+    });
+    return reqs;
+  }
+
+  void read_all_bench(::benchmark::State& state) {
+    auto reqs = data_order_requests();
+
+    for (auto _ : state) {
+      for (auto const& req : reqs) {
+        for (auto& f : fs->readv(req.inode)) {
+          auto r = f.get().size();
+          ::benchmark::DoNotOptimize(r);
+        }
+      }
+    }
+  }
+
+  void read_all_batch_bench(::benchmark::State& state) {
+    auto reqs = data_order_requests();
+
+    for (auto _ : state) {
+      fs->read_batch(reqs, [](reader::read_result&& res) {
+        auto r = res.size();
+        ::benchmark::DoNotOptimize(r);
+      });
+    }
+  }
+
+  void read_all_prefetch_bench(::benchmark::State& state) {
+    for (auto _ : state) {
+      fs->walk_data_order_prefetch(
+          [&](reader::dir_entry_view e) {
+            if (auto iv = e.inode(); iv.is_regular_file()) {
+              for (auto& f : fs->readv(iv.inode_num())) {
+                auto r = f.get().size();
+                ::benchmark::DoNotOptimize(r);
+              }
+            }
+          },
+          8);
+    }
+  }
+
   template <size_t N>
   void
   getattr_bench(::benchmark::State& state, reader::getattr_options const& opts,
@@ -510,6 +604,21 @@ BENCHMARK_DEFINE_F(filesystem, readv_future_large)(::benchmark::State& state) {
   readv_future_bench(state, "/ipsum.txt");
 }
 
+BENCHMARK_DEFINE_F(filesystem, read_all_data_order)
+(::benchmark::State& state) {
+  read_all_bench(state);
+}
+
+BENCHMARK_DEFINE_F(filesystem, read_all_data_order_batch)
+(::benchmark::State& state) {
+  read_all_batch_bench(state);
+}
+
+BENCHMARK_DEFINE_F(filesystem, read_all_data_order_prefetch)
+(::benchmark::State& state) {
+  read_all_prefetch_bench(state);
+}
+
 } // namespace
 
 BENCHMARK(frozen_legacy_string_table_lookup);
@@ -552,5 +661,10 @@ BENCHMARK_REGISTER_F(filesystem, readv_small)->Apply(PackParamsNone);
 BENCHMARK_REGISTER_F(filesystem, readv_large)->Apply(PackParamsNone);
 BENCHMARK_REGISTER_F(filesystem, readv_future_small)->Apply(PackParamsNone);
 BENCHMARK_REGISTER_F(filesystem, readv_future_large)->Apply(PackParamsNone);
+BENCHMARK_REGISTER_F(filesystem, read_all_data_order)->Apply(PackParamsNone);
+BENCHMARK_REGISTER_F(filesystem, read_all_data_order_batch)
+    ->Apply(PackParamsNone);
+BENCHMARK_REGISTER_F(filesystem, read_all_data_order_prefetch)
+    ->Apply(PackParamsNone);
 
 BENCHMARK_MAIN();
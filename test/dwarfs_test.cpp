@@ -22,10 +22,12 @@
 #include <algorithm>
 #include <filesystem>
 #include <map>
+#include <mutex>
 #include <random>
 #include <regex>
 #include <set>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
@@ -50,8 +52,10 @@
 #include <dwarfs/vfs_stat.h>
 #include <dwarfs/writer/entry_factory.h>
 #include <dwarfs/writer/filesystem_writer.h>
+#include <dwarfs/writer/filesystem_writer_options.h>
 #include <dwarfs/writer/filter_debug.h>
 #include <dwarfs/writer/fragment_order_options.h>
+#include <dwarfs/writer/memory_budget.h>
 #include <dwarfs/writer/rule_based_entry_filter.h>
 #include <dwarfs/writer/scanner.h>
 #include <dwarfs/writer/scanner_options.h>
@@ -1762,3 +1766,378 @@ TEST(filesystem, read) {
   EXPECT_TRUE(ec);
   EXPECT_EQ(ec.value(), EINVAL);
 }
+
+TEST(filesystem, read_batch) {
+  test::test_logger lgr;
+  std::mt19937_64 rng{42};
+
+  auto input = std::make_shared<test::os_access_mock>();
+  std::map<std::string, std::string> files;
+
+  input->add_dir("");
+
+  for (size_t i = 0; i < 100; ++i) {
+    auto name = fmt::format("file{}", i);
+    auto contents = test::create_random_string(rng() % 3000, rng);
+    input->add_file(name, contents);
+    files.emplace("/" + name, std::move(contents));
+  }
+
+  auto fsimage = build_dwarfs(lgr, input, "zstd:level=1",
+                              {.block_size_bits = 12});
+
+  auto mm = std::make_shared<test::mmap_mock>(std::move(fsimage));
+
+  reader::filesystem_v2 fs(lgr, *input, mm);
+
+  std::vector<reader::read_request> requests;
+  std::vector<std::string> expected;
+
+  for (auto const& [path, contents] : files) {
+    auto iv = fs.find(path.c_str());
+    ASSERT_TRUE(iv);
+    auto inode = iv->inode_num();
+    std::string_view cview(contents);
+
+    requests.push_back({.inode = inode});
+    expected.emplace_back(cview);
+
+    auto off = std::min<size_t>(cview.size(), 17);
+    requests.push_back({.inode = inode,
+                        .offset = static_cast<file_off_t>(off),
+                        .size = 1000});
+    expected.emplace_back(cview.substr(off, 1000));
+  }
+
+  requests.push_back({.inode = 66666});
+  requests.push_back({.inode = requests.front().inode, .offset = -1});
+
+  std::vector<size_t> seen(requests.size(), 0);
+
+  fs.read_batch(requests, [&](reader::read_result&& res) {
+    ASSERT_LT(res.index, requests.size());
+    ++seen[res.index];
+
+    if (res.index < expected.size()) {
+      EXPECT_FALSE(res.ec) << res.index;
+      std::string data;
+      for (auto const& br : res.ranges) {
+        data.append(reinterpret_cast<char const*>(br.data()), br.size());
+      }
+      EXPECT_EQ(res.size(), expected[res.index].size()) << res.index;
+      EXPECT_EQ(data, expected[res.index]) << res.index;
+    } else {
+      EXPECT_TRUE(res.ec) << res.index;
+      EXPECT_EQ(res.ec.value(), EINVAL) << res.index;
+      EXPECT_TRUE(res.ranges.empty()) << res.index;
+    }
+  });
+
+  EXPECT_TRUE(std::all_of(seen.begin(), seen.end(),
+                          [](size_t n) { return n == 1; }));
+}
+
+TEST(filesystem, walk_parallel_and_prefetch) {
+  test::test_logger lgr;
+  std::mt19937_64 rng{42};
+
+  auto input = std::make_shared<test::os_access_mock>();
+
+  input->add_dir("");
+
+  for (size_t i = 0; i < 8; ++i) {
+    auto dir = fmt::format("dir{}", i);
+    input->add_dir(dir);
+    for (size_t j = 0; j < 4; ++j) {
+      auto subdir = fmt::format("{}/sub{}", dir, j);
+      input->add_dir(subdir);
+      for (size_t k = 0; k < 10; ++k) {
+        input->add_file(fmt::format("{}/file{}", subdir, k),
+                        test::create_random_string(rng() % 2000, rng));
+      }
+    }
+  }
+
+  auto fsimage = build_dwarfs(lgr, input, "zstd:level=1",
+                              {.block_size_bits = 12});
+
+  auto mm = std::make_shared<test::mmap_mock>(std::move(fsimage));
+
+  reader::filesystem_v2 fs(lgr, *input, mm);
+
+  std::vector<std::string> ref;
+
+  fs.walk([&](reader::dir_entry_view e) { ref.push_back(e.unix_path()); });
+
+  std::sort(ref.begin(), ref.end());
+
+  for (size_t num_threads : {1, 2, 4, 8}) {
+    std::mutex mx;
+    std::vector<std::string> paths;
+    std::set<std::string> dirs;
+
+    fs.walk_parallel(
+        [&](reader::dir_entry_view e) {
+          std::lock_guard lock(mx);
+          if (auto parent = e.parent()) {
+            EXPECT_TRUE(dirs.contains(parent->unix_path())) << e.unix_path();
+          }
+          if (e.inode().is_directory()) {
+            dirs.insert(e.unix_path());
+          }
+          paths.push_back(e.unix_path());
+        },
+        num_threads);
+
+    std::sort(paths.begin(), paths.end());
+
+    EXPECT_EQ(ref, paths) << num_threads;
+  }
+
+  std::vector<std::string> data_order;
+
+  fs.walk_data_order(
+      [&](reader::dir_entry_view e) { data_order.push_back(e.unix_path()); });
+
+  for (size_t prefetch_blocks : {0, 1, 3, 100}) {
+    std::vector<std::string> paths;
+
+    fs.walk_data_order_prefetch(
+        [&](reader::dir_entry_view e) {
+          paths.push_back(e.unix_path());
+          if (auto iv = e.inode(); iv.is_regular_file()) {
+            auto size = fs.getattr(iv).size();
+            EXPECT_EQ(fs.read_string(iv.inode_num()).size(), size);
+          }
+        },
+        prefetch_blocks);
+
+    EXPECT_EQ(data_order, paths) << prefetch_blocks;
+  }
+}
+
+TEST(filesystem, walk_data_order_prefetch_many_small_files) {
+  test::test_logger lgr(logger::VERBOSE);
+  std::mt19937_64 rng{42};
+
+  auto input = std::make_shared<test::os_access_mock>();
+
+  input->add_dir("");
+
+  for (size_t i = 0; i < 4000; ++i) {
+    input->add_file(fmt::format("file{}", i),
+                    test::create_random_string(200, 'a', 'z', rng));
+  }
+
+  auto fsimage = build_dwarfs(lgr, input, "zstd:level=1",
+                              {.block_size_bits = 14});
+  auto mm = std::make_shared<test::mmap_mock>(std::move(fsimage));
+
+  // The block cache logs its counters when it is destroyed
+  auto explicit_prefetches = [&lgr] {
+    std::optional<size_t> rv;
+    for (auto const& e : lgr.get_log()) {
+      static constexpr std::string_view key{"explicit prefetches: "};
+      if (auto pos = e.output.find(key); pos != std::string::npos) {
+        rv = std::stoul(e.output.substr(pos + key.size()));
+      }
+    }
+    return rv;
+  };
+
+  size_t num_blocks{0};
+  std::vector<std::string> data_order;
+
+  {
+    reader::filesystem_v2 fs(lgr, *input, mm);
+
+    num_blocks = fs.num_blocks();
+
+    fs.walk_data_order(
+        [&](reader::dir_entry_view e) { data_order.push_back(e.unix_path()); });
+
+    // All entries are passed on, in data order
+    std::vector<std::string> paths;
+
+    fs.walk_data_order_prefetch(
+        [&](reader::dir_entry_view e) { paths.push_back(e.unix_path()); },
+        num_blocks * 10);
+
+    EXPECT_EQ(data_order, paths);
+  }
+
+  ASSERT_GT(num_blocks, 20);
+  ASSERT_EQ(explicit_prefetches(), num_blocks);
+
+  {
+    reader::filesystem_v2 fs(lgr, *input, mm);
+
+    // With a window larger than the image, entries are only passed on
+    // because too many of them are held back; stop at the first one
+    std::vector<std::string> paths;
+
+    EXPECT_THROW(fs.walk_data_order_prefetch(
+                     [&](reader::dir_entry_view e) {
+                       paths.push_back(e.unix_path());
+                       throw std::runtime_error("stop");
+                     },
+                     num_blocks * 10),
+                 std::runtime_error);
+
+    ASSERT_EQ(1, paths.size());
+    EXPECT_EQ(data_order.front(), paths.front());
+  }
+
+  // The first entry was passed on long before all blocks were prefetched
+  auto const prefetches = explicit_prefetches();
+  ASSERT_TRUE(prefetches);
+  EXPECT_LT(*prefetches, num_blocks / 2);
+}
+
+TEST(filesystem, hot_block_concurrent_reads) {
+  static constexpr size_t num_threads{8};
+  static constexpr size_t num_rounds{100};
+
+  test::test_logger lgr;
+  std::mt19937_64 rng{42};
+
+  auto input = std::make_shared<test::os_access_mock>();
+  std::vector<std::pair<std::string, std::string>> files;
+
+  input->add_dir("");
+
+  for (size_t i = 0; i < 200; ++i) {
+    auto name = fmt::format("file{}", i);
+    auto contents = test::create_random_string(rng() % 500, rng);
+    input->add_file(name, contents);
+    files.emplace_back("/" + name, std::move(contents));
+  }
+
+  auto fsimage = build_dwarfs(lgr, input, "zstd:level=1",
+                              {.block_size_bits = 14});
+
+  auto mm = std::make_shared<test::mmap_mock>(std::move(fsimage));
+
+  // A tiny cache forces blocks to be evicted while they're still pinned
+  for (size_t max_bytes : {size_t{1} << 14, size_t{1} << 20}) {
+    reader::filesystem_v2 fs(
+        lgr, *input, mm, {.block_cache = {.max_bytes = max_bytes}});
+
+    std::vector<uint32_t> inodes;
+
+    for (auto const& [path, contents] : files) {
+      auto iv = fs.find(path.c_str());
+      ASSERT_TRUE(iv);
+      inodes.push_back(iv->inode_num());
+    }
+
+    std::vector<std::thread> threads;
+    std::vector<size_t> errors(num_threads, 0);
+
+    for (size_t t = 0; t < num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        for (size_t r = 0; r < num_rounds; ++r) {
+          auto i = (t + r) % files.size();
+          auto const& expected = files[i].second;
+
+          if (fs.read_string(inodes[i]) != expected) {
+            ++errors[t];
+          }
+
+          reader::iovec_read_buf buf;
+          std::string data;
+          fs.readv(inodes[i], buf);
+          for (auto const& iov : buf.buf) {
+            data.append(static_cast<char const*>(iov.iov_base), iov.iov_len);
+          }
+
+          if (data != expected) {
+            ++errors[t];
+          }
+        }
+      });
+    }
+
+    for (auto& t : threads) {
+      t.join();
+    }
+
+    for (size_t t = 0; t < num_threads; ++t) {
+      EXPECT_EQ(0, errors[t]) << max_bytes << ", thread " << t;
+    }
+  }
+}
+
+TEST(filesystem, memory_budget_peak_within_limit) {
+  static constexpr size_t limit{512 << 10};
+  static constexpr size_t num_files{16};
+  static constexpr size_t file_size{96 << 10};
+
+  test::test_logger lgr;
+  auto input = std::make_shared<test::os_access_mock>();
+  input->add_dir("");
+
+  std::map<std::string, std::string> files;
+
+  for (size_t i = 0; i < num_files; ++i) {
+    auto name = fmt::format("file{}", i);
+    auto data = test::create_random_string(file_size, i);
+    input->add_file(name, data);
+    files.emplace(name, std::move(data));
+  }
+
+  auto memory = std::make_shared<writer::memory_budget>(limit);
+
+  thread_pool pool(lgr, *input, "worker", 4);
+  writer::writer_progress prog;
+
+  writer::segmenter_factory::config sf_cfg;
+  sf_cfg.block_size_bits = 14;
+  sf_cfg.max_active_blocks.set_default(4);
+  sf_cfg.memory = memory;
+
+  writer::scanner_options options;
+  options.memory = memory;
+
+  // keep the write queue, which is accounted but never waited for,
+  // small enough that all waiting reservations fit into the limit
+  writer::filesystem_writer_options fsw_opts;
+  fsw_opts.max_queue_size = 64 << 10;
+  fsw_opts.worst_case_block_size = 16 << 10;
+  fsw_opts.memory = memory;
+
+  writer::segmenter_factory sf(lgr, prog, sf_cfg);
+  writer::entry_factory ef;
+  writer::scanner s(lgr, pool, sf, ef, *input, options);
+
+  std::ostringstream oss;
+
+  {
+    block_compressor bc("null");
+    writer::filesystem_writer fsw(oss, lgr, pool, prog, fsw_opts);
+    fsw.add_default_compressor(bc);
+    s.scan(fsw, std::filesystem::path("/"), prog);
+  }
+
+  auto const st = memory->get_stats();
+  auto const component_peak = [&](writer::memory_budget::component c) {
+    return st.components[static_cast<size_t>(c)].peak;
+  };
+
+  EXPECT_EQ(0, st.current);
+  EXPECT_GT(st.peak, 0);
+  EXPECT_LE(st.peak, limit);
+  EXPECT_GT(component_peak(writer::memory_budget::component::scan), 0);
+  EXPECT_GT(component_peak(writer::memory_budget::component::segmenter), 0);
+  EXPECT_GT(component_peak(writer::memory_budget::component::compression),
+            0);
+
+  auto mm = std::make_shared<test::mmap_mock>(oss.str());
+  reader::filesystem_v2 fs(lgr, *input, mm);
+
+  for (auto const& [name, data] : files) {
+    auto iv = fs.find(("/" + name).c_str());
+    ASSERT_TRUE(iv) << name;
+    EXPECT_EQ(data, fs.read_string(iv->inode_num())) << name;
+  }
+}
@@ -0,0 +1,142 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <dwarfs/writer/memory_budget.h>
+
+using namespace dwarfs::writer;
+using namespace std::chrono_literals;
+
+namespace {
+
+using component = memory_budget::component;
+
+size_t current(memory_budget const& mb, component c) {
+  return mb.get_stats().components[static_cast<size_t>(c)].current;
+}
+
+size_t peak(memory_budget const& mb, component c) {
+  return mb.get_stats().components[static_cast<size_t>(c)].peak;
+}
+
+} // namespace
+
+TEST(memory_budget_test, accounting) {
+  memory_budget mb(0);
+
+  {
+    auto r1 = mb.account(component::segmenter, 100);
+    auto r2 = mb.reserve(component::scan, 50);
+
+    EXPECT_EQ(100, current(mb, component::segmenter));
+    EXPECT_EQ(50, current(mb, component::scan));
+    EXPECT_EQ(150, mb.get_stats().current);
+
+    r1.resize(300);
+    r1.resize(200);
+    EXPECT_EQ(200, r1.size());
+    EXPECT_EQ(300, peak(mb, component::segmenter));
+
+    r2.transfer(component::write_queue, 20);
+    EXPECT_EQ(0, current(mb, component::scan));
+    EXPECT_EQ(20, current(mb, component::write_queue));
+
+    auto r3 = std::move(r2);
+    EXPECT_FALSE(r2);
+    EXPECT_EQ(20, r3.size());
+  }
+
+  auto st = mb.get_stats();
+  EXPECT_EQ(0, st.current);
+  EXPECT_EQ(350, st.peak);
+  EXPECT_EQ(0, st.waits);
+
+  for (auto const& cs : st.components) {
+    EXPECT_EQ(0, cs.current);
+  }
+}
+
+TEST(memory_budget_test, limit_is_enforced) {
+  static constexpr size_t limit{100};
+
+  memory_budget mb(limit);
+  std::vector<std::thread> threads;
+
+  for (size_t i = 0; i < 8; ++i) {
+    threads.emplace_back([&mb] {
+      for (size_t j = 0; j < 20; ++j) {
+        auto r = mb.reserve(component::scan, 40);
+        std::this_thread::sleep_for(100us);
+      }
+    });
+  }
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  auto st = mb.get_stats();
+  EXPECT_EQ(0, st.current);
+  EXPECT_LE(st.peak, limit);
+  EXPECT_GT(st.waits, 0);
+}
+
+TEST(memory_budget_test, never_waits_for_stalled_components) {
+  memory_budget mb(100);
+
+  // memory held by components that cannot make progress on their own
+  // must not block new reservations forever
+  auto seg = mb.account(component::segmenter, 150);
+  auto r = mb.reserve(component::scan, 500);
+  EXPECT_EQ(650, mb.get_stats().current);
+  EXPECT_EQ(0, mb.get_stats().waits);
+}
+
+TEST(memory_budget_test, waits_for_compression) {
+  memory_budget mb(100);
+
+  auto comp = mb.account(component::compression, 80);
+  std::atomic<bool> done{false};
+
+  std::thread t([&] {
+    auto r = mb.reserve(component::segmenter, 40);
+    done = true;
+  });
+
+  std::this_thread::sleep_for(50ms);
+  EXPECT_FALSE(done);
+
+  // once compressed, the block is no longer drainable, so the
+  // segmenter may proceed despite exceeding the limit
+  comp.transfer(component::write_queue, 80);
+
+  t.join();
+
+  EXPECT_TRUE(done);
+  EXPECT_EQ(1, mb.get_stats().waits);
+  EXPECT_EQ(120, mb.get_stats().peak);
+}
@@ -19,10 +19,19 @@
  * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <optional>
 #include <random>
+#include <span>
+#include <string>
+#include <string_view>
 #include <vector>
 
-#include <folly/Benchmark.h>
+#include <benchmark/benchmark.h>
 
 #include <dwarfs/compression_constraints.h>
 #include <dwarfs/writer/segmenter.h>
@@ -31,20 +40,22 @@
 #include <dwarfs/writer/internal/block_data.h>
 #include <dwarfs/writer/internal/block_manager.h>
 #include <dwarfs/writer/internal/chunkable.h>
+#include <dwarfs/writer/internal/cyclic_hash.h>
 
 #include "loremipsum.h"
 #include "test_logger.h"
 
 namespace {
 
-class bench_chunkable : public dwarfs::writer::internal::chunkable {
+using namespace dwarfs;
+using writer::internal::rsync_hash;
+
+class bench_chunkable : public writer::internal::chunkable {
  public:
-  bench_chunkable(std::vector<uint8_t> data)
-      : data_{std::move(data)} {}
+  explicit bench_chunkable(std::span<uint8_t const> data)
+      : data_{data} {}
 
-  dwarfs::writer::internal::file const* get_file() const override {
-    return nullptr;
-  }
+  writer::internal::file const* get_file() const override { return nullptr; }
 
   size_t size() const override { return data_.size(); }
 
@@ -58,221 +69,473 @@ class bench_chunkable : public dwarfs::writer::internal::chunkable {
   void release_until(size_t /*offset*/) override {}
 
  private:
-  std::vector<uint8_t> data_;
+  std::span<uint8_t const> data_;
+};
+
+enum class corpus_kind { binary, text, pcm };
+
+/**
+ * Describes a synthetic corpus.
+ *
+ * A corpus is built from segments with log-uniformly distributed sizes.
+ * Each segment is either fresh data, a copy of earlier data (at a
+ * log-uniformly distributed distance, so both nearby and far-away
+ * duplicates occur), or a run of a single repeated frame. Copies can
+ * be edited by inserting or dropping a few frames somewhere in the
+ * middle, which shifts the remainder of the copy against the original.
+ * All sizes and offsets are multiples of the granularity.
+ */
+struct corpus_profile {
+  std::string_view name;
+  corpus_kind kind;
+  unsigned granularity;
+  unsigned channels;
+  double dupe_fraction;
+  double shift_probability;
+  double run_fraction;
+  size_t min_segment_size;
+  size_t max_segment_size;
 };
 
-std::vector<uint8_t>
-build_data(size_t total_size, size_t granularity, double dupe_fraction,
-           std::initializer_list<size_t> dupe_sizes) {
-  std::vector<uint8_t> data;
-  data.reserve(total_size);
-
-  std::independent_bits_engine<std::mt19937_64,
-                               std::numeric_limits<uint8_t>::digits, uint16_t>
-      rng;
-
-  auto granular_size = [granularity](size_t size) {
-    return size - (size % granularity);
-  };
-
-  auto make_random = [&rng](size_t size) {
-    std::vector<uint8_t> v;
-    v.resize(size);
-    std::generate(begin(v), end(v), std::ref(rng));
-    return v;
-  };
-
-  std::vector<std::vector<uint8_t>> dupes;
-  size_t total_dupe_size{0};
-  for (auto s : dupe_sizes) {
-    auto gs = granular_size(s);
-    dupes.emplace_back(make_random(gs));
-    total_dupe_size += gs;
+constexpr size_t operator""_KiB(unsigned long long n) { return n << 10; }
+
+using enum corpus_kind;
+
+constexpr std::array<corpus_profile, 7> const kProfiles{{
+    // clang-format off
+    // name            kind    g  ch  dupe shift runs  min     max
+    {"random",         binary, 1, 1,  0.0, 0.0,  0.0,  16_KiB, 1024_KiB},
+    {"random_dupes",   binary, 1, 1,  0.3, 0.0,  0.0,  16_KiB, 1024_KiB},
+    {"random_shifted", binary, 1, 1,  0.3, 0.7,  0.0,  16_KiB, 1024_KiB},
+    {"runs",           binary, 1, 1,  0.2, 0.2,  0.2,  16_KiB, 1024_KiB},
+    {"text",           text,   1, 1,  0.3, 0.3,  0.0,  4_KiB,  256_KiB},
+    {"pcm16_stereo",   pcm,    4, 2,  0.2, 0.2,  0.05, 64_KiB, 2048_KiB},
+    {"pcm24_mono",     pcm,    3, 1,  0.2, 0.2,  0.05, 48_KiB, 1536_KiB},
+    // clang-format on
+}};
+
+constexpr int64_t profile_index(std::string_view name) {
+  for (size_t i = 0; i < kProfiles.size(); ++i) {
+    if (kProfiles[i].name == name) {
+      return i;
+    }
   }
+  throw std::invalid_argument("unknown corpus profile");
+}
 
-  size_t num_dupes = (total_size * dupe_fraction) / total_dupe_size;
-  size_t rand_size = total_size - num_dupes * total_dupe_size;
-  size_t avg_rand_size =
-      num_dupes > 0 ? granular_size(rand_size / (num_dupes * dupe_sizes.size()))
-                    : 0;
+constexpr size_t const kCorpusSize{64 * 1024 * 1024};
+constexpr size_t const kMaxEditFrames{64};
 
-  // std::cerr << num_dupes << std::endl;
+class corpus_builder {
+ public:
+  corpus_builder(corpus_profile const& prof, uint64_t seed)
+      : prof_{prof}
+      , rng_{seed}
+      , levels_(prof.channels, 0) {
+    if (prof_.kind == corpus_kind::text) {
+      auto const& text = test::loremipsum();
+      size_t pos{0};
+      while (pos < text.size()) {
+        auto end = text.find_first_of(" \n", pos);
+        if (end == std::string::npos) {
+          end = text.size();
+        }
+        if (end > pos) {
+          words_.emplace_back(text.substr(pos, end - pos));
+        }
+        pos = end + 1;
+      }
+    }
+  }
+
+  std::vector<uint8_t> build(size_t total_size) {
+    total_size = granular(total_size);
+    data_.clear();
+    data_.reserve(total_size + prof_.max_segment_size +
+                  2 * kMaxEditFrames * prof_.granularity);
+
+    while (data_.size() < total_size) {
+      auto const size = segment_size();
+      auto const r = uniform();
+
+      if (r < prof_.run_fraction) {
+        append_run(size);
+      } else if (r < prof_.run_fraction + prof_.dupe_fraction &&
+                 data_.size() >= size) {
+        append_dupe(size);
+      } else {
+        append_fresh(size);
+      }
+    }
 
-  auto append_data = [&data](std::vector<uint8_t> const& tmp) {
-    data.resize(data.size() + tmp.size());
-    std::copy(begin(tmp), end(tmp), end(data) - tmp.size());
-  };
+    data_.resize(total_size);
 
-  for (size_t i = 0; i < num_dupes * dupe_sizes.size(); ++i) {
-    append_data(dupes[i % dupe_sizes.size()]);
-    append_data(make_random(avg_rand_size));
+    return std::move(data_);
   }
 
-  if (data.size() > total_size) {
-    throw std::runtime_error(
-        fmt::format("internal error: {} > {}", data.size(), total_size));
+ private:
+  size_t granular(size_t size) const {
+    return std::max<size_t>(size - size % prof_.granularity,
+                            prof_.granularity);
   }
 
-  append_data(make_random(total_size - data.size()));
+  double uniform() { return std::uniform_real_distribution<>()(rng_); }
 
-  return data;
+  size_t log_uniform(size_t min, size_t max) {
+    std::uniform_real_distribution<> dist(std::log(min), std::log(max));
+    return std::clamp<size_t>(std::exp(dist(rng_)), min, max);
+  }
+
+  size_t segment_size() {
+    return granular(
+        log_uniform(prof_.min_segment_size, prof_.max_segment_size));
+  }
+
+  void append_fresh(size_t size) {
+    switch (prof_.kind) {
+    case corpus_kind::binary:
+      append_random(size);
+      break;
+
+    case corpus_kind::text:
+      append_text(size);
+      break;
+
+    case corpus_kind::pcm:
+      append_pcm(size);
+      break;
+    }
+  }
+
+  void append_random(size_t size) {
+    auto const start = data_.size();
+    data_.resize(start + size);
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+      auto const v = rng_();
+      std::memcpy(data_.data() + start + i, &v,
+                  std::min(sizeof(v), size - i));
+    }
+  }
+
+  void append_text(size_t size) {
+    std::string text;
+    text.reserve(size + 64);
+    std::uniform_int_distribution<size_t> word(0, words_.size() - 1);
+    while (text.size() < size) {
+      text += words_[word(rng_)];
+      auto const r = uniform();
+      text += r < 0.02 ? ".\n" : r < 0.1 ? ". " : " ";
+    }
+    data_.insert(data_.end(), text.begin(), text.begin() + size);
+  }
+
+  // Band-limited random walk, stored as little-endian interleaved samples
+  void append_pcm(size_t size) {
+    auto const sample_bytes = prof_.granularity / prof_.channels;
+    auto const max_level = (int64_t(1) << (8 * sample_bytes - 1)) - 1;
+    std::uniform_int_distribution<int64_t> step(-max_level / 64,
+                                                max_level / 64);
+
+    for (size_t i = 0; i < size; i += prof_.granularity) {
+      for (auto& level : levels_) {
+        level = std::clamp(level + step(rng_), -max_level, max_level);
+        for (size_t b = 0; b < sample_bytes; ++b) {
+          data_.push_back(static_cast<uint8_t>(level >> (8 * b)));
+        }
+      }
+    }
+  }
+
+  void append_run(size_t size) {
+    std::vector<uint8_t> frame(prof_.granularity, 0);
+    if (uniform() < 0.5) {
+      std::generate(frame.begin(), frame.end(), [this] { return rng_(); });
+    }
+    for (size_t i = 0; i < size; i += frame.size()) {
+      data_.insert(data_.end(), frame.begin(), frame.end());
+    }
+  }
+
+  void append_copy(size_t offset, size_t size) {
+    std::vector<uint8_t> tmp(data_.begin() + offset,
+                             data_.begin() + offset + size);
+    data_.insert(data_.end(), tmp.begin(), tmp.end());
+  }
+
+  void append_dupe(size_t size) {
+    auto const distance = log_uniform(size, data_.size());
+    auto const offset = granular(data_.size() - distance);
+    size = std::min(size, data_.size() - offset);
+
+    if (uniform() >= prof_.shift_probability) {
+      append_copy(offset, size);
+      return;
+    }
+
+    std::uniform_int_distribution<size_t> frames(1, kMaxEditFrames);
+    auto const edit = frames(rng_) * prof_.granularity;
+    auto const split = granular(size / 2 + size / 4 * (uniform() - 0.5));
+
+    append_copy(offset, split);
+
+    if (uniform() < 0.5) {
+      append_fresh(edit);
+      append_copy(offset + split, size - split);
+    } else if (split + edit < size) {
+      append_copy(offset + split + edit, size - split - edit);
+    }
+  }
+
+  corpus_profile const& prof_;
+  std::mt19937_64 rng_;
+  std::vector<int64_t> levels_;
+  std::vector<std::string> words_;
+  std::vector<uint8_t> data_;
+};
+
+std::vector<uint8_t> const& corpus(int64_t profile) {
+  // benchmarks are registered grouped by profile, so caching only the
+  // most recently used corpus keeps memory usage down
+  static std::optional<int64_t> cached_profile;
+  static std::vector<uint8_t> cached_data;
+
+  if (cached_profile != profile) {
+    cached_data.clear();
+    cached_data.shrink_to_fit();
+    corpus_builder builder(kProfiles.at(profile), 42 + profile);
+    cached_data = builder.build(kCorpusSize);
+    cached_profile = profile;
+  }
+
+  return cached_data;
 }
 
-void run_segmenter_test(unsigned iters, unsigned granularity,
-                        unsigned window_size, unsigned block_size,
-                        unsigned bloom_filter_size, unsigned lookback,
-                        double dupe_fraction) {
-  folly::BenchmarkSuspender suspender;
-
-  dwarfs::writer::segmenter::config cfg;
-  cfg.blockhash_window_size = window_size;
-  cfg.window_increment_shift = 1;
-  cfg.max_active_blocks = lookback;
-  cfg.bloom_filter_size = bloom_filter_size;
-  cfg.block_size_bits = block_size;
-
-  dwarfs::compression_constraints cc;
-  cc.granularity = granularity;
-
-  size_t total_size = 512 * 1024 * 1024;
-
-  bench_chunkable bc(
-      build_data(total_size, granularity, dupe_fraction,
-                 {2 * granularity * (size_t(1) << window_size)}));
-
-  for (unsigned i = 0; i < iters; ++i) {
-    dwarfs::test::test_logger lgr;
-    dwarfs::writer::writer_progress prog;
-    auto blkmgr = std::make_shared<dwarfs::writer::internal::block_manager>();
-
-    std::vector<std::shared_ptr<dwarfs::writer::internal::block_data>> written;
-
-    dwarfs::writer::segmenter seg(
-        lgr, prog, blkmgr, cfg, cc, total_size,
-        [&written,
-         blkmgr](std::shared_ptr<dwarfs::writer::internal::block_data> blk,
-                 auto logical_block_num) {
-          auto physical_block_num = written.size();
-          written.push_back(blk);
-          blkmgr->set_written_block(logical_block_num, physical_block_num, 0);
+void segmenter_bench(::benchmark::State& state) {
+  auto const& prof = kProfiles.at(state.range(0));
+  auto const& data = corpus(state.range(0));
+
+  writer::segmenter::config cfg;
+  cfg.blockhash_window_size = state.range(1);
+  cfg.window_increment_shift = state.range(2);
+  cfg.block_size_bits = state.range(3);
+  cfg.bloom_filter_size = state.range(4);
+  cfg.max_active_blocks = state.range(5);
+  cfg.cdc_chunk_size_bits = state.range(6);
+
+  compression_constraints cc;
+  cc.granularity = prof.granularity;
+
+  bench_chunkable bc(data);
+  size_t segmented{0};
+  writer::segmenter::stats stats;
+
+  for (auto _ : state) {
+    test::test_logger lgr;
+    writer::writer_progress prog;
+    auto blkmgr = std::make_shared<writer::internal::block_manager>();
+    size_t num_blocks{0};
+
+    segmented = 0;
+
+    writer::segmenter seg(
+        lgr, prog, blkmgr, cfg, cc, data.size(),
+        [&](std::shared_ptr<writer::internal::block_data> blk,
+            size_t logical_block_num) {
+          blkmgr->set_written_block(logical_block_num, num_blocks++, 0);
+          segmented += blk->size();
         });
 
-    suspender.dismiss();
-
     seg.add_chunkable(bc);
     seg.finish();
 
-    suspender.rehire();
+    stats = seg.get_stats();
+  }
 
-    size_t segmented [[maybe_unused]]{0};
+  state.SetLabel(std::string(prof.name));
+  state.SetBytesProcessed(state.iterations() * data.size());
+  state.counters["saved%"] = 100.0 - 100.0 * segmented / data.size();
+  if (cfg.cdc_chunk_size_bits > 0) {
+    state.counters["matches"] = stats.duplicate_chunks;
+  } else {
+    state.counters["matches"] = stats.good_matches;
+    state.counters["bad"] = stats.bad_matches;
+  }
+  if (stats.bloom_lookups > 0) {
+    state.counters["reject%"] =
+        100.0 - 100.0 * stats.bloom_hits / stats.bloom_lookups;
+  }
+}
 
-    for (auto const& blk : written) {
-      segmented += blk->size();
+struct segmenter_params {
+  int64_t profile{profile_index("random_dupes")};
+  int64_t window_size{12};
+  int64_t window_step{1};
+  int64_t block_size{22};
+  int64_t bloom_filter_size{4};
+  int64_t lookback{8};
+  int64_t cdc_chunk_size{0};
+};
+
+void add_args(::benchmark::internal::Benchmark* b,
+              segmenter_params const& p) {
+  b->Args({p.profile, p.window_size, p.window_step, p.block_size,
+           p.bloom_filter_size, p.lookback, p.cdc_chunk_size});
+}
+
+void segmenter_args(::benchmark::internal::Benchmark* b) {
+  b->ArgNames({"profile", "W", "w", "S", "bloom", "lookback", "cdc"});
+  b->Unit(::benchmark::kMillisecond);
+}
+
+void profile_params(::benchmark::internal::Benchmark* b) {
+  segmenter_args(b);
+  for (size_t i = 0; i < kProfiles.size(); ++i) {
+    // single-block and multi-block mode
+    for (int64_t lookback : {1, 8}) {
+      add_args(b, {.profile = static_cast<int64_t>(i), .lookback = lookback});
     }
+  }
+}
 
-    // std::cerr << total_size << " -> " << segmented << fmt::format("
-    // ({:.1f}%)", 100.0*segmented/total_size) << std::endl;
+void window_size_params(::benchmark::internal::Benchmark* b) {
+  segmenter_args(b);
+  for (int64_t w : {8, 10, 12, 14, 16}) {
+    add_args(b, {.window_size = w});
   }
 }
 
-constexpr unsigned const kDefaultGranularity{1};
-constexpr unsigned const kDefaultWindowSize{12};
-constexpr unsigned const kDefaultBlockSize{24};
-constexpr unsigned const kDefaultBloomFilterSize{4};
-constexpr unsigned const kDefaultLookback{1};
-constexpr double const kDefaultDupeFraction{0.3};
-
-void run_granularity(unsigned iters, unsigned granularity) {
-  run_segmenter_test(iters, granularity, kDefaultWindowSize, kDefaultBlockSize,
-                     kDefaultBloomFilterSize, kDefaultLookback,
-                     kDefaultDupeFraction);
+void window_step_params(::benchmark::internal::Benchmark* b) {
+  segmenter_args(b);
+  for (int64_t s : {0, 1, 2, 3, 4}) {
+    add_args(b, {.window_step = s});
+  }
 }
 
-void run_window_size(unsigned iters, unsigned window_size) {
-  run_segmenter_test(iters, kDefaultGranularity, window_size, kDefaultBlockSize,
-                     kDefaultBloomFilterSize, kDefaultLookback,
-                     kDefaultDupeFraction);
+void block_size_params(::benchmark::internal::Benchmark* b) {
+  segmenter_args(b);
+  for (int64_t bs : {18, 20, 22, 24}) {
+    add_args(b, {.block_size = bs});
+  }
 }
 
-void run_block_size(unsigned iters, unsigned block_size) {
-  run_segmenter_test(iters, kDefaultGranularity, kDefaultWindowSize, block_size,
-                     kDefaultBloomFilterSize, kDefaultLookback,
-                     kDefaultDupeFraction);
+void bloom_filter_size_params(::benchmark::internal::Benchmark* b) {
+  segmenter_args(b);
+  for (int64_t bf : {1, 2, 3, 4, 5, 6}) {
+    add_args(b, {.bloom_filter_size = bf});
+  }
 }
 
-void run_bloom_filter_size(unsigned iters, unsigned bloom_filter_size) {
-  run_segmenter_test(iters, kDefaultGranularity, kDefaultWindowSize,
-                     kDefaultBlockSize, bloom_filter_size, kDefaultLookback,
-                     kDefaultDupeFraction);
+void lookback_params(::benchmark::internal::Benchmark* b) {
+  segmenter_args(b);
+  for (int64_t lb : {1, 2, 4, 8, 16, 32}) {
+    add_args(b, {.block_size = 20, .lookback = lb});
+  }
 }
 
-void run_lookback(unsigned iters, unsigned lookback) {
-  run_segmenter_test(iters, kDefaultGranularity, kDefaultWindowSize,
-                     kDefaultBlockSize, kDefaultBloomFilterSize, lookback,
-                     kDefaultDupeFraction);
+void cdc_params(::benchmark::internal::Benchmark* b) {
+  segmenter_args(b);
+  auto const profile = profile_index("random_shifted");
+  add_args(b, {.profile = profile});
+  for (int64_t cdc : {10, 12, 14, 16}) {
+    add_args(b, {.profile = profile, .cdc_chunk_size = cdc});
+  }
 }
 
-void run_dupe_fraction(unsigned iters, unsigned dupe_fraction) {
-  run_segmenter_test(iters, kDefaultGranularity, kDefaultWindowSize,
-                     kDefaultBlockSize, kDefaultBloomFilterSize,
-                     kDefaultLookback, 0.01 * dupe_fraction);
+constexpr size_t const kRollingHashDataSize{64 * 1024 * 1024};
+constexpr size_t const kRollingHashWindowSize{4096};
+
+std::vector<uint8_t> const& rolling_hash_data() {
+  static auto const data =
+      corpus_builder(kProfiles[profile_index("random")], 0)
+          .build(kRollingHashDataSize);
+  return data;
 }
 
-} // namespace
+void rolling_hash_scalar(::benchmark::State& state) {
+  auto const& data = rolling_hash_data();
 
-BENCHMARK_DRAW_LINE();
+  for (auto _ : state) {
+    rsync_hash hasher;
+    uint32_t sum{0};
 
-BENCHMARK_PARAM(run_granularity, 1)
-BENCHMARK_RELATIVE_PARAM(run_granularity, 2)
-BENCHMARK_RELATIVE_PARAM(run_granularity, 3)
-BENCHMARK_RELATIVE_PARAM(run_granularity, 4)
-BENCHMARK_RELATIVE_PARAM(run_granularity, 5)
-BENCHMARK_RELATIVE_PARAM(run_granularity, 6)
+    for (size_t k = 0; k < kRollingHashWindowSize; ++k) {
+      hasher.update(data[k]);
+    }
+
+    for (size_t k = kRollingHashWindowSize; k < data.size(); ++k) {
+      hasher.update(data[k - kRollingHashWindowSize], data[k]);
+      sum += hasher();
+    }
 
-BENCHMARK_DRAW_LINE();
+    ::benchmark::DoNotOptimize(sum);
+  }
 
-BENCHMARK_PARAM(run_window_size, 8)
-BENCHMARK_RELATIVE_PARAM(run_window_size, 10)
-BENCHMARK_RELATIVE_PARAM(run_window_size, 12)
-BENCHMARK_RELATIVE_PARAM(run_window_size, 14)
-BENCHMARK_RELATIVE_PARAM(run_window_size, 16)
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
 
-BENCHMARK_DRAW_LINE();
+void rolling_hash_batch(::benchmark::State& state) {
+  auto const cpu = static_cast<rsync_hash::cpu_variant>(state.range(0));
 
-BENCHMARK_PARAM(run_block_size, 18)
-BENCHMARK_RELATIVE_PARAM(run_block_size, 20)
-BENCHMARK_RELATIVE_PARAM(run_block_size, 22)
-BENCHMARK_RELATIVE_PARAM(run_block_size, 24)
-BENCHMARK_RELATIVE_PARAM(run_block_size, 26)
+  state.SetLabel(std::string(rsync_hash::cpu_variant_name(cpu)));
 
-BENCHMARK_DRAW_LINE();
+  if (!rsync_hash::is_supported(cpu)) {
+    state.SkipWithError("CPU variant not supported");
+    return;
+  }
 
-BENCHMARK_PARAM(run_bloom_filter_size, 1)
-BENCHMARK_RELATIVE_PARAM(run_bloom_filter_size, 2)
-BENCHMARK_RELATIVE_PARAM(run_bloom_filter_size, 3)
-BENCHMARK_RELATIVE_PARAM(run_bloom_filter_size, 4)
-BENCHMARK_RELATIVE_PARAM(run_bloom_filter_size, 5)
-BENCHMARK_RELATIVE_PARAM(run_bloom_filter_size, 6)
+  auto const& data = rolling_hash_data();
+  std::vector<uint32_t> hashes(256);
 
-BENCHMARK_DRAW_LINE();
+  for (auto _ : state) {
+    rsync_hash hasher;
+    uint32_t sum{0};
 
-BENCHMARK_PARAM(run_lookback, 1)
-BENCHMARK_RELATIVE_PARAM(run_lookback, 2)
-BENCHMARK_RELATIVE_PARAM(run_lookback, 4)
-BENCHMARK_RELATIVE_PARAM(run_lookback, 8)
-BENCHMARK_RELATIVE_PARAM(run_lookback, 16)
+    for (size_t k = 0; k < kRollingHashWindowSize; ++k) {
+      hasher.update(data[k]);
+    }
 
-BENCHMARK_DRAW_LINE();
+    for (size_t k = kRollingHashWindowSize; k < data.size();
+         k += hashes.size()) {
+      auto const count = std::min(hashes.size(), data.size() - k);
+      hasher.update_batch(cpu, data.data() + k - kRollingHashWindowSize,
+                          data.data() + k, count, hashes.data());
+      sum += hashes[count - 1];
+    }
 
-BENCHMARK_PARAM(run_dupe_fraction, 0)
-BENCHMARK_RELATIVE_PARAM(run_dupe_fraction, 20)
-BENCHMARK_RELATIVE_PARAM(run_dupe_fraction, 40)
-BENCHMARK_RELATIVE_PARAM(run_dupe_fraction, 60)
-BENCHMARK_RELATIVE_PARAM(run_dupe_fraction, 80)
+    ::benchmark::DoNotOptimize(sum);
+  }
 
-BENCHMARK_DRAW_LINE();
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
 
-int main(int argc, char* argv[]) {
-  gflags::ParseCommandLineFlags(&argc, &argv, true);
-  folly::runBenchmarks();
+void rolling_hash_params(::benchmark::internal::Benchmark* b) {
+  b->ArgName("cpu");
+  for (auto cpu : {rsync_hash::cpu_variant::fallback,
+                   rsync_hash::cpu_variant::has_avx2,
+                   rsync_hash::cpu_variant::has_avx512bw}) {
+    b->Arg(static_cast<int64_t>(cpu));
+  }
 }
+
+} // namespace
+
+BENCHMARK(segmenter_bench)->Name("segmenter/profile")->Apply(profile_params);
+BENCHMARK(segmenter_bench)
+    ->Name("segmenter/window_size")
+    ->Apply(window_size_params);
+BENCHMARK(segmenter_bench)
+    ->Name("segmenter/window_step")
+    ->Apply(window_step_params);
+BENCHMARK(segmenter_bench)
+    ->Name("segmenter/block_size")
+    ->Apply(block_size_params);
+BENCHMARK(segmenter_bench)
+    ->Name("segmenter/bloom_filter_size")
+    ->Apply(bloom_filter_size_params);
+BENCHMARK(segmenter_bench)->Name("segmenter/lookback")->Apply(lookback_params);
+BENCHMARK(segmenter_bench)->Name("segmenter/cdc")->Apply(cdc_params);
+
+BENCHMARK(rolling_hash_scalar);
+BENCHMARK(rolling_hash_batch)->Apply(rolling_hash_params);
+
+BENCHMARK_MAIN();
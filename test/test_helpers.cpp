@@ -465,7 +465,7 @@ os_access_mock::map_file(fs::path const& path, size_t size) const {
       }
     }
 
-    return std::make_unique<mmap_mock>(
+    auto mm = std::make_unique<mmap_mock>(
         de->v |
             match{
                 [](std::string const& str) { return str; },
@@ -475,6 +475,10 @@ os_access_mock::map_file(fs::path const& path, size_t size) const {
                 },
             },
         size);
+
+    mapped_bytes_ += mm->size();
+
+    return mm;
   }
 
   throw std::runtime_error(fmt::format("oops in map_file: {}", path.string()));
@@ -541,6 +545,17 @@ os_access_mock::find_executable(std::filesystem::path const& name) const {
   return real_os_->find_executable(name);
 }
 
+memory_pressure os_access_mock::get_memory_pressure() const {
+  std::lock_guard lock{mx_};
+  ++memory_pressure_queries_;
+  return memory_pressure_;
+}
+
+void os_access_mock::set_memory_pressure(memory_pressure const& mp) {
+  std::lock_guard lock{mx_};
+  memory_pressure_ = mp;
+}
+
 void os_access_mock::set_executable_resolver(
     executable_resolver_type resolver) {
   executable_resolver_ = std::move(resolver);
@@ -150,6 +150,16 @@ class os_access_mock : public os_access {
   std::filesystem::path
   find_executable(std::filesystem::path const& name) const override;
 
+  memory_pressure get_memory_pressure() const override;
+
+  void set_memory_pressure(memory_pressure const& mp);
+
+  size_t memory_pressure_queries() const {
+    return memory_pressure_queries_.load();
+  }
+
+  size_t mapped_bytes() const { return mapped_bytes_.load(); }
+
   void set_executable_resolver(executable_resolver_type resolver);
 
   std::set<std::filesystem::path> get_failed_paths() const;
@@ -184,6 +194,9 @@ class os_access_mock : public os_access {
   std::chrono::nanoseconds dir_reader_delay_{0};
   std::map<std::filesystem::path, std::chrono::nanoseconds> map_file_delays_;
   size_t map_file_delay_min_size_{0};
+  memory_pressure memory_pressure_;
+  std::atomic<size_t> mutable memory_pressure_queries_{0};
+  std::atomic<size_t> mutable mapped_bytes_{0};
 };
 
 struct filter_transformer_data {
@@ -294,6 +307,15 @@ class test_file_access : public file_access {
   std::unique_ptr<output_stream>
   open_output_binary(std::filesystem::path const& path) const override;
 
+  void rename(std::filesystem::path const& from,
+              std::filesystem::path const& to,
+              std::error_code& ec) const override;
+
+  void create_directories(std::filesystem::path const& path,
+                          std::error_code& ec) const override;
+  void remove_all(std::filesystem::path const& path,
+                  std::error_code& ec) const override;
+
   void set_file(std::filesystem::path const& path, std::string contents) const;
   std::optional<std::string> get_file(std::filesystem::path const& path) const;
 
@@ -309,6 +331,7 @@ class test_file_access : public file_access {
 
  private:
   std::map<std::filesystem::path, std::string> mutable files_;
+  std::set<std::filesystem::path> mutable dirs_;
   std::map<std::filesystem::path, std::error_code> mutable open_errors_;
   std::map<std::filesystem::path, std::error_code> mutable close_errors_;
 };
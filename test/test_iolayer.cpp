@@ -19,6 +19,7 @@
  * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <array>
 #include <iostream>
 
@@ -88,7 +89,7 @@ class test_output_stream : public output_stream {
 } // namespace
 
 bool test_file_access::exists(std::filesystem::path const& path) const {
-  return files_.find(path) != files_.end();
+  return files_.find(path) != files_.end() || dirs_.contains(path);
 }
 
 std::unique_ptr<input_stream>
@@ -171,6 +172,37 @@ test_file_access::open_output_binary(std::filesystem::path const& path) const {
   return rv;
 }
 
+void test_file_access::rename(std::filesystem::path const& from,
+                              std::filesystem::path const& to,
+                              std::error_code& ec) const {
+  auto it = files_.find(from);
+  if (it == files_.end()) {
+    ec = std::make_error_code(std::errc::no_such_file_or_directory);
+    return;
+  }
+  files_[to] = std::move(it->second);
+  files_.erase(it);
+}
+
+void test_file_access::create_directories(std::filesystem::path const& path,
+                                          std::error_code& /*ec*/) const {
+  for (auto p = path; !p.empty() && p != p.root_path(); p = p.parent_path()) {
+    dirs_.insert(p);
+  }
+}
+
+void test_file_access::remove_all(std::filesystem::path const& path,
+                                  std::error_code& /*ec*/) const {
+  auto const is_below = [&path](std::filesystem::path const& p) {
+    auto const [end, _] = std::mismatch(path.begin(), path.end(), p.begin(),
+                                        p.end());
+    return end == path.end();
+  };
+
+  std::erase_if(files_, [&](auto const& kv) { return is_below(kv.first); });
+  std::erase_if(dirs_, is_below);
+}
+
 void test_file_access::set_file(std::filesystem::path const& path,
                                 std::string content) const {
   files_[path] = std::move(content);
@@ -673,6 +673,53 @@ TEST(mkdwarfs_test, input_list_large) {
   EXPECT_EQ(expected, actual);
 }
 
+TEST(mkdwarfs_test, max_active_workers) {
+  auto t = mkdwarfs_tester::create_empty();
+  t.add_root_dir();
+  auto paths = t.add_random_file_tree({.avg_size = 1024.0, .dimension = 8});
+
+  // A single slot for many workers and a tiny memory limit, so jobs keep
+  // waiting for each other
+  ASSERT_EQ(0, t.run({"-i", "/", "-o", "-", "-l3", "-S14", "-N4",
+                      "--order=nilsimsa", "-L256k", "--max-active-workers=1",
+                      "--log-level=verbose"}))
+      << t.err();
+
+  EXPECT_THAT(t.err(), ::testing::HasSubstr("max. active workers: 1/1"));
+
+  auto fs = t.fs_from_stdout();
+
+  for (auto const& [path, data] : paths) {
+    auto iv = fs.find((fs::path{"/"} / path).string().c_str());
+    ASSERT_TRUE(iv) << path;
+    EXPECT_EQ(data, fs.read_string(iv->inode_num())) << path;
+  }
+}
+
+TEST(mkdwarfs_test, memory_budget) {
+  auto t = mkdwarfs_tester::create_empty();
+  t.add_root_dir();
+  auto paths = t.add_random_file_tree({.avg_size = 1024.0, .dimension = 8});
+
+  // The budget is smaller than what the segmenter alone would like to
+  // keep around, which must slow down the build, but not stall it
+  ASSERT_EQ(0, t.run({"-i", "/", "-o", "-", "-l3", "-S14", "-B8", "-N4",
+                      "--memory-budget=64k", "--log-level=verbose"}))
+      << t.err();
+
+  EXPECT_THAT(t.err(), ::testing::HasSubstr("peak memory usage: "));
+  EXPECT_THAT(t.err(), ::testing::HasSubstr("segmenter: "));
+  EXPECT_THAT(t.err(), ::testing::HasSubstr("compression: "));
+
+  auto fs = t.fs_from_stdout();
+
+  for (auto const& [path, data] : paths) {
+    auto iv = fs.find((fs::path{"/"} / path).string().c_str());
+    ASSERT_TRUE(iv) << path;
+    EXPECT_EQ(data, fs.read_string(iv->inode_num())) << path;
+  }
+}
+
 class logging_test : public testing::TestWithParam<std::string_view> {};
 
 TEST_P(logging_test, end_to_end) {
@@ -2887,6 +2934,654 @@ TEST(file_scanner, large_file_handling) {
   }
 }
 
+TEST(mkdwarfs_test, parallel_discovery_is_deterministic) {
+  using namespace std::chrono_literals;
+
+  auto build = [](size_t num_discovery_workers) {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+    t.add_random_file_tree({.avg_size = 256.0, .dimension = 16});
+    t.os->set_dir_reader_delay(1ms);
+
+    EXPECT_EQ(0, t.run({"-i", "/", "-o", "-", "-l1", "--no-history",
+                        "--no-create-timestamp",
+                        fmt::format("--num-discovery-workers={}",
+                                    num_discovery_workers)}))
+        << t.err();
+
+    return t.out();
+  };
+
+  auto const ref = build(1);
+
+  ASSERT_FALSE(ref.empty());
+
+  for (size_t num_workers : {2, 4, 16}) {
+    EXPECT_EQ(ref, build(num_workers)) << num_workers;
+  }
+}
+
+TEST(mkdwarfs_test, single_pass) {
+  auto build = [](bool single_pass) {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+    t.add_random_file_tree({.avg_size = 4096.0, .dimension = 16});
+
+    std::vector<std::string> args{"-i",           "/",
+                                  "-o",           "-",
+                                  "-l1",          "--order=nilsimsa",
+                                  "--no-history", "--no-create-timestamp",
+                                  "--log-level=verbose"};
+
+    if (single_pass) {
+      args.push_back("--single-pass");
+    }
+
+    EXPECT_EQ(0, t.run(args)) << t.err();
+
+    if (single_pass) {
+      EXPECT_THAT(t.err(), ::testing::HasSubstr("staging area: "));
+    }
+
+    return std::make_pair(t.out(), t.os->mapped_bytes());
+  };
+
+  auto const [ref, ref_mapped] = build(false);
+  auto const [out, mapped] = build(true);
+
+  ASSERT_FALSE(ref.empty());
+  EXPECT_EQ(ref, out);
+
+  // All files are small enough to be staged, so they should only be read
+  // once instead of twice
+  EXPECT_LT(mapped, ref_mapped * 6 / 10) << mapped << " / " << ref_mapped;
+}
+
+TEST(mkdwarfs_test, hash_cache) {
+  std::optional<std::string> cache;
+
+  auto build = [&cache] {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+    t.add_random_file_tree({.avg_size = 4096.0, .dimension = 16});
+
+    if (cache) {
+      t.fa->set_file("cache.bin", *cache);
+    }
+
+    EXPECT_EQ(0, t.run({"-i", "/", "-o", "-", "-l1", "--order=nilsimsa",
+                        "--hash-cache=cache.bin", "--no-history",
+                        "--no-create-timestamp", "--log-level=verbose"}))
+        << t.err();
+
+    cache = t.fa->get_file("cache.bin");
+
+    return std::make_tuple(t.out(), t.os->mapped_bytes(), t.err());
+  };
+
+  auto const [ref, ref_mapped, ref_err] = build();
+
+  ASSERT_FALSE(ref.empty());
+  ASSERT_TRUE(cache);
+  EXPECT_THAT(ref_err, ::testing::HasSubstr("0 scan results reused"));
+
+  auto const [out, mapped, err] = build();
+
+  EXPECT_EQ(ref, out);
+  EXPECT_THAT(err, ::testing::Not(::testing::HasSubstr(" 0 scan results")));
+
+  // Only the segmenter should have to read the files again
+  EXPECT_LT(mapped, ref_mapped * 6 / 10) << mapped << " / " << ref_mapped;
+
+  // A broken cache must not break the build
+  cache = "this is not a hash cache";
+
+  auto const [out2, mapped2, err2] = build();
+
+  EXPECT_EQ(ref, out2);
+  EXPECT_THAT(err2, ::testing::HasSubstr("ignoring hash cache"));
+  EXPECT_EQ(ref_mapped, mapped2);
+}
+
+TEST(mkdwarfs_test, hash_cache_resolved_options) {
+  std::optional<std::string> cache;
+
+  auto build = [&cache](std::vector<std::string> const& extra) {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+    t.add_random_file_tree({.avg_size = 4096.0, .dimension = 16});
+
+    if (cache) {
+      t.fa->set_file("cache.bin", *cache);
+    }
+
+    std::vector<std::string> args{"-i", "/", "-o", "-",
+                                  "--hash-cache=cache.bin",
+                                  "--log-level=verbose"};
+    args.insert(args.end(), extra.begin(), extra.end());
+
+    EXPECT_EQ(0, t.run(args)) << t.err();
+
+    cache = t.fa->get_file("cache.bin");
+
+    return t.err();
+  };
+
+  build({"-l1"});
+
+  // The ordering implied by the compression level differs, so the scan
+  // results from the first run lack the similarity hashes
+  EXPECT_THAT(build({"-l3"}), ::testing::HasSubstr("0 scan results reused"));
+
+  // The same ordering, whether implied or explicit, allows reuse
+  EXPECT_THAT(build({"-l1", "--order=similarity"}),
+              ::testing::Not(::testing::HasSubstr(" 0 scan results")));
+}
+
+TEST(mkdwarfs_test, segmenter_shards) {
+  std::vector<std::pair<fs::path, std::string>> paths;
+
+  auto build = [&paths] {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+    paths = t.add_random_file_tree({.avg_size = 4096.0, .dimension = 16});
+
+    EXPECT_EQ(0, t.run({"-i", "/", "-o", "-", "-l1", "-S12",
+                        "--segmenter-shards=4", "--num-segmenter-workers=4",
+                        "--no-history", "--no-create-timestamp",
+                        "--log-level=verbose"}))
+        << t.err();
+
+    EXPECT_THAT(t.err(), ::testing::HasSubstr("segmenting in 4 shards"));
+    EXPECT_THAT(t.err(), ::testing::HasSubstr("segmenting shard 4/4"));
+
+    auto fs = t.fs_from_stdout();
+
+    for (auto const& [path, data] : paths) {
+      auto iv = fs.find((fs::path{"/"} / path).string().c_str());
+      EXPECT_TRUE(iv) << path;
+      if (iv) {
+        EXPECT_EQ(data, fs.read_string(iv->inode_num())) << path;
+      }
+    }
+
+    return t.out();
+  };
+
+  auto const ref = build();
+
+  ASSERT_FALSE(ref.empty());
+
+  // The image must not depend on which shard happens to finish first
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(ref, build());
+  }
+}
+
+TEST(mkdwarfs_test, segmenter_shards_max_active_workers) {
+  auto t = mkdwarfs_tester::create_empty();
+  t.add_root_dir();
+  auto paths = t.add_random_file_tree({.avg_size = 4096.0, .dimension = 16});
+
+  // More shards than CPU slots: the shard jobs waiting for the ordering
+  // must not keep the nilsimsa ordering jobs from getting a slot
+  ASSERT_EQ(0, t.run({"-i", "/", "-o", "-", "-l1", "-S12", "-N4",
+                      "--order=nilsimsa", "--segmenter-shards=4",
+                      "--num-segmenter-workers=4", "--max-active-workers=2",
+                      "--log-level=verbose"}))
+      << t.err();
+
+  EXPECT_THAT(t.err(), ::testing::HasSubstr("segmenting in 4 shards"));
+
+  auto fs = t.fs_from_stdout();
+
+  for (auto const& [path, data] : paths) {
+    auto iv = fs.find((fs::path{"/"} / path).string().c_str());
+    ASSERT_TRUE(iv) << path;
+    EXPECT_EQ(data, fs.read_string(iv->inode_num())) << path;
+  }
+}
+
+TEST(mkdwarfs_test, segmenter_shards_dedup_loss) {
+  static constexpr size_t kNumPairs{200};
+  static constexpr size_t kFileSize{8192};
+  static constexpr size_t kBlockSize{4096};
+  static constexpr size_t kNumShards{4};
+
+  auto build = [](size_t shards) {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+
+    // Each file is followed by a near-copy in path order, so without
+    // shards all copies are found within the lookback window.
+    for (size_t i = 0; i < kNumPairs; ++i) {
+      auto data = test::create_random_string(kFileSize, i);
+      t.os->add_file(fmt::format("f{:04}a", i), data);
+      data.back() ^= 0xff;
+      t.os->add_file(fmt::format("f{:04}b", i), data);
+    }
+
+    EXPECT_EQ(0, t.run({"-i", "/", "-o", "-", "-l1", "-S12", "-W8", "-B16",
+                        "-Cnull", "--order=path",
+                        fmt::format("--segmenter-shards={}", shards),
+                        "--num-segmenter-workers=4", "--no-history",
+                        "--log-level=verbose"}))
+        << t.err();
+
+    if (shards > 1) {
+      EXPECT_THAT(t.err(), ::testing::HasSubstr(fmt::format(
+                               "segmenting in {} shards", shards)));
+    }
+
+    return t.out().size();
+  };
+
+  auto const unsharded = build(1);
+  auto const sharded = build(kNumShards);
+
+  EXPECT_LT(unsharded, kNumPairs * kFileSize * 6 / 5);
+
+  // Matches are only lost across shard boundaries, and only for data
+  // within the lookback window of the preceding shard. Here, that's at
+  // most one file per boundary, plus the partially filled last block.
+  EXPECT_LE(sharded,
+            unsharded + (kNumShards - 1) * (kFileSize + 2 * kBlockSize));
+}
+
+TEST(mkdwarfs_test, pipelined) {
+  std::vector<std::pair<fs::path, std::string>> paths;
+
+  auto build = [&paths](std::string const& order) {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+    paths = t.add_random_file_tree({.avg_size = 4096.0, .dimension = 16});
+
+    // make sure there are duplicates, some of which are only found by
+    // hashing the full file
+    auto const dup = test::create_random_string(2 << 20, 1);
+    auto const nodup = dup.substr(0, dup.size() - 1) + '!';
+    std::vector<std::pair<std::string, std::string>> const extra{
+        {"dup1", dup},
+        {"dup2", nodup},
+        {"dup3", dup},
+        {"dup4", paths.front().second}};
+
+    for (auto const& [path, data] : extra) {
+      t.os->add_file(path, data);
+      paths.emplace_back(path, data);
+    }
+
+    EXPECT_EQ(0, t.run({"-i", "/", "-o", "-", "-l1", "-S16",
+                        "--order=" + order, "--pipelined", "--no-history",
+                        "--no-create-timestamp", "--log-level=verbose"}))
+        << t.err();
+
+    EXPECT_THAT(t.err(), ::testing::HasSubstr("segmenting while scanning"));
+
+    auto fs = t.fs_from_stdout();
+
+    for (auto const& [path, data] : paths) {
+      auto iv = fs.find((fs::path{"/"} / path).string().c_str());
+      EXPECT_TRUE(iv) << path;
+      if (iv) {
+        EXPECT_EQ(data, fs.read_string(iv->inode_num())) << path;
+      }
+    }
+
+    return t.out();
+  };
+
+  auto const ref = build("none");
+
+  ASSERT_FALSE(ref.empty());
+
+  // The image must not depend on the order in which hashing finishes
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(ref, build("none"));
+  }
+}
+
+TEST(mkdwarfs_test, pipelined_fallback) {
+  std::string const image_file = "test.dwarfs";
+
+  auto build = [&](std::vector<std::string> extra_args) {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+    t.add_random_file_tree({.avg_size = 4096.0, .dimension = 8});
+
+    std::vector<std::string> args{"-i",
+                                  "/",
+                                  "-o",
+                                  image_file,
+                                  "-l1",
+                                  "--no-history",
+                                  "--no-create-timestamp"};
+    args.insert(args.end(), extra_args.begin(), extra_args.end());
+
+    EXPECT_EQ(0, t.run(args)) << t.err();
+
+    auto image = t.fa->get_file(image_file);
+    EXPECT_TRUE(image);
+
+    return std::make_pair(image.value_or(""), t.err());
+  };
+
+  for (std::string order : {"path", "nilsimsa"}) {
+    auto const [ref, ref_err] = build({"--order=" + order});
+    auto const [img, err] = build({"--order=" + order, "--pipelined"});
+
+    EXPECT_THAT(err, ::testing::HasSubstr("cannot segment while scanning "
+                                          "with '" +
+                                          order + "' ordering"))
+        << order;
+    EXPECT_THAT(err, ::testing::Not(::testing::HasSubstr(
+                         "segmenting while scanning...")))
+        << order;
+
+    // The regular build is used, so the order is reproduced exactly
+    EXPECT_EQ(ref, img) << order;
+  }
+
+  {
+    auto const [ref, ref_err] = build({"--order=none", "--resume"});
+    auto const [img, err] =
+        build({"--order=none", "--resume", "--pipelined"});
+
+    EXPECT_THAT(err, ::testing::HasSubstr("cannot segment while scanning "
+                                          "with a build checkpoint"));
+    EXPECT_THAT(err, ::testing::Not(::testing::HasSubstr(
+                         "segmenting while scanning...")));
+    EXPECT_EQ(ref, img);
+  }
+}
+
+TEST(mkdwarfs_test, segmenter_runs) {
+  std::string pattern;
+
+  while (pattern.size() < (4 << 20)) {
+    pattern += "0123456789abc";
+  }
+
+  auto const data = test::create_random_string(64 << 10, 1) +
+                    std::string(16 << 20, '\0') + pattern +
+                    test::create_random_string(64 << 10, 2);
+
+  auto t = mkdwarfs_tester::create_empty();
+  t.add_root_dir();
+  t.os->add_file("image.raw", data);
+
+  ASSERT_EQ(0, t.run({"-i", "/", "-o", "-", "-l3", "-S20",
+                      "--log-level=verbose"}))
+      << t.err();
+
+  EXPECT_THAT(t.err(), ::testing::HasSubstr("runs of repeated data"));
+
+  auto fs = t.fs_from_stdout();
+  auto iv = fs.find("/image.raw");
+  ASSERT_TRUE(iv);
+  EXPECT_EQ(data, fs.read_string(iv->inode_num()));
+
+  // Each run is represented by chunks of up to 256 KiB (a quarter of the
+  // block size) referencing the same data
+  auto info = fs.get_inode_info(*iv);
+  ASSERT_TRUE(info.count("chunks") > 0);
+  EXPECT_LT(info["chunks"].size(), 200);
+}
+
+TEST(mkdwarfs_test, segmenter_independent_of_bloom_filter) {
+  std::string data;
+
+  // Runs, data that is repeated from within the lookback and data that is
+  // repeated from blocks that have already expired
+  for (size_t i = 0; i < 12; ++i) {
+    data += test::create_random_string(256 << 10, i);
+    data += std::string(128 << 10, static_cast<char>(i));
+    data += test::create_random_string(64 << 10, i / 4);
+  }
+
+  auto build = [&data](unsigned bloom_filter_size) {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+    t.os->add_file("data", data);
+
+    EXPECT_EQ(0, t.run({"-i", "/", "-o", "-", "-l3", "-S18", "-B8", "-Cnull",
+                        fmt::format("--bloom-filter-size={}",
+                                    bloom_filter_size),
+                        "--no-history", "--no-create-timestamp",
+                        "--log-level=verbose"}))
+        << t.err();
+
+    EXPECT_THAT(t.err(), ::testing::HasSubstr("runs of repeated data"));
+
+    return t.out();
+  };
+
+  // The filters only decide where to look for matches. With a filter size
+  // of zero, the global filter has lots of false positives and stale hits
+  // from expired blocks, which must not change the segmenting results.
+  auto const ref = build(4);
+
+  ASSERT_FALSE(ref.empty());
+  EXPECT_EQ(ref, build(0));
+  EXPECT_EQ(ref, build(10));
+}
+
+TEST(mkdwarfs_test, large_lookback) {
+  auto t = mkdwarfs_tester::create_empty();
+  t.add_root_dir();
+  auto paths = t.add_random_file_tree({.avg_size = 4096.0, .dimension = 8});
+  std::set<fs::path> dirs;
+
+  // Add a copy of all files, so there's plenty to find in the lookback
+  t.os->add_dir("copy");
+
+  for (auto const& [path, data] : paths) {
+    auto const copy = fs::path{"copy"} / path;
+    for (auto const& dir : {copy.parent_path().parent_path(),
+                            copy.parent_path()}) {
+      if (dirs.insert(dir).second) {
+        t.os->add_dir(dir);
+      }
+    }
+    t.os->add_file(copy, data);
+  }
+
+  ASSERT_EQ(0, t.run({"-i", "/", "-o", "-", "-l3", "-S12", "-B128",
+                      "--file-hash=none", "--order=none",
+                      "--log-level=verbose"}))
+      << t.err();
+
+  EXPECT_THAT(t.err(), ::testing::HasSubstr("global bloom filter rebuilt"));
+
+  auto fs = t.fs_from_stdout();
+
+  for (auto const& [path, data] : paths) {
+    for (auto const& p : {fs::path{"/"} / path, fs::path{"/copy"} / path}) {
+      auto iv = fs.find(p.string().c_str());
+      ASSERT_TRUE(iv) << p;
+      EXPECT_EQ(data, fs.read_string(iv->inode_num())) << p;
+    }
+  }
+}
+
+TEST(mkdwarfs_test, shared_chunk_index) {
+  auto const random = test::create_random_string(512 << 10, 1);
+  auto const text = test::loremipsum(2 << 20);
+  auto const mixed = text + random + text;
+
+  auto build = [&](std::vector<std::string> extra_args) {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+    t.os->add_file("random.bin", random);
+    t.os->add_file("mixed.txt", mixed);
+
+    // With a shared index, categories are segmented serially no matter
+    // how many segmenter workers there are. All blocks are kept for
+    // comparing chunks across categories.
+    std::vector<std::string> args{"-i",
+                                  "/",
+                                  "-o",
+                                  "-",
+                                  "-S20",
+                                  "-B8",
+                                  "--categorize=incompressible",
+                                  "--cdc-chunk-size=12",
+                                  "--num-segmenter-workers=4",
+                                  "--no-history",
+                                  "--no-create-timestamp",
+                                  "--compression=null",
+                                  "--log-level=verbose"};
+    args.insert(args.end(), extra_args.begin(), extra_args.end());
+
+    EXPECT_EQ(0, t.run(args)) << t.err();
+
+    auto fs = t.fs_from_stdout();
+
+    for (auto const& [path, data] :
+         {std::pair{"/random.bin", &random}, std::pair{"/mixed.txt", &mixed}}) {
+      auto iv = fs.find(path);
+      EXPECT_TRUE(iv) << path;
+      if (iv) {
+        EXPECT_EQ(*data, fs.read_string(iv->inode_num())) << path;
+      }
+    }
+
+    return std::make_pair(t.out(), t.err());
+  };
+
+  auto const [ref_image, ref_err] = build({});
+  auto const [shared_image, shared_err] = build({"--shared-chunk-index"});
+  auto const ref_size = ref_image.size();
+  auto const shared_size = shared_image.size();
+
+  EXPECT_THAT(shared_err, ::testing::HasSubstr("using the shared chunk index"));
+  EXPECT_THAT(shared_err,
+              ::testing::HasSubstr("in blocks of other categories"));
+  EXPECT_THAT(ref_err,
+              ::testing::Not(::testing::HasSubstr("shared chunk index")));
+
+  // The random data is stored only once
+  EXPECT_LT(shared_size + (400 << 10), ref_size);
+
+  // The image doesn't depend on which segmenter gets to a chunk first
+  for (int i = 0; i < 3; ++i) {
+    auto const [image, err] = build({"--shared-chunk-index"});
+    EXPECT_EQ(shared_image, image) << i;
+  }
+}
+
+TEST(mkdwarfs_test, spill_dir) {
+  temporary_directory tempdir("dwarfs");
+  auto const head = test::create_random_string(256 << 10, 1);
+  auto const data =
+      head + test::create_random_string(4 << 20, 2) +
+      head.substr(1000, 200'000);
+
+  auto build = [&](std::vector<std::string> extra_args) {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+    t.os->add_file("file.bin", data);
+
+    // mkdwarfs checks the spill directory through os_access, so it must
+    // also exist in the mock file system; add it to both builds
+    std::filesystem::path spill_path;
+    for (auto const& part : tempdir.path().relative_path()) {
+      spill_path /= part;
+      t.os->add_dir(spill_path);
+    }
+
+    std::vector<std::string> args{"-i", "/", "-o", "-", "-S18", "-B2",
+                                  "--compression=null", "--log-level=verbose"};
+    args.insert(args.end(), extra_args.begin(), extra_args.end());
+
+    EXPECT_EQ(0, t.run(args)) << t.err();
+
+    auto fs = t.fs_from_stdout();
+    auto iv = fs.find("/file.bin");
+    EXPECT_TRUE(iv);
+    if (iv) {
+      EXPECT_EQ(data, fs.read_string(iv->inode_num()));
+    }
+
+    return std::make_pair(t.out().size(), t.err());
+  };
+
+  auto const [ref_size, ref_err] = build({});
+  auto const [spill_size, spill_err] =
+      build({"--spill-dir", tempdir.path().string()});
+
+  EXPECT_THAT(spill_err, ::testing::HasSubstr("in spilled blocks"));
+  EXPECT_THAT(spill_err, ::testing::Not(::testing::HasSubstr("found 0")));
+  EXPECT_THAT(ref_err, ::testing::Not(::testing::HasSubstr("spilled")));
+
+  // The repeated part of `head` is only found in the spilled blocks
+  EXPECT_LT(spill_size + 190'000, ref_size);
+
+  // The spill files must be gone
+  EXPECT_TRUE(std::filesystem::is_empty(tempdir.path()));
+
+  {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+    EXPECT_NE(0, t.run({"-i", "/", "-o", "-", "--spill-dir",
+                        (tempdir.path() / "missing").string()}));
+    EXPECT_THAT(t.err(), ::testing::HasSubstr("does not exist"));
+  }
+}
+
+TEST(mkdwarfs_test, cdc_segmenter) {
+  // The shifted copy of `head` is too far away to be found by the default
+  // segmenter with a single lookback block, and too far away for the data
+  // to be compared by the content-defined chunking segmenter
+  auto const head = test::create_random_string(1 << 20, 1);
+  auto const data = head + test::create_random_string(8 << 20, 2) +
+                    test::create_random_string(100, 3) + head;
+
+  auto build = [&data](std::vector<std::string> extra_args) {
+    auto t = mkdwarfs_tester::create_empty();
+    t.add_root_dir();
+    t.os->add_file("file.bin", data);
+
+    std::vector<std::string> args{"-i", "/", "-o", "-", "-S20",
+                                  "--compression=null", "--log-level=verbose"};
+    args.insert(args.end(), extra_args.begin(), extra_args.end());
+
+    EXPECT_EQ(0, t.run(args)) << t.err();
+
+    auto fs = t.fs_from_stdout();
+    auto iv = fs.find("/file.bin");
+    EXPECT_TRUE(iv);
+    if (iv) {
+      EXPECT_EQ(data, fs.read_string(iv->inode_num()));
+    }
+
+    return std::make_pair(t.out().size(), t.err());
+  };
+
+  auto const [ref_size, ref_err] = build({"-B1"});
+  auto const [cdc_size, cdc_err] = build({"-B1", "--cdc-chunk-size=12"});
+  auto const [hash_size, hash_err] =
+      build({"-B1", "--cdc-chunk-size=12", "--cdc-hash-only"});
+  auto const [lookback_size, lookback_err] =
+      build({"-B16", "--cdc-chunk-size=12"});
+
+  EXPECT_THAT(cdc_err, ::testing::HasSubstr("content-defined chunking"));
+  EXPECT_THAT(ref_err,
+              ::testing::Not(::testing::HasSubstr("content-defined chunking")));
+
+  // The earlier copy of `head` can't be compared, so it is stored again
+  EXPECT_THAT(cdc_err, ::testing::HasSubstr("were stored again"));
+  EXPECT_GT(cdc_size + (900 << 10), ref_size);
+
+  // All but the chunks around the boundaries of `head` are deduplicated,
+  // either without comparing or with all blocks kept for comparison
+  EXPECT_LT(hash_size + (900 << 10), ref_size);
+  EXPECT_THAT(hash_err, ::testing::Not(::testing::HasSubstr("stored again")));
+  EXPECT_LT(lookback_size + (900 << 10), ref_size);
+  EXPECT_THAT(lookback_err,
+              ::testing::Not(::testing::HasSubstr("stored again")));
+}
+
 TEST(mkdwarfs_test, file_scanner_dump) {
   auto t = mkdwarfs_tester::create_empty();
   t.add_root_dir();
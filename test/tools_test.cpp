@@ -1753,3 +1753,83 @@ TEST(tools_test, dwarfsextract_file_out) {
   EXPECT_THAT(mtree, ::testing::StartsWith("#mtree\n"));
   EXPECT_THAT(mtree, ::testing::HasSubstr("type=file"));
 }
+
+#ifndef _WIN32
+TEST(tools_test, mkdwarfs_resume) {
+  dwarfs::temporary_directory tempdir("dwarfs");
+  auto td = fs::path(tempdir.path().string());
+  auto input = td / "input";
+  auto reference = td / "reference.dwarfs";
+  auto image = td / "image.dwarfs";
+  auto checkpoint = td / "image.dwarfs.checkpoint";
+  auto journal = checkpoint / "journal.0";
+
+  fs::create_directory(input);
+
+  {
+    std::mt19937_64 rng{42};
+
+    for (int i = 0; i < 8; ++i) {
+      std::ofstream ofs(input / fmt::format("file{}", i), std::ios::binary);
+      ofs << dwarfs::test::create_random_string(512 << 10, 'a', 'z', rng);
+    }
+  }
+
+  std::vector<std::string> const args{
+      "-i", input.string(), "-S", "16", "-C", "lzma:level=9", "-N", "1",
+      "--no-progress", "--no-create-timestamp", "--no-history"};
+
+  ASSERT_TRUE(subprocess::check_run(mkdwarfs_bin, args, "-o", reference));
+
+  // The builds are terminated right after a few blocks have been added
+  // to the checkpoint, just as if they had been killed
+  ::setenv("DWARFS_CHECKPOINT_ABORT_AFTER_BLOCKS", "4", 1);
+
+  {
+    auto const [out, err, ec] =
+        subprocess::run(mkdwarfs_bin, args, "-o", image, "--resume");
+
+    ASSERT_NE(0, ec) << err;
+  }
+
+  ASSERT_TRUE(fs::exists(journal));
+  EXPECT_TRUE(fs::exists(checkpoint / "hash-cache"));
+
+  // simulate a record that was only partially written
+  {
+    std::ofstream ofs(journal, std::ios::binary | std::ios::app);
+    ofs << "torn";
+  }
+
+  {
+    auto const [out, err, ec] =
+        subprocess::run(mkdwarfs_bin, args, "-o", image, "--resume");
+
+    ASSERT_NE(0, ec) << err;
+    EXPECT_THAT(err, ::testing::HasSubstr("resuming from checkpoint"));
+    EXPECT_THAT(err, ::testing::HasSubstr("incomplete data"));
+  }
+
+  // the previous journal has been compacted, the second build has
+  // started a new one
+  EXPECT_TRUE(fs::exists(checkpoint / "journal.1"));
+  EXPECT_FALSE(fs::exists(checkpoint / "journal.2"));
+  EXPECT_FALSE(fs::exists(checkpoint / "journal.tmp"));
+
+  ::unsetenv("DWARFS_CHECKPOINT_ABORT_AFTER_BLOCKS");
+
+  auto const [out, err, ec] =
+      subprocess::run(mkdwarfs_bin, args, "-o", image, "--resume");
+
+  ASSERT_EQ(0, ec) << err;
+  EXPECT_THAT(err, ::testing::HasSubstr("resuming from checkpoint"));
+  EXPECT_THAT(err, ::testing::HasSubstr("checkpoint: reused 8 blocks"));
+  EXPECT_THAT(err, ::testing::Not(::testing::HasSubstr("incomplete data")));
+  EXPECT_FALSE(fs::exists(checkpoint));
+
+  std::string ref, img;
+  ASSERT_TRUE(read_file(reference, ref));
+  ASSERT_TRUE(read_file(image, img));
+  EXPECT_TRUE(ref == img);
+}
+#endif
@@ -0,0 +1,161 @@
+/* vim:set ts=2 sw=2 sts=2 et: */
+/**
+ * \author     Marcus Holland-Moritz (github@mhxnet.de)
+ * \copyright  Copyright (c) Marcus Holland-Moritz
+ *
+ * This file is part of dwarfs.
+ *
+ * dwarfs is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * dwarfs is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <dwarfs/checksum.h>
+#include <dwarfs/logger.h>
+#include <dwarfs/os_access_generic.h>
+
+#include <dwarfs/internal/worker_group.h>
+
+namespace {
+
+using namespace dwarfs;
+using internal::worker_group;
+
+std::vector<uint8_t> const& test_data() {
+  static std::vector<uint8_t> const data = [] {
+    std::vector<uint8_t> d(1 << 20);
+    std::mt19937_64 rng{42};
+    for (auto& b : d) {
+      b = static_cast<uint8_t>(rng());
+    }
+    return d;
+  }();
+  return data;
+}
+
+// A small amount of work, similar to hashing a small file or copying
+// a small range out of a cached block
+uint64_t tiny_job(size_t offset, size_t size) {
+  auto const& data = test_data();
+  checksum cs(checksum::algorithm::XXH3_64);
+  cs.update(data.data() + (offset % (data.size() - size)), size);
+  uint64_t rv{0};
+  cs.finalize(&rv);
+  return rv;
+}
+
+worker_group::scheduling scheduling_arg(::benchmark::State const& state) {
+  return state.range(0) == 0 ? worker_group::scheduling::shared_queue
+                             : worker_group::scheduling::work_stealing;
+}
+
+/**
+ * Mimics the block cache: several reader threads submit lots of small
+ * demand jobs and wait for their results, with the occasional
+ * speculative (readahead) job in between.
+ */
+void blkcache_workload(::benchmark::State& state) {
+  static constexpr size_t num_readers{8};
+  static constexpr size_t requests_per_reader{256};
+
+  null_logger lgr;
+  os_access_generic os;
+  worker_group wg(lgr, os, "blkcache", state.range(1),
+                  std::numeric_limits<size_t>::max(), 0, scheduling_arg(state));
+  wg.set_max_speculative_workers(std::max<size_t>(state.range(1) / 2, 1));
+
+  for (auto _ : state) {
+    std::vector<std::thread> readers;
+
+    for (size_t r = 0; r < num_readers; ++r) {
+      readers.emplace_back([&wg, r] {
+        for (size_t i = 0; i < requests_per_reader; ++i) {
+          std::promise<uint64_t> p;
+          auto f = p.get_future();
+          wg.add_job([&p, r, i] { p.set_value(tiny_job(r * 4096 + i, 4096)); });
+          if (i % 4 == 0) {
+            wg.add_speculative_job(
+                [r, i] { benchmark::DoNotOptimize(tiny_job(r + i, 16384)); });
+          }
+          benchmark::DoNotOptimize(f.get());
+        }
+      });
+    }
+
+    for (auto& t : readers) {
+      t.join();
+    }
+
+    wg.wait();
+  }
+
+  state.SetItemsProcessed(state.iterations() * num_readers *
+                          requests_per_reader);
+}
+
+/**
+ * Mimics the scanner: a single thread adds directory jobs, which in turn
+ * add hashing jobs for lots of small files.
+ */
+void scanner_workload(::benchmark::State& state) {
+  static constexpr size_t num_dirs{64};
+  static constexpr size_t files_per_dir{128};
+
+  null_logger lgr;
+  os_access_generic os;
+  worker_group wg(lgr, os, "scanner", state.range(1),
+                  std::numeric_limits<size_t>::max(), 0, scheduling_arg(state));
+
+  for (auto _ : state) {
+    for (size_t d = 0; d < num_dirs; ++d) {
+      wg.add_job([&wg, d] {
+        for (size_t f = 0; f < files_per_dir; ++f) {
+          wg.add_job([d, f] {
+            auto size = 256 + ((d * files_per_dir + f) * 97) % 8192;
+            benchmark::DoNotOptimize(tiny_job(d * 8192 + f, size));
+          });
+        }
+      });
+    }
+
+    wg.wait();
+  }
+
+  state.SetItemsProcessed(state.iterations() * num_dirs * files_per_dir);
+}
+
+void scheduling_params(::benchmark::internal::Benchmark* b) {
+  b->ArgNames({"steal", "workers"});
+  for (int steal : {0, 1}) {
+    for (int workers : {1, 2, 4, 8, 16}) {
+      b->Args({steal, workers});
+    }
+  }
+  b->UseRealTime();
+}
+
+} // namespace
+
+BENCHMARK(blkcache_workload)->Apply(scheduling_params);
+BENCHMARK(scanner_workload)->Apply(scheduling_params);
+
+BENCHMARK_MAIN();
@@ -19,9 +19,19 @@
  * along with dwarfs.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <dwarfs/cpu_budget.h>
+
 #include <dwarfs/internal/worker_group.h>
 
 #include "test_helpers.h"
@@ -49,3 +59,315 @@ TEST(worker_group_test, set_thread_affinity_env) {
   internal::worker_group wg_apple(lgr, os, "apple", 1);
   EXPECT_EQ(0, os.set_affinity_calls.size());
 }
+
+namespace {
+
+class blocker {
+ public:
+  void block(internal::worker_group& wg) {
+    wg.add_job([this] {
+      started_.set_value();
+      release_.get_future().wait();
+    });
+    started_.get_future().wait();
+  }
+
+  void release() { release_.set_value(); }
+
+ private:
+  std::promise<void> started_;
+  std::promise<void> release_;
+};
+
+} // namespace
+
+TEST(worker_group_test, speculative_jobs_run_last) {
+  test::test_logger lgr;
+  test::os_access_mock os;
+  internal::worker_group wg(lgr, os, "prio", 1);
+
+  std::mutex mx;
+  std::vector<int> order;
+  auto job = [&](int i) {
+    return [&, i] {
+      std::lock_guard lock(mx);
+      order.push_back(i);
+    };
+  };
+
+  blocker b;
+  b.block(wg);
+
+  EXPECT_TRUE(wg.add_speculative_job(job(1)));
+  EXPECT_TRUE(wg.add_job(job(2)));
+  EXPECT_TRUE(wg.add_speculative_job(job(3)));
+  EXPECT_TRUE(wg.add_job(job(4)));
+
+  EXPECT_EQ(4, wg.queue_size());
+
+  b.release();
+  wg.wait();
+
+  EXPECT_EQ(std::vector<int>({2, 4, 1, 3}), order);
+
+  using job_priority = internal::worker_group::job_priority;
+  auto demand = wg.get_queue_stats(job_priority::demand);
+  auto spec = wg.get_queue_stats(job_priority::speculative);
+
+  EXPECT_EQ(3, demand.jobs);
+  EXPECT_EQ(2, spec.jobs);
+  EXPECT_EQ(0, spec.cancelled);
+  EXPECT_GE(spec.max_delay, demand.max_delay);
+}
+
+TEST(worker_group_test, promote_and_cancel) {
+  test::test_logger lgr;
+  test::os_access_mock os;
+  internal::worker_group wg(lgr, os, "prio", 1);
+
+  std::mutex mx;
+  std::vector<int> order;
+  auto job = [&](int i) {
+    return [&, i] {
+      std::lock_guard lock(mx);
+      order.push_back(i);
+    };
+  };
+
+  blocker b;
+  b.block(wg);
+
+  auto t1 = wg.add_speculative_job(job(1));
+  auto t2 = wg.add_speculative_job(job(2));
+  auto t3 = wg.add_speculative_job(job(3));
+  wg.add_job(job(4));
+
+  EXPECT_TRUE(wg.promote(t2));
+  EXPECT_FALSE(wg.promote(t2));
+  EXPECT_TRUE(wg.cancel(t3));
+  EXPECT_FALSE(wg.cancel(t3));
+  EXPECT_FALSE(wg.cancel(t2));
+  EXPECT_FALSE(wg.cancel(nullptr));
+
+  b.release();
+  wg.wait();
+
+  EXPECT_EQ(std::vector<int>({4, 2, 1}), order);
+
+  // Jobs that have already run can no longer be cancelled
+  EXPECT_FALSE(wg.cancel(t1));
+
+  auto spec =
+      wg.get_queue_stats(internal::worker_group::job_priority::speculative);
+
+  EXPECT_EQ(1, spec.jobs);
+  EXPECT_EQ(1, spec.cancelled);
+}
+
+TEST(worker_group_test, speculative_worker_limit) {
+  static constexpr size_t num_workers{4};
+
+  test::test_logger lgr;
+  test::os_access_mock os;
+  internal::worker_group wg(lgr, os, "prio", num_workers);
+
+  wg.set_max_speculative_workers(2);
+
+  std::atomic<size_t> running{0};
+  std::atomic<size_t> max_running{0};
+  std::atomic<size_t> demand_done{0};
+
+  for (size_t i = 0; i < 16; ++i) {
+    wg.add_speculative_job([&] {
+      auto r = ++running;
+      auto m = max_running.load();
+      while (r > m && !max_running.compare_exchange_weak(m, r)) {
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      --running;
+    });
+  }
+
+  // There are always free workers for demand jobs
+  for (size_t i = 0; i < 4; ++i) {
+    wg.add_job([&] { ++demand_done; });
+  }
+
+  wg.wait();
+
+  EXPECT_LE(max_running.load(), 2);
+  EXPECT_EQ(4, demand_done.load());
+}
+
+namespace {
+
+constexpr auto work_stealing =
+    internal::worker_group::scheduling::work_stealing;
+
+} // namespace
+
+TEST(worker_group_test, work_stealing_nested_jobs) {
+  static constexpr size_t num_outer{64};
+  static constexpr size_t num_inner{256};
+
+  test::test_logger lgr;
+  test::os_access_mock os;
+  internal::worker_group wg(lgr, os, "steal", 4,
+                            std::numeric_limits<size_t>::max(), 0,
+                            work_stealing);
+
+  std::atomic<size_t> done{0};
+
+  for (size_t i = 0; i < num_outer; ++i) {
+    wg.add_job([&] {
+      // these go to the worker's local queue
+      for (size_t k = 0; k < num_inner; ++k) {
+        wg.add_job([&] { ++done; });
+      }
+    });
+  }
+
+  wg.wait();
+
+  EXPECT_EQ(num_outer * num_inner, done.load());
+  EXPECT_EQ(0, wg.queue_size());
+  EXPECT_EQ(num_outer * (num_inner + 1),
+            wg.get_queue_stats(internal::worker_group::job_priority::demand)
+                .jobs);
+}
+
+TEST(worker_group_test, work_stealing_promote_and_cancel) {
+  test::test_logger lgr;
+  test::os_access_mock os;
+  internal::worker_group wg(lgr, os, "steal", 1,
+                            std::numeric_limits<size_t>::max(), 0,
+                            work_stealing);
+
+  std::mutex mx;
+  std::vector<int> order;
+  auto job = [&](int i) {
+    return [&, i] {
+      std::lock_guard lock(mx);
+      order.push_back(i);
+    };
+  };
+
+  blocker b;
+  b.block(wg);
+
+  auto t1 = wg.add_speculative_job(job(1));
+  auto t2 = wg.add_speculative_job(job(2));
+  auto t3 = wg.add_speculative_job(job(3));
+  wg.add_job(job(4));
+  wg.add_speculative_job(job(5));
+
+  EXPECT_EQ(5, wg.queue_size());
+
+  EXPECT_TRUE(wg.promote(t2));
+  EXPECT_FALSE(wg.promote(t2));
+  EXPECT_TRUE(wg.cancel(t3));
+  EXPECT_FALSE(wg.cancel(t3));
+  EXPECT_FALSE(wg.cancel(t2));
+
+  b.release();
+  wg.wait();
+
+  EXPECT_EQ(std::vector<int>({4, 2, 1, 5}), order);
+  EXPECT_FALSE(wg.cancel(t1));
+
+  auto spec =
+      wg.get_queue_stats(internal::worker_group::job_priority::speculative);
+
+  EXPECT_EQ(2, spec.jobs);
+  EXPECT_EQ(1, spec.cancelled);
+}
+
+TEST(worker_group_test, work_stealing_queue_limit) {
+  static constexpr size_t max_queue_len{4};
+
+  test::test_logger lgr;
+  test::os_access_mock os;
+  internal::worker_group wg(lgr, os, "steal", 2, max_queue_len, 0,
+                            work_stealing);
+
+  std::atomic<size_t> max_queued{0};
+  std::atomic<size_t> done{0};
+
+  for (size_t i = 0; i < 100; ++i) {
+    wg.add_job([&] {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      ++done;
+    });
+    auto q = wg.queue_size();
+    auto m = max_queued.load();
+    while (q > m && !max_queued.compare_exchange_weak(m, q)) {
+    }
+  }
+
+  wg.stop();
+
+  EXPECT_EQ(100, done.load());
+  EXPECT_LE(max_queued.load(), max_queue_len);
+}
+
+TEST(worker_group_test, shared_cpu_budget) {
+  static constexpr size_t num_slots{2};
+
+  test::test_logger lgr;
+  test::os_access_mock os;
+  auto budget = std::make_shared<cpu_budget>(num_slots);
+  internal::worker_group wg1(lgr, os, "one", budget, 4);
+  internal::worker_group wg2(lgr, os, "two", budget, 4);
+
+  std::atomic<size_t> running{0};
+  std::atomic<size_t> max_running{0};
+
+  auto job = [&] {
+    auto r = ++running;
+    auto m = max_running.load();
+    while (r > m && !max_running.compare_exchange_weak(m, r)) {
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    --running;
+  };
+
+  for (size_t i = 0; i < 16; ++i) {
+    wg1.add_job(job);
+    wg2.add_job(job);
+  }
+
+  wg1.wait();
+  wg2.wait();
+
+  EXPECT_LE(max_running.load(), num_slots);
+  EXPECT_EQ(32, budget->get_stats().acquired);
+  EXPECT_LE(budget->get_stats().peak_active, num_slots);
+}
+
+TEST(worker_group_test, cpu_budget_blocking_section) {
+  test::test_logger lgr;
+  test::os_access_mock os;
+  auto budget = std::make_shared<cpu_budget>(1);
+  internal::worker_group wg1(lgr, os, "waiter", budget, 1);
+  internal::worker_group wg2(lgr, os, "worker", budget, 1);
+
+  std::promise<void> started;
+  std::promise<void> done;
+
+  // The waiting job holds the only slot until it starts waiting, so this
+  // would deadlock without the blocking section
+  wg1.add_job([&] {
+    started.set_value();
+    cpu_budget::blocking_section bs;
+    done.get_future().wait();
+  });
+
+  started.get_future().wait();
+
+  wg2.add_job([&] { done.set_value(); });
+
+  wg1.wait();
+  wg2.wait();
+
+  EXPECT_EQ(nullptr, cpu_budget::current());
+}
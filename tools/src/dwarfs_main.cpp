@@ -91,6 +91,7 @@
 #include <dwarfs/mmap.h>
 #include <dwarfs/os_access.h>
 #include <dwarfs/performance_monitor.h>
+#include <dwarfs/reader/block_allocator_mode.h>
 #include <dwarfs/reader/cache_tidy_config.h>
 #include <dwarfs/reader/filesystem_options.h>
 #include <dwarfs/reader/filesystem_v2.h>
@@ -156,11 +157,13 @@ struct options {
   std::shared_ptr<std::string> fsimage;
   int seen_mountpoint{0};
   char const* cachesize_str{nullptr};           // TODO: const?? -> use string?
+  char const* compcachesize_str{nullptr};       // TODO: const?? -> use string?
   char const* blocksize_str{nullptr};           // TODO: const?? -> use string?
   char const* readahead_str{nullptr};           // TODO: const?? -> use string?
   char const* debuglevel_str{nullptr};          // TODO: const?? -> use string?
   char const* workers_str{nullptr};             // TODO: const?? -> use string?
   char const* mlock_str{nullptr};               // TODO: const?? -> use string?
+  char const* block_allocator_str{nullptr};     // TODO: const?? -> use string?
   char const* decompress_ratio_str{nullptr};    // TODO: const?? -> use string?
   char const* image_offset_str{nullptr};        // TODO: const?? -> use string?
   char const* cache_tidy_strategy_str{nullptr}; // TODO: const?? -> use string?
@@ -175,11 +178,15 @@ struct options {
   int readonly{0};
   int cache_image{0};
   int cache_files{0};
+  int bypass_whole_blocks{0};
   size_t cachesize{0};
+  size_t compcachesize{0};
   size_t blocksize{0};
   size_t readahead{0};
   size_t workers{0};
   reader::mlock_mode lock_mode{reader::mlock_mode::NONE};
+  reader::block_allocator_mode block_allocator{
+      reader::block_allocator_mode::MALLOC};
   double decompress_ratio{0.0};
   logger_options logopts{};
   reader::cache_tidy_strategy block_cache_tidy_strategy{
@@ -230,11 +237,13 @@ struct dwarfs_userdata {
 constexpr struct ::fuse_opt dwarfs_opts[] = {
     // TODO: user, group, atime, mtime, ctime for those fs who don't have it?
     DWARFS_OPT("cachesize=%s", cachesize_str, 0),
+    DWARFS_OPT("compcachesize=%s", compcachesize_str, 0),
     DWARFS_OPT("blocksize=%s", blocksize_str, 0),
     DWARFS_OPT("readahead=%s", readahead_str, 0),
     DWARFS_OPT("debuglevel=%s", debuglevel_str, 0),
     DWARFS_OPT("workers=%s", workers_str, 0),
     DWARFS_OPT("mlock=%s", mlock_str, 0),
+    DWARFS_OPT("blockalloc=%s", block_allocator_str, 0),
     DWARFS_OPT("decratio=%s", decompress_ratio_str, 0),
     DWARFS_OPT("offset=%s", image_offset_str, 0),
     DWARFS_OPT("tidy_strategy=%s", cache_tidy_strategy_str, 0),
@@ -247,6 +256,7 @@ constexpr struct ::fuse_opt dwarfs_opts[] = {
     DWARFS_OPT("no_cache_image", cache_image, 0),
     DWARFS_OPT("cache_files", cache_files, 1),
     DWARFS_OPT("no_cache_files", cache_files, 0),
+    DWARFS_OPT("bypass_whole_blocks", bypass_whole_blocks, 1),
 #if DWARFS_PERFMON_ENABLED
     DWARFS_OPT("perfmon=%s", perfmon_enabled_str, 0),
     DWARFS_OPT("perfmon_trace=%s", perfmon_trace_file_str, 0),
@@ -258,6 +268,7 @@ std::unordered_map<std::string_view, reader::cache_tidy_strategy> const
         {"none", reader::cache_tidy_strategy::NONE},
         {"time", reader::cache_tidy_strategy::EXPIRY_TIME},
         {"swap", reader::cache_tidy_strategy::BLOCK_SWAPPED_OUT},
+        {"memory", reader::cache_tidy_strategy::MEMORY_PRESSURE},
     };
 
 constexpr std::string_view pid_xattr{"user.dwarfs.driver.pid"};
@@ -666,8 +677,13 @@ void op_read(fuse_req_t req, fuse_ino_t ino, size_t size, file_off_t off,
       return EIO;
     }
 
+    // Reuse the buffer across requests on the same thread so that large
+    // reads don't have to grow it on the heap every time. The block ranges
+    // must be released once the reply has been sent, though.
+    thread_local reader::iovec_read_buf buf;
+    scope_exit release_ranges{[] { buf.clear(); }};
+
     std::error_code ec;
-    reader::iovec_read_buf buf;
     auto num = userdata.fs.readv(ino, buf, size, off, ec);
 
     LOG_DEBUG << "readv(" << ino << ", " << size << ", " << off << ") -> "
@@ -1180,18 +1196,21 @@ void usage(std::ostream& os, std::filesystem::path const& progname) {
      << " <image> <mountpoint> [options]\n\n"
      << "DWARFS options:\n"
      << "    -o cachesize=SIZE      set size of block cache (512M)\n"
+     << "    -o compcachesize=SIZE  size of compressed data cache (0)\n"
      << "    -o blocksize=SIZE      set file I/O block size (512K)\n"
      << "    -o readahead=SIZE      set readahead size (0)\n"
      << "    -o workers=NUM         number of worker threads (2)\n"
      << "    -o mlock=NAME          mlock mode: (none), try, must\n"
+     << "    -o blockalloc=NAME     (malloc)|arena|thp|hugetlb\n"
      << "    -o decratio=NUM        ratio for full decompression (0.8)\n"
      << "    -o offset=NUM|auto     filesystem image offset in bytes (0)\n"
      << "    -o enable_nlink        show correct hardlink numbers\n"
      << "    -o readonly            show read-only file system\n"
      << "    -o (no_)cache_image    (don't) keep image in kernel cache\n"
      << "    -o (no_)cache_files    (don't) keep files in kernel cache\n"
+     << "    -o bypass_whole_blocks don't cache blocks read as a whole\n"
      << "    -o debuglevel=NAME     " << logger::all_level_names() << "\n"
-     << "    -o tidy_strategy=NAME  (none)|time|swap\n"
+     << "    -o tidy_strategy=NAME  (none)|time|swap|memory\n"
      << "    -o tidy_interval=TIME  interval for cache tidying (5m)\n"
      << "    -o tidy_max_age=TIME   tidy blocks after this time (10m)\n"
      << "    -o seq_detector=NUM    sequential access detector threshold (4)\n"
@@ -1418,8 +1437,11 @@ void load_filesystem(dwarfs_userdata& userdata) {
   reader::filesystem_options fsopts;
   fsopts.lock_mode = opts.lock_mode;
   fsopts.block_cache.max_bytes = opts.cachesize;
+  fsopts.block_cache.max_compressed_bytes = opts.compcachesize;
   fsopts.block_cache.num_workers = opts.workers;
   fsopts.block_cache.decompress_ratio = opts.decompress_ratio;
+  fsopts.block_cache.allocator = opts.block_allocator;
+  fsopts.block_cache.bypass_whole_block_reads = bool(opts.bypass_whole_blocks);
   fsopts.block_cache.mm_release = !opts.cache_image;
   fsopts.block_cache.init_workers = false;
   fsopts.block_cache.sequential_access_detector_threshold =
@@ -1567,6 +1589,9 @@ int dwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
     opts.cachesize = opts.cachesize_str
                          ? parse_size_with_unit(opts.cachesize_str)
                          : (static_cast<size_t>(512) << 20);
+    opts.compcachesize = opts.compcachesize_str
+                             ? parse_size_with_unit(opts.compcachesize_str)
+                             : 0;
     opts.blocksize = opts.blocksize_str
                          ? parse_size_with_unit(opts.blocksize_str)
                          : kDefaultBlockSize;
@@ -1575,6 +1600,10 @@ int dwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
     opts.workers = opts.workers_str ? to<size_t>(opts.workers_str) : 2;
     opts.lock_mode = opts.mlock_str ? reader::parse_mlock_mode(opts.mlock_str)
                                     : reader::mlock_mode::NONE;
+    opts.block_allocator =
+        opts.block_allocator_str
+            ? reader::parse_block_allocator_mode(opts.block_allocator_str)
+            : reader::block_allocator_mode::MALLOC;
     opts.decompress_ratio =
         opts.decompress_ratio_str ? to<double>(opts.decompress_ratio_str) : 0.8;
 
@@ -151,6 +151,8 @@ int dwarfsextract_main(int argc, sys_char** argv, iolayer const& iol) {
     fsopts.block_cache.max_bytes = parse_size_with_unit(cache_size_str);
     fsopts.block_cache.num_workers = num_workers;
     fsopts.block_cache.disable_block_integrity_check = disable_integrity_check;
+    // Blocks covered by a single file will only be read once
+    fsopts.block_cache.bypass_whole_block_reads = true;
     fsopts.metadata.enable_nlink = true;
 
     std::unordered_set<std::string> perfmon_enabled;
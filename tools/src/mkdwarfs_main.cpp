@@ -30,6 +30,7 @@
 #include <map>
 #include <memory>
 #include <optional>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
@@ -58,6 +59,7 @@
 #include <dwarfs/checksum.h>
 #include <dwarfs/config.h>
 #include <dwarfs/conv.h>
+#include <dwarfs/cpu_budget.h>
 #include <dwarfs/error.h>
 #include <dwarfs/file_access.h>
 #include <dwarfs/integral_value_parser.h>
@@ -77,6 +79,7 @@
 #include <dwarfs/util.h>
 #include <dwarfs/utility/rewrite_filesystem.h>
 #include <dwarfs/utility/rewrite_options.h>
+#include <dwarfs/writer/build_checkpoint.h>
 #include <dwarfs/writer/categorizer.h>
 #include <dwarfs/writer/category_parser.h>
 #include <dwarfs/writer/chmod_entry_transformer.h>
@@ -87,6 +90,7 @@
 #include <dwarfs/writer/filesystem_writer_options.h>
 #include <dwarfs/writer/filter_debug.h>
 #include <dwarfs/writer/fragment_order_parser.h>
+#include <dwarfs/writer/memory_budget.h>
 #include <dwarfs/writer/rule_based_entry_filter.h>
 #include <dwarfs/writer/scanner.h>
 #include <dwarfs/writer/scanner_options.h>
@@ -381,19 +385,22 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
   static constexpr size_t const kDefaultBloomFilterSize{4};
 
   writer::segmenter_factory::config sf_config;
-  sys_string path_str, input_list_str, output_str, header_str;
-  std::string memory_limit, script_arg, schema_compression,
+  sys_string path_str, input_list_str, output_str, header_str, hash_cache_str,
+      spill_dir_str;
+  std::string memory_limit, memory_budget, script_arg, schema_compression,
       metadata_compression, timestamp, time_resolution, progress_mode,
       recompress_opts, pack_metadata, file_hash_algo, debug_filter,
       max_similarity_size, chmod_str, history_compression,
-      recompress_categories;
+      recompress_categories, staging_size;
   std::vector<sys_string> filter;
   std::vector<std::string> order, max_lookback_blocks, window_size, window_step,
-      bloom_filter_size, compression;
-  size_t num_workers, num_scanner_workers, num_segmenter_workers;
+      bloom_filter_size, cdc_chunk_size, compression;
+  size_t num_workers, num_scanner_workers, num_segmenter_workers,
+      segmenter_shards, num_discovery_workers, max_active_workers;
   bool no_progress = false, remove_header = false, no_section_index = false,
        force_overwrite = false, no_history = false,
-       no_history_timestamps = false, no_history_command_line = false;
+       no_history_timestamps = false, no_history_command_line = false,
+       single_pass = false, pipelined = false, resume = false;
   unsigned level;
   int compress_niceness;
   uint16_t uid, gid;
@@ -403,6 +410,7 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
   integral_value_parser<unsigned> window_size_parser(0, 24);
   integral_value_parser<unsigned> window_step_parser(0, 8);
   integral_value_parser<unsigned> bloom_filter_size_parser(0, 10);
+  integral_value_parser<unsigned> cdc_chunk_size_parser(0, 24);
   writer::fragment_order_parser order_parser;
   block_compressor_parser compressor_parser;
 
@@ -464,6 +472,9 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
     ("force,f",
         po::value<bool>(&force_overwrite)->zero_tokens(),
         "force overwrite of existing output image")
+    ("resume",
+        po::value<bool>(&resume)->zero_tokens(),
+        "resume an interrupted build from its checkpoint")
     ("compress-level,l",
         po::value<unsigned>(&level)->default_value(default_level),
         "compression level (0=fast, 9=best, please see man page for details)")
@@ -494,9 +505,30 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
         po::value<size_t>(&num_segmenter_workers)
           ->value_name(dep_def_val("num-workers")),
         "number of segmenter worker threads")
+    ("segmenter-shards",
+        po::value<size_t>(&segmenter_shards)->default_value(1),
+        "max. number of shards to segment each category in parallel")
+    ("num-discovery-workers",
+        po::value<size_t>(&num_discovery_workers)->default_value(1),
+        "number of threads reading the input directories")
+    ("max-active-workers",
+        po::value<size_t>(&max_active_workers)->default_value(0),
+        "max. number of jobs running at once across all stages (0 = no limit)")
     ("memory-limit,L",
         po::value<std::string>(&memory_limit)->default_value("1g"),
         "block manager memory limit")
+    ("memory-budget",
+        po::value<std::string>(&memory_budget)->default_value("0"),
+        "memory limit for the whole pipeline (0 = no limit)")
+    ("single-pass",
+        po::value<bool>(&single_pass)->zero_tokens(),
+        "read each input file only once if possible")
+    ("staging-size",
+        po::value<std::string>(&staging_size)->default_value("64m"),
+        "memory for keeping small files between scanning and segmenting")
+    ("pipelined",
+        po::value<bool>(&pipelined)->zero_tokens(),
+        "segment and compress files while still scanning the input")
     ("recompress",
         po::value<std::string>(&recompress_opts)->implicit_value("all"),
         "recompress an existing filesystem (none, block, metadata, all)")
@@ -518,6 +550,9 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
     ("file-hash",
         po::value<std::string>(&file_hash_algo)->default_value("xxh3-128"),
         file_hash_desc.c_str())
+    ("hash-cache",
+        po_sys_value<sys_string>(&hash_cache_str),
+        "file to cache hashes and scan results of unchanged files")
     ("progress",
         po::value<std::string>(&progress_mode)->default_value(default_progress_mode),
         progress_desc.c_str())
@@ -577,6 +612,20 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
           ->value_name(cat_def_val(kDefaultBloomFilterSize))
           ->multitoken()->composing(),
         "bloom filter size (2^N*values bits)")
+    ("cdc-chunk-size",
+        po::value<std::vector<std::string>>(&cdc_chunk_size)
+          ->value_name(cat_def_val(0))
+          ->multitoken()->composing(),
+        "content-defined chunking average chunk size (2^N bytes, 0 = off)")
+    ("cdc-hash-only",
+        po::value<bool>(&sf_config.cdc_hash_only)->zero_tokens(),
+        "don't compare the data of duplicate chunks")
+    ("shared-chunk-index",
+        po::value<bool>(&sf_config.shared_chunk_index)->zero_tokens(),
+        "share content-defined chunks between categories")
+    ("spill-dir",
+        po_sys_value<sys_string>(&spill_dir_str),
+        "directory to spill blocks to that drop out of the lookback")
     ;
 
   po::options_description compressor_opts("Compressor options");
@@ -657,6 +706,7 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
   catreg.add_options(opts);
 
   po::variables_map vm;
+  std::string categorizer_config;
 
   std::vector<std::string> command_line;
   command_line.reserve(argc);
@@ -671,6 +721,24 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
     po::store(parsed, vm);
     po::notify(vm);
 
+    // The categorizer options are part of the configuration that cached
+    // scan results depend on, see `scan_config` below
+    po::options_description categorizer_opts;
+    catreg.add_options(categorizer_opts);
+
+    std::set<std::string> cat_opts;
+
+    for (auto const& o : categorizer_opts.options()) {
+      cat_opts.insert(o->long_name());
+    }
+
+    for (auto const& o : parsed.options) {
+      if (cat_opts.contains(o.string_key)) {
+        categorizer_config +=
+            fmt::format("{}={}\n", o.string_key, fmt::join(o.value, ","));
+      }
+    }
+
     auto unrecognized =
         po::collect_unrecognized(parsed.options, po::include_positional);
 
@@ -848,6 +916,18 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
   path = iol.os->canonical(path);
 
   bool recompress = vm.count("recompress");
+
+  if (resume) {
+    if (recompress) {
+      iol.err << "error: --resume cannot be used with --recompress\n";
+      return 1;
+    }
+
+    if (output_str == "-") {
+      iol.err << "error: --resume requires an output file\n";
+      return 1;
+    }
+  }
   utility::rewrite_options rw_opts;
   if (recompress) {
     std::unordered_map<std::string, unsigned> const modes{
@@ -901,7 +981,50 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
     num_segmenter_workers = num_workers;
   }
 
+  if (segmenter_shards < 1) {
+    iol.err << "error: segmenter shards must be at least 1\n";
+    return 1;
+  }
+
   options.num_segmenter_workers = num_segmenter_workers;
+  options.segmenter_shards = segmenter_shards;
+  options.num_discovery_workers = num_discovery_workers;
+
+  if (max_active_workers > 0) {
+    options.budget = std::make_shared<cpu_budget>(max_active_workers);
+  }
+
+  if (auto limit = parse_size_with_unit(memory_budget); limit > 0) {
+    options.memory = std::make_shared<writer::memory_budget>(limit);
+    sf_config.memory = options.memory;
+  }
+
+  options.single_pass = single_pass;
+  options.pipelined = pipelined;
+  options.staging_size = parse_size_with_unit(staging_size);
+
+  if (vm.count("hash-cache")) {
+    options.hash_cache = std::filesystem::path(hash_cache_str);
+  }
+
+  if (vm.count("spill-dir")) {
+    sf_config.spill_dir = std::filesystem::path(spill_dir_str);
+
+    bool is_dir{false};
+
+    try {
+      is_dir = iol.os->symlink_info(iol.os->canonical(sf_config.spill_dir))
+                   .is_directory();
+    } catch (std::exception const&) {
+      // is_dir remains false
+    }
+
+    if (!is_dir) {
+      iol.err << "error: spill directory " << sf_config.spill_dir
+              << " does not exist\n";
+      return 1;
+    }
+  }
 
   if (vm.count("debug-filter")) {
     if (auto it = debug_filter_modes.find(debug_filter);
@@ -1074,6 +1197,7 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
   fswopts.worst_case_block_size = UINT64_C(1) << sf_config.block_size_bits;
   fswopts.remove_header = remove_header;
   fswopts.no_section_index = no_section_index;
+  fswopts.memory = options.memory;
 
   std::unique_ptr<input_stream> header_ifs;
 
@@ -1117,6 +1241,15 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
   }
 
   std::filesystem::path output(output_str);
+  std::filesystem::path checkpoint_dir;
+  std::shared_ptr<writer::build_checkpoint> checkpoint;
+  bool resuming = false;
+
+  if (resume && !options.debug_filter_function) {
+    checkpoint_dir = output;
+    checkpoint_dir += ".checkpoint";
+    resuming = iol.file->exists(checkpoint_dir);
+  }
 
   std::variant<std::monostate, std::unique_ptr<output_stream>,
                std::ostringstream>
@@ -1124,7 +1257,8 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
 
   if (!options.debug_filter_function) {
     if (output != "-") {
-      if (iol.file->exists(output) && !force_overwrite) {
+      // the partial output of an interrupted build will be replaced
+      if (iol.file->exists(output) && !force_overwrite && !resuming) {
         LOG_ERROR << "output file already exists, use --force to overwrite";
         return 1;
       }
@@ -1212,6 +1346,7 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
   }
 
   writer::category_parser cp(cat_resolver);
+  std::string order_config;
 
   try {
     {
@@ -1220,7 +1355,8 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
       cop.parse(defaults.order);
       cop.parse(order);
       categorizer_list.add_implicit_defaults(cop);
-      LOG_VERBOSE << cop.as_string();
+      order_config = cop.as_string();
+      LOG_VERBOSE << order_config;
     }
 
     {
@@ -1262,17 +1398,59 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
       categorizer_list.add_implicit_defaults(cop);
       LOG_VERBOSE << cop.as_string();
     }
+
+    {
+      writer::contextual_option_parser cop("--cdc-chunk-size",
+                                           sf_config.cdc_chunk_size_bits, cp,
+                                           cdc_chunk_size_parser);
+      sf_config.cdc_chunk_size_bits.set_default(0);
+      cop.parse(cdc_chunk_size);
+      categorizer_list.add_implicit_defaults(cop);
+      LOG_VERBOSE << cop.as_string();
+    }
   } catch (std::exception const& e) {
     LOG_ERROR << e.what();
     return 1;
   }
 
+  // Cached scan results and orderings must not be used if anything that
+  // affects categorization, similarity hashing or ordering has changed.
+  // This is fingerprinted from the resolved options, so the same options
+  // implied by a different compression level are treated as a change.
+  auto const scan_config = fmt::format(
+      "categorize={}\nmax-similarity-size={}\n{}{}", categorizer_list.value,
+      options.inode.max_similarity_scan_size.value_or(0), order_config,
+      categorizer_config);
+
+  if (options.hash_cache) {
+    options.hash_cache_config = scan_config;
+  }
+
+  if (!checkpoint_dir.empty()) {
+    try {
+      checkpoint = std::make_shared<writer::build_checkpoint>(
+          lgr, iol.file, checkpoint_dir, scan_config);
+    } catch (std::exception const& e) {
+      LOG_ERROR << "cannot open checkpoint '" << checkpoint_dir
+                << "': " << e.what();
+      return 1;
+    }
+
+    options.checkpoint = checkpoint;
+    fswopts.checkpoint = checkpoint;
+
+    if (!options.hash_cache) {
+      options.hash_cache = checkpoint->hash_cache_path();
+      options.hash_cache_config = scan_config;
+    }
+  }
+
   block_compressor schema_bc(schema_compression);
   block_compressor metadata_bc(metadata_compression);
   block_compressor history_bc(history_compression);
 
-  thread_pool compress_pool(lgr, *iol.os, "compress", num_workers,
-                            std::numeric_limits<size_t>::max(),
+  thread_pool compress_pool(lgr, *iol.os, "compress", options.budget,
+                            num_workers, std::numeric_limits<size_t>::max(),
                             compress_niceness);
 
   std::optional<writer::filesystem_writer> fsw;
@@ -1351,7 +1529,8 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
                                    sf_config);
       writer::entry_factory ef;
 
-      thread_pool scanner_pool(lgr, *iol.os, "scanner", num_scanner_workers);
+      thread_pool scanner_pool(lgr, *iol.os, "scanner", options.budget,
+                               num_scanner_workers);
 
       writer::scanner s(lgr, scanner_pool, sf, ef, *iol.os, options);
 
@@ -1380,6 +1559,29 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
     } else {
       LOG_INFO << "compression CPU time: " << time_with_unit(cpu_time);
     }
+
+    if (options.budget) {
+      auto st = options.budget->get_stats();
+      LOG_VERBOSE << "max. active workers: " << st.peak_active << "/"
+                  << options.budget->slots() << ", " << st.contended << "/"
+                  << st.acquired << " jobs had to wait for a slot";
+    }
+
+    if (options.memory) {
+      auto st = options.memory->get_stats();
+      std::vector<std::string> components;
+      for (size_t i = 0; i < st.components.size(); ++i) {
+        components.push_back(fmt::format(
+            "{}: {}",
+            writer::memory_budget::component_name(
+                static_cast<writer::memory_budget::component>(i)),
+            size_with_unit(st.components[i].peak)));
+      }
+      LOG_INFO << "peak memory usage: " << size_with_unit(st.peak) << "/"
+               << size_with_unit(options.memory->limit()) << " ("
+               << fmt::format("{}", fmt::join(components, ", ")) << "), "
+               << st.waits << " reservations had to wait";
+    }
   }
 
   {
@@ -1405,6 +1607,14 @@ int mkdwarfs_main(int argc, sys_char** argv, iolayer const& iol) {
     }
   }
 
+  if (checkpoint) {
+    auto const st = checkpoint->get_stats();
+    LOG_INFO << "checkpoint: reused " << st.reused_blocks << " blocks ("
+             << size_with_unit(st.reused_bytes) << "), "
+             << st.reused_orderings << " orderings";
+    checkpoint->remove();
+  }
+
   auto errors = prog.errors();
 
   if (!options.debug_filter_function) {